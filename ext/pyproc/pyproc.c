@@ -3,6 +3,552 @@
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
 
+/*
+** Per-connection Python state.  Every connection that runs a Python
+** procedure gets its own globals dictionary, created on first use and
+** kept until the connection is closed, so imports and other top-level
+** state made by one call are still there for the next.
+*/
+static PyObject *pConnGlobals = 0;  /* dict: connection handle -> globals */
+
+/* A procedure body compiled by pyCompile() */
+typedef struct PyProc PyProc;
+struct PyProc {
+  PyObject *pCode;      /* Code object for the procedure body */
+  PyObject *pGlobals;   /* Namespace of the owning connection */
+};
+
+/*
+** The cursor type available to Python procedures as the result of
+** sqlite3_cursor(sql [, params]).  A cursor wraps an sqlite3_stmt
+** directly, without going through a separate Python binding:
+**
+**   cur.fetchone()      next row as a tuple, or None when done
+**   cur.fetchmany(n)    list of up to n rows
+**   cur.close()         finalize the statement
+**   for row in cur:     iterate over the remaining rows
+**
+** TEXT and BLOB values returned by fetchone() and by iteration are
+** read-only buffer objects that point into SQLite's own copy of the
+** column, so no per-value copy is made.  Such a buffer is only valid
+** until the cursor is advanced or closed.  After that any access to it
+** raises RuntimeError (see PyProcValue).  fetchmany() instead copies
+** all TEXT and BLOB data of each row into a single string and returns
+** buffers over slices of it, which stay valid as long as they are
+** referenced.
+**
+** A cursor is closed automatically when the procedure call that
+** opened it returns.
+*/
+typedef struct PyProcCursor PyProcCursor;
+struct PyProcCursor {
+  PyObject_HEAD
+  sqlite3 *db;              /* Connection the statement belongs to */
+  sqlite3_stmt *pStmt;      /* Statement, or NULL once closed */
+  int iDepth;               /* Value of iExecDepth when opened */
+  int iRow;                 /* Incremented whenever the row changes */
+  PyProcCursor *pNext;      /* Next in list of open cursors */
+  PyProcCursor **ppPrev;    /* Pointer to this cursor in that list */
+};
+
+/*
+** A PyProcValue is the base object of a buffer returned for a TEXT or
+** BLOB value by fetchone() or by iteration.  It points into the column
+** memory of the statement and holds a reference to the cursor.  A
+** buffer object fetches the pointer from its base on every access, so
+** once the cursor has been advanced or closed any use of the buffer
+** raises an exception instead of reading memory SQLite may have freed.
+*/
+typedef struct PyProcValue PyProcValue;
+struct PyProcValue {
+  PyObject_HEAD
+  PyProcCursor *pCur;       /* Cursor the value was read from */
+  int iRow;                 /* Value of pCur->iRow when it was read */
+  const void *z;            /* Column data */
+  Py_ssize_t n;             /* Size of z in bytes */
+};
+
+static PyProcCursor *pOpenCursors = 0;  /* All cursors not yet closed */
+static int iExecDepth = 0;              /* Nesting depth of pyExec() */
+
+static void
+cursorClose(PyProcCursor *pCur) {
+  pCur->iRow++;
+  if( pCur->pStmt ){
+    sqlite3_finalize(pCur->pStmt);
+    pCur->pStmt = 0;
+    *pCur->ppPrev = pCur->pNext;
+    if( pCur->pNext ) pCur->pNext->ppPrev = pCur->ppPrev;
+  }
+}
+
+/* Close every cursor of connection db opened at nesting depth iDepth */
+static void
+cursorCloseAll(sqlite3 *db, int iDepth) {
+  PyProcCursor *pCur = pOpenCursors;
+  while( pCur ){
+    PyProcCursor *pNext = pCur->pNext;
+    if( pCur->db==db && pCur->iDepth==iDepth ) cursorClose(pCur);
+    pCur = pNext;
+  }
+}
+
+static void
+cursorDealloc(PyProcCursor *pCur) {
+  cursorClose(pCur);
+  PyObject_Del(pCur);
+}
+
+/* Buffer procedures of PyProcValue.  See the comment above the object. */
+static Py_ssize_t
+valueGetBuffer(PyProcValue *pVal, Py_ssize_t iSeg, void **pp) {
+  if( iSeg!=0 ){
+    PyErr_SetString(PyExc_SystemError, "accessing non-existent segment");
+    return -1;
+  }
+  if( pVal->pCur->pStmt==0 || pVal->pCur->iRow!=pVal->iRow ){
+    PyErr_SetString(PyExc_RuntimeError,
+                    "value is no longer valid: the cursor has moved");
+    return -1;
+  }
+  *pp = (void*)pVal->z;
+  return pVal->n;
+}
+
+static Py_ssize_t
+valueSegCount(PyProcValue *pVal, Py_ssize_t *pnByte) {
+  if( pnByte ) *pnByte = pVal->n;
+  return 1;
+}
+
+static PyBufferProcs valueBufferProcs = {
+  (readbufferproc)valueGetBuffer,   /* bf_getreadbuffer */
+  0,                                /* bf_getwritebuffer */
+  (segcountproc)valueSegCount,      /* bf_getsegcount */
+  (charbufferproc)valueGetBuffer,   /* bf_getcharbuffer */
+};
+
+static void
+valueDealloc(PyProcValue *pVal) {
+  Py_DECREF(pVal->pCur);
+  PyObject_Del(pVal);
+}
+
+static PyTypeObject PyProcValueType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "pyproc.Value",                   /* tp_name */
+  sizeof(PyProcValue),              /* tp_basicsize */
+  0,                                /* tp_itemsize */
+  (destructor)valueDealloc,         /* tp_dealloc */
+};
+
+/*
+** Return a read-only buffer over the n bytes at z, which belong to the
+** current row of pCur.
+*/
+static PyObject *
+valueNew(PyProcCursor *pCur, const void *z, int n) {
+  PyProcValue *pVal;
+  PyObject *pBuf;
+
+  if( (pVal = PyObject_New(PyProcValue, &PyProcValueType))==0 ) return 0;
+  Py_INCREF(pCur);
+  pVal->pCur = pCur;
+  pVal->iRow = pCur->iRow;
+  pVal->z = z;
+  pVal->n = n;
+  pBuf = PyBuffer_FromObject((PyObject*)pVal, 0, n);
+  Py_DECREF(pVal);
+  return pBuf;
+}
+
+/*
+** Return column iCol of the current row of pCur.  If pArena is not NULL,
+** TEXT and BLOB values are returned as buffers over pArena starting at
+** offset *piOff, which is advanced.  Otherwise they are buffers over the
+** memory of the statement itself.
+*/
+static PyObject *
+cursorColumn(PyProcCursor *pCur, int iCol, PyObject *pArena, int *piOff) {
+  sqlite3_stmt *pStmt = pCur->pStmt;
+  const void *z;
+  int n;
+
+  switch( sqlite3_column_type(pStmt, iCol) ){
+    case SQLITE_INTEGER:
+      return PyLong_FromLongLong(sqlite3_column_int64(pStmt, iCol));
+    case SQLITE_FLOAT:
+      return PyFloat_FromDouble(sqlite3_column_double(pStmt, iCol));
+    case SQLITE_TEXT:
+      z = sqlite3_column_text(pStmt, iCol);
+      break;
+    case SQLITE_BLOB:
+      z = sqlite3_column_blob(pStmt, iCol);
+      break;
+    default:
+      Py_INCREF(Py_None);
+      return Py_None;
+  }
+  n = sqlite3_column_bytes(pStmt, iCol);
+  if( pArena==0 ){
+    return valueNew(pCur, z, n);
+  }
+  memcpy(PyString_AS_STRING(pArena) + *piOff, z, n);
+  *piOff += n;
+  return PyBuffer_FromObject(pArena, *piOff - n, n);
+}
+
+/* Build a tuple from the current row of pCur.  See cursorColumn(). */
+static PyObject *
+cursorRow(PyProcCursor *pCur, PyObject *pArena, int *piOff) {
+  int nCol = sqlite3_column_count(pCur->pStmt);
+  PyObject *pRow = PyTuple_New(nCol);
+  int i;
+
+  for(i=0; pRow && i<nCol; i++){
+    PyObject *pVal = cursorColumn(pCur, i, pArena, piOff);
+    if( pVal==0 ){
+      Py_DECREF(pRow);
+      return 0;
+    }
+    PyTuple_SET_ITEM(pRow, i, pVal);
+  }
+  return pRow;
+}
+
+/*
+** Advance pCur to the next row.  Return 1 if a row is available, 0 when
+** the statement is done (the cursor is then closed) or -1 and set a
+** Python exception on error.
+*/
+static int
+cursorStep(PyProcCursor *pCur) {
+  int rc;
+  if( pCur->pStmt==0 ) return 0;
+  pCur->iRow++;
+  rc = sqlite3_step(pCur->pStmt);
+  if( rc==SQLITE_ROW ) return 1;
+  if( rc!=SQLITE_DONE ){
+    PyErr_SetString(PyExc_RuntimeError, sqlite3_errmsg(pCur->db));
+    cursorClose(pCur);
+    return -1;
+  }
+  cursorClose(pCur);
+  return 0;
+}
+
+static PyObject *
+cursorIterNext(PyProcCursor *pCur) {
+  int rc = cursorStep(pCur);
+  return rc>0 ? cursorRow(pCur, 0, 0) : 0;
+}
+
+static PyObject *
+cursorFetchone(PyProcCursor *pCur) {
+  PyObject *pRow = cursorIterNext(pCur);
+  if( pRow==0 && !PyErr_Occurred() ){
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return pRow;
+}
+
+static PyObject *
+cursorFetchmany(PyProcCursor *pCur, PyObject *args) {
+  int nRow = 1;
+  int i, j, rc;
+  PyObject *pList;
+
+  if( !PyArg_ParseTuple(args, "|i:fetchmany", &nRow) ) return 0;
+  if( (pList = PyList_New(0))==0 ) return 0;
+
+  for(i=0; i<nRow; i++){
+    sqlite3_stmt *pStmt;
+    PyObject *pArena = 0;
+    PyObject *pRow;
+    int nByte = 0;
+    int iOff = 0;
+
+    if( (rc = cursorStep(pCur))<=0 ){
+      if( rc<0 ) goto fetchmany_error;
+      break;
+    }
+
+    /* Size the arena that receives the TEXT and BLOB data of this row */
+    pStmt = pCur->pStmt;
+    for(j=0; j<sqlite3_column_count(pStmt); j++){
+      int t = sqlite3_column_type(pStmt, j);
+      if( t==SQLITE_TEXT ) sqlite3_column_text(pStmt, j);
+      if( t==SQLITE_TEXT || t==SQLITE_BLOB ){
+        nByte += sqlite3_column_bytes(pStmt, j);
+      }
+    }
+    if( nByte>0 && (pArena = PyString_FromStringAndSize(0, nByte))==0 ){
+      goto fetchmany_error;
+    }
+    pRow = cursorRow(pCur, pArena, &iOff);
+    Py_XDECREF(pArena);
+    if( pRow==0 || PyList_Append(pList, pRow)<0 ){
+      Py_XDECREF(pRow);
+      goto fetchmany_error;
+    }
+    Py_DECREF(pRow);
+  }
+  return pList;
+
+fetchmany_error:
+  Py_DECREF(pList);
+  return 0;
+}
+
+static PyObject *
+cursorCloseMethod(PyProcCursor *pCur) {
+  cursorClose(pCur);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyMethodDef aCursorMethod[] = {
+  { "fetchone",  (PyCFunction)cursorFetchone,    METH_NOARGS,
+    "Return the next row, or None when there are no more rows." },
+  { "fetchmany", (PyCFunction)cursorFetchmany,   METH_VARARGS,
+    "Return a list of up to N rows." },
+  { "close",     (PyCFunction)cursorCloseMethod, METH_NOARGS,
+    "Finalize the statement." },
+  { 0, 0, 0, 0 }
+};
+
+static PyTypeObject PyProcCursorType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "pyproc.Cursor",                  /* tp_name */
+  sizeof(PyProcCursor),             /* tp_basicsize */
+  0,                                /* tp_itemsize */
+  (destructor)cursorDealloc,        /* tp_dealloc */
+};
+
+/*
+** Bind the values in sequence pParams to the parameters of pStmt.
+** Return 0 on success or -1 with a Python exception set.
+*/
+static int
+cursorBind(sqlite3_stmt *pStmt, PyObject *pParams) {
+  Py_ssize_t i, n;
+  int rc = SQLITE_OK;
+
+  if( pParams==0 ) return 0;
+  if( !PySequence_Check(pParams) ){
+    PyErr_SetString(PyExc_TypeError, "parameters must be a sequence");
+    return -1;
+  }
+  n = PySequence_Size(pParams);
+  for(i=0; i<n && rc==SQLITE_OK; i++){
+    PyObject *pVal = PySequence_GetItem(pParams, i);
+    const void *z;
+    Py_ssize_t nByte;
+    int iVar = (int)i + 1;
+
+    if( pVal==0 ) return -1;
+    if( pVal==Py_None ){
+      rc = sqlite3_bind_null(pStmt, iVar);
+    }else if( PyInt_Check(pVal) || PyLong_Check(pVal) ){
+      rc = sqlite3_bind_int64(pStmt, iVar, PyLong_AsLongLong(pVal));
+    }else if( PyFloat_Check(pVal) ){
+      rc = sqlite3_bind_double(pStmt, iVar, PyFloat_AsDouble(pVal));
+    }else if( PyString_Check(pVal) ){
+      rc = sqlite3_bind_text(pStmt, iVar, PyString_AS_STRING(pVal),
+                             (int)PyString_GET_SIZE(pVal), SQLITE_TRANSIENT);
+    }else if( PyObject_AsReadBuffer(pVal, &z, &nByte)==0 ){
+      rc = sqlite3_bind_blob(pStmt, iVar, z, (int)nByte, SQLITE_TRANSIENT);
+    }else{
+      Py_DECREF(pVal);
+      PyErr_Format(PyExc_TypeError, "cannot bind parameter %d", iVar);
+      return -1;
+    }
+    Py_DECREF(pVal);
+  }
+  if( rc!=SQLITE_OK ){
+    PyErr_SetString(PyExc_RuntimeError,
+                    sqlite3_errmsg(sqlite3_db_handle(pStmt)));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** sqlite3_cursor(sql [, params]) - prepare sql on the connection whose
+** handle is held by pSelf and return a PyProcCursor over it.
+*/
+static PyObject *
+pyCursor(PyObject *pSelf, PyObject *args) {
+  sqlite3 *db = (sqlite3*)PyLong_AsVoidPtr(pSelf);
+  const char *zSql;
+  PyObject *pParams = 0;
+  PyProcCursor *pCur;
+  sqlite3_stmt *pStmt = 0;
+
+  if( !PyArg_ParseTuple(args, "s|O:sqlite3_cursor", &zSql, &pParams) ){
+    return 0;
+  }
+  if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)!=SQLITE_OK ){
+    PyErr_SetString(PyExc_RuntimeError, sqlite3_errmsg(db));
+    return 0;
+  }
+  if( pStmt==0 ){
+    PyErr_SetString(PyExc_ValueError, "no SQL statement");
+    return 0;
+  }
+  if( cursorBind(pStmt, pParams)<0
+   || (pCur = PyObject_New(PyProcCursor, &PyProcCursorType))==0 ){
+    sqlite3_finalize(pStmt);
+    return 0;
+  }
+  pCur->db = db;
+  pCur->pStmt = pStmt;
+  pCur->iDepth = iExecDepth;
+  pCur->iRow = 0;
+  pCur->pNext = pOpenCursors;
+  pCur->ppPrev = &pOpenCursors;
+  if( pOpenCursors ) pOpenCursors->ppPrev = &pCur->pNext;
+  pOpenCursors = pCur;
+  return (PyObject*)pCur;
+}
+
+static PyMethodDef pyCursorDef = {
+  "sqlite3_cursor", pyCursor, METH_VARARGS,
+  "Prepare an SQL statement and return a cursor over its rows."
+};
+
+/*
+** Return a new reference to the globals dictionary of connection db,
+** creating it if necessary.  Return NULL if a Python error occurs.
+*/
+static PyObject *
+connGlobals(sqlite3 *db) {
+  PyObject *pKey;
+  PyObject *pGlobals;
+  PyObject *pydb;
+  PyObject *pCursorFunc;
+
+  if( pConnGlobals==0 && (pConnGlobals = PyDict_New())==0 ) return 0;
+  if( (pKey = PyLong_FromVoidPtr(db))==0 ) return 0;
+  pGlobals = PyDict_GetItem(pConnGlobals, pKey);
+  if( pGlobals ){
+    Py_INCREF(pGlobals);
+    Py_DECREF(pKey);
+    return pGlobals;
+  }
+
+  pydb = PyInt_FromLong((long)db);
+  pCursorFunc = PyCFunction_New(&pyCursorDef, pKey);
+  pGlobals = PyDict_New();
+  if( pydb==0 || pCursorFunc==0 || pGlobals==0
+   || PyDict_SetItemString(pGlobals, "__builtins__", PyEval_GetBuiltins())<0
+   || PyDict_SetItemString(pGlobals, "sqlite3_db_handle", pydb)<0
+   || PyDict_SetItemString(pGlobals, "sqlite3_cursor", pCursorFunc)<0
+   || PyDict_SetItem(pConnGlobals, pKey, pGlobals)<0 ){
+    Py_XDECREF(pGlobals);
+    pGlobals = 0;
+  }
+  Py_XDECREF(pCursorFunc);
+  Py_XDECREF(pydb);
+  Py_DECREF(pKey);
+  return pGlobals;
+}
+
+/*
+** Format the pending Python exception as an sqlite3_malloc'd string
+** and clear it.
+*/
+static char *
+pyErrMsg(const char *zContext) {
+  PyObject *pType, *pValue, *pTrace, *pStr = 0;
+  char *zErr;
+
+  PyErr_Fetch(&pType, &pValue, &pTrace);
+  if( pValue ) pStr = PyObject_Str(pValue);
+  zErr = sqlite3_mprintf("%s: %s", zContext,
+      pStr ? PyString_AsString(pStr) : "unknown Python error");
+  Py_XDECREF(pStr);
+  Py_XDECREF(pType);
+  Py_XDECREF(pValue);
+  Py_XDECREF(pTrace);
+  return zErr;
+}
+
+/* ProcLangImpl.xCompile - compile a procedure body once */
+static void *
+pyCompile(sqlite3 *db, const char *zBody, char **pzErr) {
+  PyProc *p;
+
+  p = (PyProc*)sqlite3_malloc(sizeof(PyProc));
+  if( p==0 ){
+    *pzErr = sqlite3_mprintf("out of memory");
+    return 0;
+  }
+  p->pGlobals = connGlobals(db);
+  p->pCode = p->pGlobals ? Py_CompileString(zBody, "<procedure>",
+                                            Py_file_input) : 0;
+  if( p->pCode==0 ){
+    *pzErr = pyErrMsg("cannot compile python procedure");
+    Py_XDECREF(p->pGlobals);
+    sqlite3_free(p);
+    return 0;
+  }
+  return p;
+}
+
+/* ProcLangImpl.xExec - run a body compiled by pyCompile() */
+static int
+pyExec(sqlite3 *db, void *pCompiled, char **pzErr) {
+  PyProc *p = (PyProc*)pCompiled;
+  PyObject *pCode = p->pCode;
+  PyObject *pGlobals = p->pGlobals;
+  PyObject *pResult;
+
+  /* The body may drop procedures, which releases p while it runs */
+  Py_INCREF(pCode);
+  Py_INCREF(pGlobals);
+  iExecDepth++;
+  pResult = PyEval_EvalCode((PyCodeObject*)pCode, pGlobals, pGlobals);
+  cursorCloseAll(db, iExecDepth);
+  iExecDepth--;
+  Py_DECREF(pCode);
+  Py_DECREF(pGlobals);
+  if( pResult==0 ){
+    *pzErr = pyErrMsg("python procedure failed");
+    return SQLITE_ERROR;
+  }
+  Py_DECREF(pResult);
+  return SQLITE_OK;
+}
+
+/* ProcLangImpl.xFree */
+static void
+pyFree(void *pCompiled) {
+  PyProc *p = (PyProc*)pCompiled;
+  Py_XDECREF(p->pCode);
+  Py_XDECREF(p->pGlobals);
+  sqlite3_free(p);
+}
+
+/* ProcLangImpl.procDbFinalize - forget the namespace of a closing db */
+static void
+pyDbFinalize(sqlite3 *db) {
+  PyObject *pKey;
+  if( pConnGlobals==0 ) return;
+  if( (pKey = PyLong_FromVoidPtr(db))==0 ){
+    PyErr_Clear();
+    return;
+  }
+  if( PyDict_DelItem(pConnGlobals, pKey)<0 ) PyErr_Clear();
+  Py_DECREF(pKey);
+}
+
+static ProcLangImpl pyLangImpl = {
+  "python", 0, pyDbFinalize, 0, pyCompile, pyExec, pyFree
+};
+static int bRegistered = 0;      /* True once pyLangImpl is registered */
+
 void 
 execpython(sqlite3 *db, const char *procBody) {
   PyObject* main_module;
@@ -103,15 +649,35 @@ sqlite3_extension_init(
 ){
   SQLITE_EXTENSION_INIT2 (pApi);
   pf_sqlite3_execpython = execpython;
-  fprintf(stderr, "*** Database: 0x%08.08x\n", (long)db);
-  Py_Initialize();
-  PyThreadState* gTstate  = PyThreadState_Get();
-  PyThreadState* pyTstate = Py_NewInterpreter();
-  // void Py_EndInterpreter(PyThreadState *pyTstate)
-
-  fprintf(stderr, 
-    "*** global interpreter: 0x%08.08x sub-interpreter: 0x%08.08x\n", 
-      (long)gTstate, (long)pyTstate);
+
+  /* The interpreter, and the code objects compiled in it, are shared by
+  ** every connection that loads this extension, so create it only once.
+  */
+  if( !bRegistered ){
+    bRegistered = 1;
+    Py_Initialize();
+    (void)Py_NewInterpreter();
+
+    PyProcCursorType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PyProcCursorType.tp_doc = "Cursor over an SQLite prepared statement";
+    PyProcCursorType.tp_iter = PyObject_SelfIter;
+    PyProcCursorType.tp_iternext = (iternextfunc)cursorIterNext;
+    PyProcCursorType.tp_methods = aCursorMethod;
+    if( PyType_Ready(&PyProcCursorType)<0 ){
+      *pzErrMsg = sqlite3_mprintf("cannot initialize pyproc.Cursor");
+      return SQLITE_ERROR;
+    }
+    PyProcValueType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PyProcValueType.tp_doc = "Column value of the current row of a cursor";
+    PyProcValueType.tp_as_buffer = &valueBufferProcs;
+    if( PyType_Ready(&PyProcValueType)<0 ){
+      *pzErrMsg = sqlite3_mprintf("cannot initialize pyproc.Value");
+      return SQLITE_ERROR;
+    }
+
+    pyLangImpl.pNext = pProcLangImpl;
+    pProcLangImpl = &pyLangImpl;
+  }
 
   sqlite3_create_function(db, "sid", 0, SQLITE_ANY, 0, sid, 0, 0);
   sqlite3_create_function(db, "pid", 0, SQLITE_ANY, 0, pid, 0, 0);
@@ -269,6 +269,7 @@ static void detachFunc(
     goto detach_error;
   }
 
+  sqlite3CkptThreadStop(pDb);
   sqlite3BtreeClose(pDb->pBt);
   pDb->pBt = 0;
   pDb->pSchema = 0;
@@ -348,7 +348,9 @@ int sqlite3_backup_step(sqlite3_backup *p, int nPage){
     pgszSrc = sqlite3BtreeGetPageSize(p->pSrc);
     pgszDest = sqlite3BtreeGetPageSize(p->pDest);
     destMode = sqlite3PagerGetJournalMode(sqlite3BtreePager(p->pDest));
-    if( SQLITE_OK==rc && destMode==PAGER_JOURNALMODE_WAL && pgszSrc!=pgszDest ){
+    if( SQLITE_OK==rc && pgszSrc!=pgszDest
+     && (destMode==PAGER_JOURNALMODE_WAL || destMode==PAGER_JOURNALMODE_WAL2)
+    ){
       rc = SQLITE_READONLY;
     }
   
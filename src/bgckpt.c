@@ -0,0 +1,272 @@
+/*
+** 2010 November 15
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains the background checkpointer enabled for a database
+** by "PRAGMA wal_checkpoint_thread".
+**
+** Normally the checkpoint requested by wal_autocheckpoint runs in the
+** connection that happened to commit the transaction that took the WAL
+** over the threshold, adding the cost of the whole checkpoint to that
+** commit.  With a background checkpointer, sqlite3WalDefaultHook() just
+** wakes a thread dedicated to the database.  The thread opens a private
+** connection of its own to the same file, and checkpoints through it in
+** incremental steps that copy at most nPage pages each.  It takes and
+** releases the WAL locks for each step, so that readers and writers are
+** never held up by more than one short step.  As with any checkpoint,
+** frames that readers may still need are left in the WAL.
+**
+** The thread keeps stepping until the WAL has been completely backfilled
+** or a step makes no progress, for example because a reader is using an
+** old snapshot or another connection is running a checkpoint.  It then
+** waits until it is woken by another commit.
+**
+** Background checkpointers are only available in threadsafe builds on
+** unix.  Elsewhere the pragma has no effect and checkpoints are run by
+** the committing connection as before.
+*/
+#include "sqliteInt.h"
+
+#if !defined(SQLITE_OMIT_WAL) && SQLITE_THREADSAFE>0 && SQLITE_OS_UNIX
+#include <pthread.h>
+
+/*
+** A background checkpointer.  The mutex protects nPage, bWake, bStop and
+** bBusy.  The other fields are set when the object is created, except for
+** db, which is only used by the thread.
+*/
+struct CkptThread {
+  pthread_mutex_t mutex;          /* Mutex protecting this structure */
+  pthread_cond_t cond;            /* Signalled when bWake or bStop is set */
+  pthread_t thread;               /* The checkpointer thread */
+  int nPage;                      /* Max pages to copy in one step */
+  int bWake;                      /* True if there may be work to do */
+  int bStop;                      /* True to make the thread exit */
+  int bBusy;                      /* True if the last step was SQLITE_BUSY */
+  char *zFile;                    /* Database file name */
+  char *zVfs;                     /* Name of VFS used to open zFile */
+  sqlite3 *db;                    /* Connection used by the thread */
+};
+
+/*
+** Return true if the owner of checkpointer p has asked it to stop.
+*/
+static int ckptStopRequested(CkptThread *p){
+  int bStop;
+  pthread_mutex_lock(&p->mutex);
+  bStop = p->bStop;
+  pthread_mutex_unlock(&p->mutex);
+  return bStop;
+}
+
+/*
+** Checkpoint the database of checkpointer p in steps of at most nPage
+** pages, until there is nothing left to backfill or a step makes no
+** progress.  The private connection is opened the first time this is
+** called, and closed again if an error occurs.
+**
+** Errors are reported through sqlite3_log() only.  A checkpoint that
+** cannot run because the database is busy is not an error.
+*/
+static void ckptRun(CkptThread *p, int nPage){
+  int rc = SQLITE_OK;
+  int nLog = 0;                   /* Frames in the WAL */
+  int nCkpt = -1;                 /* Frames backfilled */
+  int nPrev;                      /* Value of nCkpt before the last step */
+
+  if( p->db==0 ){
+    rc = sqlite3_open_v2(p->zFile, &p->db,
+        SQLITE_OPEN_READWRITE|SQLITE_OPEN_NOMUTEX|SQLITE_OPEN_PRIVATECACHE,
+        p->zVfs
+    );
+    if( rc==SQLITE_OK ){
+      sqlite3_wal_autocheckpoint(p->db, 0);
+    }
+  }
+
+  /* Read the database header.  This opens the WAL if the database has
+  ** been switched to WAL mode since the last call. */
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(p->db, "PRAGMA schema_version", 0, 0, 0);
+  }
+
+  if( rc==SQLITE_OK ){
+    do{
+      nPrev = nCkpt;
+      rc = sqlite3BtreeCheckpoint(p->db->aDb[0].pBt, nPage, 0,
+                                  &nLog, &nCkpt);
+    }while( rc==SQLITE_OK && nCkpt<nLog && nCkpt>nPrev
+         && !ckptStopRequested(p)
+    );
+  }
+
+  pthread_mutex_lock(&p->mutex);
+  p->bBusy = (rc==SQLITE_BUSY);
+  pthread_mutex_unlock(&p->mutex);
+
+  if( rc!=SQLITE_OK && rc!=SQLITE_BUSY ){
+    sqlite3_log(rc, "background checkpoint of %s failed", p->zFile);
+    sqlite3_close(p->db);
+    p->db = 0;
+  }
+}
+
+/*
+** The main routine of a checkpointer thread.
+*/
+static void *ckptMain(void *pArg){
+  CkptThread *p = (CkptThread*)pArg;
+  pthread_mutex_lock(&p->mutex);
+  while( !p->bStop ){
+    if( p->bWake ){
+      int nPage = p->nPage;
+      p->bWake = 0;
+      pthread_mutex_unlock(&p->mutex);
+      ckptRun(p, nPage);
+      pthread_mutex_lock(&p->mutex);
+    }else{
+      pthread_cond_wait(&p->cond, &p->mutex);
+    }
+  }
+  pthread_mutex_unlock(&p->mutex);
+  sqlite3_close(p->db);
+  p->db = 0;
+  return 0;
+}
+
+/*
+** Start, stop or reconfigure the background checkpointer for database iDb
+** of connection db.  If nPage is greater than zero, the checkpointer
+** copies up to nPage pages per step.  If it is zero, the checkpointer
+** is stopped.  If it is negative, nothing is changed.
+**
+** Return the number of pages per step of the checkpointer, or zero if
+** none is running.  No checkpointer is started for temporary or in-memory
+** databases, or if the thread cannot be created.
+*/
+int sqlite3CkptThreadConfig(sqlite3 *db, int iDb, int nPage){
+  Db *pDb = &db->aDb[iDb];
+  CkptThread *p = pDb->pCkpt;
+  const char *zFile;
+  const char *zVfs;
+  int nFile;
+  int nVfs;
+
+  assert( sqlite3_mutex_held(db->mutex) );
+  if( nPage<0 ){
+    return p ? p->nPage : 0;
+  }
+  if( nPage==0 ){
+    sqlite3CkptThreadStop(pDb);
+    return 0;
+  }
+  if( p ){
+    pthread_mutex_lock(&p->mutex);
+    p->nPage = nPage;
+    pthread_mutex_unlock(&p->mutex);
+    return nPage;
+  }
+
+  zFile = pDb->pBt ? sqlite3BtreeGetFilename(pDb->pBt) : 0;
+  if( zFile==0 || zFile[0]==0 ) return 0;
+  zVfs = db->pVfs->zName;
+  nFile = sqlite3Strlen30(zFile);
+  nVfs = sqlite3Strlen30(zVfs);
+  p = (CkptThread*)sqlite3MallocZero(sizeof(CkptThread) + nFile + nVfs + 2);
+  if( p==0 ) return 0;
+  p->zFile = (char*)&p[1];
+  memcpy(p->zFile, zFile, nFile+1);
+  p->zVfs = &p->zFile[nFile+1];
+  memcpy(p->zVfs, zVfs, nVfs+1);
+  p->nPage = nPage;
+  pthread_mutex_init(&p->mutex, 0);
+  pthread_cond_init(&p->cond, 0);
+  if( pthread_create(&p->thread, 0, ckptMain, (void*)p) ){
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    sqlite3_free(p);
+    return 0;
+  }
+  pDb->pCkpt = p;
+  return nPage;
+}
+
+/*
+** Wake the background checkpointer for database pDb, if there is one.
+** Return true if it was woken, or false if the caller should run the
+** checkpoint itself.
+**
+** The checkpoint is left to the caller if the database is in exclusive
+** locking mode, as the thread's connection could never obtain the locks
+** it needs, and the WAL would grow without bound.  It is also left to the
+** caller if the last step run by the thread returned SQLITE_BUSY.  In
+** that case the thread is woken again by the next commit.
+*/
+int sqlite3CkptThreadWake(Db *pDb){
+  CkptThread *p = pDb->pCkpt;
+  Pager *pPager;
+  int bWake;
+  if( p==0 ) return 0;
+  pPager = sqlite3BtreePager(pDb->pBt);
+  if( sqlite3PagerLockingMode(pPager, PAGER_LOCKINGMODE_QUERY)
+        ==PAGER_LOCKINGMODE_EXCLUSIVE
+  ){
+    return 0;
+  }
+  pthread_mutex_lock(&p->mutex);
+  bWake = !p->bBusy;
+  if( bWake ){
+    p->bWake = 1;
+    pthread_cond_signal(&p->cond);
+  }else{
+    p->bBusy = 0;
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return bWake;
+}
+
+/*
+** Stop the background checkpointer for database pDb, if there is one,
+** and wait for its thread to exit.  This is called before the database
+** is closed or detached.
+*/
+void sqlite3CkptThreadStop(Db *pDb){
+  CkptThread *p = pDb->pCkpt;
+  if( p ){
+    pthread_mutex_lock(&p->mutex);
+    p->bStop = 1;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    pthread_join(p->thread, 0);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    sqlite3_free(p);
+    pDb->pCkpt = 0;
+  }
+}
+
+#else /* No background checkpointers in this build */
+
+int sqlite3CkptThreadConfig(sqlite3 *db, int iDb, int nPage){
+  UNUSED_PARAMETER(db);
+  UNUSED_PARAMETER(iDb);
+  UNUSED_PARAMETER(nPage);
+  return 0;
+}
+int sqlite3CkptThreadWake(Db *pDb){
+  UNUSED_PARAMETER(pDb);
+  return 0;
+}
+void sqlite3CkptThreadStop(Db *pDb){
+  UNUSED_PARAMETER(pDb);
+}
+
+#endif
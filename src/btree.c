@@ -631,6 +631,33 @@ static int saveAllCursors(BtShared *pBt, Pgno iRoot, BtCursor *pExcept){
   return SQLITE_OK;
 }
 
+/*
+** Release the pages held by all cursors open on pBt. The positions of
+** valid cursors are saved first so that they can be restored later.
+** Cursors in any other state simply reload the root page when they are
+** next moved.
+*/
+static int saveAllCursorPages(BtShared *pBt){
+  BtCursor *p;
+  assert( sqlite3_mutex_held(pBt->mutex) );
+  for(p=pBt->pCursor; p; p=p->pNext){
+    if( p->eState==CURSOR_VALID ){
+      int rc = saveCursorPosition(p);
+      if( SQLITE_OK!=rc ){
+        return rc;
+      }
+    }else{
+      int i;
+      for(i=0; i<=p->iPage; i++){
+        releasePage(p->apPage[i]);
+        p->apPage[i] = 0;
+      }
+      p->iPage = -1;
+    }
+  }
+  return SQLITE_OK;
+}
+
 /*
 ** Clear the current cursor position.
 */
@@ -2096,6 +2123,20 @@ int sqlite3BtreeSetCacheSize(Btree *p, int mxPage){
   return SQLITE_OK;
 }
 
+/*
+** Change the limit on the amount of the database file that may be
+** memory-mapped.  A negative value leaves the limit unchanged.  The
+** limit in effect is returned.
+*/
+i64 sqlite3BtreeSetMmapLimit(Btree *p, i64 szMmap){
+  BtShared *pBt = p->pBt;
+  assert( sqlite3_mutex_held(p->db->mutex) );
+  sqlite3BtreeEnter(p);
+  szMmap = sqlite3PagerMmapLimit(pBt->pPager, szMmap);
+  sqlite3BtreeLeave(p);
+  return szMmap;
+}
+
 /*
 ** Change the way data is synced to disk in order to increase or decrease
 ** how well the database resists damage due to OS crashes and power
@@ -2156,6 +2197,7 @@ int sqlite3BtreeSetPageSize(Btree *p, int pageSize, int nReserve, int iFix){
   BtShared *pBt = p->pBt;
   assert( nReserve>=-1 && nReserve<=255 );
   sqlite3BtreeEnter(p);
+  if( nReserve>=0 ) pBt->nReserveWanted = (u8)nReserve;
   if( pBt->pageSizeFixed ){
     sqlite3BtreeLeave(p);
     return SQLITE_READONLY;
@@ -2198,6 +2240,21 @@ int sqlite3BtreeGetReserve(Btree *p){
   return n;
 }
 
+/*
+** Return the number of bytes of reserved space that should be used when
+** the database is next rebuilt.  This is the larger of the reserve in
+** use now and the reserve most recently requested, so the reserve can
+** grow through VACUUM but never shrink.
+*/
+int sqlite3BtreeGetRequestedReserve(Btree *p){
+  int n;
+  sqlite3BtreeEnter(p);
+  n = sqlite3BtreeGetReserve(p);
+  if( n<p->pBt->nReserveWanted ) n = p->pBt->nReserveWanted;
+  sqlite3BtreeLeave(p);
+  return n;
+}
+
 /*
 ** Set the maximum page count for a database if mxPage is positive.
 ** No changes are made if mxPage is 0 or negative.
@@ -2324,24 +2381,24 @@ static int lockBtree(BtShared *pBt){
       goto page1_init_failed;
     }
 #else
-    if( page1[18]>2 ){
+    if( page1[18]>3 ){
       pBt->readOnly = 1;
     }
-    if( page1[19]>2 ){
+    if( page1[19]>3 ){
       goto page1_init_failed;
     }
 
     /* If the write version is set to 2, this database should be accessed
-    ** in WAL mode. If the log is not already open, open it now. Then 
-    ** return SQLITE_OK and return without populating BtShared.pPage1.
-    ** The caller detects this and calls this function again. This is
-    ** required as the version of page 1 currently in the page1 buffer
-    ** may not be the latest version - there may be a newer one in the log
-    ** file.
+    ** in WAL mode, or if it is set to 3, in wal2 mode. If the log is not
+    ** already open, open it now. Then return SQLITE_OK and return without
+    ** populating BtShared.pPage1. The caller detects this and calls this
+    ** function again. This is required as the version of page 1 currently
+    ** in the page1 buffer may not be the latest version - there may be a
+    ** newer one in the log file.
     */
-    if( page1[19]==2 && pBt->doNotUseWAL==0 ){
+    if( (page1[19]==2 || page1[19]==3) && pBt->doNotUseWAL==0 ){
       int isOpen = 0;
-      rc = sqlite3PagerOpenWal(pBt->pPager, &isOpen);
+      rc = sqlite3PagerOpenWal(pBt->pPager, page1[19]==3, &isOpen);
       if( rc!=SQLITE_OK ){
         goto page1_init_failed;
       }else if( isOpen==0 ){
@@ -2588,11 +2645,32 @@ int sqlite3BtreeBeginTrans(Btree *p, int wrflag){
     */
     while( pBt->pPage1==0 && SQLITE_OK==(rc = lockBtree(pBt)) );
 
+    /* If this is the first statement of a transaction opened by BEGIN
+    ** CONCURRENT, have the pager start recording the pages it reads.  */
+    if( rc==SQLITE_OK && p->inTrans==TRANS_NONE
+     && p->db->bConcurrent && !p->db->autoCommit
+    ){
+      rc = sqlite3PagerBeginConcurrent(pBt->pPager);
+    }
+
     if( rc==SQLITE_OK && wrflag ){
       if( pBt->readOnly ){
         rc = SQLITE_READONLY;
       }else{
-        rc = sqlite3PagerBegin(pBt->pPager,wrflag>1,sqlite3TempInMemory(p->db));
+        /* Read cursors opened before the write transaction may hold
+        ** pages that point into the memory mapping of the database file.
+        ** Those are not part of the page cache, so they would not see
+        ** changes made by this transaction (or a page being relocated by
+        ** auto-vacuum). Have all cursors drop their pages so that they
+        ** seek back to their position through the page cache when next
+        ** used.  */
+        if( sqlite3PagerMmapRefcount(pBt->pPager) ){
+          rc = saveAllCursorPages(pBt);
+        }
+        if( rc==SQLITE_OK ){
+          rc = sqlite3PagerBegin(pBt->pPager, wrflag>1,
+                                 sqlite3TempInMemory(p->db));
+        }
         if( rc==SQLITE_OK ){
           rc = newDatabase(pBt);
         }
@@ -3123,6 +3201,7 @@ static void btreeEndTransaction(Btree *p){
   assert( sqlite3BtreeHoldsMutex(p) );
 
   btreeClearHasContent(pBt);
+  sqlite3PagerEndConcurrent(pBt->pPager);
   if( p->inTrans>TRANS_NONE && p->db->activeVdbeCnt>1 ){
     /* If there are other active statements that belong to this database
     ** handle, downgrade to a read-only transaction. The other statements
@@ -4081,6 +4160,67 @@ const void *sqlite3BtreeDataFetch(BtCursor *pCur, int *pAmt){
 }
 
 
+#if SQLITE_READAHEAD_PAGES>0
+/*
+** Return the page number of the iIdx'th child of interior page pPage.
+** The right-child pointer is child number pPage->nCell.
+*/
+static Pgno childPageNumber(MemPage *pPage, int iIdx){
+  assert( !pPage->leaf && iIdx>=0 && iIdx<=pPage->nCell );
+  if( iIdx==pPage->nCell ){
+    return get4byte(&pPage->aData[pPage->hdrOffset+8]);
+  }
+  return get4byte(findCell(pPage, iIdx));
+}
+
+/*
+** Cursor pCur is about to descend from interior page pParent into the
+** child at index iIdx.  If this continues a walk through consecutive
+** children of pParent (in either direction), pass the page numbers of
+** the siblings that come next to sqlite3PagerReadahead() so that the
+** VFS can start reading them before they are needed.
+**
+** Siblings are requested SQLITE_READAHEAD_PAGES at a time.  The next
+** batch is requested once the cursor is half way through the previous
+** one, so that the reads stay ahead of the scan.  A seek enters only
+** one child per interior page and so never triggers a request.
+**
+** The return value is an error code if the pager reports an I/O error
+** while reading the siblings, or SQLITE_OK otherwise.
+*/
+static int btreeReadahead(BtCursor *pCur, MemPage *pParent, int iIdx){
+  int rc = SQLITE_OK;
+  if( pParent->pgno!=pCur->raParent
+   || (iIdx!=pCur->raIdx+1 && iIdx!=pCur->raIdx-1)
+  ){
+    pCur->raParent = pParent->pgno;
+    pCur->raEnd = iIdx;
+  }else{
+    int iDir = iIdx - pCur->raIdx;            /* +1 or -1 */
+    int nAhead = (pCur->raEnd - iIdx)*iDir;   /* Children already requested */
+    if( nAhead<=SQLITE_READAHEAD_PAGES/2 ){
+      Pgno aPgno[SQLITE_READAHEAD_PAGES];
+      int iLast = iIdx + iDir*SQLITE_READAHEAD_PAGES;
+      int n = 0;
+      int i;
+      if( iLast>pParent->nCell ) iLast = pParent->nCell;
+      if( iLast<0 ) iLast = 0;
+      for(i=(nAhead>0 ? pCur->raEnd : iIdx+iDir); (i-iLast)*iDir<=0; i+=iDir){
+        aPgno[n++] = childPageNumber(pParent, i);
+      }
+      pCur->raEnd = i;
+      if( n>0 ){
+        rc = sqlite3PagerReadahead(pCur->pBt->pPager, aPgno, n);
+      }
+    }
+  }
+  pCur->raIdx = iIdx;
+  return rc;
+}
+#else
+# define btreeReadahead(x,y,z) SQLITE_OK
+#endif
+
 /*
 ** Move the cursor down to a new child page.  The newPgno argument is the
 ** page number of the child page to move to.
@@ -4102,6 +4242,8 @@ static int moveToChild(BtCursor *pCur, u32 newPgno){
   if( pCur->iPage>=(BTCURSOR_MAX_DEPTH-1) ){
     return SQLITE_CORRUPT_BKPT;
   }
+  rc = btreeReadahead(pCur, pCur->apPage[i], pCur->aiIdx[i]);
+  if( rc ) return rc;
   rc = getAndInitPage(pBt, newPgno, &pNewPage);
   if( rc ) return rc;
   pCur->apPage[i+1] = pNewPage;
@@ -7930,12 +8072,22 @@ int sqlite3BtreeIsInTrans(Btree *p){
 
 #ifndef SQLITE_OMIT_WAL
 /*
-** Run a checkpoint on the Btree passed as the first argument.
+** Run a checkpoint on the Btree passed as the first argument.  If nPage
+** or nMs is greater than zero, the checkpoint is incremental and copies
+** at most nPage pages, or stops after about nMs milliseconds.  The number
+** of frames in the WAL and the number backfilled are written to *pnLog
+** and *pnCkpt if they are not NULL.
 **
 ** Return SQLITE_LOCKED if this or any other connection has an open 
 ** transaction on the shared-cache the argument Btree is connected to.
 */
-int sqlite3BtreeCheckpoint(Btree *p){
+int sqlite3BtreeCheckpoint(
+  Btree *p,                       /* Btree to checkpoint */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs,                        /* Max time to spend in ms, or 0 */
+  int *pnLog,                     /* OUT: Frames in WAL */
+  int *pnCkpt                     /* OUT: Frames backfilled */
+){
   int rc = SQLITE_OK;
   if( p ){
     BtShared *pBt = p->pBt;
@@ -7943,7 +8095,7 @@ int sqlite3BtreeCheckpoint(Btree *p){
     if( pBt->inTransaction!=TRANS_NONE ){
       rc = SQLITE_LOCKED;
     }else{
-      rc = sqlite3PagerCheckpoint(pBt->pPager);
+      rc = sqlite3PagerCheckpoint(pBt->pPager, nPage, nMs, pnLog, pnCkpt);
     }
     sqlite3BtreeLeave(p);
   }
@@ -8104,19 +8256,23 @@ void sqlite3BtreeCacheOverflow(BtCursor *pCur){
 /*
 ** Set both the "read version" (single byte at byte offset 18) and 
 ** "write version" (single byte at byte offset 19) fields in the database
-** header to iVersion.
+** header to iVersion: 1 for rollback mode, 2 for WAL mode or 3 for wal2
+** mode.
 */
 int sqlite3BtreeSetVersion(Btree *pBtree, int iVersion){
   BtShared *pBt = pBtree->pBt;
   int rc;                         /* Return code */
  
   assert( pBtree->inTrans==TRANS_NONE );
-  assert( iVersion==1 || iVersion==2 );
+  assert( iVersion==1 || iVersion==2 || iVersion==3 );
 
-  /* If setting the version fields to 1, do not automatically open the
-  ** WAL connection, even if the version fields are currently set to 2.
+  /* Do not automatically open the WAL connection, even if the version
+  ** fields are currently set to 2 or 3.  If leaving WAL or wal2 mode, the
+  ** log has already been checkpointed and closed.  If changing between
+  ** the two, it must be reopened in the new mode once the fields have
+  ** been changed.
   */
-  pBt->doNotUseWAL = (u8)(iVersion==1);
+  pBt->doNotUseWAL = 1;
 
   rc = sqlite3BtreeBeginTrans(pBtree, 0);
   if( rc==SQLITE_OK ){
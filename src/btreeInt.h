@@ -410,6 +410,7 @@ struct BtShared {
   u8 secureDelete;      /* True if secure_delete is enabled */
   u8 initiallyEmpty;    /* Database is empty at start of transaction */
   u8 openFlags;         /* Flags to sqlite3BtreeOpen() */
+  u8 nReserveWanted;    /* Desired number of extra bytes per page */
 #ifndef SQLITE_OMIT_AUTOVACUUM
   u8 autoVacuum;        /* True if auto-vacuum is enabled */
   u8 incrVacuum;        /* True if incr-vacuum is enabled */
@@ -467,6 +468,16 @@ struct CellInfo {
 */
 #define BTCURSOR_MAX_DEPTH 20
 
+/*
+** When a cursor steps through consecutive children of an interior page
+** (as it does during a full scan in either direction), the btree asks
+** the pager to prefetch the next SQLITE_READAHEAD_PAGES siblings. Set
+** this to zero to disable readahead hints.
+*/
+#ifndef SQLITE_READAHEAD_PAGES
+# define SQLITE_READAHEAD_PAGES 32
+#endif
+
 /*
 ** A cursor is a pointer to a particular entry within a particular
 ** b-tree within a database file.
@@ -496,6 +507,11 @@ struct BtCursor {
   void *pKey;      /* Saved key that was cursor's last known position */
   i64 nKey;        /* Size of pKey, or last integer key */
   int skipNext;    /* Prev() is noop if negative. Next() is noop if positive */
+#if SQLITE_READAHEAD_PAGES>0
+  Pgno raParent;            /* Interior page whose children are prefetched */
+  int raIdx;                /* Index of the child of raParent last entered */
+  int raEnd;                /* First child index not yet prefetched */
+#endif
 #ifndef SQLITE_OMIT_INCRBLOB
   u8 isIncrblobHandle;      /* True if this cursor is an incr. io handle */
   Pgno *aOverflow;          /* Cache of overflow page locations */
@@ -1855,10 +1855,9 @@ void sqlite3EndCreateProc(
     pp = pp->pNext;
   }
 
-  if(sqlite3CreateProc(pParse, ctx->pName1, ctx->pName2,
+  sqlite3CreateProc(pParse, ctx->pName1, ctx->pName2,
     procbody, ROOT_PROC_PARAM(pParse), returnTypeCode,
-    language, ctx->nReplace, ctx->noErr) != SQLITE_OK) {
-  }
+    language, ctx->nReplace, ctx->noErr);
 
 create_proc_done:
   //sqliteDbFree(db, zSql);
@@ -1868,9 +1867,15 @@ create_proc_done:
   while(pp && pp->name) {
     proc_param *pNext = pp->pNext;
     sqlite3_free(pp->name);
+    sqlite3_free(pp->typeDecl);
     sqlite3_free(pp);
     pp = pNext;
   }
+  sqlite3_free(pp);
+  sqlite3_free((char*)ctx->pName1->z);
+  sqlite3_free(ctx->pName1);
+  sqlite3_free((char*)ctx->pName2->z);
+  sqlite3_free(ctx->pName2);
   sqlite3_free(PARSE_PROC_CTX(pParse));
 }
 
@@ -1883,18 +1888,20 @@ void sqlite3DropProc(Parse *pParse, SrcList *pName, int noErr){
   }
   assert( pParse->nErr==0 );
   assert( pName->nSrc==1 );
-  if( noErr ) db->suppressErr++;
 
- 
-  int rowsDeleted = -1;
-  char *zErrMsg;
-  if( deleteProcSchema(db, pName->a[0].zName, &rowsDeleted, noErr, &zErrMsg) 
-    != SQLITE_OK) {
-      if (!noErr) {
-        sqlite3ErrorMsg(pParse, "Cannot drop proc \"%s\"", pName->a[0].zName);
-        pParse->nErr++;
-      }
+  if( SQLITE_OK!=sqlite3ReadSchema(pParse) ) goto exit_drop_proc;
+  if( noErr ) db->suppressErr++;
+  iDb = 0;
+  if( pName->a[0].zDatabase ){
+    iDb = sqlite3FindDbName(db, pName->a[0].zDatabase);
+    if( iDb<0 ){
+      sqlite3ErrorMsg(pParse, "unknown database %s", pName->a[0].zDatabase);
+    }
   }
+  if( noErr ) db->suppressErr--;
+  if( iDb<0 ) goto exit_drop_proc;
+ 
+  sqlite3ProcCatalogDrop(pParse, iDb, pName->a[0].zName, noErr);
 
 exit_drop_proc:
   sqlite3SrcListDelete(db, pName);
@@ -3511,13 +3518,13 @@ void sqlite3BeginTransaction(Parse *pParse, int type){
   }
   v = sqlite3GetVdbe(pParse);
   if( !v ) return;
-  if( type!=TK_DEFERRED ){
+  if( type!=TK_DEFERRED && type!=TK_CONCURRENT ){
     for(i=0; i<db->nDb; i++){
       sqlite3VdbeAddOp2(v, OP_Transaction, i, (type==TK_EXCLUSIVE)+1);
       sqlite3VdbeUsesBtree(v, i);
     }
   }
-  sqlite3VdbeAddOp2(v, OP_AutoCommit, 0, 0);
+  sqlite3VdbeAddOp3(v, OP_AutoCommit, 0, 0, type==TK_CONCURRENT);
 }
 
 /*
@@ -426,6 +426,9 @@ void sqlite3SchemaFree(void *p){
   }
   sqlite3HashClear(&temp1);
   sqlite3HashClear(&pSchema->fkeyHash);
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  sqlite3ProcCatalogClear(pSchema);
+#endif
   pSchema->pSeqTab = 0;
   pSchema->flags &= ~DB_SchemaLoaded;
 }
@@ -448,6 +451,9 @@ Schema *sqlite3SchemaGet(sqlite3 *db, Btree *pBt){
     sqlite3HashInit(&p->idxHash);
     sqlite3HashInit(&p->trigHash);
     sqlite3HashInit(&p->fkeyHash);
+#ifdef SQLITE_ENABLE_STOREDPROCS
+    sqlite3HashInit(&p->procHash);
+#endif
     p->enc = SQLITE_UTF8;
   }
   return p;
@@ -547,6 +547,10 @@ void sqlite3ExprAssignVarNumber(Parse *pParse, Expr *pExpr){
   z = pExpr->u.zToken;
   assert( z!=0 );
   assert( z[0]!=0 );
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  /* A parameter of the stored procedure whose body is being parsed */
+  if( sqlite3ProcArgToRegister(pParse, pExpr) ) return;
+#endif
   if( z[1]==0 ){
     /* Wildcard of the form "?".  Assign the next variable number */
     assert( z[0]=='?' );
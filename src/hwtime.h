@@ -47,9 +47,9 @@
 #elif (defined(__GNUC__) && defined(__x86_64__))
 
   __inline__ sqlite_uint64 sqlite3Hwtime(void){
-      unsigned long val;
-      __asm__ __volatile__ ("rdtsc" : "=A" (val));
-      return val;
+      unsigned int lo, hi;
+      __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+      return (sqlite_uint64)hi << 32 | lo;
   }
  
 #elif (defined(__GNUC__) && defined(__ppc__))
@@ -687,6 +687,7 @@ int sqlite3_close(sqlite3 *db){
 
   for(j=0; j<db->nDb; j++){
     struct Db *pDb = &db->aDb[j];
+    sqlite3CkptThreadStop(pDb);
     if( pDb->pBt ){
       sqlite3BtreeClose(pDb->pBt);
       pDb->pBt = 0;
@@ -797,6 +798,7 @@ void sqlite3RollbackAll(sqlite3 *db){
 
   /* Any deferred constraint violations have now been resolved. */
   db->nDeferredCons = 0;
+  db->bConcurrent = 0;
 
   /* If one has been configured, invoke the rollback-hook callback */
   if( db->xRollbackCallback && (inTrans || !db->autoCommit) ){
@@ -1282,7 +1284,8 @@ void *sqlite3_rollback_hook(
 ** The sqlite3_wal_hook() callback registered by sqlite3_wal_autocheckpoint().
 ** Invoke sqlite3_wal_checkpoint if the number of frames in the log file
 ** is greater than sqlite3.pWalArg cast to an integer (the value configured by
-** wal_autocheckpoint()).
+** wal_autocheckpoint()).  If a background checkpointer is running for the
+** database and is able to run the checkpoint, wake it up instead.
 */ 
 int sqlite3WalDefaultHook(
   void *pClientData,     /* Argument */
@@ -1291,9 +1294,12 @@ int sqlite3WalDefaultHook(
   int nFrame             /* Size of WAL */
 ){
   if( nFrame>=SQLITE_PTR_TO_INT(pClientData) ){
-    sqlite3BeginBenignMalloc();
-    sqlite3_wal_checkpoint(db, zDb);
-    sqlite3EndBenignMalloc();
+    int iDb = sqlite3FindDbName(db, zDb);
+    if( iDb<0 || sqlite3CkptThreadWake(&db->aDb[iDb])==0 ){
+      sqlite3BeginBenignMalloc();
+      sqlite3_wal_checkpoint(db, zDb);
+      sqlite3EndBenignMalloc();
+    }
   }
   return SQLITE_OK;
 }
@@ -1376,6 +1382,46 @@ int sqlite3_wal_checkpoint(sqlite3 *db, const char *zDb){
 #endif
 }
 
+/*
+** Run one step of an incremental checkpoint of database zDb, copying at
+** most nPage pages and for no longer than about nMs milliseconds.  See
+** the documentation of sqlite3_wal_checkpoint_step() for details.
+*/
+int sqlite3_wal_checkpoint_step(
+  sqlite3 *db,                    /* Database connection */
+  const char *zDb,                /* Name of attached database (or NULL) */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs,                        /* Max time to spend in ms, or 0 */
+  int *pnLog,                     /* OUT: Frames in WAL */
+  int *pnCkpt                     /* OUT: Frames checkpointed */
+){
+#ifdef SQLITE_OMIT_WAL
+  if( pnLog ) *pnLog = 0;
+  if( pnCkpt ) *pnCkpt = 0;
+  return SQLITE_OK;
+#else
+  int rc;                         /* Return code */
+  int iDb = 0;                    /* sqlite3.aDb[] index of db to checkpoint */
+
+  if( pnLog ) *pnLog = 0;
+  if( pnCkpt ) *pnCkpt = 0;
+  sqlite3_mutex_enter(db->mutex);
+  if( zDb && zDb[0] ){
+    iDb = sqlite3FindDbName(db, zDb);
+  }
+  if( iDb<0 ){
+    rc = SQLITE_ERROR;
+    sqlite3Error(db, SQLITE_ERROR, "unknown database: %s", zDb);
+  }else{
+    rc = sqlite3BtreeCheckpoint(db->aDb[iDb].pBt, nPage, nMs, pnLog, pnCkpt);
+    sqlite3Error(db, rc, 0);
+  }
+  rc = sqlite3ApiExit(db, rc);
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+#endif
+}
+
 #ifndef SQLITE_OMIT_WAL
 /*
 ** Run a checkpoint on database iDb. This is a no-op if database iDb is
@@ -1402,7 +1448,7 @@ int sqlite3Checkpoint(sqlite3 *db, int iDb){
 
   for(i=0; i<db->nDb && rc==SQLITE_OK; i++){
     if( i==iDb || iDb==SQLITE_MAX_ATTACHED ){
-      rc = sqlite3BtreeCheckpoint(db->aDb[i].pBt);
+      rc = sqlite3BtreeCheckpoint(db->aDb[i].pBt, 0, 0, 0, 0);
     }
   }
 
@@ -1826,6 +1872,9 @@ static int openDatabase(
 #ifdef SQLITE_ENABLE_LOAD_EXTENSION
                  | SQLITE_LoadExtension
 #endif
+#ifdef SQLITE_ENABLE_STOREDPROCS
+                 | SQLITE_StreamProcs
+#endif
 #if SQLITE_DEFAULT_RECURSIVE_TRIGGERS
                  | SQLITE_RecTriggers
 #endif
@@ -2371,7 +2420,14 @@ int sqlite3_file_control(sqlite3 *db, const char *zDbName, int op, void *pArg){
       assert( pPager!=0 );
       fd = sqlite3PagerFile(pPager);
       assert( fd!=0 );
-      if( fd->pMethods ){
+      if( op==SQLITE_FCNTL_RESERVE_BYTES ){
+        int iNew = *(int*)pArg;
+        *(int*)pArg = sqlite3BtreeGetRequestedReserve(pBtree);
+        if( iNew>=0 && iNew<=255 ){
+          sqlite3BtreeSetPageSize(pBtree, 0, iNew, 0);
+        }
+        rc = SQLITE_OK;
+      }else if( fd->pMethods ){
         rc = sqlite3OsFileControl(fd, op, pArg);
       }
       sqlite3BtreeLeave(pBtree);
@@ -119,6 +119,96 @@ int sqlite3OsShmMap(
   return id->pMethods->xShmMap(id, iPage, pgsz, bExtend, pp);
 }
 
+/*
+** The xFetch and xUnfetch methods are only present in version 3 and
+** later of sqlite3_io_methods.  For older VFSes, sqlite3OsFetch() always
+** reports that no mapping is available so that the caller falls back
+** to an ordinary read.
+*/
+int sqlite3OsFetch(sqlite3_file *id, i64 iOff, int iAmt, void **pp){
+  if( id->pMethods->iVersion<3 || id->pMethods->xFetch==0 ){
+    *pp = 0;
+    return SQLITE_OK;
+  }
+  return id->pMethods->xFetch(id, iOff, iAmt, pp);
+}
+int sqlite3OsUnfetch(sqlite3_file *id, i64 iOff, void *p){
+  if( id->pMethods->iVersion<3 || id->pMethods->xUnfetch==0 ){
+    return SQLITE_OK;
+  }
+  return id->pMethods->xUnfetch(id, iOff, p);
+}
+
+/*
+** Write nBuf buffers of iAmt bytes each to consecutive locations in the
+** file, starting at offset iOff.  The xWritev method is only present in
+** version 4 and later of sqlite3_io_methods.  For older VFSes, each buffer
+** is written separately using xWrite.
+*/
+int sqlite3OsWritev(
+  sqlite3_file *id,
+  const void **apBuf,
+  int nBuf,
+  int iAmt,
+  i64 iOff
+){
+  int rc = SQLITE_OK;
+  int i;
+  DO_OS_MALLOC_TEST(id);
+  if( id->pMethods->iVersion>=4 && id->pMethods->xWritev ){
+    return id->pMethods->xWritev(id, apBuf, nBuf, iAmt, iOff);
+  }
+  for(i=0; rc==SQLITE_OK && i<nBuf; i++){
+    rc = id->pMethods->xWrite(id, apBuf[i], iAmt, iOff + i*(i64)iAmt);
+  }
+  return rc;
+}
+
+/*
+** DO_OS_MALLOC_TEST() returns from the function it is used in.  This
+** wrapper lets sqlite3OsSubmit() also set the rc of each request.
+*/
+static int osSubmitMallocTest(sqlite3_file *id){
+  DO_OS_MALLOC_TEST(id);
+  return SQLITE_OK;
+}
+
+/*
+** Perform the nReq I/O requests in aReq[].  The xSubmit method is only
+** present in version 5 and later of sqlite3_io_methods.  For older VFSes,
+** the requests are performed one at a time, in order.  Either way, the
+** return value is SQLITE_OK if all requests succeeded, or the rc of the
+** first that failed.
+*/
+int sqlite3OsSubmit(sqlite3_file *id, sqlite3_io_request *aReq, int nReq){
+  int rc = osSubmitMallocTest(id);
+  int i;
+  if( rc!=SQLITE_OK ){
+    for(i=0; i<nReq; i++) aReq[i].rc = rc;
+    return rc;
+  }
+  if( id->pMethods->iVersion>=5 && id->pMethods->xSubmit ){
+    return id->pMethods->xSubmit(id, aReq, nReq);
+  }
+  for(i=0; i<nReq; i++){
+    sqlite3_io_request *p = &aReq[i];
+    switch( p->op ){
+      case SQLITE_IOREQ_READ:
+        p->rc = id->pMethods->xRead(id, p->pBuf, p->iAmt, p->iOfst);
+        break;
+      case SQLITE_IOREQ_WRITE:
+        p->rc = id->pMethods->xWrite(id, p->pBuf, p->iAmt, p->iOfst);
+        break;
+      default:
+        assert( p->op==SQLITE_IOREQ_SYNC );
+        p->rc = id->pMethods->xSync(id, p->iAmt);
+        break;
+    }
+    if( rc==SQLITE_OK ) rc = p->rc;
+  }
+  return rc;
+}
+
 /*
 ** The next group of routines are convenience wrappers around the
 ** VFS methods.
@@ -120,6 +120,7 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #if SQLITE_ENABLE_LOCKING_STYLE
 # include <sys/ioctl.h>
@@ -136,6 +137,27 @@
 # include <sys/mount.h>
 #endif
 
+/*
+** The xSubmit method uses io_uring on Linux systems whose headers define
+** it.  Compile with SQLITE_OMIT_IO_URING to use only the thread-pool and
+** sequential engines.  See the "Batched I/O" division below.
+*/
+#if !defined(HAVE_IO_URING) && defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define HAVE_IO_URING 1
+# endif
+#endif
+#if defined(HAVE_IO_URING) && defined(SQLITE_OMIT_IO_URING)
+# undef HAVE_IO_URING
+#endif
+#if defined(HAVE_IO_URING) && HAVE_IO_URING
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#else
+# undef HAVE_IO_URING
+# define HAVE_IO_URING 0
+#endif
+
 /*
 ** Allowed values of unixFile.fsFlags
 */
@@ -175,11 +197,18 @@
 */
 #define IS_LOCK_ERROR(x)  ((x != SQLITE_OK) && (x != SQLITE_BUSY))
 
+/*
+** Number of shared-memory locks supported by unixShmLock(), including
+** those at or above SQLITE_SHM_NLOCK (see SQLITE_FCNTL_SHM_NLOCK).
+*/
+#define UNIX_SHM_NLOCK 24
+
 /* Forward references */
 typedef struct unixShm unixShm;               /* Connection shared memory */
 typedef struct unixShmNode unixShmNode;       /* Shared memory instance */
 typedef struct unixInodeInfo unixInodeInfo;   /* An i-node */
 typedef struct UnixUnusedFd UnixUnusedFd;     /* An unused file descriptor */
+typedef struct UnixRing UnixRing;             /* An io_uring instance */
 
 /*
 ** Sometimes, after a file handle is closed by SQLite, the file descriptor
@@ -211,6 +240,17 @@ struct unixFile {
   const char *zPath;                  /* Name of the file */
   unixShm *pShm;                      /* Shared memory segment information */
   int szChunk;                        /* Configured by FCNTL_CHUNK_SIZE */
+  sqlite3_int64 szAlloc;              /* Size known to be allocated, or 0 */
+#if HAVE_IO_URING
+  UnixRing *pRing;                    /* io_uring used by xSubmit, or NULL */
+#endif
+#if SQLITE_MAX_MMAP_SIZE>0
+  int nFetchOut;                      /* Number of outstanding xFetch refs */
+  sqlite3_int64 mmapSize;             /* Usable size of mapping at pMapRegion */
+  sqlite3_int64 mmapSizeActual;       /* Actual size of mapping at pMapRegion */
+  sqlite3_int64 mmapSizeMax;          /* Configured FCNTL_MMAP_SIZE value */
+  void *pMapRegion;                   /* Memory mapped region */
+#endif
 #if SQLITE_ENABLE_LOCKING_STYLE
   int openFlags;                      /* The flags specified at open() */
 #endif
@@ -245,6 +285,7 @@ struct unixFile {
 ** The following macros define bits in unixFile.fileFlags
 */
 #define SQLITE_WHOLE_FILE_LOCKING  0x0001   /* Use whole-file locking */
+#define UNIXFILE_DIRECT            0x0002   /* File is open with O_DIRECT */
 
 /*
 ** Include code that is common to all os_*.c files
@@ -268,6 +309,16 @@ struct unixFile {
 # define O_BINARY 0
 #endif
 
+/*
+** The "unix-direct" VFS is available if SQLite is compiled with
+** SQLITE_ENABLE_DIRECT_IO on a system that supports O_DIRECT.
+*/
+#if defined(SQLITE_ENABLE_DIRECT_IO) && defined(O_DIRECT)
+# define UNIX_DIRECT_IO 1
+#else
+# define UNIX_DIRECT_IO 0
+#endif
+
 /*
 ** The DJGPP compiler environment looks mostly like Unix, but it
 ** lacks the fcntl() system call.  So redefine fcntl() to be something
@@ -1401,9 +1452,21 @@ static int unixUnlock(sqlite3_file *id, int eFileLock){
 ** even on VxWorks.  A mutex will be acquired on VxWorks by the
 ** vxworksReleaseFileId() routine.
 */
+#if SQLITE_MAX_MMAP_SIZE>0
+static void unixUnmapfile(unixFile *pFd);
+#endif
+#if HAVE_IO_URING
+static void unixRingClose(unixFile *pFd);
+#endif
 static int closeUnixFile(sqlite3_file *id){
   unixFile *pFile = (unixFile*)id;
   if( pFile ){
+#if SQLITE_MAX_MMAP_SIZE>0
+    unixUnmapfile(pFile);
+#endif
+#if HAVE_IO_URING
+    unixRingClose(pFile);
+#endif
     if( pFile->dirfd>=0 ){
       int err = close(pFile->dirfd);
       if( err ){
@@ -1452,6 +1515,13 @@ static int unixClose(sqlite3_file *id){
       ** descriptor to pInode->pUnused list.  It will be automatically closed 
       ** when the last lock is cleared.
       */
+#if UNIX_DIRECT_IO
+      /* The descriptor may be reused by a connection that does not expect
+      ** O_DIRECT. See findReusableFd().  */
+      if( pFile->fileFlags & UNIXFILE_DIRECT ){
+        fcntl(pFile->h, F_SETFL, fcntl(pFile->h, F_GETFL) & ~O_DIRECT);
+      }
+#endif
       setPendingFd(pFile);
     }
     releaseInodeInfo(pFile);
@@ -2601,10 +2671,30 @@ static int nfsUnlock(sqlite3_file *id, int eFileLock){
 ** To avoid stomping the errno value on a failed read the lastErrno value
 ** is set before returning.
 */
+#if UNIX_DIRECT_IO
+/*
+** True if a transfer of nByte bytes between buffer pBuf and file offset
+** iOff meets the alignment requirements of O_DIRECT.
+*/
+#define unixDirectAligned(iOff, pBuf, nByte)                       \
+  ((((iOff) | (i64)(nByte) | SQLITE_PTR_TO_INT(pBuf))              \
+      & (SQLITE_DIRECT_IO_ALIGN-1))==0)
+
+static int unixDirectRead(unixFile*, i64, void*, int);
+static int unixDirectWrite(unixFile*, i64, const void*, int);
+#endif
+
 static int seekAndRead(unixFile *id, sqlite3_int64 offset, void *pBuf, int cnt){
   int got;
 #if (!defined(USE_PREAD) && !defined(USE_PREAD64))
   i64 newOffset;
+#endif
+#if UNIX_DIRECT_IO
+  if( (id->fileFlags & UNIXFILE_DIRECT) 
+   && !unixDirectAligned(offset, pBuf, cnt) 
+  ){
+    return unixDirectRead(id, offset, pBuf, cnt);
+  }
 #endif
   TIMER_START;
 #if defined(USE_PREAD)
@@ -2658,12 +2748,30 @@ static int unixRead(
   );
 #endif
 
+#if SQLITE_MAX_MMAP_SIZE>0
+  /* Deal with as much of this read request as possible by copying the
+  ** data out of the memory mapping, if there is one.  */
+  if( offset<pFile->mmapSize ){
+    if( offset+amt<=pFile->mmapSize ){
+      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], amt);
+      return SQLITE_OK;
+    }else{
+      int nCopy = (int)(pFile->mmapSize - offset);
+      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], nCopy);
+      pBuf = &((u8 *)pBuf)[nCopy];
+      amt -= nCopy;
+      offset += nCopy;
+    }
+  }
+#endif
+
   got = seekAndRead(pFile, offset, pBuf, amt);
   if( got==amt ){
     return SQLITE_OK;
   }else if( got<0 ){
-    /* lastErrno set by seekAndRead */
-    return SQLITE_IOERR_READ;
+    /* lastErrno set by seekAndRead. It is ENOMEM if an O_DIRECT bounce
+    ** buffer could not be allocated. */
+    return pFile->lastErrno==ENOMEM ? SQLITE_IOERR_NOMEM : SQLITE_IOERR_READ;
   }else{
     pFile->lastErrno = 0; /* not a system error */
     /* Unread parts of the buffer must be zero-filled */
@@ -2683,6 +2791,13 @@ static int seekAndWrite(unixFile *id, i64 offset, const void *pBuf, int cnt){
   int got;
 #if (!defined(USE_PREAD) && !defined(USE_PREAD64))
   i64 newOffset;
+#endif
+#if UNIX_DIRECT_IO
+  if( (id->fileFlags & UNIXFILE_DIRECT) 
+   && !unixDirectAligned(offset, pBuf, cnt) 
+  ){
+    return unixDirectWrite(id, offset, pBuf, cnt);
+  }
 #endif
   TIMER_START;
 #if defined(USE_PREAD)
@@ -2710,6 +2825,105 @@ static int seekAndWrite(unixFile *id, i64 offset, const void *pBuf, int cnt){
   return got;
 }
 
+#if UNIX_DIRECT_IO
+/*
+** The following two functions are used by seekAndRead() and seekAndWrite()
+** for transfers to or from a file open with O_DIRECT that do not meet its
+** alignment requirements.  Examples are reads of the 100 byte database
+** header, and pages smaller than SQLITE_DIRECT_IO_ALIGN.  The transfer is
+** made through a temporary aligned buffer that covers all the blocks the
+** caller's range touches.  Both functions return the number of bytes
+** transferred, or -1 if an error occurs.
+**
+** unixDirectBuffer() allocates the temporary buffer.  *ppFree is set to
+** the pointer to pass to sqlite3_free() afterwards.
+*/
+static char *unixDirectBuffer(unixFile *id, int nByte, char **ppFree){
+  const int mask = SQLITE_DIRECT_IO_ALIGN-1;
+  char *p = (char *)sqlite3_malloc(nByte + SQLITE_DIRECT_IO_ALIGN);
+  *ppFree = p;
+  if( p==0 ){
+    id->lastErrno = ENOMEM;
+    return 0;
+  }
+  return &p[(SQLITE_DIRECT_IO_ALIGN - (SQLITE_PTR_TO_INT(p) & mask)) & mask];
+}
+static int unixDirectRead(unixFile *id, i64 offset, void *pBuf, int cnt){
+  const i64 mask = SQLITE_DIRECT_IO_ALIGN-1;
+  i64 iStart = offset & ~mask;            /* Offset of first block */
+  int nByte = (int)(((offset+cnt+mask) & ~mask) - iStart);
+  int iSkip = (int)(offset - iStart);     /* Bytes of aBuf before pBuf data */
+  char *pFree;                            /* Allocation to free */
+  char *aBuf;                             /* Aligned buffer */
+  int got;
+
+  aBuf = unixDirectBuffer(id, nByte, &pFree);
+  if( aBuf==0 ) return -1;
+  got = seekAndRead(id, iStart, aBuf, nByte);
+  if( got>=0 ){
+    got -= iSkip;
+    if( got<0 ) got = 0;
+    if( got>cnt ) got = cnt;
+    memcpy(pBuf, &aBuf[iSkip], got);
+  }
+  sqlite3_free(pFree);
+  return got;
+}
+static int unixDirectWrite(unixFile *id, i64 offset, const void *pBuf, int cnt){
+  const i64 mask = SQLITE_DIRECT_IO_ALIGN-1;
+  i64 iStart = offset & ~mask;            /* Offset of first block */
+  int nByte = (int)(((offset+cnt+mask) & ~mask) - iStart);
+  int iSkip = (int)(offset - iStart);     /* Bytes of aBuf before pBuf data */
+  char *pFree;                            /* Allocation to free */
+  char *aBuf;                             /* Aligned buffer */
+  int got;                                /* Bytes of existing data read */
+  int wrote;                              /* Bytes written */
+
+  aBuf = unixDirectBuffer(id, nByte, &pFree);
+  if( aBuf==0 ) return -1;
+
+  /* Read the existing content of the blocks, merge in the new data and
+  ** write the blocks back.  If the file ended within the last block, it
+  ** is truncated afterwards so that its size is the same as it would have
+  ** been had the write been made without O_DIRECT.  */
+  got = seekAndRead(id, iStart, aBuf, nByte);
+  if( got<0 ){
+    sqlite3_free(pFree);
+    return -1;
+  }
+  memset(&aBuf[got], 0, nByte-got);
+  memcpy(&aBuf[iSkip], pBuf, cnt);
+  wrote = seekAndWrite(id, iStart, aBuf, nByte);
+  sqlite3_free(pFree);
+  if( wrote!=nByte ){
+    return wrote<0 ? -1 : 0;
+  }
+  if( got<nByte ){
+    i64 iEnd = iStart + (got>iSkip+cnt ? got : iSkip+cnt);
+    if( ftruncate(id->h, iEnd) ){
+      id->lastErrno = errno;
+      return -1;
+    }
+  }
+  return cnt;
+}
+#endif /* UNIX_DIRECT_IO */
+
+static int fcntlSizeHint(unixFile *pFile, i64 nByte);
+
+/*
+** If the user has configured a chunk-size for file pFile and a write that
+** ends at offset iEnd would extend it beyond the space already allocated,
+** grow the file by a whole number of chunks first.  Growing the file in
+** large steps keeps it contiguous on disk and saves a metadata update on
+** most commits.  Errors are ignored here.  If the disk really is full, the
+** write itself fails.
+*/
+static void unixGrowForWrite(unixFile *pFile, i64 iEnd){
+  if( pFile->szChunk>0 && iEnd>pFile->szAlloc ){
+    fcntlSizeHint(pFile, iEnd);
+  }
+}
 
 /*
 ** Write data from a buffer into a file.  Return SQLITE_OK on success
@@ -2757,6 +2971,7 @@ static int unixWrite(
   }
 #endif
 
+  unixGrowForWrite(pFile, offset+amt);
   while( amt>0 && (wrote = seekAndWrite(pFile, offset, pBuf, amt))>0 ){
     amt -= wrote;
     offset += wrote;
@@ -2768,6 +2983,7 @@ static int unixWrite(
   if( amt>0 ){
     if( wrote<0 ){
       /* lastErrno set by seekAndWrite */
+      if( pFile->lastErrno==ENOMEM ) return SQLITE_IOERR_NOMEM;
       return SQLITE_IOERR_WRITE;
     }else{
       pFile->lastErrno = 0; /* not a system error */
@@ -2778,6 +2994,144 @@ static int unixWrite(
   return SQLITE_OK;
 }
 
+/*
+** Use pwritev() for vectored writes where it is known to be available.
+** Otherwise lseek() and writev() are used.
+*/
+#if !defined(HAVE_PWRITEV) && defined(__GLIBC__)
+# if __GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=10)
+#  define HAVE_PWRITEV 1
+# endif
+#endif
+
+/*
+** The maximum number of buffers written by a single call to writev()
+** or pwritev().
+*/
+#define UNIX_MAX_IOV 64
+
+/*
+** Seek to the offset passed as the second argument, then write the nIov
+** buffers described by aIov[].  Return the number of bytes actually
+** written, or -1 on error (in which case id->lastErrno is set).
+*/
+static int seekAndWritev(unixFile *id, i64 offset, struct iovec *aIov, int nIov){
+  int got;
+#if !defined(HAVE_PWRITEV)
+  i64 newOffset;
+#endif
+  TIMER_START;
+#if defined(HAVE_PWRITEV)
+  got = (int)pwritev(id->h, aIov, nIov, offset);
+#else
+  newOffset = lseek(id->h, offset, SEEK_SET);
+  if( newOffset!=offset ){
+    if( newOffset == -1 ){
+      id->lastErrno = errno;
+    }else{
+      id->lastErrno = 0;
+    }
+    return -1;
+  }
+  got = (int)writev(id->h, aIov, nIov);
+#endif
+  TIMER_END;
+  if( got<0 ){
+    id->lastErrno = errno;
+  }
+
+  OSTRACE(("WRITEV  %-3d %5d %7lld %llu\n", id->h, got, offset, TIMER_ELAPSED));
+  return got;
+}
+
+/*
+** Write nBuf buffers of amt bytes each to consecutive locations in the
+** file, starting at the given offset.  Up to UNIX_MAX_IOV buffers are
+** written by each system call.  If a system call writes less than it
+** was asked to, the rest of the buffer it stopped in is written using
+** unixWrite() before continuing.
+*/
+static int unixWritev(
+  sqlite3_file *id,
+  const void **apBuf,
+  int nBuf,
+  int amt,
+  sqlite3_int64 offset
+){
+  unixFile *pFile = (unixFile*)id;
+  struct iovec aIov[UNIX_MAX_IOV];
+  assert( id );
+  assert( nBuf>0 && amt>0 );
+
+  unixGrowForWrite(pFile, offset + nBuf*(i64)amt);
+
+#if UNIX_DIRECT_IO
+  /* O_DIRECT requires every buffer to be aligned. If any is not, write
+  ** the buffers one at a time so that seekAndWrite() can copy them.  */
+  if( pFile->fileFlags & UNIXFILE_DIRECT ){
+    int i;
+    for(i=0; i<nBuf && unixDirectAligned(offset, apBuf[i], amt); i++);
+    if( i<nBuf ){
+      for(i=0; i<nBuf; i++){
+        int rc = unixWrite(id, apBuf[i], amt, offset + i*(i64)amt);
+        if( rc!=SQLITE_OK ) return rc;
+      }
+      return SQLITE_OK;
+    }
+  }
+#endif
+
+#ifndef NDEBUG
+  /* Let unixWrite() record any change to the transaction counter. */
+  if( pFile->inNormalWrite ){
+    pFile->dbUpdate = 1;
+    if( offset<=24 ){
+      int rc = unixWrite(id, apBuf[0], amt, offset);
+      if( rc!=SQLITE_OK ) return rc;
+      apBuf++;
+      nBuf--;
+      offset += amt;
+    }
+  }
+#endif
+
+  while( nBuf>0 ){
+    int nIov = nBuf<UNIX_MAX_IOV ? nBuf : UNIX_MAX_IOV;
+    int nDone;                    /* Number of buffers completely written */
+    int wrote;
+    int i;
+
+    for(i=0; i<nIov; i++){
+      aIov[i].iov_base = (void *)apBuf[i];
+      aIov[i].iov_len = amt;
+    }
+    wrote = seekAndWritev(pFile, offset, aIov, nIov);
+    SimulateIOError(( wrote=(-1) ));
+    SimulateDiskfullError(( wrote=0 ));
+    if( wrote<=0 ){
+      if( wrote<0 ){
+        /* lastErrno set by seekAndWritev */
+        return SQLITE_IOERR_WRITE;
+      }
+      pFile->lastErrno = 0; /* not a system error */
+      return SQLITE_FULL;
+    }
+
+    nDone = wrote/amt;
+    if( wrote%amt ){
+      int rc = unixWrite(id, &((const char *)apBuf[nDone])[wrote%amt],
+                         amt - wrote%amt, offset + wrote);
+      if( rc!=SQLITE_OK ) return rc;
+      nDone++;
+    }
+    apBuf += nDone;
+    nBuf -= nDone;
+    offset += nDone*(i64)amt;
+  }
+
+  return SQLITE_OK;
+}
+
 #ifdef SQLITE_TEST
 /*
 ** Count the number of fullsyncs and normal syncs.  This is used to test
@@ -2995,6 +3349,7 @@ static int unixTruncate(sqlite3_file *id, i64 nByte){
     pFile->lastErrno = errno;
     return SQLITE_IOERR_TRUNCATE;
   }else{
+    pFile->szAlloc = nByte;
 #ifndef NDEBUG
     /* If we are doing a normal write to a database file (as opposed to
     ** doing a hot-journal rollback or a write to some file other than a
@@ -3008,6 +3363,15 @@ static int unixTruncate(sqlite3_file *id, i64 nByte){
     }
 #endif
 
+#if SQLITE_MAX_MMAP_SIZE>0
+    /* If the file was just truncated to a size smaller than the currently
+    ** mapped region, reduce the effective mapping size as well.  Accessing
+    ** the part of the mapping beyond the end of the file would fault. */
+    if( nByte<pFile->mmapSize ){
+      pFile->mmapSize = nByte;
+    }
+#endif
+
     return SQLITE_OK;
   }
 }
@@ -3047,6 +3411,14 @@ static int unixFileSize(sqlite3_file *id, i64 *pSize){
 static int proxyFileControl(sqlite3_file*,int,void*);
 #endif
 
+/*
+** posix_fallocate() is available in all versions of glibc. On Linux it
+** uses the fallocate() system call where the file-system supports it.
+*/
+#if !defined(HAVE_POSIX_FALLOCATE) && defined(__GLIBC__)
+# define HAVE_POSIX_FALLOCATE 1
+#endif
+
 /* 
 ** This function is called to handle the SQLITE_FCNTL_SIZE_HINT 
 ** file-control operation.
@@ -3054,6 +3426,10 @@ static int proxyFileControl(sqlite3_file*,int,void*);
 ** If the user has configured a chunk-size for this file, it could be
 ** that the file needs to be extended at this point. Otherwise, the
 ** SQLITE_FCNTL_SIZE_HINT operation is a no-op for Unix.
+**
+** On success, unixFile.szAlloc is set to the size of the file, so that
+** unixWrite() need not call this function again until a write extends
+** the file beyond that point.
 */
 static int fcntlSizeHint(unixFile *pFile, i64 nByte){
   if( pFile->szChunk ){
@@ -3065,7 +3441,9 @@ static int fcntlSizeHint(unixFile *pFile, i64 nByte){
     nSize = ((nByte+pFile->szChunk-1) / pFile->szChunk) * pFile->szChunk;
     if( nSize>(i64)buf.st_size ){
 #if defined(HAVE_POSIX_FALLOCATE) && HAVE_POSIX_FALLOCATE
-      if( posix_fallocate(pFile->h, buf.st_size, nSize-buf.st_size) ){
+      int err = posix_fallocate(pFile->h, buf.st_size, nSize-buf.st_size);
+      if( err ){
+        pFile->lastErrno = err;
         return SQLITE_IOERR_WRITE;
       }
 #else
@@ -3090,9 +3468,180 @@ static int fcntlSizeHint(unixFile *pFile, i64 nByte){
       } while( nWrite==1 && iWrite<nSize );
       if( nWrite!=1 ) return SQLITE_IOERR_WRITE;
 #endif
+      pFile->szAlloc = nSize;
+    }else{
+      pFile->szAlloc = buf.st_size;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+#if SQLITE_MAX_MMAP_SIZE>0
+/*
+** If it is currently memory mapped, unmap file pFd.
+*/
+static void unixUnmapfile(unixFile *pFd){
+  assert( pFd->nFetchOut==0 );
+  if( pFd->pMapRegion ){
+    munmap(pFd->pMapRegion, (size_t)pFd->mmapSizeActual);
+    pFd->pMapRegion = 0;
+    pFd->mmapSize = 0;
+    pFd->mmapSizeActual = 0;
+  }
+}
+
+/*
+** Memory map or remap the file opened by pFd.  The new mapping covers
+** the whole file, or the first unixFile.mmapSizeMax bytes of it,
+** whichever is smaller.  If there are outstanding xFetch() references
+** to the current mapping, it cannot be moved and this function is a
+** no-op.
+**
+** A failure of mmap() itself is not an error.  Memory-mapped I/O is
+** simply disabled for this file and reads fall back to pread().
+** SQLITE_OK is returned in that case, or an SQLite error code if
+** the size of the file cannot be determined.
+*/
+static int unixMapfile(unixFile *pFd){
+  struct stat statbuf;            /* Low-level file information */
+  i64 nMap;                       /* Size of new mapping in bytes */
+
+  if( pFd->nFetchOut>0 ) return SQLITE_OK;
+  if( fstat(pFd->h, &statbuf) ){
+    pFd->lastErrno = errno;
+    return SQLITE_IOERR_FSTAT;
+  }
+  nMap = statbuf.st_size;
+  if( nMap>pFd->mmapSizeMax ) nMap = pFd->mmapSizeMax;
+
+  if( nMap!=pFd->mmapSize ){
+    unixUnmapfile(pFd);
+    if( nMap>0 ){
+      void *pNew = mmap(0, (size_t)nMap, PROT_READ, MAP_SHARED, pFd->h, 0);
+      if( pNew==MAP_FAILED ){
+        OSTRACE(("MMAP    %-3d failed errno=%d\n", pFd->h, errno));
+        pFd->mmapSizeMax = 0;
+        return SQLITE_OK;
+      }
+      pFd->pMapRegion = pNew;
+      pFd->mmapSize = pFd->mmapSizeActual = nMap;
+    }
+    OSTRACE(("MMAP    %-3d %lld\n", pFd->h, nMap));
+  }
+  return SQLITE_OK;
+}
+
+/*
+** This function is called to handle the SQLITE_FCNTL_MMAP_SIZE
+** file-control operation.  A new limit is installed if *pLimit is
+** non-negative, and *pLimit is overwritten with the limit in effect.
+**
+** The limit cannot be changed while there are outstanding xFetch()
+** references, since that would require moving the mapping.
+*/
+static int fcntlMmapSize(unixFile *pFile, i64 *pLimit){
+  i64 newLimit = *pLimit;
+  int rc = SQLITE_OK;
+  if( newLimit>SQLITE_MAX_MMAP_SIZE ){
+    newLimit = SQLITE_MAX_MMAP_SIZE;
+  }
+  if( sizeof(void*)<8 && newLimit>0x7fff0000 ){
+    /* Leave some address space for everything else on 32-bit hosts */
+    newLimit = 0x7fff0000;
+  }
+  if( newLimit>=0 && newLimit!=pFile->mmapSizeMax && pFile->nFetchOut==0 ){
+    pFile->mmapSizeMax = newLimit;
+    if( pFile->pMapRegion ){
+      unixUnmapfile(pFile);
+      rc = unixMapfile(pFile);
+    }
+  }
+  *pLimit = pFile->mmapSizeMax;
+  return rc;
+}
+#else
+static int fcntlMmapSize(unixFile *pFile, i64 *pLimit){
+  UNUSED_PARAMETER(pFile);
+  *pLimit = 0;
+  return SQLITE_OK;
+}
+#endif /* SQLITE_MAX_MMAP_SIZE>0 */
+
+/*
+** This function is called to handle the SQLITE_FCNTL_READAHEAD
+** file-control operation.  Ask the kernel to start reading nByte bytes
+** of the file at offset iOff into the OS cache.  If that part of the
+** file is memory-mapped, madvise() is used so that the pages are also
+** mapped in.  Otherwise posix_fadvise() is used where available.
+*/
+static void fcntlReadahead(unixFile *pFile, i64 iOff, i64 nByte){
+#if SQLITE_MAX_MMAP_SIZE>0 && defined(MADV_WILLNEED)
+  if( iOff+nByte<=pFile->mmapSize ){
+    /* madvise() requires a page-aligned start address */
+    i64 iAlign = iOff & ~(i64)(sysconf(_SC_PAGESIZE)-1);
+    madvise(&((u8 *)pFile->pMapRegion)[iAlign],
+            (size_t)(nByte + iOff - iAlign), MADV_WILLNEED);
+    return;
+  }
+#endif
+#if defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(pFile->h, (off_t)iOff, (off_t)nByte, POSIX_FADV_WILLNEED);
+#else
+  UNUSED_PARAMETER(pFile);
+  UNUSED_PARAMETER2(iOff, nByte);
+#endif
+}
+
+/*
+** Return a pointer to iAmt bytes of the file starting at offset iOff
+** inside the memory mapping, or set *pp to NULL if that part of the
+** file is not (and cannot now be) mapped.  Every non-NULL pointer
+** returned must be released with unixUnfetch().
+**
+** If the request reaches past the end of the current mapping, try to
+** remap the file first.  The file may have grown since it was mapped.
+*/
+static int unixFetch(sqlite3_file *fd, i64 iOff, int iAmt, void **pp){
+  unixFile *pFd = (unixFile *)fd;
+  *pp = 0;
+#if SQLITE_MAX_MMAP_SIZE>0
+  if( pFd->mmapSizeMax>0 ){
+    if( pFd->mmapSize<iOff+iAmt ){
+      int rc = unixMapfile(pFd);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+    if( pFd->mmapSize>=iOff+iAmt ){
+      *pp = &((u8 *)pFd->pMapRegion)[iOff];
+      pFd->nFetchOut++;
     }
   }
+#else
+  UNUSED_PARAMETER2(pFd, iOff);
+  UNUSED_PARAMETER(iAmt);
+#endif
+  return SQLITE_OK;
+}
 
+/*
+** Release a reference obtained by unixFetch().  Or, if p is NULL, drop
+** the mapping altogether (which is only possible if there are no
+** outstanding references).
+*/
+static int unixUnfetch(sqlite3_file *fd, i64 iOff, void *p){
+  unixFile *pFd = (unixFile *)fd;
+  UNUSED_PARAMETER(iOff);
+#if SQLITE_MAX_MMAP_SIZE>0
+  if( p ){
+    assert( pFd->nFetchOut>0 );
+    assert( p==&((u8 *)pFd->pMapRegion)[iOff] );
+    pFd->nFetchOut--;
+  }else if( pFd->nFetchOut==0 ){
+    unixUnmapfile(pFd);
+  }
+#else
+  UNUSED_PARAMETER2(pFd, p);
+#endif
   return SQLITE_OK;
 }
 
@@ -3110,12 +3659,34 @@ static int unixFileControl(sqlite3_file *id, int op, void *pArg){
       return SQLITE_OK;
     }
     case SQLITE_FCNTL_CHUNK_SIZE: {
+      /* unixFile.szAlloc is left as is. It is never more than the size of
+      ** the file, so a write within the file does not extend it. */
       ((unixFile*)id)->szChunk = *(int *)pArg;
       return SQLITE_OK;
     }
     case SQLITE_FCNTL_SIZE_HINT: {
       return fcntlSizeHint((unixFile *)id, *(i64 *)pArg);
     }
+    case SQLITE_FCNTL_MMAP_SIZE: {
+      return fcntlMmapSize((unixFile *)id, (i64 *)pArg);
+    }
+    case SQLITE_FCNTL_READAHEAD: {
+      fcntlReadahead((unixFile *)id, ((i64 *)pArg)[0], ((i64 *)pArg)[1]);
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_SHM_NLOCK: {
+      *(int*)pArg = UNIX_SHM_NLOCK;
+      return SQLITE_OK;
+    }
+#if UNIX_DIRECT_IO
+    /* The pager calls this method to find out whether the database file
+    ** is open with O_DIRECT, in which case it aligns page buffers.
+    */
+    case SQLITE_FCNTL_DIRECT_IO: {
+      *(int *)pArg = (((unixFile *)id)->fileFlags & UNIXFILE_DIRECT)!=0;
+      return SQLITE_OK;
+    }
+#endif
 #ifndef NDEBUG
     /* The pager calls this method to signal that it has done
     ** a rollback and that the database is therefore unchanged and
@@ -3190,7 +3761,17 @@ static int unixDeviceCharacteristics(sqlite3_file *NotUsed){
 **
 ** Either unixShmNode.mutex must be held or unixShmNode.nRef==0 and
 ** unixMutexHeld() is true when reading or writing any other field
-** in this structure.
+** in this structure, except for aLock[].
+**
+** aLock[i] is the number of connections in this process that hold a
+** shared lock on lock i, or -1 if one of them holds an exclusive lock.
+** The process holds the corresponding system-level lock whenever
+** aLock[i] is non-zero.  Entries only change from zero, or to zero,
+** while the mutex is held.  If UNIX_SHM_LOCKFREE is defined, other
+** changes are made without the mutex using atomic operations, so that
+** a connection can join or leave a shared lock already held by another
+** connection in the same process without waiting for the mutex (see
+** unixShmLock()).  Otherwise they are made with the mutex held.
 */
 struct unixShmNode {
   unixInodeInfo *pInode;     /* unixInodeInfo that owns this SHM node */
@@ -3202,9 +3783,10 @@ struct unixShmNode {
   char **apRegion;           /* Array of mapped shared-memory regions */
   int nRef;                  /* Number of unixShm objects pointing to this */
   unixShm *pFirst;           /* All unixShm objects pointing to this */
+  int aLock[UNIX_SHM_NLOCK];  /* Locks held by connections in this process */
 #ifdef SQLITE_DEBUG
-  u8 exclMask;               /* Mask of exclusive locks held */
-  u8 sharedMask;             /* Mask of shared locks held */
+  u32 exclMask;              /* Mask of exclusive locks held */
+  u32 sharedMask;            /* Mask of shared locks held */
   u8 nextShmId;              /* Next available unixShm.id value */
 #endif
 };
@@ -3220,24 +3802,47 @@ struct unixShmNode {
 **    unixShm.id
 **
 ** All other fields are read/write.  The unixShm.pFile->mutex must be held
-** while accessing any read/write fields.
+** while accessing any read/write fields, except for sharedMask and
+** exclMask, which are only accessed by the connection that owns this
+** object.
 */
 struct unixShm {
   unixShmNode *pShmNode;     /* The underlying unixShmNode object */
   unixShm *pNext;            /* Next unixShm with the same unixShmNode */
   u8 hasMutex;               /* True if holding the unixShmNode mutex */
-  u16 sharedMask;            /* Mask of shared locks held */
-  u16 exclMask;              /* Mask of exclusive locks held */
+  u32 sharedMask;            /* Mask of shared locks held */
+  u32 exclMask;              /* Mask of exclusive locks held */
 #ifdef SQLITE_DEBUG
   u8 id;                     /* Id of this connection within its unixShmNode */
 #endif
 };
 
 /*
-** Constants used for locking
+** Constants used for locking.  The bytes of the locks at or above
+** SQLITE_SHM_NLOCK follow the dead-man switch.
 */
 #define UNIX_SHM_BASE   ((22+SQLITE_SHM_NLOCK)*4)         /* first lock byte */
 #define UNIX_SHM_DMS    (UNIX_SHM_BASE+SQLITE_SHM_NLOCK)  /* deadman switch */
+#define UNIX_SHM_LOCK(i) (UNIX_SHM_BASE+(i)+((i)>=SQLITE_SHM_NLOCK))
+
+/*
+** Operations on the unixShmNode.aLock[] counters.  With GCC in threadsafe
+** builds these are atomic, and unixShmLock() uses them to take and release
+** some locks without the unixShmNode mutex.  Otherwise they are plain
+** loads and stores, and are only used with the mutex held.
+*/
+#if defined(__GNUC__) && SQLITE_THREADSAFE>0
+# define UNIX_SHM_LOCKFREE 1
+# define shmLockGet(p)      __atomic_load_n((p), __ATOMIC_SEQ_CST)
+# define shmLockSet(p,v)    __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+# define shmLockAdd(p,d)    __atomic_add_fetch((p), (d), __ATOMIC_SEQ_CST)
+# define shmLockCas(p,pv,v) __atomic_compare_exchange_n((p), (pv), (v), 0, \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#else
+# define shmLockGet(p)      (*(p))
+# define shmLockSet(p,v)    (*(p) = (v))
+# define shmLockAdd(p,d)    (*(p) += (d))
+#endif
 
 /*
 ** Apply posix advisory locks for all bytes from ofst through ofst+n-1.
@@ -3261,7 +3866,7 @@ static int unixShmSystemLock(
   assert( n==1 || lockType!=F_RDLCK );
 
   /* Locks are within range */
-  assert( n>=1 && n<SQLITE_SHM_NLOCK );
+  assert( n>=1 && n<UNIX_SHM_NLOCK );
 
   /* Initialize the locking parameters */
   memset(&f, 0, sizeof(f));
@@ -3275,7 +3880,7 @@ static int unixShmSystemLock(
 
   /* Update the global lock state and do debug tracing */
 #ifdef SQLITE_DEBUG
-  { u16 mask;
+  { u32 mask;
   OSTRACE(("SHM-LOCK "));
   mask = (1<<(ofst+n)) - (1<<ofst);
   if( rc==SQLITE_OK ){
@@ -3587,6 +4192,22 @@ shmpage_out:
 ** different here than in posix.  In xShmLock(), one can go from unlocked
 ** to shared and back or from unlocked to exclusive and back.  But one may
 ** not go from shared to exclusive or from exclusive to shared.
+**
+** Which system-level locks the process needs is determined by the counts
+** of locks held by connections in this process in unixShmNode.aLock[].
+** If UNIX_SHM_LOCKFREE is defined, the following are done without the
+** unixShmNode mutex:
+**
+**   *  Taking a shared lock that another connection in this process
+**      already holds a shared lock on.  This is the common case for WAL
+**      readers, which share a read-mark whenever they use the same
+**      snapshot.
+**
+**   *  Releasing a shared lock that another connection in this process
+**      also holds.
+**
+**   *  Failing to take an exclusive lock because another connection in
+**      this process holds a lock in the range.
 */
 static int unixShmLock(
   sqlite3_file *fd,          /* Database file holding the shared memory */
@@ -3596,14 +4217,16 @@ static int unixShmLock(
 ){
   unixFile *pDbFd = (unixFile*)fd;      /* Connection holding shared memory */
   unixShm *p = pDbFd->pShm;             /* The shared memory being locked */
-  unixShm *pX;                          /* For looping over all siblings */
   unixShmNode *pShmNode = p->pShmNode;  /* The underlying file iNode */
+  int *aLock = pShmNode->aLock;         /* Locks held by this process */
   int rc = SQLITE_OK;                   /* Result code */
-  u16 mask;                             /* Mask of locks to take or release */
+  u32 mask;                             /* Mask of locks to take or release */
+  int i;                                /* Loop counter */
 
   assert( pShmNode==pDbFd->pInode->pShmNode );
   assert( pShmNode->pInode==pDbFd->pInode );
-  assert( ofst>=0 && ofst+n<=SQLITE_SHM_NLOCK );
+  assert( ofst>=0 && ofst+n<=UNIX_SHM_NLOCK );
+  assert( ofst>=SQLITE_SHM_NLOCK || ofst+n<=SQLITE_SHM_NLOCK );
   assert( n>=1 );
   assert( flags==(SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)
        || flags==(SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE)
@@ -3611,24 +4234,52 @@ static int unixShmLock(
        || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE) );
   assert( n==1 || (flags & SQLITE_SHM_EXCLUSIVE)!=0 );
 
-  mask = (1<<(ofst+n)) - (1<<ofst);
-  assert( n>1 || mask==(1<<ofst) );
-  sqlite3_mutex_enter(pShmNode->mutex);
-  if( flags & SQLITE_SHM_UNLOCK ){
-    u16 allMask = 0; /* Mask of locks held by siblings */
-
-    /* See if any siblings hold this same lock */
-    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
-      if( pX==p ) continue;
-      assert( (pX->exclMask & (p->exclMask|p->sharedMask))==0 );
-      allMask |= pX->sharedMask;
+  mask = ((u32)1<<(ofst+n)) - ((u32)1<<ofst);
+  assert( n>1 || mask==((u32)1<<ofst) );
+  assert( (flags & SQLITE_SHM_UNLOCK)==0 || (flags & SQLITE_SHM_SHARED)==0
+       || (p->sharedMask & mask)==mask );
+  assert( (flags & SQLITE_SHM_UNLOCK)==0 || (flags & SQLITE_SHM_SHARED)!=0
+       || (p->exclMask & mask)==mask );
+
+#ifdef UNIX_SHM_LOCKFREE
+  if( flags==(SQLITE_SHM_LOCK|SQLITE_SHM_SHARED) ){
+    int v = shmLockGet(&aLock[ofst]);
+    while( v>0 ){
+      if( shmLockCas(&aLock[ofst], &v, v+1) ){
+        p->sharedMask |= mask;
+        return SQLITE_OK;
+      }
+    }
+  }else if( flags==(SQLITE_SHM_UNLOCK|SQLITE_SHM_SHARED) ){
+    int v = shmLockGet(&aLock[ofst]);
+    while( v>1 ){
+      if( shmLockCas(&aLock[ofst], &v, v-1) ){
+        p->sharedMask &= ~mask;
+        return SQLITE_OK;
+      }
+    }
+  }else if( flags==(SQLITE_SHM_LOCK|SQLITE_SHM_EXCLUSIVE) ){
+    for(i=ofst; i<ofst+n; i++){
+      if( shmLockGet(&aLock[i])!=0 ) return SQLITE_BUSY;
     }
+  }
+#endif
 
-    /* Unlock the system-level locks */
-    if( (mask & allMask)==0 ){
-      rc = unixShmSystemLock(pShmNode, F_UNLCK, ofst+UNIX_SHM_BASE, n);
+  sqlite3_mutex_enter(pShmNode->mutex);
+  if( flags & SQLITE_SHM_UNLOCK ){
+    if( flags & SQLITE_SHM_SHARED ){
+      /* Release the system-level lock if this was the last connection in
+      ** the process holding it. */
+      assert( aLock[ofst]>0 );
+      if( shmLockAdd(&aLock[ofst], -1)==0 ){
+        rc = unixShmSystemLock(pShmNode, F_UNLCK, UNIX_SHM_LOCK(ofst), n);
+      }
     }else{
-      rc = SQLITE_OK;
+      rc = unixShmSystemLock(pShmNode, F_UNLCK, UNIX_SHM_LOCK(ofst), n);
+      for(i=ofst; i<ofst+n; i++){
+        assert( aLock[i]==-1 );
+        shmLockSet(&aLock[i], 0);
+      }
     }
 
     /* Undo the local locks */
@@ -3637,39 +4288,28 @@ static int unixShmLock(
       p->sharedMask &= ~mask;
     } 
   }else if( flags & SQLITE_SHM_SHARED ){
-    u16 allShared = 0;  /* Union of locks held by connections other than "p" */
-
-    /* Find out which shared locks are already held by sibling connections.
-    ** If any sibling already holds an exclusive lock, go ahead and return
-    ** SQLITE_BUSY.
+    /* If another connection in this process holds an exclusive lock, go
+    ** ahead and return SQLITE_BUSY.  Otherwise get a shared lock at the
+    ** system level if this process does not already hold one.
     */
-    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
-      if( (pX->exclMask & mask)!=0 ){
-        rc = SQLITE_BUSY;
-        break;
-      }
-      allShared |= pX->sharedMask;
-    }
-
-    /* Get shared locks at the system level, if necessary */
-    if( rc==SQLITE_OK ){
-      if( (allShared & mask)==0 ){
-        rc = unixShmSystemLock(pShmNode, F_RDLCK, ofst+UNIX_SHM_BASE, n);
-      }else{
-        rc = SQLITE_OK;
-      }
+    assert( (p->sharedMask & mask)==0 );
+    if( aLock[ofst]<0 ){
+      rc = SQLITE_BUSY;
+    }else if( aLock[ofst]==0 ){
+      rc = unixShmSystemLock(pShmNode, F_RDLCK, UNIX_SHM_LOCK(ofst), n);
     }
 
     /* Get the local shared locks */
     if( rc==SQLITE_OK ){
+      shmLockAdd(&aLock[ofst], 1);
       p->sharedMask |= mask;
     }
   }else{
-    /* Make sure no sibling connections hold locks that will block this
-    ** lock.  If any do, return SQLITE_BUSY right away.
+    /* Make sure no other connections in this process hold locks that will
+    ** block this lock.  If any do, return SQLITE_BUSY right away.
     */
-    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
-      if( (pX->exclMask & mask)!=0 || (pX->sharedMask & mask)!=0 ){
+    for(i=ofst; i<ofst+n; i++){
+      if( aLock[i]!=0 ){
         rc = SQLITE_BUSY;
         break;
       }
@@ -3679,9 +4319,10 @@ static int unixShmLock(
     ** also mark the local connection as being locked.
     */
     if( rc==SQLITE_OK ){
-      rc = unixShmSystemLock(pShmNode, F_WRLCK, ofst+UNIX_SHM_BASE, n);
+      rc = unixShmSystemLock(pShmNode, F_WRLCK, UNIX_SHM_LOCK(ofst), n);
       if( rc==SQLITE_OK ){
         assert( (p->sharedMask & mask)==0 );
+        for(i=ofst; i<ofst+n; i++) shmLockSet(&aLock[i], -1);
         p->exclMask |= mask;
       }
     }
@@ -3763,6 +4404,563 @@ static int unixShmUnmap(
 # define unixShmUnmap   0
 #endif /* #ifndef SQLITE_OMIT_WAL */
 
+/******************************************************************************
+******************************* Batched I/O ***********************************
+**
+** The xSubmit method performs a batch of reads, writes and syncs.  The
+** reads and writes between each pair of syncs are performed concurrently
+** by one of the following engines:
+**
+**   *  On Linux, an io_uring instance that belongs to the file.  Up to
+**      UNIX_RING_SIZE requests are passed to the kernel by one system call.
+**
+**   *  Otherwise, a pool of UNIX_IO_NTHREAD worker threads that is shared
+**      by all files.  The calling thread also performs requests.
+**
+**   *  If neither is available, the requests are performed one at a time.
+**
+** The calling thread performs some requests itself, using the ordinary
+** xRead, xWrite and xSync methods: syncs, reads that can be served from
+** the memory-mapped region, and O_DIRECT transfers that must use a bounce
+** buffer.
+*/
+
+/*
+** The number of threads in the worker pool, and the number of entries in
+** each io_uring.  UNIX_RING_SIZE is also the maximum number of requests
+** handed to an engine at once.
+*/
+#ifndef UNIX_IO_NTHREAD
+# define UNIX_IO_NTHREAD 4
+#endif
+#define UNIX_RING_SIZE 64
+
+/*
+** Allowed values for sqlite3_unix_io_engine.  Test builds can set it to
+** make xSubmit use a particular engine, if that engine is available.
+*/
+#define UNIX_IO_AUTO        0     /* io_uring, then threads, then neither */
+#define UNIX_IO_URING       1     /* Use io_uring if possible */
+#define UNIX_IO_THREADS     2     /* Use the worker threads if possible */
+#define UNIX_IO_SEQUENTIAL  3     /* Perform requests one at a time */
+
+#ifdef SQLITE_TEST
+int sqlite3_unix_io_engine = UNIX_IO_AUTO;
+#else
+# define sqlite3_unix_io_engine UNIX_IO_AUTO
+#endif
+
+/*
+** Perform read or write request p on file descriptor fd using pread() or
+** pwrite(), starting nDone bytes into the transfer, and set p->rc.  If a
+** system call fails, return its errno.  Otherwise, return 0.
+**
+** This function does not use the file offset, so several threads may
+** call it for the same file descriptor at the same time.
+*/
+static int unixIoPerform(int fd, sqlite3_io_request *p, int nDone){
+  char *aBuf = (char *)p->pBuf;
+  int iErrno = 0;
+  while( nDone<p->iAmt ){
+    ssize_t got;
+    if( p->op==SQLITE_IOREQ_READ ){
+      got = pread(fd, &aBuf[nDone], p->iAmt-nDone, p->iOfst+nDone);
+    }else{
+      got = pwrite(fd, &aBuf[nDone], p->iAmt-nDone, p->iOfst+nDone);
+    }
+    if( got<0 && errno==EINTR ) continue;
+    if( got<=0 ){
+      if( got<0 ) iErrno = errno;
+      break;
+    }
+    nDone += (int)got;
+  }
+  if( nDone==p->iAmt ){
+    p->rc = SQLITE_OK;
+  }else if( p->op==SQLITE_IOREQ_READ ){
+    if( iErrno ){
+      p->rc = SQLITE_IOERR_READ;
+    }else{
+      /* Unread parts of the buffer must be zero-filled */
+      memset(&aBuf[nDone], 0, p->iAmt-nDone);
+      p->rc = SQLITE_IOERR_SHORT_READ;
+    }
+  }else{
+    p->rc = iErrno ? SQLITE_IOERR_WRITE : SQLITE_FULL;
+  }
+  return iErrno;
+}
+
+#if HAVE_IO_URING
+/*
+** An io_uring instance.  The submission and completion queues are shared
+** with the kernel.  See io_uring_setup(2).
+*/
+struct UnixRing {
+  int fd;                         /* File descriptor of the io_uring */
+  unsigned nEntry;                /* Number of submission queue entries */
+  unsigned *pSqHead;              /* Submission queue head */
+  unsigned *pSqTail;              /* Submission queue tail */
+  unsigned sqMask;                /* Submission queue index mask */
+  unsigned *aSqIndex;             /* Submission queue index array */
+  struct io_uring_sqe *aSqe;      /* Submission queue entries */
+  unsigned *pCqHead;              /* Completion queue head */
+  unsigned *pCqTail;              /* Completion queue tail */
+  unsigned cqMask;                /* Completion queue index mask */
+  struct io_uring_cqe *aCqe;      /* Completion queue entries */
+  void *pSqMap;                   /* Mapping of the submission queue */
+  size_t szSqMap;                 /* Size of mapping pSqMap */
+  void *pCqMap;                   /* Mapping of the completion queue */
+  size_t szCqMap;                 /* Size of mapping pCqMap */
+};
+
+/*
+** Set if io_uring cannot be used in this process.  Either the system
+** call is not available, or the kernel is older than 5.6 and does not
+** support IORING_OP_READ and IORING_OP_WRITE.
+*/
+static int unixRingUnavailable = 0;
+
+/*
+** Release all resources held by io_uring p.
+*/
+static void unixRingFree(UnixRing *p){
+  if( p->aSqe && p->aSqe!=MAP_FAILED ){
+    munmap(p->aSqe, p->nEntry*sizeof(struct io_uring_sqe));
+  }
+  if( p->pCqMap && p->pCqMap!=MAP_FAILED ) munmap(p->pCqMap, p->szCqMap);
+  if( p->pSqMap && p->pSqMap!=MAP_FAILED ) munmap(p->pSqMap, p->szSqMap);
+  close(p->fd);
+  sqlite3_free(p);
+}
+
+/*
+** Free the io_uring belonging to file pFd, if it has one.
+*/
+static void unixRingClose(unixFile *pFd){
+  if( pFd->pRing ){
+    unixRingFree(pFd->pRing);
+    pFd->pRing = 0;
+  }
+}
+
+/*
+** Return the io_uring belonging to file pFd, creating it if necessary.
+** Return NULL if an io_uring cannot be created.
+*/
+static UnixRing *unixRingOpen(unixFile *pFd){
+  struct io_uring_params params;
+  UnixRing *p;
+  u8 *aSq;
+  u8 *aCq;
+  int fd;
+
+  if( unixRingUnavailable ){
+    unixRingClose(pFd);
+    return 0;
+  }
+  if( pFd->pRing ) return pFd->pRing;
+  memset(&params, 0, sizeof(params));
+  fd = (int)syscall(__NR_io_uring_setup, UNIX_RING_SIZE, &params);
+  if( fd<0 ){
+    if( errno==ENOSYS || errno==EPERM ) unixRingUnavailable = 1;
+    return 0;
+  }
+  sqlite3BeginBenignMalloc();
+  p = (UnixRing *)sqlite3MallocZero(sizeof(UnixRing));
+  sqlite3EndBenignMalloc();
+  if( p==0 ){
+    close(fd);
+    return 0;
+  }
+  p->fd = fd;
+  p->nEntry = params.sq_entries;
+  p->szSqMap = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+  p->szCqMap = params.cq_off.cqes
+             + params.cq_entries*sizeof(struct io_uring_cqe);
+  p->pSqMap = mmap(0, p->szSqMap, PROT_READ|PROT_WRITE, MAP_SHARED, fd,
+                   IORING_OFF_SQ_RING);
+  p->pCqMap = mmap(0, p->szCqMap, PROT_READ|PROT_WRITE, MAP_SHARED, fd,
+                   IORING_OFF_CQ_RING);
+  p->aSqe = (struct io_uring_sqe *)mmap(0,
+      p->nEntry*sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+      MAP_SHARED, fd, IORING_OFF_SQES
+  );
+  if( p->pSqMap==MAP_FAILED || p->pCqMap==MAP_FAILED 
+   || p->aSqe==MAP_FAILED || p->nEntry>UNIX_RING_SIZE
+  ){
+    unixRingFree(p);
+    return 0;
+  }
+  aSq = (u8 *)p->pSqMap;
+  p->pSqHead = (unsigned *)&aSq[params.sq_off.head];
+  p->pSqTail = (unsigned *)&aSq[params.sq_off.tail];
+  p->sqMask = *(unsigned *)&aSq[params.sq_off.ring_mask];
+  p->aSqIndex = (unsigned *)&aSq[params.sq_off.array];
+  aCq = (u8 *)p->pCqMap;
+  p->pCqHead = (unsigned *)&aCq[params.cq_off.head];
+  p->pCqTail = (unsigned *)&aCq[params.cq_off.tail];
+  p->cqMask = *(unsigned *)&aCq[params.cq_off.ring_mask];
+  p->aCqe = (struct io_uring_cqe *)&aCq[params.cq_off.cqes];
+  pFd->pRing = p;
+  return p;
+}
+
+/*
+** Perform the nReq read and write requests in apReq[] using the io_uring
+** belonging to file pFd.  nReq may not be greater than the size of the
+** ring.  Any part of a request that the kernel does not complete, for
+** example because of an error, is then performed using unixIoPerform().
+** Return the errno of a failed request, or 0.
+**
+** If io_uring_enter() fails, entries the kernel has not yet consumed are
+** withdrawn from the submission queue, and the requests already passed to
+** the kernel are drained: this function waits for their completions,
+** polling the completion queue if io_uring_enter() cannot be used to wait.
+** Only then is the ring closed and are the withdrawn requests performed
+** using unixIoPerform().  Each request's rc field reports whether or not
+** it was completed.
+*/
+static int unixRingSubmit(unixFile *pFd, sqlite3_io_request **apReq, int nReq){
+  UnixRing *p = pFd->pRing;
+  unsigned tail = *p->pSqTail;
+  u8 aDone[UNIX_RING_SIZE];       /* True once a request is complete */
+  int nSubmit = 0;                /* Entries consumed by the kernel */
+  int nWait = nReq;               /* Requests not yet complete */
+  int bFailed = 0;                /* True after io_uring_enter() fails */
+  int iErrno = 0;
+  int i;
+
+  assert( nReq>0 && nReq<=(int)p->nEntry );
+  for(i=0; i<nReq; i++){
+    sqlite3_io_request *pReq = apReq[i];
+    unsigned idx = (tail+i) & p->sqMask;
+    struct io_uring_sqe *pSqe = &p->aSqe[idx];
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = (pReq->op==SQLITE_IOREQ_READ) ?
+                       IORING_OP_READ : IORING_OP_WRITE;
+    pSqe->fd = pFd->h;
+    pSqe->off = (sqlite3_uint64)pReq->iOfst;
+    pSqe->addr = (sqlite3_uint64)(size_t)pReq->pBuf;
+    pSqe->len = (unsigned)pReq->iAmt;
+    pSqe->user_data = (sqlite3_uint64)i;
+    p->aSqIndex[idx] = idx;
+    aDone[i] = 0;
+  }
+  __atomic_store_n(p->pSqTail, tail+nReq, __ATOMIC_RELEASE);
+
+  while( nWait>0 ){
+    unsigned head;
+    int nNew = bFailed ? 0 : nReq-nSubmit;
+    int rc = (int)syscall(__NR_io_uring_enter, p->fd, nNew, nWait,
+                          IORING_ENTER_GETEVENTS, 0, 0);
+    if( rc<0 ){
+      if( errno==EINTR || errno==EAGAIN || errno==EBUSY ) continue;
+      if( !bFailed ){
+        /* Withdraw the entries the kernel has not consumed.  The kernel
+        ** consumes entries in order, so they are the last nReq-nSubmit. */
+        nSubmit = (int)(__atomic_load_n(p->pSqHead, __ATOMIC_ACQUIRE)-tail);
+        __atomic_store_n(p->pSqTail, tail+nSubmit, __ATOMIC_RELEASE);
+        nWait -= nReq-nSubmit;
+        bFailed = 1;
+        OSTRACE(("RING    %-3d enter failed errno=%d, %d of %d in flight\n",
+                 pFd->h, errno, nWait, nReq));
+      }else{
+        /* The kernel still owns the buffers of the requests in flight,
+        ** so the ring may not be closed until they complete. */
+        usleep(1000);
+      }
+    }else{
+      nSubmit += rc;
+    }
+    head = *p->pCqHead;
+    while( head!=__atomic_load_n(p->pCqTail, __ATOMIC_ACQUIRE) ){
+      struct io_uring_cqe *pCqe = &p->aCqe[head & p->cqMask];
+      int iReq = (int)pCqe->user_data;
+      int res = pCqe->res;
+      int err;
+      if( res==-EINVAL || res==-EOPNOTSUPP ) unixRingUnavailable = 1;
+      if( res<0 ) res = 0;
+      err = unixIoPerform(pFd->h, apReq[iReq], res);
+      if( err ) iErrno = err;
+      aDone[iReq] = 1;
+      nWait--;
+      head++;
+    }
+    __atomic_store_n(p->pCqHead, head, __ATOMIC_RELEASE);
+  }
+
+  if( bFailed ){
+    /* Stop using this ring, now that the kernel has finished with every
+    ** request passed to it, and perform the withdrawn requests directly.  */
+    unixRingClose(pFd);
+    for(i=0; i<nReq; i++){
+      if( aDone[i]==0 ){
+        int err = unixIoPerform(pFd->h, apReq[i], 0);
+        if( err ) iErrno = err;
+      }
+    }
+  }
+  return iErrno;
+}
+#endif /* HAVE_IO_URING */
+
+#if SQLITE_UNIX_THREADS
+/*
+** A set of read and write requests being performed by the worker pool.
+*/
+typedef struct UnixIoBatch UnixIoBatch;
+struct UnixIoBatch {
+  int fd;                         /* File descriptor */
+  sqlite3_io_request **apReq;     /* Requests to perform */
+  int nReq;                       /* Number of entries in apReq[] */
+  int iNext;                      /* Index of next request to start */
+  int nDone;                      /* Number of requests finished */
+  int iErrno;                     /* errno of a failed request, or 0 */
+  UnixIoBatch *pNext;             /* Next batch in unixIoPool.pQueue */
+};
+
+/*
+** The worker pool.  All fields are protected by the mutex.  Worker
+** threads are started the first time a batch is submitted, and stopped
+** by sqlite3_os_end().
+*/
+static struct UnixIoPool {
+  pthread_mutex_t mutex;          /* Mutex protecting this structure */
+  pthread_cond_t work;            /* Signalled when a batch is queued */
+  pthread_cond_t done;            /* Signalled when a batch is finished */
+  int nThread;                    /* Number of worker threads started */
+  int bShutdown;                  /* True to make worker threads exit */
+  UnixIoBatch *pQueue;            /* Batches with requests not yet started */
+  pthread_t aThread[UNIX_IO_NTHREAD];   /* Worker threads */
+} unixIoPool = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, 0, 0, 0
+};
+
+/*
+** Start the next request of batch p, which must be in the queue.  The
+** mutex must be held when this is called.  It is released while the
+** request is performed.
+*/
+static void unixIoPoolStep(UnixIoBatch *p){
+  sqlite3_io_request *pReq = p->apReq[p->iNext++];
+  int iErrno;
+  if( p->iNext==p->nReq ){
+    UnixIoBatch **pp;
+    for(pp=&unixIoPool.pQueue; *pp!=p; pp=&(*pp)->pNext);
+    *pp = p->pNext;
+  }
+  pthread_mutex_unlock(&unixIoPool.mutex);
+  iErrno = unixIoPerform(p->fd, pReq, 0);
+  pthread_mutex_lock(&unixIoPool.mutex);
+  if( iErrno ) p->iErrno = iErrno;
+  if( ++p->nDone==p->nReq ) pthread_cond_broadcast(&unixIoPool.done);
+}
+
+/*
+** The main routine of each worker thread.
+*/
+static void *unixIoWorker(void *NotUsed){
+  UNUSED_PARAMETER(NotUsed);
+  pthread_mutex_lock(&unixIoPool.mutex);
+  while( !unixIoPool.bShutdown ){
+    if( unixIoPool.pQueue ){
+      unixIoPoolStep(unixIoPool.pQueue);
+    }else{
+      pthread_cond_wait(&unixIoPool.work, &unixIoPool.mutex);
+    }
+  }
+  pthread_mutex_unlock(&unixIoPool.mutex);
+  return 0;
+}
+
+/*
+** Perform the nReq read and write requests in apReq[] on file descriptor
+** fd using the worker pool.  Return the errno of a failed request, or 0.
+**
+** The calling thread starts requests too, so the batch finishes even if
+** no worker threads could be started.
+*/
+static int unixPoolSubmit(int fd, sqlite3_io_request **apReq, int nReq){
+  UnixIoBatch b;
+  UnixIoBatch **pp;
+
+  memset(&b, 0, sizeof(b));
+  b.fd = fd;
+  b.apReq = apReq;
+  b.nReq = nReq;
+
+  pthread_mutex_lock(&unixIoPool.mutex);
+  while( unixIoPool.nThread<UNIX_IO_NTHREAD && !unixIoPool.bShutdown ){
+    pthread_t *pThread = &unixIoPool.aThread[unixIoPool.nThread];
+    if( pthread_create(pThread, 0, unixIoWorker, 0) ) break;
+    unixIoPool.nThread++;
+  }
+  for(pp=&unixIoPool.pQueue; *pp; pp=&(*pp)->pNext);
+  *pp = &b;
+  pthread_cond_broadcast(&unixIoPool.work);
+  while( b.iNext<b.nReq ){
+    unixIoPoolStep(&b);
+  }
+  while( b.nDone<b.nReq ){
+    pthread_cond_wait(&unixIoPool.done, &unixIoPool.mutex);
+  }
+  pthread_mutex_unlock(&unixIoPool.mutex);
+  return b.iErrno;
+}
+
+/*
+** Stop the worker threads.  They are started again if needed.
+*/
+static void unixIoPoolShutdown(void){
+  int nThread;
+  int i;
+  pthread_mutex_lock(&unixIoPool.mutex);
+  unixIoPool.bShutdown = 1;
+  nThread = unixIoPool.nThread;
+  pthread_cond_broadcast(&unixIoPool.work);
+  pthread_mutex_unlock(&unixIoPool.mutex);
+  for(i=0; i<nThread; i++){
+    pthread_join(unixIoPool.aThread[i], 0);
+  }
+  pthread_mutex_lock(&unixIoPool.mutex);
+  unixIoPool.nThread = 0;
+  unixIoPool.bShutdown = 0;
+  pthread_mutex_unlock(&unixIoPool.mutex);
+}
+#endif /* SQLITE_UNIX_THREADS */
+
+/*
+** Perform the nReq read and write requests in apReq[] using the engine
+** selected by sqlite3_unix_io_engine, and wait for them all to finish.
+** The requests must not overlap.
+*/
+static void unixSubmitBatch(
+  unixFile *pFile,
+  sqlite3_io_request **apReq,
+  int nReq
+){
+  int eEngine = sqlite3_unix_io_engine;
+  int iErrno = 0;
+  int bDone = 0;
+
+  if( nReq==0 ) return;
+  OSTRACE(("SUBMIT  %-3d %d\n", pFile->h, nReq));
+  if( nReq==1 ) eEngine = UNIX_IO_SEQUENTIAL;
+#if HAVE_IO_URING
+  if( (eEngine==UNIX_IO_AUTO || eEngine==UNIX_IO_URING)
+   && unixRingOpen(pFile)
+  ){
+    iErrno = unixRingSubmit(pFile, apReq, nReq);
+    bDone = 1;
+  }
+#endif
+#if SQLITE_UNIX_THREADS
+  if( !bDone && eEngine!=UNIX_IO_SEQUENTIAL ){
+    iErrno = unixPoolSubmit(pFile->h, apReq, nReq);
+    bDone = 1;
+  }
+#endif
+  if( !bDone ){
+    int i;
+    for(i=0; i<nReq; i++){
+      int err = unixIoPerform(pFile->h, apReq[i], 0);
+      if( err ) iErrno = err;
+    }
+  }
+  if( iErrno ) pFile->lastErrno = iErrno;
+}
+
+/*
+** Return true if read or write request p must be performed by the calling
+** thread using unixRead() or unixWrite(), rather than by an engine.
+*/
+static int unixSubmitInline(unixFile *pFile, sqlite3_io_request *p){
+#if SQLITE_MAX_MMAP_SIZE>0
+  if( p->op==SQLITE_IOREQ_READ && p->iOfst<pFile->mmapSize ) return 1;
+#endif
+#if UNIX_DIRECT_IO
+  if( (pFile->fileFlags & UNIXFILE_DIRECT)
+   && !unixDirectAligned(p->iOfst, p->pBuf, p->iAmt)
+  ){
+    return 1;
+  }
+#endif
+#ifndef NDEBUG
+  /* Let unixWrite() record any change to the transaction counter. */
+  if( p->op==SQLITE_IOREQ_WRITE && pFile->inNormalWrite ){
+    pFile->dbUpdate = 1;
+    if( p->iOfst<=24 ) return 1;
+  }
+#endif
+  UNUSED_PARAMETER2(pFile, p);
+  return 0;
+}
+
+/*
+** Perform the nReq I/O requests in aReq[].  Each run of reads and writes
+** between syncs is passed to unixSubmitBatch() in groups of up to
+** UNIX_RING_SIZE.  Syncs are performed by unixSync().
+*/
+static int unixSubmit(sqlite3_file *id, sqlite3_io_request *aReq, int nReq){
+  unixFile *pFile = (unixFile*)id;
+  sqlite3_io_request *apBatch[UNIX_RING_SIZE];
+  int nBatch = 0;
+  i64 iEnd = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  /* Grow the file to its final size once, before the writes start. */
+  for(i=0; i<nReq; i++){
+    if( aReq[i].op==SQLITE_IOREQ_WRITE && aReq[i].iOfst+aReq[i].iAmt>iEnd ){
+      iEnd = aReq[i].iOfst + aReq[i].iAmt;
+    }
+  }
+  if( iEnd>0 ) unixGrowForWrite(pFile, iEnd);
+
+  for(i=0; i<nReq; i++){
+    sqlite3_io_request *p = &aReq[i];
+    assert( p->op==SQLITE_IOREQ_READ || p->op==SQLITE_IOREQ_WRITE
+         || p->op==SQLITE_IOREQ_SYNC );
+    if( p->op==SQLITE_IOREQ_SYNC ){
+      unixSubmitBatch(pFile, apBatch, nBatch);
+      nBatch = 0;
+      p->rc = unixSync(id, p->iAmt);
+    }else if( unixSubmitInline(pFile, p) ){
+      if( p->op==SQLITE_IOREQ_READ ){
+        p->rc = unixRead(id, p->pBuf, p->iAmt, p->iOfst);
+      }else{
+        p->rc = unixWrite(id, p->pBuf, p->iAmt, p->iOfst);
+      }
+    }else{
+      p->rc = SQLITE_OK;
+      if( p->op==SQLITE_IOREQ_READ ){
+        SimulateIOError( p->rc = SQLITE_IOERR_READ );
+      }else{
+        SimulateIOError( p->rc = SQLITE_IOERR_WRITE );
+        SimulateDiskfullError( p->rc = SQLITE_FULL );
+      }
+      if( p->rc==SQLITE_OK ){
+        apBatch[nBatch++] = p;
+        if( nBatch==UNIX_RING_SIZE ){
+          unixSubmitBatch(pFile, apBatch, nBatch);
+          nBatch = 0;
+        }
+      }
+    }
+  }
+  unixSubmitBatch(pFile, apBatch, nBatch);
+
+  for(i=0; i<nReq && rc==SQLITE_OK; i++){
+    rc = aReq[i].rc;
+  }
+  return rc;
+}
+
+/****************************** End of Batched I/O *****************************
+******************************************************************************/
+
 /*
 ** Here ends the implementation of all sqlite3_file methods.
 **
@@ -3821,7 +5019,11 @@ static const sqlite3_io_methods METHOD = {                                   \
    unixShmMap,                 /* xShmMap */                                 \
    unixShmLock,                /* xShmLock */                                \
    unixShmBarrier,             /* xShmBarrier */                             \
-   unixShmUnmap                /* xShmUnmap */                               \
+   unixShmUnmap,               /* xShmUnmap */                               \
+   unixFetch,                  /* xFetch */                                  \
+   unixUnfetch,                /* xUnfetch */                                \
+   unixWritev,                 /* xWritev */                                 \
+   unixSubmit                  /* xSubmit */                                 \
 };                                                                           \
 static const sqlite3_io_methods *FINDER##Impl(const char *z, unixFile *p){   \
   UNUSED_PARAMETER(z); UNUSED_PARAMETER(p);                                  \
@@ -3838,12 +5040,34 @@ static const sqlite3_io_methods *(*const FINDER)(const char*,unixFile *p)    \
 IOMETHODS(
   posixIoFinder,            /* Finder function name */
   posixIoMethods,           /* sqlite3_io_methods object name */
-  2,                        /* shared memory is enabled */
+  5,                        /* shared memory, xFetch, xWritev, xSubmit */
   unixClose,                /* xClose method */
   unixLock,                 /* xLock method */
   unixUnlock,               /* xUnlock method */
   unixCheckReservedLock     /* xCheckReservedLock method */
 )
+#if UNIX_DIRECT_IO
+/*
+** The finder-function for the "unix-direct" VFS.  Database files use the
+** same locking as the "unix" VFS, but are switched to O_DIRECT so that
+** reads and writes bypass the operating system cache.  If the file-system
+** does not support O_DIRECT, the file is used normally.
+*/
+static const sqlite3_io_methods *directIoFinderImpl(
+  const char *filePath,    /* name of the database file */
+  unixFile *pNew           /* the open file object */
+){
+  int flags = fcntl(pNew->h, F_GETFL);
+  UNUSED_PARAMETER(filePath);
+  if( flags>=0 && fcntl(pNew->h, F_SETFL, flags|O_DIRECT)==0 ){
+    pNew->fileFlags |= UNIXFILE_DIRECT;
+  }
+  return &posixIoMethods;
+}
+static const sqlite3_io_methods 
+  *(*const directIoFinder)(const char*,unixFile*) = directIoFinderImpl;
+#endif
+
 IOMETHODS(
   nolockIoFinder,           /* Finder function name */
   nolockIoMethods,          /* sqlite3_io_methods object name */
@@ -3853,6 +5077,36 @@ IOMETHODS(
   nolockUnlock,             /* xUnlock method */
   nolockCheckReservedLock   /* xCheckReservedLock method */
 )
+
+/*
+** The methods used for journals, WAL files and the other files that are
+** never locked.  These are the nolockIoMethods with the shared-memory
+** methods left out, which allows a version number that makes xWritev and
+** xSubmit available.
+*/
+static const sqlite3_io_methods nolockAuxIoMethods = {
+   5,                          /* iVersion */
+   nolockClose,                /* xClose */
+   unixRead,                   /* xRead */
+   unixWrite,                  /* xWrite */
+   unixTruncate,               /* xTruncate */
+   unixSync,                   /* xSync */
+   unixFileSize,               /* xFileSize */
+   nolockLock,                 /* xLock */
+   nolockUnlock,               /* xUnlock */
+   nolockCheckReservedLock,    /* xCheckReservedLock */
+   unixFileControl,            /* xFileControl */
+   unixSectorSize,             /* xSectorSize */
+   unixDeviceCharacteristics,  /* xDeviceCapabilities */
+   0,                          /* xShmMap */
+   0,                          /* xShmLock */
+   0,                          /* xShmBarrier */
+   0,                          /* xShmUnmap */
+   unixFetch,                  /* xFetch */
+   unixUnfetch,                /* xUnfetch */
+   unixWritev,                 /* xWritev */
+   unixSubmit                  /* xSubmit */
+};
 IOMETHODS(
   dotlockIoFinder,          /* Finder function name */
   dotlockIoMethods,         /* sqlite3_io_methods object name */
@@ -4103,7 +5357,7 @@ static int fillInUnixFile(
 #endif
 
   if( noLock ){
-    pLockingStyle = &nolockIoMethods;
+    pLockingStyle = &nolockAuxIoMethods;
   }else{
     pLockingStyle = (**(finder_type*)pVfs->pAppData)(zFilename, pNew);
 #if SQLITE_ENABLE_LOCKING_STYLE
@@ -4431,7 +5685,10 @@ static int findCreateFileMode(
     int nDb;                      /* Number of valid bytes in zDb */
     struct stat sStat;            /* Output of stat() on database file */
 
-    nDb = sqlite3Strlen30(zPath) - ((flags & SQLITE_OPEN_WAL) ? 4 : 8);
+    /* zPath is a database file name with "-journal", "-wal" or "-wal2"
+    ** appended.  Strip the suffix to find the database file.  */
+    nDb = sqlite3Strlen30(zPath) - 1;
+    while( nDb>0 && zPath[nDb]!='-' ) nDb--;
     memcpy(zDb, zPath, nDb);
     zDb[nDb] = '\0';
     if( 0==stat(zDb, &sStat) ){
@@ -6278,6 +7535,9 @@ int sqlite3_os_init(void){
 #endif
     UNIXVFS("unix-none",     nolockIoFinder ),
     UNIXVFS("unix-dotfile",  dotlockIoFinder ),
+#if UNIX_DIRECT_IO
+    UNIXVFS("unix-direct",   directIoFinder ),
+#endif
 #if OS_VXWORKS
     UNIXVFS("unix-namedsem", semIoFinder ),
 #endif
@@ -6310,6 +7570,9 @@ int sqlite3_os_init(void){
 ** This routine is a no-op for unix.
 */
 int sqlite3_os_end(void){ 
+#if SQLITE_UNIX_THREADS
+  unixIoPoolShutdown();
+#endif
   return SQLITE_OK; 
 }
  
@@ -80,6 +80,12 @@
 typedef struct winShm winShm;           /* A connection to shared-memory */
 typedef struct winShmNode winShmNode;   /* A region of shared-memory */
 
+/*
+** Number of shared-memory locks supported by winShmLock(), including
+** those at or above SQLITE_SHM_NLOCK (see SQLITE_FCNTL_SHM_NLOCK).
+*/
+#define WIN_SHM_NLOCK 24
+
 /*
 ** WinCE lacks native support for file locking so we have to fake it
 ** with some code of our own.
@@ -1183,6 +1189,10 @@ static int winFileControl(sqlite3_file *id, int op, void *pArg){
       SimulateIOErrorBenign(0);
       return SQLITE_OK;
     }
+    case SQLITE_FCNTL_SHM_NLOCK: {
+      *(int*)pArg = WIN_SHM_NLOCK;
+      return SQLITE_OK;
+    }
   }
   return SQLITE_ERROR;
 }
@@ -1313,18 +1323,20 @@ struct winShm {
   winShmNode *pShmNode;      /* The underlying winShmNode object */
   winShm *pNext;             /* Next winShm with the same winShmNode */
   u8 hasMutex;               /* True if holding the winShmNode mutex */
-  u16 sharedMask;            /* Mask of shared locks held */
-  u16 exclMask;              /* Mask of exclusive locks held */
+  u32 sharedMask;            /* Mask of shared locks held */
+  u32 exclMask;              /* Mask of exclusive locks held */
 #ifdef SQLITE_DEBUG
   u8 id;                     /* Id of this connection with its winShmNode */
 #endif
 };
 
 /*
-** Constants used for locking
+** Constants used for locking.  The bytes of the locks at or above
+** SQLITE_SHM_NLOCK follow the dead-man switch.
 */
 #define WIN_SHM_BASE   ((22+SQLITE_SHM_NLOCK)*4)        /* first lock byte */
 #define WIN_SHM_DMS    (WIN_SHM_BASE+SQLITE_SHM_NLOCK)  /* deadman switch */
+#define WIN_SHM_LOCK(i) (WIN_SHM_BASE+(i)+((i)>=SQLITE_SHM_NLOCK))
 
 /*
 ** Apply advisory locks for all n bytes beginning at ofst.
@@ -1595,9 +1607,10 @@ static int winShmLock(
   winShm *pX;                           /* For looping over all siblings */
   winShmNode *pShmNode = p->pShmNode;
   int rc = SQLITE_OK;                   /* Result code */
-  u16 mask;                             /* Mask of locks to take or release */
+  u32 mask;                             /* Mask of locks to take or release */
 
-  assert( ofst>=0 && ofst+n<=SQLITE_SHM_NLOCK );
+  assert( ofst>=0 && ofst+n<=WIN_SHM_NLOCK );
+  assert( ofst>=SQLITE_SHM_NLOCK || ofst+n<=SQLITE_SHM_NLOCK );
   assert( n>=1 );
   assert( flags==(SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)
        || flags==(SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE)
@@ -1605,11 +1618,11 @@ static int winShmLock(
        || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE) );
   assert( n==1 || (flags & SQLITE_SHM_EXCLUSIVE)!=0 );
 
-  mask = (u16)((1U<<(ofst+n)) - (1U<<ofst));
+  mask = (u32)((1U<<(ofst+n)) - (1U<<ofst));
   assert( n>1 || mask==(1<<ofst) );
   sqlite3_mutex_enter(pShmNode->mutex);
   if( flags & SQLITE_SHM_UNLOCK ){
-    u16 allMask = 0; /* Mask of locks held by siblings */
+    u32 allMask = 0; /* Mask of locks held by siblings */
 
     /* See if any siblings hold this same lock */
     for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
@@ -1620,7 +1633,7 @@ static int winShmLock(
 
     /* Unlock the system-level locks */
     if( (mask & allMask)==0 ){
-      rc = winShmSystemLock(pShmNode, _SHM_UNLCK, ofst+WIN_SHM_BASE, n);
+      rc = winShmSystemLock(pShmNode, _SHM_UNLCK, WIN_SHM_LOCK(ofst), n);
     }else{
       rc = SQLITE_OK;
     }
@@ -1631,7 +1644,7 @@ static int winShmLock(
       p->sharedMask &= ~mask;
     } 
   }else if( flags & SQLITE_SHM_SHARED ){
-    u16 allShared = 0;  /* Union of locks held by connections other than "p" */
+    u32 allShared = 0;  /* Union of locks held by connections other than "p" */
 
     /* Find out which shared locks are already held by sibling connections.
     ** If any sibling already holds an exclusive lock, go ahead and return
@@ -1648,7 +1661,7 @@ static int winShmLock(
     /* Get shared locks at the system level, if necessary */
     if( rc==SQLITE_OK ){
       if( (allShared & mask)==0 ){
-        rc = winShmSystemLock(pShmNode, _SHM_RDLCK, ofst+WIN_SHM_BASE, n);
+        rc = winShmSystemLock(pShmNode, _SHM_RDLCK, WIN_SHM_LOCK(ofst), n);
       }else{
         rc = SQLITE_OK;
       }
@@ -1673,7 +1686,7 @@ static int winShmLock(
     ** also mark the local connection as being locked.
     */
     if( rc==SQLITE_OK ){
-      rc = winShmSystemLock(pShmNode, _SHM_WRLCK, ofst+WIN_SHM_BASE, n);
+      rc = winShmSystemLock(pShmNode, _SHM_WRLCK, WIN_SHM_LOCK(ofst), n);
       if( rc==SQLITE_OK ){
         assert( (p->sharedMask & mask)==0 );
         p->exclMask |= mask;
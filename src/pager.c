@@ -600,6 +600,27 @@ struct PagerSavepoint {
 **   size-hint passed to the method call. See pager_write_pagelist() for 
 **   details.
 **
+** bUseFetch, szMmap, nMmapOut, pMmapFreelist
+**
+**   These variables control memory-mapped reads of the database file.
+**   szMmap is the limit configured by "PRAGMA mmap_size" and bUseFetch is
+**   true if that limit is non-zero and the VFS supports xFetch.  When it
+**   is set, pages requested while the pager is in PAGER_READER state may
+**   be returned as pointers directly into the mapping instead of being
+**   copied into the page cache.  Such pages have the PGHDR_MMAP flag set
+**   and are never part of the PCache.  nMmapOut is the number of them
+**   currently referenced, and pMmapFreelist is a list of spare PgHdr
+**   objects for wrapping them.
+**
+** pReadSet
+**
+**   This is non-NULL while a transaction opened by BEGIN CONCURRENT is
+**   active on a WAL database.  It has one bit set for each page acquired
+**   by the transaction (and for each page it modifies), and is used when 
+**   the transaction commits to determine whether or not any of those pages
+**   has been changed by another connection since the snapshot was taken.
+**   See sqlite3PagerBeginConcurrent() and pagerLockForCommit().
+**
 ** errCode
 **
 **   The Pager.errCode variable is only ever used in PAGER_ERROR state. It
@@ -619,6 +640,7 @@ struct Pager {
   u8 tempFile;                /* zFilename is a temporary file */
   u8 readOnly;                /* True for a read-only database */
   u8 memDb;                   /* True to inhibit all file I/O */
+  u8 bUseFetch;               /* True to use xFetch() */
 
   /**************************************************************************
   ** The following block contains those class members that change during
@@ -645,6 +667,7 @@ struct Pager {
   u32 cksumInit;              /* Quasi-random value added to every checksum */
   u32 nSubRec;                /* Number of records written to sub-journal */
   Bitvec *pInJournal;         /* One bit for each page in the database file */
+  Bitvec *pReadSet;           /* Pages read by a BEGIN CONCURRENT transaction */
   sqlite3_file *fd;           /* File descriptor for database */
   sqlite3_file *jfd;          /* File descriptor for main journal */
   sqlite3_file *sjfd;         /* File descriptor for sub-journal */
@@ -654,6 +677,8 @@ struct Pager {
   PagerSavepoint *aSavepoint; /* Array of active savepoints */
   int nSavepoint;             /* Number of elements in aSavepoint[] */
   char dbFileVers[16];        /* Changes whenever database file changes */
+  int nMmapOut;               /* Number of mmap pages currently outstanding */
+  PgHdr *pMmapFreelist;       /* List of free mmap page headers (pDirty) */
   /*
   ** End of the routinely-changing class members
   ***************************************************************************/
@@ -665,6 +690,9 @@ struct Pager {
   int pageSize;               /* Number of bytes in a page */
   Pgno mxPgno;                /* Maximum allowed size of the database */
   i64 journalSizeLimit;       /* Size limit for persistent journal files */
+  sqlite3_int64 szMmap;       /* Desired maximum mmap size */
+  int nGroupCommit;           /* WAL group commit window in us, or -1 */
+  int szChunk;                /* Growth increment for db, journal and WAL */
   char *zFilename;            /* Name of the database file */
   char *zJournal;             /* Name of the journal file */
   int (*xBusyHandler)(void*); /* Function to call when busy */
@@ -685,6 +713,7 @@ struct Pager {
 #ifndef SQLITE_OMIT_WAL
   Wal *pWal;                  /* Write-ahead log used by "journal_mode=wal" */
   char *zWal;                 /* File name for write-ahead log */
+  char *zWal2;                /* File name for second log of "wal2" mode */
 #endif
 };
 
@@ -697,6 +726,8 @@ struct Pager {
 int sqlite3_pager_readdb_count = 0;    /* Number of full pages read from DB */
 int sqlite3_pager_writedb_count = 0;   /* Number of full pages written to DB */
 int sqlite3_pager_writej_count = 0;    /* Number of pages written to journal */
+int sqlite3_pager_readahead_count = 0; /* Number of pages hinted to the VFS */
+int sqlite3_pager_writev_count = 0;    /* Number of sqlite3OsWritev() calls */
 # define PAGER_INCR(v)  v++
 #else
 # define PAGER_INCR(v)
@@ -774,6 +805,16 @@ static const unsigned char aJournalMagic[] = {
 */
 #define isOpen(pFd) ((pFd)->pMethods)
 
+/*
+** True if the pager may return pages that point directly into a
+** memory-mapped region of the database file.
+*/
+#if SQLITE_MAX_MMAP_SIZE>0
+# define USEFETCH(x) ((x)->bUseFetch)
+#else
+# define USEFETCH(x) 0
+#endif
+
 /*
 ** Return true if this pager uses a write-ahead log instead of the usual
 ** rollback journal. Otherwise false.
@@ -790,6 +831,13 @@ static int pagerUseWal(Pager *pPager){
 # define pagerBeginReadTransaction(z) SQLITE_OK
 #endif
 
+/*
+** Return true if journal mode x is one of the write-ahead log modes,
+** "wal" or "wal2".
+*/
+#define isWalMode(x) \
+  ((x)==PAGER_JOURNALMODE_WAL || (x)==PAGER_JOURNALMODE_WAL2)
+
 #ifndef NDEBUG 
 /*
 ** Usage:
@@ -885,7 +933,7 @@ static int assert_pager_state(Pager *p){
         assert( p->eLock>=RESERVED_LOCK );
         assert( isOpen(p->jfd) 
              || p->journalMode==PAGER_JOURNALMODE_OFF 
-             || p->journalMode==PAGER_JOURNALMODE_WAL 
+             || isWalMode(p->journalMode)
         );
       }
       assert( pPager->dbOrigSize==pPager->dbFileSize );
@@ -899,7 +947,7 @@ static int assert_pager_state(Pager *p){
       assert( p->eLock>=EXCLUSIVE_LOCK );
       assert( isOpen(p->jfd) 
            || p->journalMode==PAGER_JOURNALMODE_OFF 
-           || p->journalMode==PAGER_JOURNALMODE_WAL 
+           || isWalMode(p->journalMode)
       );
       assert( pPager->dbOrigSize<=pPager->dbHintSize );
       break;
@@ -910,7 +958,7 @@ static int assert_pager_state(Pager *p){
       assert( !pagerUseWal(pPager) );
       assert( isOpen(p->jfd) 
            || p->journalMode==PAGER_JOURNALMODE_OFF 
-           || p->journalMode==PAGER_JOURNALMODE_WAL 
+           || isWalMode(p->journalMode)
       );
       break;
 
@@ -967,7 +1015,8 @@ static char *print_pager_state(Pager *p){
         p->journalMode==PAGER_JOURNALMODE_DELETE   ? "delete" :
         p->journalMode==PAGER_JOURNALMODE_PERSIST  ? "persist" :
         p->journalMode==PAGER_JOURNALMODE_TRUNCATE ? "truncate" :
-        p->journalMode==PAGER_JOURNALMODE_WAL      ? "wal" : "?error?"
+        p->journalMode==PAGER_JOURNALMODE_WAL      ? "wal" :
+        p->journalMode==PAGER_JOURNALMODE_WAL2     ? "wal2" : "?error?"
       , (int)p->tempFile, (int)p->memDb, (int)p->useJournal
       , p->journalOff, p->journalHdr
       , (int)p->dbSize, (int)p->dbOrigSize, (int)p->dbFileSize
@@ -1556,6 +1605,18 @@ static int readJournalHdr(
 }
 
 
+/*
+** Pass the configured growth increment, Pager.szChunk, to file pFile
+** using SQLITE_FCNTL_CHUNK_SIZE.  In-memory journals do not implement
+** xFileControl, so they are skipped.
+*/
+static void pagerSetChunkSize(Pager *pPager, sqlite3_file *pFile){
+  if( isOpen(pFile) && pFile->pMethods->xFileControl ){
+    int sz = pPager->szChunk;
+    sqlite3OsFileControl(pFile, SQLITE_FCNTL_CHUNK_SIZE, &sz);
+  }
+}
+
 /*
 ** Write the supplied master journal name into the journal file for pager
 ** pPager at the current location. The master journal name must be the last
@@ -1629,13 +1690,22 @@ static int writeMasterJournal(Pager *pPager, const char *zMaster){
   ** will not be able to find the master-journal name to determine 
   ** whether or not the journal is hot. 
   **
-  ** Easiest thing to do in this scenario is to truncate the journal 
+  ** Easiest thing to do in this scenario is to truncate the journal
   ** file to the required size.
-  */ 
+  **
+  ** The journal also extends past the master-journal name if a chunk size
+  ** is configured, and truncating it would round the size up to a whole
+  ** chunk again. So the chunk size is cleared for the truncation.
+  */
   if( SQLITE_OK==(rc = sqlite3OsFileSize(pPager->jfd, &jrnlSize))
    && jrnlSize>pPager->journalOff
   ){
+    if( pPager->szChunk && pPager->jfd->pMethods->xFileControl ){
+      int sz = 0;
+      sqlite3OsFileControl(pPager->jfd, SQLITE_FCNTL_CHUNK_SIZE, &sz);
+    }
     rc = sqlite3OsTruncate(pPager->jfd, pPager->journalOff);
+    pagerSetChunkSize(pPager, pPager->jfd);
   }
   return rc;
 }
@@ -1729,6 +1799,7 @@ static void pager_unlock(Pager *pPager){
   sqlite3BitvecDestroy(pPager->pInJournal);
   pPager->pInJournal = 0;
   releaseAllSavepoints(pPager);
+  sqlite3PagerEndConcurrent(pPager);
 
   if( pagerUseWal(pPager) ){
     assert( !isOpen(pPager->jfd) );
@@ -1919,7 +1990,7 @@ static int pager_end_transaction(Pager *pPager, int hasMaster){
       }
       pPager->journalOff = 0;
     }else if( pPager->journalMode==PAGER_JOURNALMODE_PERSIST
-      || (pPager->exclusiveMode && pPager->journalMode!=PAGER_JOURNALMODE_WAL)
+      || (pPager->exclusiveMode && !isWalMode(pPager->journalMode))
     ){
       rc = zeroJournalHdr(pPager, hasMaster);
       pPager->journalOff = 0;
@@ -1931,7 +2002,7 @@ static int pager_end_transaction(Pager *pPager, int hasMaster){
       */
       assert( pPager->journalMode==PAGER_JOURNALMODE_DELETE 
            || pPager->journalMode==PAGER_JOURNALMODE_MEMORY 
-           || pPager->journalMode==PAGER_JOURNALMODE_WAL 
+           || isWalMode(pPager->journalMode)
       );
       sqlite3OsClose(pPager->jfd);
       if( !pPager->tempFile ){
@@ -2777,17 +2848,20 @@ end_playback:
 ** pPg->pData. A shared lock or greater must be held on the database
 ** file before this function is called.
 **
+** If iFrame is non-zero, it is the frame of the write-ahead log that
+** holds the current content of the page (see sqlite3WalFindFrame()).
+** Otherwise the page is read from the database file.
+**
 ** If page 1 is read, then the value of Pager.dbFileVers[] is set to
 ** the value read from the database file.
 **
 ** If an IO error occurs, then the IO error is returned to the caller.
 ** Otherwise, SQLITE_OK is returned.
 */
-static int readDbPage(PgHdr *pPg){
+static int readDbPage(PgHdr *pPg, u32 iFrame){
   Pager *pPager = pPg->pPager; /* Pager object associated with page pPg */
   Pgno pgno = pPg->pgno;       /* Page number to read */
   int rc = SQLITE_OK;          /* Return code */
-  int isInWal = 0;             /* True if page is in log file */
   int pgsz = pPager->pageSize; /* Number of bytes to read */
 
   assert( pPager->eState>=PAGER_READER && !MEMDB );
@@ -2799,11 +2873,10 @@ static int readDbPage(PgHdr *pPg){
     return SQLITE_OK;
   }
 
-  if( pagerUseWal(pPager) ){
-    /* Try to pull the page from the write-ahead log. */
-    rc = sqlite3WalRead(pPager->pWal, pgno, &isInWal, pgsz, pPg->pData);
-  }
-  if( rc==SQLITE_OK && !isInWal ){
+  if( iFrame ){
+    /* Pull the page from the write-ahead log. */
+    rc = sqlite3WalReadFrame(pPager->pWal, iFrame, pgsz, pPg->pData);
+  }else{
     i64 iOffset = (pgno-1)*(i64)pPager->pageSize;
     rc = sqlite3OsRead(pPager->fd, pPg->pData, pgsz, iOffset);
     if( rc==SQLITE_IOERR_SHORT_READ ){
@@ -2865,7 +2938,11 @@ static int pagerUndoCallback(void *pCtx, Pgno iPg){
     if( sqlite3PcachePageRefcount(pPg)==1 ){
       sqlite3PcacheDrop(pPg);
     }else{
-      rc = readDbPage(pPg);
+      u32 iFrame = 0;
+      rc = sqlite3WalFindFrame(pPager->pWal, pPg->pgno, &iFrame);
+      if( rc==SQLITE_OK ){
+        rc = readDbPage(pPg, iFrame);
+      }
       if( rc==SQLITE_OK ){
         pPager->xReiniter(pPg);
       }
@@ -3035,15 +3112,33 @@ static int pagerPagecount(Pager *pPager, Pgno *pnPage){
 }
 
 #ifndef SQLITE_OMIT_WAL
+/*
+** Set *pbWal2 to true if the write-version field of the database header
+** in the database file indicates a "wal2" database, or false otherwise.
+** The log files cannot be used to tell, as both may be empty.
+**
+** The database header in the file is always up to date in this respect,
+** as journal mode changes that modify it are made with a rollback journal.
+*/
+static int pagerIsWal2(Pager *pPager, int *pbWal2){
+  u8 iVersion = 0;
+  int rc = sqlite3OsRead(pPager->fd, &iVersion, 1, 19);
+  if( rc==SQLITE_IOERR_SHORT_READ ) rc = SQLITE_OK;
+  *pbWal2 = (iVersion==3);
+  return rc;
+}
+
 /*
 ** Check if the *-wal file that corresponds to the database opened by pPager
 ** exists if the database is not empy, or verify that the *-wal file does
-** not exist (by deleting it) if the database file is empty.
+** not exist (by deleting it) if the database file is empty.  The same
+** goes for the *-wal2 file used by journal_mode=wal2.
 **
-** If the database is not empty and the *-wal file exists, open the pager
-** in WAL mode.  If the database is empty or if no *-wal file exists and
-** if no error occurs, make sure Pager.journalMode is not set to
-** PAGER_JOURNALMODE_WAL.
+** If the database is not empty and the *-wal or *-wal2 file exists, open
+** the pager in WAL mode, using both files if the database header says
+** that this is a wal2 database.  If the database is empty or if neither
+** file exists and if no error occurs, make sure Pager.journalMode is not
+** set to PAGER_JOURNALMODE_WAL or PAGER_JOURNALMODE_WAL2.
 **
 ** Return SQLITE_OK or an error code.
 **
@@ -3059,24 +3154,35 @@ static int pagerOpenWalIfPresent(Pager *pPager){
   assert( pPager->eLock>=SHARED_LOCK || pPager->noReadlock );
 
   if( !pPager->tempFile ){
-    int isWal;                    /* True if WAL file exists */
+    int isWal = 0;                /* True if WAL file exists */
+    int isWal2 = 0;               /* True if second WAL file exists */
     Pgno nPage;                   /* Size of the database file */
 
     rc = pagerPagecount(pPager, &nPage);
     if( rc ) return rc;
     if( nPage==0 ){
       rc = sqlite3OsDelete(pPager->pVfs, pPager->zWal, 0);
-      isWal = 0;
+      if( rc==SQLITE_OK ){
+        rc = sqlite3OsDelete(pPager->pVfs, pPager->zWal2, 0);
+      }
     }else{
       rc = sqlite3OsAccess(
           pPager->pVfs, pPager->zWal, SQLITE_ACCESS_EXISTS, &isWal
       );
+      if( rc==SQLITE_OK ){
+        rc = sqlite3OsAccess(
+            pPager->pVfs, pPager->zWal2, SQLITE_ACCESS_EXISTS, &isWal2
+        );
+      }
     }
     if( rc==SQLITE_OK ){
-      if( isWal ){
+      if( isWal || isWal2 ){
         testcase( sqlite3PcachePagecount(pPager->pPCache)==0 );
-        rc = sqlite3PagerOpenWal(pPager, 0);
-      }else if( pPager->journalMode==PAGER_JOURNALMODE_WAL ){
+        rc = pagerIsWal2(pPager, &isWal2);
+        if( rc==SQLITE_OK ){
+          rc = sqlite3PagerOpenWal(pPager, isWal2, 0);
+        }
+      }else if( isWalMode(pPager->journalMode) ){
         pPager->journalMode = PAGER_JOURNALMODE_DELETE;
       }
     }
@@ -3236,6 +3342,140 @@ void sqlite3PagerSetCachesize(Pager *pPager, int mxPage){
   sqlite3PcacheSetCachesize(pPager->pPCache, mxPage);
 }
 
+/*
+** Invoke SQLITE_FCNTL_MMAP_SIZE based on the current value of szMmap,
+** and recompute Pager.bUseFetch.  Memory-mapped pages are never used
+** for temporary or in-memory databases, or if a codec is attached,
+** since the codec needs a private copy of each page to decode.  Nor
+** are they used by "PRAGMA omit_readlock" connections.  Without a read
+** lock, the content of a mapped page could change while it is in use.
+*/
+static void pagerFixMaplimit(Pager *pPager){
+#if SQLITE_MAX_MMAP_SIZE>0
+  sqlite3_file *fd = pPager->fd;
+  pPager->bUseFetch = 0;
+  if( isOpen(fd) && fd->pMethods->iVersion>=3
+   && !pPager->tempFile && !pPager->noReadlock
+#ifdef SQLITE_HAS_CODEC
+   && pPager->xCodec==0
+#endif
+  ){
+    sqlite3_int64 sz = pPager->szMmap;
+    if( sqlite3OsFileControl(fd, SQLITE_FCNTL_MMAP_SIZE, &sz)==SQLITE_OK ){
+      pPager->szMmap = sz;
+      pPager->bUseFetch = (sz>0);
+    }
+  }
+#else
+  UNUSED_PARAMETER(pPager);
+#endif
+}
+
+/*
+** Get/set the increment by which the database file, rollback journal and
+** WAL file are grown.  Once set, a write that extends one of these files
+** first extends it to a multiple of szChunk bytes, and truncating the
+** database leaves it a multiple of szChunk bytes long.  Zero restores the
+** default behaviour of growing each file one write at a time.  A negative
+** value leaves the setting unchanged.  The current value is returned.
+*/
+int sqlite3PagerChunkSize(Pager *pPager, int szChunk){
+  if( szChunk>=0 ){
+    pPager->szChunk = szChunk;
+    pagerSetChunkSize(pPager, pPager->fd);
+    pagerSetChunkSize(pPager, pPager->jfd);
+#ifndef SQLITE_OMIT_WAL
+    if( pPager->pWal ){
+      pagerSetChunkSize(pPager, sqlite3WalFile(pPager->pWal));
+    }
+#endif
+  }
+  return pPager->szChunk;
+}
+
+/*
+** Change the maximum number of bytes of the database file that may be
+** memory-mapped.  A value of zero disables memory-mapped reads.  A
+** negative value leaves the limit unchanged.  The limit in effect is
+** returned.
+*/
+sqlite3_int64 sqlite3PagerMmapLimit(Pager *pPager, sqlite3_int64 szMmap){
+  if( szMmap>=0 ){
+    pPager->szMmap = szMmap;
+    pagerFixMaplimit(pPager);
+  }
+  return pPager->szMmap;
+}
+
+#if SQLITE_MAX_MMAP_SIZE>0
+/*
+** Obtain a page header for page pgno, whose content is the nPageSize
+** bytes at pData within the memory mapping of the database file.  The
+** header is taken from Pager.pMmapFreelist if possible.  The space for
+** the extra data the btree layer keeps alongside each page is zeroed, so
+** the btree will reinitialize its view of the page before using it.
+*/
+static int pagerAcquireMapPage(
+  Pager *pPager,                  /* Pager object */
+  Pgno pgno,                      /* Page number */
+  void *pData,                    /* xFetch()'d data for this page */
+  PgHdr **ppPage                  /* OUT: Acquired page object */
+){
+  PgHdr *p;
+  if( pPager->pMmapFreelist ){
+    p = pPager->pMmapFreelist;
+    pPager->pMmapFreelist = p->pDirty;
+    p->pDirty = 0;
+    memset(p->pExtra, 0, pPager->nExtra);
+  }else{
+    p = (PgHdr *)sqlite3MallocZero(sizeof(PgHdr) + pPager->nExtra);
+    if( p==0 ){
+      sqlite3OsUnfetch(pPager->fd, (i64)(pgno-1) * pPager->pageSize, pData);
+      return SQLITE_NOMEM;
+    }
+    p->pExtra = (void *)&p[1];
+  }
+  p->flags = PGHDR_MMAP;
+  p->nRef = 1;
+  p->pPager = pPager;
+  p->pgno = pgno;
+  p->pData = pData;
+  pPager->nMmapOut++;
+  *ppPage = p;
+  return SQLITE_OK;
+}
+
+/*
+** Release a reference to page pPg. pPg must have been returned by an 
+** earlier call to pagerAcquireMapPage().
+*/
+static void pagerReleaseMapPage(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  assert( pPg->flags & PGHDR_MMAP );
+  assert( pPg->nRef==0 );
+  pPager->nMmapOut--;
+  pPg->pDirty = pPager->pMmapFreelist;
+  pPager->pMmapFreelist = pPg;
+  sqlite3OsUnfetch(pPager->fd, (i64)(pPg->pgno-1)*pPager->pageSize, pPg->pData);
+}
+
+/*
+** Free all PgHdr objects stored in the Pager.pMmapFreelist list.
+*/
+static void pagerFreeMapHdrs(Pager *pPager){
+  PgHdr *p;
+  PgHdr *pNext;
+  for(p=pPager->pMmapFreelist; p; p=pNext){
+    pNext = p->pDirty;
+    sqlite3_free(p);
+  }
+  pPager->pMmapFreelist = 0;
+}
+#else
+# define pagerReleaseMapPage(x)
+# define pagerFreeMapHdrs(x)
+#endif /* SQLITE_MAX_MMAP_SIZE>0 */
+
 /*
 ** Adjust the robustness of the database to damage due to OS crashes
 ** or power failures by changing the number of syncs()s when writing
@@ -3389,6 +3629,7 @@ int sqlite3PagerSetPagesize(Pager *pPager, u32 *pPageSize, int nReserve){
   assert( pageSize==0 || (pageSize>=512 && pageSize<=SQLITE_MAX_PAGE_SIZE) );
   if( (pPager->memDb==0 || pPager->dbSize==0)
    && sqlite3PcacheRefCount(pPager->pPCache)==0 
+   && pPager->nMmapOut==0
    && pageSize && pageSize!=(u32)pPager->pageSize 
   ){
     char *pNew = NULL;             /* New temp space */
@@ -3682,6 +3923,7 @@ int sqlite3PagerClose(Pager *pPager){
   enable_simulated_io_errors();
   PAGERTRACE(("CLOSE %d\n", PAGERID(pPager)));
   IOTRACE(("CLOSE %p\n", pPager))
+  pagerFreeMapHdrs(pPager);
   sqlite3OsClose(pPager->jfd);
   sqlite3OsClose(pPager->fd);
   sqlite3PageFree(pTmp);
@@ -3711,7 +3953,12 @@ Pgno sqlite3PagerPagenumber(DbPage *pPg){
 ** Increment the reference count for page pPg.
 */
 void sqlite3PagerRef(DbPage *pPg){
-  sqlite3PcacheRef(pPg);
+  if( pPg->flags & PGHDR_MMAP ){
+    assert( pPg->nRef>0 );
+    pPg->nRef++;
+  }else{
+    sqlite3PcacheRef(pPg);
+  }
 }
 
 /*
@@ -3860,6 +4107,63 @@ static int syncJournal(Pager *pPager, int newHdr){
   return SQLITE_OK;
 }
 
+/*
+** The maximum number of pages written to the database file by a single
+** call to sqlite3OsWritev() in pager_write_pagelist().
+*/
+#define PAGER_MAX_WRITEV 64
+
+/*
+** Write the nPg pages in apPg[], which must have consecutive page numbers,
+** to the database file using a single call to sqlite3OsWritev().
+**
+** If page 1 is written, Pager.dbFileVers is updated to match the value
+** now stored in the database file. If writing the pages causes the
+** database file to grow, Pager.dbFileSize is updated.
+*/
+static int pagerWriteRun(Pager *pPager, PgHdr **apPg, int nPg){
+  const void *apData[PAGER_MAX_WRITEV];          /* Data to write */
+  i64 offset = (apPg[0]->pgno-1)*(i64)pPager->pageSize;   /* Offset to write */
+  int rc;                                        /* Return code */
+  int i;
+
+  assert( nPg>0 && nPg<=PAGER_MAX_WRITEV );
+  for(i=0; i<nPg; i++){
+    char *pData;
+    assert( (apPg[i]->flags&PGHDR_NEED_SYNC)==0 );
+    assert( i==0 || apPg[i]->pgno==apPg[i-1]->pgno+1 );
+
+    /* Encode the database */
+    CODEC2(pPager, apPg[i]->pData, apPg[i]->pgno, 6, return SQLITE_NOMEM, pData);
+    apData[i] = pData;
+  }
+
+  /* Write out the page data. */
+  rc = sqlite3OsWritev(pPager->fd, apData, nPg, pPager->pageSize, offset);
+  PAGER_INCR(sqlite3_pager_writev_count);
+
+  for(i=0; i<nPg; i++){
+    Pgno pgno = apPg[i]->pgno;
+    if( pgno==1 ){
+      memcpy(&pPager->dbFileVers, &((u8*)apData[i])[24],
+             sizeof(pPager->dbFileVers));
+    }
+    if( pgno>pPager->dbFileSize ){
+      pPager->dbFileSize = pgno;
+    }
+
+    /* Update any backup objects copying the contents of this pager. */
+    sqlite3BackupUpdate(pPager->pBackup, pgno, (u8*)apPg[i]->pData);
+
+    PAGERTRACE(("STORE %d page %d hash(%08x)\n",
+                 PAGERID(pPager), pgno, pager_pagehash(apPg[i])));
+    IOTRACE(("PGOUT %p %d\n", pPager, pgno));
+    PAGER_INCR(sqlite3_pager_writedb_count);
+    PAGER_INCR(pPager->nWrite);
+  }
+  return rc;
+}
+
 /*
 ** The argument is the first in a linked list of dirty pages connected
 ** by the PgHdr.pDirty pointer. This function writes each one of the
@@ -3877,8 +4181,9 @@ static int syncJournal(Pager *pPager, int newHdr){
 ** written out.
 **
 ** Once the lock has been upgraded and, if necessary, the file opened,
-** the pages are written out to the database file in list order. Writing
-** a page is skipped if it meets either of the following criteria:
+** the pages are written out to the database file in list order, each
+** run of consecutive pages using a single call to sqlite3OsWritev().
+** Writing a page is skipped if it meets either of the following criteria:
 **
 **   * The page number is greater than Pager.dbSize, or
 **   * The PGHDR_DONT_WRITE flag is set on the page.
@@ -3894,6 +4199,9 @@ static int syncJournal(Pager *pPager, int newHdr){
 */
 static int pager_write_pagelist(Pager *pPager, PgHdr *pList){
   int rc = SQLITE_OK;                  /* Return code */
+  PgHdr *apRun[PAGER_MAX_WRITEV];      /* Run of consecutive pages to write */
+  int nRun = 0;                        /* Number of pages in apRun[] */
+  int nRunMax = PAGER_MAX_WRITEV;      /* Maximum pages in apRun[] */
 
   /* This function is only called for rollback pagers in WRITER_DBMOD state. */
   assert( !pagerUseWal(pPager) );
@@ -3919,6 +4227,12 @@ static int pager_write_pagelist(Pager *pPager, PgHdr *pList){
     pPager->dbHintSize = pPager->dbSize;
   }
 
+#ifdef SQLITE_HAS_CODEC
+  /* A codec may return the encoded page in a buffer that is reused by
+  ** the next call, so pages are written one at a time. */
+  if( pPager->xCodec ) nRunMax = 1;
+#endif
+
   while( rc==SQLITE_OK && pList ){
     Pgno pgno = pList->pgno;
 
@@ -3929,44 +4243,26 @@ static int pager_write_pagelist(Pager *pPager, PgHdr *pList){
     **
     ** Also, do not write out any page that has the PGHDR_DONT_WRITE flag
     ** set (set by sqlite3PagerDontWrite()).
+    **
+    ** Pages that are written are collected in apRun[] until a page that 
+    ** does not immediately follow the last one is found. The run is then
+    ** written out by a single call to pagerWriteRun().
     */
     if( pgno<=pPager->dbSize && 0==(pList->flags&PGHDR_DONT_WRITE) ){
-      i64 offset = (pgno-1)*(i64)pPager->pageSize;   /* Offset to write */
-      char *pData;                                   /* Data to write */    
-
-      assert( (pList->flags&PGHDR_NEED_SYNC)==0 );
-
-      /* Encode the database */
-      CODEC2(pPager, pList->pData, pgno, 6, return SQLITE_NOMEM, pData);
-
-      /* Write out the page data. */
-      rc = sqlite3OsWrite(pPager->fd, pData, pPager->pageSize, offset);
-
-      /* If page 1 was just written, update Pager.dbFileVers to match
-      ** the value now stored in the database file. If writing this 
-      ** page caused the database file to grow, update dbFileSize. 
-      */
-      if( pgno==1 ){
-        memcpy(&pPager->dbFileVers, &pData[24], sizeof(pPager->dbFileVers));
-      }
-      if( pgno>pPager->dbFileSize ){
-        pPager->dbFileSize = pgno;
+      if( nRun>0 && (nRun==nRunMax || pgno!=apRun[nRun-1]->pgno+1) ){
+        rc = pagerWriteRun(pPager, apRun, nRun);
+        nRun = 0;
       }
-
-      /* Update any backup objects copying the contents of this pager. */
-      sqlite3BackupUpdate(pPager->pBackup, pgno, (u8*)pList->pData);
-
-      PAGERTRACE(("STORE %d page %d hash(%08x)\n",
-                   PAGERID(pPager), pgno, pager_pagehash(pList)));
-      IOTRACE(("PGOUT %p %d\n", pPager, pgno));
-      PAGER_INCR(sqlite3_pager_writedb_count);
-      PAGER_INCR(pPager->nWrite);
+      apRun[nRun++] = pList;
     }else{
       PAGERTRACE(("NOSTORE %d page %d\n", PAGERID(pPager), pgno));
     }
     pager_set_pagehash(pList);
     pList = pList->pDirty;
   }
+  if( rc==SQLITE_OK && nRun>0 ){
+    rc = pagerWriteRun(pPager, apRun, nRun);
+  }
 
   return rc;
 }
@@ -4076,6 +4372,9 @@ static int pagerStress(void *p, PgHdr *pPg){
   ** The doNotSpill flag inhibits all cache spilling regardless of whether
   ** or not a sync is required.  This is set during a rollback.
   **
+  ** A BEGIN CONCURRENT transaction does not spill either, as it may not
+  ** write to the log until it holds the WAL WRITER lock at commit time.
+  **
   ** Spilling is also prohibited when in an error state since that could
   ** lead to database corruption.   In the current implementaton it 
   ** is impossible for sqlite3PCacheFetch() to be called with createFlag==1
@@ -4084,7 +4383,7 @@ static int pagerStress(void *p, PgHdr *pPg){
   ** test for the error state as a safeguard against future changes.
   */
   if( NEVER(pPager->errCode) ) return SQLITE_OK;
-  if( pPager->doNotSpill ) return SQLITE_OK;
+  if( pPager->doNotSpill || pPager->pReadSet ) return SQLITE_OK;
   if( pPager->doNotSyncSpill && (pPg->flags & PGHDR_NEED_SYNC)!=0 ){
     return SQLITE_OK;
   }
@@ -4283,6 +4582,7 @@ int sqlite3PagerOpen(
     nPathname + 8 + 1              /* zJournal */
 #ifndef SQLITE_OMIT_WAL
     + nPathname + 4 + 1              /* zWal */
+    + nPathname + 5 + 1              /* zWal2 */
 #endif
   );
   assert( EIGHT_BYTE_ALIGNMENT(SQLITE_INT_TO_PTR(journalFileSize)) );
@@ -4309,6 +4609,9 @@ int sqlite3PagerOpen(
     pPager->zWal = &pPager->zJournal[nPathname+8+1];
     memcpy(pPager->zWal, zPathname, nPathname);
     memcpy(&pPager->zWal[nPathname], "-wal", 4);
+    pPager->zWal2 = &pPager->zWal[nPathname+4+1];
+    memcpy(pPager->zWal2, zPathname, nPathname);
+    memcpy(&pPager->zWal2[nPathname], "-wal2", 5);
 #endif
     sqlite3_free(zPathname);
   }
@@ -4395,6 +4698,15 @@ int sqlite3PagerOpen(
   nExtra = ROUND8(nExtra);
   sqlite3PcacheOpen(szPageDflt, nExtra, !memDb,
                     !memDb?pagerStress:0, (void *)pPager, pPager->pPCache);
+#if SQLITE_DIRECT_IO_ALIGN>0
+  /* If the database file is open for direct I/O, align the page buffers
+  ** so that pages can be read and written without a copy. */
+  if( isOpen(pPager->fd) ){
+    int bDirect = 0;
+    sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_DIRECT_IO, &bDirect);
+    if( bDirect ) sqlite3PcacheSetAligned(pPager->pPCache);
+  }
+#endif
 
   PAGERTRACE(("OPEN %d %s\n", FILEHANDLEID(pPager->fd), pPager->zFilename));
   IOTRACE(("OPEN %p %s\n", pPager, pPager->zFilename))
@@ -4430,8 +4742,15 @@ int sqlite3PagerOpen(
   /* pPager->pLast = 0; */
   pPager->nExtra = (u16)nExtra;
   pPager->journalSizeLimit = SQLITE_DEFAULT_JOURNAL_SIZE_LIMIT;
+  pPager->nGroupCommit = -1;
   assert( isOpen(pPager->fd) || tempFile );
   setSectorSize(pPager);
+  pPager->szMmap = SQLITE_DEFAULT_MMAP_SIZE;
+  pagerFixMaplimit(pPager);
+  pPager->szChunk = SQLITE_DEFAULT_CHUNK_SIZE;
+  if( pPager->szChunk ){
+    pagerSetChunkSize(pPager, pPager->fd);
+  }
   if( !useJournal ){
     pPager->journalMode = PAGER_JOURNALMODE_OFF;
   }else if( memDb ){
@@ -4799,6 +5118,120 @@ int sqlite3PagerSharedLock(Pager *pPager){
   return rc;
 }
 
+#ifndef SQLITE_OMIT_WAL
+/*
+** Start a transaction opened by BEGIN CONCURRENT. This is called by the
+** btree layer when the read transaction is opened, before any pages other
+** than page 1 have been read.  If the pager is not in WAL mode, or is in
+** locking_mode=exclusive, it is a no-op and the transaction behaves as 
+** one opened by BEGIN DEFERRED.
+**
+** Otherwise, the set of pages read by the transaction is recorded from
+** now on.  When the transaction writes, no WAL write lock is taken and no
+** frames are written to the log until it commits.
+*/
+int sqlite3PagerBeginConcurrent(Pager *pPager){
+  int rc = SQLITE_OK;
+  if( pagerUseWal(pPager) && !pPager->exclusiveMode && !pPager->pReadSet ){
+    assert( pPager->eState==PAGER_READER );
+    pPager->pReadSet = sqlite3BitvecCreate(pPager->mxPgno);
+    if( pPager->pReadSet==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      rc = sqlite3BitvecSet(pPager->pReadSet, 1);
+    }
+  }
+  return rc;
+}
+
+/*
+** Stop recording the pages read by a BEGIN CONCURRENT transaction. This 
+** is called when the transaction has been committed or rolled back.
+*/
+void sqlite3PagerEndConcurrent(Pager *pPager){
+  sqlite3BitvecDestroy(pPager->pReadSet);
+  pPager->pReadSet = 0;
+}
+
+/*
+** Add page pgno to the set of pages read by the current BEGIN CONCURRENT
+** transaction, if any.
+*/
+static int pagerAddToReadSet(Pager *pPager, Pgno pgno){
+  Bitvec *p = pPager->pReadSet;
+  if( p && pgno<=sqlite3BitvecSize(p) ){
+    return sqlite3BitvecSet(p, pgno);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** This is the callback passed to sqlite3WalLockForCommit(). It is invoked
+** for each page written to the log by other connections since the
+** snapshot of the BEGIN CONCURRENT transaction was taken.
+**
+** If the transaction read page iPg, it cannot be committed.  Otherwise,
+** any copy of the page in the cache is out of date.  It is discarded so 
+** that the current version is read from the log when next it is needed.
+*/
+static int pagerConcurrentPage(void *pCtx, Pgno iPg){
+  Pager *pPager = (Pager *)pCtx;
+  PgHdr *pPg = 0;
+
+  if( sqlite3BitvecTest(pPager->pReadSet, iPg) ){
+    return SQLITE_BUSY_SNAPSHOT;
+  }
+  sqlite3PcacheFetch(pPager->pPCache, iPg, 0, &pPg);
+  if( pPg ){
+    /* A page that was not read by this transaction cannot be referenced
+    ** by it, or it would be in the read-set.  */
+    assert( sqlite3PcachePageRefcount(pPg)==1 );
+    assert( (pPg->flags & PGHDR_DIRTY)==0 );
+    sqlite3PcacheDrop(pPg);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Obtain the WAL WRITER lock so that the BEGIN CONCURRENT transaction 
+** open on pager pPager may be committed, invoking the busy-handler while
+** another connection holds it.  Every page modified by the transaction is 
+** added to the read-set first, so that two transactions that modify the 
+** same page conflict even if it was never read by either.
+**
+** SQLITE_BUSY_SNAPSHOT is returned if another connection has committed a
+** change to a page in the read-set since the snapshot was taken.
+*/
+static int pagerLockForCommit(Pager *pPager){
+  int rc = SQLITE_OK;
+  PgHdr *pPg;
+
+  assert( pagerUseWal(pPager) && pPager->pReadSet );
+  pPg = sqlite3PcacheDirtyList(pPager->pPCache);
+  for(; rc==SQLITE_OK && pPg; pPg=pPg->pDirty){
+    rc = pagerAddToReadSet(pPager, pPg->pgno);
+  }
+  while( rc==SQLITE_OK ){
+    rc = sqlite3WalLockForCommit(pPager->pWal, pagerConcurrentPage, pPager);
+    if( rc!=SQLITE_BUSY || !pPager->xBusyHandler(pPager->pBusyHandlerArg) ){
+      break;
+    }
+    rc = SQLITE_OK;
+  }
+  return rc;
+}
+#else
+# define pagerAddToReadSet(x,y) SQLITE_OK
+# define pagerLockForCommit(x)  SQLITE_OK
+int sqlite3PagerBeginConcurrent(Pager *pPager){
+  UNUSED_PARAMETER(pPager);
+  return SQLITE_OK;
+}
+void sqlite3PagerEndConcurrent(Pager *pPager){
+  UNUSED_PARAMETER(pPager);
+}
+#endif
+
 /*
 ** If the reference count has reached zero, rollback any active
 ** transaction and unlock the pager.
@@ -4808,7 +5241,7 @@ int sqlite3PagerSharedLock(Pager *pPager){
 ** nothing to rollback, so this routine is a no-op.
 */ 
 static void pagerUnlockIfUnused(Pager *pPager){
-  if( (sqlite3PcacheRefCount(pPager->pPCache)==0) ){
+  if( pPager->nMmapOut==0 && sqlite3PcacheRefCount(pPager->pPCache)==0 ){
     pagerUnlockAndRollback(pPager);
   }
 }
@@ -4862,6 +5295,12 @@ static void pagerUnlockIfUnused(Pager *pPager){
 ** has to go to disk, and could also playback an old journal if necessary.
 ** Since Lookup() never goes to disk, it never has to deal with locks
 ** or journal files.
+**
+** If memory-mapped reads are enabled (see sqlite3PagerMmapLimit()), the
+** pager is in PAGER_READER state and the page is neither page 1, already
+** in the cache nor in the write-ahead log, then the page returned may
+** point directly into the mapping of the database file. Such a page must
+** not be written (it never is, since writing requires a write transaction).
 */
 int sqlite3PagerAcquire(
   Pager *pPager,      /* The pager open on the database file */
@@ -4871,6 +5310,15 @@ int sqlite3PagerAcquire(
 ){
   int rc;
   PgHdr *pPg;
+  u32 iFrame = 0;     /* Frame of the WAL holding the page, or 0 */
+
+  /* It is acceptable to use a read-only (mmap) page for any page except
+  ** page 1 so long as there is no write-transaction open and the caller
+  ** wants the page content.  USEFETCH() is never true for temporary or
+  ** in-memory databases.  */
+  const int bMmapOk = (pgno!=1 && USEFETCH(pPager)
+   && pPager->eState==PAGER_READER && !noContent
+  );
 
   assert( pPager->eState>=PAGER_READER );
   assert( assert_pager_state(pPager) );
@@ -4884,6 +5332,46 @@ int sqlite3PagerAcquire(
   if( pPager->errCode!=SQLITE_OK ){
     rc = pPager->errCode;
   }else{
+    rc = pagerAddToReadSet(pPager, pgno);
+    if( rc!=SQLITE_OK ){
+      pPg = 0;
+      goto pager_acquire_err;
+    }
+#if SQLITE_MAX_MMAP_SIZE>0
+    if( bMmapOk && pgno<=pPager->dbSize && pgno!=PAGER_MJ_PGNO(pPager) ){
+      pPg = 0;
+      if( pagerUseWal(pPager) ){
+        rc = sqlite3WalFindFrame(pPager->pWal, pgno, &iFrame);
+        if( rc!=SQLITE_OK ){
+          pPg = 0;
+          goto pager_acquire_err;
+        }
+      }
+      if( iFrame==0 && (pPg = sqlite3PagerLookup(pPager, pgno))==0 ){
+        void *pData = 0;
+        rc = sqlite3OsFetch(pPager->fd, 
+            (i64)(pgno-1) * pPager->pageSize, pPager->pageSize, &pData
+        );
+        if( rc==SQLITE_OK && pData ){
+          rc = pagerAcquireMapPage(pPager, pgno, pData, &pPg);
+          if( rc==SQLITE_OK ){
+            *ppPage = pPg;
+            return SQLITE_OK;
+          }
+        }
+        if( rc!=SQLITE_OK ){
+          pPg = 0;
+          goto pager_acquire_err;
+        }
+      }
+      if( pPg ){
+        /* The page was already in the cache */
+        PAGER_INCR(pPager->nHit);
+        *ppPage = pPg;
+        return SQLITE_OK;
+      }
+    }
+#endif
     rc = sqlite3PcacheFetch(pPager->pPCache, pgno, 1, ppPage);
   }
 
@@ -4944,7 +5432,11 @@ int sqlite3PagerAcquire(
       IOTRACE(("ZERO %p %d\n", pPager, pgno));
     }else{
       assert( pPg->pPager==pPager );
-      rc = readDbPage(pPg);
+      if( pagerUseWal(pPager) && !bMmapOk ){
+        rc = sqlite3WalFindFrame(pPager->pWal, pgno, &iFrame);
+        if( rc!=SQLITE_OK ) goto pager_acquire_err;
+      }
+      rc = readDbPage(pPg, iFrame);
       if( rc!=SQLITE_OK ){
         goto pager_acquire_err;
       }
@@ -4982,10 +5474,145 @@ DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno){
   assert( pgno!=0 );
   assert( pPager->pPCache!=0 );
   assert( pPager->eState>=PAGER_READER && pPager->eState!=PAGER_ERROR );
-  sqlite3PcacheFetch(pPager->pPCache, pgno, 0, &pPg);
+  if( pagerAddToReadSet(pPager, pgno)==SQLITE_OK ){
+    sqlite3PcacheFetch(pPager->pPCache, pgno, 0, &pPg);
+  }
   return pPg;
 }
 
+/*
+** The maximum number of pages loaded by a single call to sqlite3OsSubmit()
+** from within sqlite3PagerReadahead().
+*/
+#define PAGER_READAHEAD_BATCH 32
+
+/*
+** Read the content of the nPg new pages in apPg[] from the database file,
+** using a single call to sqlite3OsSubmit().  Each page is then released,
+** leaving it clean in the cache, or dropped if it could not be read.
+** Return the error code of the first page that could not be read, or
+** SQLITE_OK.
+*/
+static int pagerReadaheadLoad(Pager *pPager, PgHdr **apPg, int nPg){
+  sqlite3_io_request aReq[PAGER_READAHEAD_BATCH];
+  int rc = SQLITE_OK;
+  int i;
+
+  assert( nPg>0 && nPg<=PAGER_READAHEAD_BATCH );
+  for(i=0; i<nPg; i++){
+    aReq[i].op = SQLITE_IOREQ_READ;
+    aReq[i].iAmt = pPager->pageSize;
+    aReq[i].iOfst = (apPg[i]->pgno-1)*(i64)pPager->pageSize;
+    aReq[i].pBuf = apPg[i]->pData;
+  }
+  sqlite3OsSubmit(pPager->fd, aReq, nPg);
+  for(i=0; i<nPg; i++){
+    PgHdr *pPg = apPg[i];
+    int rc2 = aReq[i].rc;
+    if( rc2==SQLITE_IOERR_SHORT_READ ) rc2 = SQLITE_OK;
+    CODEC1(pPager, pPg->pData, pPg->pgno, 3, rc2 = SQLITE_NOMEM);
+    if( rc2==SQLITE_OK ){
+      PAGER_INCR(sqlite3_pager_readdb_count);
+      PAGER_INCR(pPager->nRead);
+      IOTRACE(("PGIN %p %d\n", pPager, pPg->pgno));
+      pager_set_pagehash(pPg);
+      sqlite3PcacheRelease(pPg);
+    }else{
+      sqlite3PcacheDrop(pPg);
+      if( rc==SQLITE_OK ) rc = rc2;
+    }
+  }
+  return rc;
+}
+
+/*
+** The nPgno pages listed in aPgno[] are likely to be read soon.  Pages
+** that are already in the cache, that lie beyond the end of the database
+** image or that will be read from the WAL are skipped.
+**
+** If the VFS supports xSubmit and the pager holds only a read lock, the
+** remaining pages are loaded into the cache by batches of concurrent
+** reads.  Otherwise, each run of consecutive page numbers is passed to
+** the VFS as a single SQLITE_FCNTL_READAHEAD hint.  Page 1, which must
+** always be read by readDbPage(), is only ever hinted.
+**
+** Hints are purely advisory, and VFSes that do not understand the
+** file-control simply ignore it.  But if a page cannot be loaded because
+** of an I/O error, the error code is returned just as it would have been
+** by sqlite3PagerGet().  Otherwise, SQLITE_OK is returned.
+*/
+int sqlite3PagerReadahead(Pager *pPager, Pgno *aPgno, int nPgno){
+  const i64 szPage = pPager->pageSize;
+  i64 aHint[2];                   /* Offset and size of pending request */
+  PgHdr *apLoad[PAGER_READAHEAD_BATCH];   /* Pages to load */
+  int nLoad = 0;                  /* Number of entries in apLoad[] */
+  int bLoad;                      /* True to load pages using xSubmit */
+  int rc = SQLITE_OK;
+  int i;
+
+  assert( pPager->eState>=PAGER_READER );
+  if( MEMDB || !isOpen(pPager->fd) || pPager->errCode ) return SQLITE_OK;
+  bLoad = pPager->eState==PAGER_READER && !USEFETCH(pPager)
+       && pPager->fd->pMethods->iVersion>=5
+       && pPager->fd->pMethods->xSubmit!=0;
+
+  aHint[0] = aHint[1] = 0;
+  for(i=0; i<nPgno; i++){
+    Pgno pgno = aPgno[i];
+    PgHdr *pPg = 0;
+    i64 iOff;
+
+    if( pgno==0 || pgno>pPager->dbSize ) continue;
+    sqlite3PcacheFetch(pPager->pPCache, pgno, 0, &pPg);
+    if( pPg ){
+      sqlite3PcacheRelease(pPg);
+      continue;
+    }
+    if( pagerUseWal(pPager) ){
+      u32 iFrame = 0;
+      if( sqlite3WalFindFrame(pPager->pWal, pgno, &iFrame) || iFrame ) continue;
+    }
+
+    PAGER_INCR(sqlite3_pager_readahead_count);
+    if( bLoad && pgno!=1 && pgno!=PAGER_MJ_PGNO(pPager) ){
+      int rc2;
+      sqlite3BeginBenignMalloc();
+      rc2 = sqlite3PcacheFetch(pPager->pPCache, pgno, 1, &pPg);
+      sqlite3EndBenignMalloc();
+      if( rc2==SQLITE_OK ){
+        assert( pPg->pPager==0 );
+        pPg->pPager = pPager;
+        apLoad[nLoad++] = pPg;
+        if( nLoad==PAGER_READAHEAD_BATCH ){
+          rc2 = pagerReadaheadLoad(pPager, apLoad, nLoad);
+          if( rc==SQLITE_OK ) rc = rc2;
+          nLoad = 0;
+        }
+      }
+      continue;
+    }
+
+    iOff = (pgno-1)*szPage;
+    if( aHint[1]>0 && aHint[0]+aHint[1]==iOff ){
+      aHint[1] += szPage;
+    }else{
+      if( aHint[1]>0 ){
+        sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_READAHEAD, aHint);
+      }
+      aHint[0] = iOff;
+      aHint[1] = szPage;
+    }
+  }
+  if( nLoad>0 ){
+    int rc2 = pagerReadaheadLoad(pPager, apLoad, nLoad);
+    if( rc==SQLITE_OK ) rc = rc2;
+  }
+  if( aHint[1]>0 ){
+    sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_READAHEAD, aHint);
+  }
+  return rc;
+}
+
 /*
 ** Release a page reference.
 **
@@ -4997,7 +5624,14 @@ DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno){
 void sqlite3PagerUnref(DbPage *pPg){
   if( pPg ){
     Pager *pPager = pPg->pPager;
-    sqlite3PcacheRelease(pPg);
+    if( pPg->flags & PGHDR_MMAP ){
+      assert( pPg->nRef>0 );
+      if( --pPg->nRef==0 ){
+        pagerReleaseMapPage(pPg);
+      }
+    }else{
+      sqlite3PcacheRelease(pPg);
+    }
     pagerUnlockIfUnused(pPager);
   }
 }
@@ -5061,6 +5695,9 @@ static int pager_open_journal(Pager *pPager){
   #else
         rc = sqlite3OsOpen(pVfs, pPager->zJournal, pPager->jfd, flags, 0);
   #endif
+        if( rc==SQLITE_OK && pPager->szChunk ){
+          pagerSetChunkSize(pPager, pPager->jfd);
+        }
       }
       assert( rc!=SQLITE_OK || isOpen(pPager->jfd) );
     }
@@ -5133,8 +5770,15 @@ int sqlite3PagerBegin(Pager *pPager, int exFlag, int subjInMemory){
       ** PAGER_RESERVED state. Otherwise, return an error code to the caller.
       ** The busy-handler is not invoked if another connection already
       ** holds the write-lock. If possible, the upper layer will call it.
+      **
+      ** A BEGIN CONCURRENT transaction does not take the write lock until
+      ** it commits.
       */
-      rc = sqlite3WalBeginWriteTransaction(pPager->pWal);
+      if( pPager->pReadSet ){
+        rc = sqlite3WalBeginConcurrent(pPager->pWal);
+      }else{
+        rc = sqlite3WalBeginWriteTransaction(pPager->pWal);
+      }
     }else{
       /* Obtain a RESERVED lock on the database file. If the exFlag parameter
       ** is true, then immediately upgrade this to an EXCLUSIVE lock. The
@@ -5185,6 +5829,11 @@ static int pager_write(PgHdr *pPg){
   Pager *pPager = pPg->pPager;
   int rc = SQLITE_OK;
 
+  /* Memory-mapped pages are only handed out in PAGER_READER state, and
+  ** the btree layer saves all cursors holding such pages before it opens
+  ** a write transaction. So a page being written is never one of them. */
+  assert( (pPg->flags & PGHDR_MMAP)==0 );
+
   /* This routine is not called unless a write-transaction has already 
   ** been started. The journal file may or may not be open at this point.
   ** It is never called in the ERROR state.
@@ -5566,14 +6215,17 @@ int sqlite3PagerSync(Pager *pPager){
 
 /*
 ** This function may only be called while a write-transaction is active in
-** rollback. If the connection is in WAL mode, this call is a no-op. 
-** Otherwise, if the connection does not already have an EXCLUSIVE lock on 
-** the database file, an attempt is made to obtain one.
+** rollback. If the connection is in WAL mode, this call is a no-op, except
+** that a BEGIN CONCURRENT transaction takes the WAL WRITER lock and checks
+** for conflicting changes made by other connections (see 
+** pagerLockForCommit()). Otherwise, if the connection does not already 
+** have an EXCLUSIVE lock on the database file, an attempt is made to 
+** obtain one.
 **
 ** If the EXCLUSIVE lock is already held or the attempt to obtain it is
 ** successful, or the connection is in WAL mode, SQLITE_OK is returned.
-** Otherwise, either SQLITE_BUSY or an SQLITE_IOERR_XXX error code is 
-** returned.
+** Otherwise, either SQLITE_BUSY, SQLITE_BUSY_SNAPSHOT or an SQLITE_IOERR_XXX 
+** error code is returned.
 */
 int sqlite3PagerExclusiveLock(Pager *pPager){
   int rc = SQLITE_OK;
@@ -5584,6 +6236,8 @@ int sqlite3PagerExclusiveLock(Pager *pPager){
   assert( assert_pager_state(pPager) );
   if( 0==pagerUseWal(pPager) ){
     rc = pager_wait_on_lock(pPager, EXCLUSIVE_LOCK);
+  }else if( pPager->pReadSet ){
+    rc = pagerLockForCommit(pPager);
   }
   return rc;
 }
@@ -5645,7 +6299,12 @@ int sqlite3PagerCommitPhaseOne(
     sqlite3BackupRestart(pPager->pBackup);
   }else{
     if( pagerUseWal(pPager) ){
-      PgHdr *pList = sqlite3PcacheDirtyList(pPager->pPCache);
+      PgHdr *pList;
+      if( pPager->pReadSet ){
+        rc = pagerLockForCommit(pPager);
+        if( rc!=SQLITE_OK ) return rc;
+      }
+      pList = sqlite3PcacheDirtyList(pPager->pPCache);
       if( pList ){
         rc = pagerWalFrames(pPager, pList, pPager->dbSize, 1, 
             (pPager->fullSync ? pPager->sync_flags : 0)
@@ -5682,7 +6341,7 @@ int sqlite3PagerCommitPhaseOne(
       PgHdr *pPg;
       assert( isOpen(pPager->jfd) 
            || pPager->journalMode==PAGER_JOURNALMODE_OFF 
-           || pPager->journalMode==PAGER_JOURNALMODE_WAL 
+           || isWalMode(pPager->journalMode)
       );
       if( !zMaster && isOpen(pPager->jfd) 
        && pPager->journalOff==jrnlBufferSize(pPager) 
@@ -5844,7 +6503,17 @@ int sqlite3PagerCommitPhaseTwo(Pager *pPager){
 
   PAGERTRACE(("COMMIT %d\n", PAGERID(pPager)));
   rc = pager_end_transaction(pPager, pPager->setMaster);
-  return pager_error(pPager, rc);
+  rc = pager_error(pPager, rc);
+
+  /* If WAL group commit is enabled, the WAL has not been synced yet. Do
+  ** so now that the WAL write lock has been released. An error here does
+  ** not move the pager into the error state, as the transaction has
+  ** already been committed.
+  */
+  if( rc==SQLITE_OK && pagerUseWal(pPager) ){
+    rc = sqlite3WalSyncCommit(pPager->pWal);
+  }
+  return rc;
 }
 
 /*
@@ -5917,7 +6586,14 @@ u8 sqlite3PagerIsreadonly(Pager *pPager){
 ** Return the number of references to the pager.
 */
 int sqlite3PagerRefcount(Pager *pPager){
-  return sqlite3PcacheRefCount(pPager->pPCache);
+  return sqlite3PcacheRefCount(pPager->pPCache) + pPager->nMmapOut;
+}
+
+/*
+** Return the number of outstanding references to memory-mapped pages.
+*/
+int sqlite3PagerMmapRefcount(Pager *pPager){
+  return pPager->nMmapOut;
 }
 
 /*
@@ -6158,6 +6834,7 @@ void sqlite3PagerSetCodec(
   pPager->xCodecFree = xCodecFree;
   pPager->pCodec = pCodec;
   pagerReportSize(pPager);
+  pagerFixMaplimit(pPager);
 }
 void *sqlite3PagerGetCodec(Pager *pPager){
   return pPager->pCodec;
@@ -6392,13 +7069,14 @@ int sqlite3PagerSetJournalMode(Pager *pPager, int eMode){
             || eMode==PAGER_JOURNALMODE_PERSIST
             || eMode==PAGER_JOURNALMODE_OFF 
             || eMode==PAGER_JOURNALMODE_WAL 
+            || eMode==PAGER_JOURNALMODE_WAL2
             || eMode==PAGER_JOURNALMODE_MEMORY );
 
   /* This routine is only called from the OP_JournalMode opcode, and
   ** the logic there will never allow a temporary file to be changed
   ** to WAL mode.
   */
-  assert( pPager->tempFile==0 || eMode!=PAGER_JOURNALMODE_WAL );
+  assert( pPager->tempFile==0 || !isWalMode(eMode) );
 
   /* Do allow the journalmode of an in-memory database to be set to
   ** anything other than MEMORY or OFF
@@ -6426,6 +7104,7 @@ int sqlite3PagerSetJournalMode(Pager *pPager, int eMode){
     assert( (PAGER_JOURNALMODE_MEMORY & 5)==4 );
     assert( (PAGER_JOURNALMODE_OFF & 5)==0 );
     assert( (PAGER_JOURNALMODE_WAL & 5)==5 );
+    assert( (PAGER_JOURNALMODE_WAL2 & 5)==4 );
 
     assert( isOpen(pPager->fd) || pPager->exclusiveMode );
     if( !pPager->exclusiveMode && (eOld & 5)==1 && (eMode & 1)==0 ){
@@ -6497,6 +7176,9 @@ int sqlite3PagerOkToChangeJournalMode(Pager *pPager){
 i64 sqlite3PagerJournalSizeLimit(Pager *pPager, i64 iLimit){
   if( iLimit>=-1 ){
     pPager->journalSizeLimit = iLimit;
+#ifndef SQLITE_OMIT_WAL
+    if( pPager->pWal ) sqlite3WalLimit(pPager->pWal, iLimit);
+#endif
   }
   return pPager->journalSizeLimit;
 }
@@ -6513,16 +7195,28 @@ sqlite3_backup **sqlite3PagerBackupPtr(Pager *pPager){
 
 #ifndef SQLITE_OMIT_WAL
 /*
-** This function is called when the user invokes "PRAGMA checkpoint".
+** This function is called when the user invokes "PRAGMA checkpoint", and
+** by the background checkpointer.  See sqlite3WalCheckpoint() for the
+** meaning of nPage, nMs, pnLog and pnCkpt.  If the pager is not in WAL
+** mode, *pnLog and *pnCkpt are set to zero.
 */
-int sqlite3PagerCheckpoint(Pager *pPager){
+int sqlite3PagerCheckpoint(
+  Pager *pPager,                  /* Pager to checkpoint */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs,                        /* Max time to spend in ms, or 0 */
+  int *pnLog,                     /* OUT: Frames in WAL */
+  int *pnCkpt                     /* OUT: Frames backfilled */
+){
   int rc = SQLITE_OK;
   if( pPager->pWal ){
     u8 *zBuf = (u8 *)pPager->pTmpSpace;
     rc = sqlite3WalCheckpoint(pPager->pWal,
         (pPager->noSync ? 0 : pPager->sync_flags),
-        pPager->pageSize, zBuf
+        pPager->pageSize, zBuf, nPage, nMs, pnLog, pnCkpt
     );
+  }else{
+    if( pnLog ) *pnLog = 0;
+    if( pnCkpt ) *pnCkpt = 0;
   }
   return rc;
 }
@@ -6531,6 +7225,21 @@ int sqlite3PagerWalCallback(Pager *pPager){
   return sqlite3WalCallback(pPager->pWal);
 }
 
+/*
+** Get/set the WAL group commit window, in microseconds. A negative value
+** disables group commit. An attempt to set a value smaller than -1 is
+** a no-op.
+*/
+int sqlite3PagerWalGroupCommit(Pager *pPager, int nWindow){
+  if( nWindow>=-1 ){
+    pPager->nGroupCommit = nWindow;
+    if( pPager->pWal ){
+      sqlite3WalGroupCommit(pPager->pWal, nWindow);
+    }
+  }
+  return pPager->nGroupCommit;
+}
+
 /*
 ** Return true if the underlying VFS for the given pager supports the
 ** primitives necessary for write-ahead logging.
@@ -6554,9 +7263,13 @@ int sqlite3PagerWalSupported(Pager *pPager){
 ** If the pager is open on a temp-file (or in-memory database), or if
 ** the WAL file is already open, set *pbOpen to 1 and return SQLITE_OK
 ** without doing anything.
+**
+** If bWal2 is true, the log is opened in "wal2" mode, using both the
+** *-wal and *-wal2 files.
 */
 int sqlite3PagerOpenWal(
   Pager *pPager,                  /* Pager object */
+  int bWal2,                      /* True to open in wal2 mode */
   int *pbOpen                     /* OUT: Set to true if call is a no-op */
 ){
   int rc = SQLITE_OK;             /* Return code */
@@ -6577,9 +7290,16 @@ int sqlite3PagerOpenWal(
     ** (e.g. due to malloc() failure), unlock the database file and 
     ** return an error code.
     */
-    rc = sqlite3WalOpen(pPager->pVfs, pPager->fd, pPager->zWal, &pPager->pWal);
+    rc = sqlite3WalOpen(pPager->pVfs, pPager->fd, pPager->zWal, 
+                        bWal2 ? pPager->zWal2 : 0, &pPager->pWal);
     if( rc==SQLITE_OK ){
-      pPager->journalMode = PAGER_JOURNALMODE_WAL;
+      sqlite3WalGroupCommit(pPager->pWal, pPager->nGroupCommit);
+      sqlite3WalLimit(pPager->pWal, pPager->journalSizeLimit);
+      if( pPager->szChunk ){
+        pagerSetChunkSize(pPager, sqlite3WalFile(pPager->pWal));
+      }
+      pPager->journalMode = bWal2 ? PAGER_JOURNALMODE_WAL2
+                                  : PAGER_JOURNALMODE_WAL;
       pPager->eState = PAGER_OPEN;
     }
   }else{
@@ -6601,7 +7321,7 @@ int sqlite3PagerOpenWal(
 int sqlite3PagerCloseWal(Pager *pPager){
   int rc = SQLITE_OK;
 
-  assert( pPager->journalMode==PAGER_JOURNALMODE_WAL );
+  assert( isWalMode(pPager->journalMode) );
 
   /* If the log file is not already open, but does exist in the file-system,
   ** it may need to be checkpointed before the connection can switch to
@@ -6609,15 +7329,25 @@ int sqlite3PagerCloseWal(Pager *pPager){
   */
   if( !pPager->pWal ){
     int logexists = 0;
+    int log2exists = 0;
+    int bWal2 = 0;
     rc = pagerLockDb(pPager, SHARED_LOCK);
     if( rc==SQLITE_OK ){
       rc = sqlite3OsAccess(
           pPager->pVfs, pPager->zWal, SQLITE_ACCESS_EXISTS, &logexists
       );
     }
-    if( rc==SQLITE_OK && logexists ){
-      rc = sqlite3WalOpen(pPager->pVfs, pPager->fd,
-                          pPager->zWal, &pPager->pWal);
+    if( rc==SQLITE_OK ){
+      rc = sqlite3OsAccess(
+          pPager->pVfs, pPager->zWal2, SQLITE_ACCESS_EXISTS, &log2exists
+      );
+    }
+    if( rc==SQLITE_OK && (logexists || log2exists) ){
+      rc = pagerIsWal2(pPager, &bWal2);
+      if( rc==SQLITE_OK ){
+        rc = sqlite3WalOpen(pPager->pVfs, pPager->fd, pPager->zWal,
+                            bWal2 ? pPager->zWal2 : 0, &pPager->pWal);
+      }
     }
   }
     
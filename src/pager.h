@@ -26,6 +26,16 @@
   #define SQLITE_DEFAULT_JOURNAL_SIZE_LIMIT -1
 #endif
 
+/*
+** Default increment, in bytes, by which the database, journal and WAL
+** files are grown. Zero means files grow one write at a time. This value
+** may be overridden using the sqlite3PagerChunkSize() API. See also
+** "PRAGMA chunk_size".
+*/
+#ifndef SQLITE_DEFAULT_CHUNK_SIZE
+  #define SQLITE_DEFAULT_CHUNK_SIZE 0
+#endif
+
 /*
 ** The type used to represent a page number.  The first page in a file
 ** is called page 1.  0 is used to represent "not a page".
@@ -78,6 +88,7 @@ typedef struct PgHdr DbPage;
 #define PAGER_JOURNALMODE_TRUNCATE    3   /* Commit by truncating journal */
 #define PAGER_JOURNALMODE_MEMORY      4   /* In-memory journal file */
 #define PAGER_JOURNALMODE_WAL         5   /* Use write-ahead logging */
+#define PAGER_JOURNALMODE_WAL2        6   /* Use write-ahead logging w/ 2 logs */
 
 /*
 ** The remainder of this file contains the declarations of the functions
@@ -109,12 +120,15 @@ int sqlite3PagerSetJournalMode(Pager *, int);
 int sqlite3PagerGetJournalMode(Pager*);
 int sqlite3PagerOkToChangeJournalMode(Pager*);
 i64 sqlite3PagerJournalSizeLimit(Pager *, i64);
+sqlite3_int64 sqlite3PagerMmapLimit(Pager *, sqlite3_int64);
+int sqlite3PagerChunkSize(Pager *, int);
 sqlite3_backup **sqlite3PagerBackupPtr(Pager*);
 
 /* Functions used to obtain and release page references. */ 
 int sqlite3PagerAcquire(Pager *pPager, Pgno pgno, DbPage **ppPage, int clrFlag);
 #define sqlite3PagerGet(A,B,C) sqlite3PagerAcquire(A,B,C,0)
 DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno);
+int sqlite3PagerReadahead(Pager *pPager, Pgno *aPgno, int nPgno);
 void sqlite3PagerRef(DbPage*);
 void sqlite3PagerUnref(DbPage*);
 
@@ -131,6 +145,8 @@ void sqlite3PagerPagecount(Pager*, int*);
 int sqlite3PagerBegin(Pager*, int exFlag, int);
 int sqlite3PagerCommitPhaseOne(Pager*,const char *zMaster, int);
 int sqlite3PagerExclusiveLock(Pager*);
+int sqlite3PagerBeginConcurrent(Pager*);
+void sqlite3PagerEndConcurrent(Pager*);
 int sqlite3PagerSync(Pager *pPager);
 int sqlite3PagerCommitPhaseTwo(Pager*);
 int sqlite3PagerRollback(Pager*);
@@ -138,15 +154,17 @@ int sqlite3PagerOpenSavepoint(Pager *pPager, int n);
 int sqlite3PagerSavepoint(Pager *pPager, int op, int iSavepoint);
 int sqlite3PagerSharedLock(Pager *pPager);
 
-int sqlite3PagerCheckpoint(Pager *pPager);
+int sqlite3PagerCheckpoint(Pager *pPager, int, int, int*, int*);
 int sqlite3PagerWalSupported(Pager *pPager);
 int sqlite3PagerWalCallback(Pager *pPager);
-int sqlite3PagerOpenWal(Pager *pPager, int *pisOpen);
+int sqlite3PagerOpenWal(Pager *pPager, int bWal2, int *pisOpen);
 int sqlite3PagerCloseWal(Pager *pPager);
+int sqlite3PagerWalGroupCommit(Pager *pPager, int nWindow);
 
 /* Functions used to query pager state and configuration. */
 u8 sqlite3PagerIsreadonly(Pager*);
 int sqlite3PagerRefcount(Pager*);
+int sqlite3PagerMmapRefcount(Pager*);
 int sqlite3PagerMemUsed(Pager*);
 const char *sqlite3PagerFilename(Pager*);
 const sqlite3_vfs *sqlite3PagerVfs(Pager*);
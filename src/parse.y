@@ -123,6 +123,7 @@ transtype(A) ::= .             {A = TK_DEFERRED;}
 transtype(A) ::= DEFERRED(X).  {A = @X;}
 transtype(A) ::= IMMEDIATE(X). {A = @X;}
 transtype(A) ::= EXCLUSIVE(X). {A = @X;}
+transtype(A) ::= CONCURRENT(X). {A = @X;}
 cmd ::= COMMIT trans_opt.      {sqlite3CommitTransaction(pParse);}
 cmd ::= END trans_opt.         {sqlite3CommitTransaction(pParse);}
 cmd ::= ROLLBACK trans_opt.    {sqlite3RollbackTransaction(pParse);}
@@ -195,7 +196,7 @@ id(A) ::= INDEXED(X).    {A = X;}
 //
 %fallback ID
   ABORT ACTION AFTER ANALYZE ASC ATTACH BEFORE BEGIN BY CASCADE CAST COLUMNKW
-  CONFLICT DATABASE DEFERRED DESC DETACH EACH END EXCLUSIVE EXPLAIN FAIL FOR
+  CONCURRENT CONFLICT DATABASE DEFERRED DESC DETACH EACH END EXCLUSIVE EXPLAIN FAIL FOR
   IGNORE IMMEDIATE INITIALLY INSTEAD LIKE_KW MATCH NO PLAN
   QUERY KEY OF OFFSET PRAGMA RAISE RELEASE REPLACE RESTRICT ROW ROLLBACK
   SAVEPOINT TEMP TRIGGER VACUUM VIEW VIRTUAL
@@ -499,10 +500,10 @@ cmd  ::= execpreamble execargs. {
     &pParse->pExecProc->Return);
 }
 
-// special prefixed select used for returning resultset from stored proc
-// by creating temp table
+// special prefixed select used for returning resultset from stored proc.
+// The select is pushed onto the result set stack and coded by the EXEC
+// statement, see sqlite3OutputResultSet().
 cmd ::= SPRESULT select(S). {
-  printf("*** SPRESULT pParse: 0x%08.08x\n", (long)pParse);
   sqlite3RenderResultSet(pParse, S);
 }
 %endif SQLITE_ENABLE_STOREDPROCS
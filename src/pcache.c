@@ -28,6 +28,9 @@ struct PCache {
   void *pStress;                      /* Argument to xStress */
   sqlite3_pcache *pCache;             /* Pluggable cache module */
   PgHdr *pPage1;                      /* Reference to page 1 */
+#if SQLITE_DIRECT_IO_ALIGN>0
+  int bAligned;                       /* True to align page buffers */
+#endif
 };
 
 /*
@@ -42,6 +45,24 @@ struct PCache {
 # define expensive_assert(X)
 #endif
 
+/*
+** Each page obtained from the pluggable cache is a buffer holding a PgHdr,
+** the page content (szPage bytes) and the extra space (szExtra bytes).
+** Usually the PgHdr comes first.  If the cache has been configured for
+** direct I/O (see sqlite3PcacheSetAligned()) the buffer is aligned and the
+** page content comes first, so that it is aligned too.  These macros
+** convert between a buffer and its PgHdr.
+*/
+#if SQLITE_DIRECT_IO_ALIGN>0
+# define pcacheBufToHdr(pCache, pBuf) ((pCache)->bAligned ?               \
+    (PgHdr *)&((char *)(pBuf))[(pCache)->szPage+(pCache)->szExtra] :     \
+    (PgHdr *)(pBuf))
+# define pcacheHdrToBuf(p) ((p)->pCache->bAligned ? (p)->pData : (void *)(p))
+#else
+# define pcacheBufToHdr(pCache, pBuf) ((PgHdr *)(pBuf))
+# define pcacheHdrToBuf(p) ((void *)(p))
+#endif
+
 /********************************** Linked List Management ********************/
 
 #if !defined(NDEBUG) && defined(SQLITE_ENABLE_EXPENSIVE_ASSERT)
@@ -131,7 +152,7 @@ static void pcacheUnpin(PgHdr *p){
     if( p->pgno==1 ){
       pCache->pPage1 = 0;
     }
-    sqlite3GlobalConfig.pcache.xUnpin(pCache->pCache, p, 0);
+    sqlite3GlobalConfig.pcache.xUnpin(pCache->pCache, pcacheHdrToBuf(p), 0);
   }
 }
 
@@ -198,6 +219,17 @@ void sqlite3PcacheSetPageSize(PCache *pCache, int szPage){
   pCache->szPage = szPage;
 }
 
+#if SQLITE_DIRECT_IO_ALIGN>0
+/*
+** Request that the page buffers of this cache be aligned for direct I/O.
+** This takes effect when the pluggable cache object is next created.
+*/
+void sqlite3PcacheSetAligned(PCache *pCache){
+  assert( pCache->pCache==0 );
+  pCache->bAligned = 1;
+}
+#endif
+
 /*
 ** Try to obtain a page from the cache.
 */
@@ -207,7 +239,8 @@ int sqlite3PcacheFetch(
   int createFlag,       /* If true, create page if it does not exist already */
   PgHdr **ppPage        /* Write the page here */
 ){
-  PgHdr *pPage = 0;
+  void *pBuf = 0;
+  PgHdr *pPage;
   int eCreate;
 
   assert( pCache!=0 );
@@ -226,15 +259,18 @@ int sqlite3PcacheFetch(
       return SQLITE_NOMEM;
     }
     sqlite3GlobalConfig.pcache.xCachesize(p, pCache->nMax);
+#if SQLITE_DIRECT_IO_ALIGN>0
+    if( pCache->bAligned ) sqlite3PCache1SetAligned(p);
+#endif
     pCache->pCache = p;
   }
 
   eCreate = createFlag * (1 + (!pCache->bPurgeable || !pCache->pDirty));
   if( pCache->pCache ){
-    pPage = sqlite3GlobalConfig.pcache.xFetch(pCache->pCache, pgno, eCreate);
+    pBuf = sqlite3GlobalConfig.pcache.xFetch(pCache->pCache, pgno, eCreate);
   }
 
-  if( !pPage && eCreate==1 ){
+  if( !pBuf && eCreate==1 ){
     PgHdr *pPg;
 
     /* Find a dirty page to write-out and recycle. First try to find a 
@@ -259,13 +295,15 @@ int sqlite3PcacheFetch(
       }
     }
 
-    pPage = sqlite3GlobalConfig.pcache.xFetch(pCache->pCache, pgno, 2);
+    pBuf = sqlite3GlobalConfig.pcache.xFetch(pCache->pCache, pgno, 2);
   }
 
-  if( pPage ){
+  pPage = 0;
+  if( pBuf ){
+    pPage = pcacheBufToHdr(pCache, pBuf);
     if( !pPage->pData ){
       memset(pPage, 0, sizeof(PgHdr));
-      pPage->pData = (void *)&pPage[1];
+      pPage->pData = (pPage==pBuf) ? (void *)&pPage[1] : pBuf;
       pPage->pExtra = (void*)&((char *)pPage->pData)[pCache->szPage];
       memset(pPage->pExtra, 0, pCache->szExtra);
       pPage->pCache = pCache;
@@ -273,8 +311,8 @@ int sqlite3PcacheFetch(
     }
     assert( pPage->pCache==pCache );
     assert( pPage->pgno==pgno );
-    assert( pPage->pData==(void *)&pPage[1] );
-    assert( pPage->pExtra==(void *)&((char *)&pPage[1])[pCache->szPage] );
+    assert( pPage->pData==((pPage==pBuf) ? (void *)&pPage[1] : pBuf) );
+    assert( pPage->pExtra==(void *)&((char *)pPage->pData)[pCache->szPage] );
 
     if( 0==pPage->nRef ){
       pCache->nRef++;
@@ -332,7 +370,7 @@ void sqlite3PcacheDrop(PgHdr *p){
   if( p->pgno==1 ){
     pCache->pPage1 = 0;
   }
-  sqlite3GlobalConfig.pcache.xUnpin(pCache->pCache, p, 1);
+  sqlite3GlobalConfig.pcache.xUnpin(pCache->pCache, pcacheHdrToBuf(p), 1);
 }
 
 /*
@@ -390,7 +428,9 @@ void sqlite3PcacheMove(PgHdr *p, Pgno newPgno){
   PCache *pCache = p->pCache;
   assert( p->nRef>0 );
   assert( newPgno>0 );
-  sqlite3GlobalConfig.pcache.xRekey(pCache->pCache, p, p->pgno, newPgno);
+  sqlite3GlobalConfig.pcache.xRekey(
+      pCache->pCache, pcacheHdrToBuf(p), p->pgno, newPgno
+  );
   p->pgno = newPgno;
   if( (p->flags&PGHDR_DIRTY) && (p->flags&PGHDR_NEED_SYNC) ){
     pcacheRemoveFromDirtyList(p);
@@ -51,6 +51,7 @@ struct PgHdr {
 #define PGHDR_NEED_READ         0x008  /* Content is unread */
 #define PGHDR_REUSE_UNLIKELY    0x010  /* A hint that reuse is unlikely */
 #define PGHDR_DONT_WRITE        0x020  /* Do not write content to disk */
+#define PGHDR_MMAP              0x040  /* This is an mmap page object */
 
 /* Initialize and shutdown the page cache subsystem */
 int sqlite3PcacheInitialize(void);
@@ -152,4 +153,10 @@ void sqlite3PcacheStats(int*,int*,int*,int*);
 
 void sqlite3PCacheSetDefault(void);
 
+#if SQLITE_DIRECT_IO_ALIGN>0
+/* Align the page buffers of a cache, for a file open for direct I/O */
+void sqlite3PcacheSetAligned(PCache *);
+void sqlite3PCache1SetAligned(sqlite3_pcache *);
+#endif
+
 #endif /* _PCACHE_H_ */
@@ -39,6 +39,9 @@ struct PCache1 {
   */
   int szPage;                         /* Size of allocated pages in bytes */
   int bPurgeable;                     /* True if cache is purgeable */
+#if SQLITE_DIRECT_IO_ALIGN>0
+  int bAligned;                       /* True to align page buffers */
+#endif
   unsigned int nMin;                  /* Minimum number of pages reserved */
   unsigned int nMax;                  /* Configured "cache_size" value */
 
@@ -233,13 +236,60 @@ static int pcache1MemSize(void *p){
 }
 #endif /* SQLITE_ENABLE_MEMORY_MANAGEMENT */
 
+#if SQLITE_DIRECT_IO_ALIGN>0
+/*
+** Page buffers of a cache used by a database file that is open for direct
+** I/O (see sqlite3PCache1SetAligned()) are allocated using these two
+** functions.  They are aligned to SQLITE_DIRECT_IO_ALIGN bytes so that
+** pages may be read and written without an intermediate copy.  The space
+** is obtained from sqlite3Malloc() with enough extra bytes to align the
+** buffer, and the pointer returned by sqlite3Malloc() is stored just
+** before the aligned buffer so that pcache1FreeAligned() can free it.
+** Such buffers are never taken from the SQLITE_CONFIG_PAGECACHE pool,
+** whose slots are not aligned.
+*/
+static void *pcache1AllocAligned(int nByte){
+  const int mask = SQLITE_DIRECT_IO_ALIGN-1;
+  char *p;
+  char *pBuf = 0;
+  assert( sqlite3_mutex_held(pcache1.mutex) );
+
+  /* As in pcache1Alloc(), the mutex is released while allocating. */
+  pcache1LeaveMutex();
+  p = (char *)sqlite3Malloc(nByte + SQLITE_DIRECT_IO_ALIGN + sizeof(void*));
+  pcache1EnterMutex();
+  if( p ){
+    pBuf = &p[sizeof(void*)];
+    pBuf = &pBuf[(SQLITE_DIRECT_IO_ALIGN - (SQLITE_PTR_TO_INT(pBuf) & mask))
+                 & mask];
+    ((void **)pBuf)[-1] = p;
+    sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_OVERFLOW, sqlite3MallocSize(p));
+    sqlite3MemdebugSetType(p, MEMTYPE_PCACHE);
+  }
+  return pBuf;
+}
+static void pcache1FreeAligned(void *pBuf){
+  void *p = ((void **)pBuf)[-1];
+  assert( sqlite3MemdebugHasType(p, MEMTYPE_PCACHE) );
+  sqlite3MemdebugSetType(p, MEMTYPE_HEAP);
+  sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_OVERFLOW, -sqlite3MallocSize(p));
+  sqlite3_free(p);
+}
+#endif
+
 /*
 ** Allocate a new page object initially associated with cache pCache.
 */
 static PgHdr1 *pcache1AllocPage(PCache1 *pCache){
   int nByte = sizeof(PgHdr1) + pCache->szPage;
-  void *pPg = pcache1Alloc(nByte);
+  void *pPg;
   PgHdr1 *p;
+#if SQLITE_DIRECT_IO_ALIGN>0
+  if( pCache->bAligned ){
+    pPg = pcache1AllocAligned(nByte);
+  }else
+#endif
+  pPg = pcache1Alloc(nByte);
   if( pPg ){
     p = PAGE_TO_PGHDR1(pCache, pPg);
     if( pCache->bPurgeable ){
@@ -263,6 +313,12 @@ static void pcache1FreePage(PgHdr1 *p){
     if( p->pCache->bPurgeable ){
       pcache1.nCurrentPage--;
     }
+#if SQLITE_DIRECT_IO_ALIGN>0
+    if( p->pCache->bAligned ){
+      pcache1FreeAligned(PGHDR1_TO_PAGE(p));
+      return;
+    }
+#endif
     pcache1Free(PGHDR1_TO_PAGE(p));
   }
 }
@@ -629,7 +685,11 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
     pPage = pcache1.pLruTail;
     pcache1RemoveFromHash(pPage);
     pcache1PinPage(pPage);
-    if( pPage->pCache->szPage!=pCache->szPage ){
+    if( pPage->pCache->szPage!=pCache->szPage
+#if SQLITE_DIRECT_IO_ALIGN>0
+     || pPage->pCache->bAligned!=pCache->bAligned
+#endif
+    ){
       pcache1FreePage(pPage);
       pPage = 0;
     }else{
@@ -652,6 +712,15 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
     pPage->pCache = pCache;
     pPage->pLruPrev = 0;
     pPage->pLruNext = 0;
+#if SQLITE_DIRECT_IO_ALIGN>0
+    if( pCache->bAligned ){
+      /* In an aligned cache the PgHdr is at the end of the buffer. See
+      ** pcacheBufToHdr() in pcache.c. */
+      *(void **)&((char *)PGHDR1_TO_PAGE(pPage))[
+          pCache->szPage - sizeof(PgHdr)
+      ] = 0;
+    }else
+#endif
     *(void **)(PGHDR1_TO_PAGE(pPage)) = 0;
     pCache->apHash[h] = pPage;
   }
@@ -800,6 +869,22 @@ void sqlite3PCacheSetDefault(void){
   sqlite3_config(SQLITE_CONFIG_PCACHE, &defaultMethods);
 }
 
+#if SQLITE_DIRECT_IO_ALIGN>0
+/*
+** Arrange for the page buffers of cache p to be aligned to
+** SQLITE_DIRECT_IO_ALIGN bytes.  This must be called before any pages are
+** allocated.  It is a no-op if p was not created by this module, as is
+** the case if the application has configured its own page cache.
+*/
+void sqlite3PCache1SetAligned(sqlite3_pcache *p){
+  if( sqlite3GlobalConfig.pcache.xCreate==pcache1Create ){
+    PCache1 *pCache = (PCache1 *)p;
+    assert( pCache->nPage==0 );
+    pCache->bAligned = 1;
+  }
+}
+#endif
+
 #ifdef SQLITE_ENABLE_MEMORY_MANAGEMENT
 /*
 ** This function is called to free superfluous dynamically allocated memory
@@ -816,6 +901,11 @@ int sqlite3PcacheReleaseMemory(int nReq){
     PgHdr1 *p;
     pcache1EnterMutex();
     while( (nReq<0 || nFree<nReq) && ((p=pcache1.pLruTail)!=0) ){
+#if SQLITE_DIRECT_IO_ALIGN>0
+      if( p->pCache->bAligned ){
+        nFree += sizeof(PgHdr1) + p->pCache->szPage;
+      }else
+#endif
       nFree += pcache1MemSize(PGHDR1_TO_PAGE(p));
       pcache1PinPage(p);
       pcache1RemoveFromHash(p);
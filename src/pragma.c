@@ -197,6 +197,9 @@ static int flagPragma(Parse *pParse, const char *zLeft, const char *zRight){
     ** are present in the build.  */
 #if !defined(SQLITE_OMIT_FOREIGN_KEY) && !defined(SQLITE_OMIT_TRIGGER)
     { "foreign_keys",             SQLITE_ForeignKeys },
+#endif
+#if defined(SQLITE_ENABLE_STOREDPROCS) && defined(SQLITE_USE_TEMPTABLES_FOR_PROCS)
+    { "stream_proc_results",      SQLITE_StreamProcs },
 #endif
   };
   int i;
@@ -267,7 +270,7 @@ const char *sqlite3JournalModename(int eMode){
   static char * const azModeName[] = {
     "delete", "persist", "off", "truncate", "memory"
 #ifndef SQLITE_OMIT_WAL
-     , "wal"
+     , "wal", "wal2"
 #endif
   };
   assert( PAGER_JOURNALMODE_DELETE==0 );
@@ -276,6 +279,7 @@ const char *sqlite3JournalModename(int eMode){
   assert( PAGER_JOURNALMODE_TRUNCATE==3 );
   assert( PAGER_JOURNALMODE_MEMORY==4 );
   assert( PAGER_JOURNALMODE_WAL==5 );
+  assert( PAGER_JOURNALMODE_WAL2==6 );
   assert( eMode>=0 && eMode<=ArraySize(azModeName) );
 
   if( eMode==ArraySize(azModeName) ) return 0;
@@ -594,6 +598,43 @@ void sqlite3Pragma(
     returnSingleInt(pParse, "journal_size_limit", iLimit);
   }else
 
+  /*
+  **  PRAGMA [database.]chunk_size
+  **  PRAGMA [database.]chunk_size=N
+  **
+  ** Get or set the increment, in bytes, by which the database file, its
+  ** rollback journal and its WAL file are grown. Space is preallocated
+  ** a chunk at a time. Zero (the default) grows files one write at a time.
+  */
+  if( sqlite3StrICmp(zLeft,"chunk_size")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int szChunk = -1;
+    if( zRight ){
+      szChunk = atoi(zRight);
+      if( szChunk<0 ) szChunk = 0;
+    }
+    szChunk = sqlite3PagerChunkSize(pPager, szChunk);
+    returnSingleInt(pParse, "chunk_size", szChunk);
+  }else
+
+  /*
+  **  PRAGMA [database.]mmap_size
+  **  PRAGMA [database.]mmap_size=N
+  **
+  ** Get or set the maximum number of bytes of the database file that
+  ** may be memory-mapped in order to read pages without copying them
+  ** into the page cache. Zero disables memory-mapped reads.
+  */
+  if( sqlite3StrICmp(zLeft,"mmap_size")==0 ){
+    i64 sz = -1;
+    if( zRight ){
+      sqlite3Atoi64(zRight, &sz, 1000000, SQLITE_UTF8);
+      if( sz<0 ) sz = 0;
+    }
+    sz = sqlite3BtreeSetMmapLimit(pDb->pBt, sz);
+    returnSingleInt(pParse, "mmap_size", sz);
+  }else
+
 #endif /* SQLITE_OMIT_PAGER_PRAGMAS */
 
   /*
@@ -1419,6 +1460,49 @@ void sqlite3Pragma(
        db->xWalCallback==sqlite3WalDefaultHook ? 
            SQLITE_PTR_TO_INT(db->pWalArg) : 0);
   }else
+
+  /*
+  **   PRAGMA [database.]wal_group_commit
+  **   PRAGMA [database.]wal_group_commit = N
+  **
+  ** Enable group commit for a WAL database, or query the current setting.
+  ** If N is negative (the default), group commit is disabled. Otherwise,
+  ** committers share WAL syncs, and the connection performing a sync first
+  ** waits N microseconds for others to join it.  Group commit is only
+  ** used if the VFS supports the shared-memory locks beyond SQLITE_SHM_NLOCK
+  ** (see SQLITE_FCNTL_SHM_NLOCK).  If it does not, each commit syncs the
+  ** WAL as if group commit were disabled.
+  */
+  if( sqlite3StrICmp(zLeft, "wal_group_commit")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int nWindow = -2;
+    if( zRight ){
+      nWindow = atoi(zRight);
+      if( nWindow<-1 ) nWindow = -1;
+    }
+    nWindow = sqlite3PagerWalGroupCommit(pPager, nWindow);
+    returnSingleInt(pParse, "wal_group_commit", nWindow);
+  }else
+
+  /*
+  **   PRAGMA [database.]wal_checkpoint_thread
+  **   PRAGMA [database.]wal_checkpoint_thread = N
+  **
+  ** If N is greater than zero, hand the checkpoints that wal_autocheckpoint
+  ** would run after a commit to a background thread, which copies at most
+  ** N pages per step.  If N is zero (the default), stop the thread.  The
+  ** value returned is zero if no thread is running, for example because
+  ** threads are not supported by this build or platform.
+  */
+  if( sqlite3StrICmp(zLeft, "wal_checkpoint_thread")==0 ){
+    int nPage = -1;
+    if( zRight ){
+      nPage = atoi(zRight);
+      if( nPage<0 ) nPage = 0;
+    }
+    nPage = sqlite3CkptThreadConfig(db, iDb, nPage);
+    returnSingleInt(pParse, "wal_checkpoint_thread", nPage);
+  }else
 #endif
 
 #if defined(SQLITE_DEBUG) || defined(SQLITE_TEST)
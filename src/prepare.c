@@ -335,6 +335,11 @@ static int sqlite3InitOne(sqlite3 *db, int iDb, char **pzErrMsg){
     if( rc==SQLITE_OK ){
       sqlite3AnalysisLoad(db, iDb);
     }
+#endif
+#ifdef SQLITE_ENABLE_STOREDPROCS
+    if( rc==SQLITE_OK ){
+      sqlite3ProcCatalogLoad(db, iDb);
+    }
 #endif
   }
   if( db->mallocFailed ){
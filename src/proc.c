@@ -27,6 +27,21 @@
 #include <string.h>
 #include <assert.h>
 #include "sqliteInt.h"
+#include "vdbeInt.h"
+
+/*
+** Procedure statistics are timed with the cycle counter of hwtime.h on
+** the platforms it supports, and with the millisecond clock of the VFS
+** elsewhere.  The extern declaration makes sure an out-of-line copy of
+** the inline sqlite3Hwtime() exists when the compiler declines to inline.
+*/
+#if ((defined(__GNUC__) || defined(_MSC_VER)) && \
+      (defined(i386) || defined(__i386__) || defined(_M_IX86))) || \
+    (defined(__GNUC__) && (defined(__x86_64__) || defined(__ppc__)))
+# include "hwtime.h"
+  extern sqlite_uint64 sqlite3Hwtime(void);
+# define SP_HAVE_HWTIME 1
+#endif
 
 /*
  ** The following DDL/DML statement templates form the data dictionary 
@@ -35,7 +50,7 @@
  ** to avoid unanticipated side effects.
  */
 static const char *cr_sp_schema=
-"create table if not exists sp_schema(\
+"create table if not exists %Q.sp_schema(\
  id integer primary key,\
  name text not null,\
  params_key text,\
@@ -46,7 +61,7 @@ static const char *cr_sp_schema=
  unique(name, params_key))";
 
 static const char *cr_sp_params=
-"create table if not exists sp_params(\
+"create table if not exists %Q.sp_params(\
   id integer primary key,\
   sp_schema_id int references sp_schema(id) on delete cascade,\
   name text not null,\
@@ -54,24 +69,23 @@ static const char *cr_sp_params=
   affinity char not null)";
 
 static const char *ins_sp_schema=
-"insert into sp_schema (name, params_key, body, return_type, impl_lang, sql)\
+"insert into %Q.sp_schema (name, params_key, body, return_type, impl_lang, sql)\
   values(?,?,?,?,?,?)";
 
 static const char *ins_sp_params=
-"insert into sp_params (sp_schema_id, name, type_decl, affinity)\
+"insert into %Q.sp_params (sp_schema_id, name, type_decl, affinity)\
   values(?,?,?,?)";
 
+static const char *del_sp_params=
+  "delete from %Q.sp_params where sp_schema_id in "
+  "(select id from %Q.sp_schema where name=?)";
 static const char *del_sp_schema=
-  "delete from sp_schema where name=?";
-static const char *sel_sp_schema=
-  "select * from sp_schema where name=?";
-static const char *sel_sp_params=
-  "select * from sp_params where sp_schema_id=?";
-static const char *count_sp_schema=
-  "select count(*) from sp_schema where name=?";
-static const char *sel_sp_temp=
-  "select tbl_name from sp_temp where tid=? and proc_name=? "
-  "order by last_update_time desc limit 1";
+  "delete from %Q.sp_schema where name=?";
+static const char *sel_sp_catalog=
+  "select s.id, s.name, s.body, s.return_type, s.impl_lang,"
+  " p.name, p.type_decl, p.affinity"
+  " from %Q.sp_schema s left join %Q.sp_params p on p.sp_schema_id=s.id"
+  " order by s.id, p.id";
 
 /**
 * Registry of language implementations connection init and finalize
@@ -101,6 +115,7 @@ static int doUpdate(sqlite3 *db, const char  *sql,
                     int *rowsEffected, char **ppzErrMsg);
 static int addProcSchema(
   sqlite3          *db, 
+  const char       *zDb,
   const char       *procName, 
   const proc_param *procParams,
   const char       *procBody,
@@ -109,23 +124,17 @@ static int addProcSchema(
   const char       *sql,
   int              *rowsEffected,
   char            **ppzErrMsg); 
-
-static int
-countProc(
+static int deleteProcSchema(
   sqlite3          *db,
+  const char       *zDb,
   const char       *procName,
-  int              *count,
-  char            **ppzErrMsg /* must sqlite3_free*/);
-
-static int
-getProcSchema(
-  sqlite3          *db, 
-  const char       *procName, 
-  char            **procParams,
-  char            **procBody,
-  int              *procReturnType,
-  char            **procLangImpl,
-  char            **ppzErrMsg /* must sqlite3_free*/);
+  int              *rowsDeleted,
+  char            **ppzErrMsg);
+static int initSpSchema(Parse *pParse, int iDb, char **ppzErrMsg);
+static void spStatClear(sqlite3 *db);
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+static sqlite3_module spStatsModule;
+#endif
 
 #define MAX_SPPARAMS 128
 #define SP_API_ERR(d,e,r,f,l) \
@@ -134,7 +143,6 @@ getProcSchema(
 #define SP_API_ERR_INTRANS(d,s,e,r,f,l) \
         *(e) = errmsgEx((d),(r),(f),(l));\
         sqlite3_finalize((s));\
-        doUpdate((d),"rollback", 0, 0);\
         return 1
 
 int
@@ -145,6 +153,7 @@ spresult_push(SpResultset **head, Select *select) {
   entry->select = select;
   entry->next = *head==(SpResultset*)0 ? (SpResultset*)0 : *head;
   *head = entry;
+  return SQLITE_OK;
 }
 
 Select *
@@ -170,6 +179,13 @@ sqlite3ProcDbInit(sqlite3 **pDb, char **pzErrMsg) {
   ProcLangImpl *p = pProcLangImpl;
   (*pDb)->pConnProcCtx = sqlite3DbMallocZero(*pDb, sizeof(ConnProcCtx));
   int rc;
+  if( (*pDb)->pConnProcCtx==0 ) return SQLITE_NOMEM;
+  sqlite3HashInit(&(*pDb)->pConnProcCtx->procCache);
+  sqlite3HashInit(&(*pDb)->pConnProcCtx->procStats);
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+  rc = sqlite3_create_module(*pDb, "sp_stats", &spStatsModule, 0);
+  if( rc!=SQLITE_OK ) return rc;
+#endif
   while(p) {
     if (p->procDbInit) {
       if((rc = (*p->procDbInit)(*pDb, pzErrMsg)) != SQLITE_OK)
@@ -183,6 +199,8 @@ sqlite3ProcDbInit(sqlite3 **pDb, char **pzErrMsg) {
 /* close connection callback */
 void
 sqlite3ProcDbFinalize(sqlite3 *db) {
+  sqlite3ProcCacheClear(db);
+  spStatClear(db);
   sqlite3DbFree(db, db->pConnProcCtx);
   ProcLangImpl *p = pProcLangImpl;
   while(p) {
@@ -209,22 +227,870 @@ sqlite3RenderResultSet(Parse *pParse, Select *s) {
     sqlite3ErrorMsg(pParse, "%s:%d - no memory.", __FILE__, __LINE__);
 }
 
-static void
-sqlite3OutputResultSet(Parse *pParse) {
+/*
+** Code the result set returned by the procedure zName.  pMark is the top
+** of the result set stack before the procedure body was run.  The SELECT
+** most recently pushed by the body (its final SPRESULT statement) is
+** coded with SRT_Output, so its rows are returned directly by
+** sqlite3_step() on the EXEC statement without being materialized.  Any
+** earlier SPRESULT statements of the body are discarded.
+*/
+static void
+sqlite3OutputResultSet(Parse *pParse, const char *zName, SpResultset *pMark) {
+  sqlite3 *db = pParse->db;
+  SpResultset **ppStack = &db->pConnProcCtx->pResultsetStack;
+  Select *s = 0;
+  SelectDest dest = {SRT_Output, 0, 0, 0, 0};
+
+  if( *ppStack==pMark ){
+    sqlite3ErrorMsg(pParse, "procedure \"%s\" did not return a result set",
+        zName);
+    return;
+  }
+  s = spresult_pop(ppStack);
+  if( pParse->nErr==0 ){
+    sqlite3Select(pParse, s, &dest);
+  }
+  sqlite3SelectDelete(db, s);
+}
+
+/*
+** Pop and delete any result sets pushed since the stack top was pMark.
+*/
+static void
+spResultsetUnwind(sqlite3 *db, SpResultset *pMark) {
+  SpResultset **ppStack = &db->pConnProcCtx->pResultsetStack;
+  while( *ppStack && *ppStack!=pMark ){
+    sqlite3SelectDelete(db, spresult_pop(ppStack));
+  }
+}
+
+/*
+** Return the current value of the clock used to time procedures.
+*/
+u64
+sqlite3ProcClock(sqlite3 *db) {
+#ifdef SP_HAVE_HWTIME
+  UNUSED_PARAMETER(db);
+  return sqlite3Hwtime();
+#else
+  sqlite3_int64 iNow = 0;
+  sqlite3OsCurrentTimeInt64(db->pVfs, &iNow);
+  return (u64)iNow;
+#endif
+}
+
+/*
+** Return the statistics entry of procedure zName in database zDb,
+** creating it if bCreate is true.  Return NULL if the entry does not
+** exist or cannot be allocated.
+*/
+static SpStat *
+spStatFind(sqlite3 *db, const char *zDb, const char *zName, int bCreate) {
+  Hash *pStats = &db->pConnProcCtx->procStats;
+  SpStat *p;
+  SpStat *pOld;
+  char *zKey;
+
+  zKey = sqlite3MPrintf(db, "%s.%s", zDb, zName);
+  if( zKey==0 ) return 0;
+  p = sqlite3HashFind(pStats, zKey, sqlite3Strlen30(zKey));
+  if( p || !bCreate ){
+    sqlite3DbFree(db, zKey);
+    return p;
+  }
+  p = (SpStat*)sqlite3DbMallocZero(db, sizeof(SpStat));
+  if( p ){
+    p->zKey = zKey;
+    p->zDb = sqlite3DbStrDup(db, zDb);
+    p->zName = sqlite3DbStrDup(db, zName);
+    if( p->zDb && p->zName ){
+      pOld = sqlite3HashInsert(pStats, zKey, sqlite3Strlen30(zKey), p);
+      if( pOld==0 ) return p;
+      db->mallocFailed = 1;
+    }
+    sqlite3DbFree(db, p->zName);
+    sqlite3DbFree(db, p->zDb);
+    sqlite3DbFree(db, p);
+  }
+  sqlite3DbFree(db, zKey);
+  return 0;
+}
+
+/*
+** Add one call, lasting nTick clock ticks, that executed nStep VDBE
+** instructions and returned nRow rows, to statistics entry p.
+*/
+static void
+spStatAdd(SpStat *p, u64 nTick, i64 nStep, i64 nRow) {
+  p->nCall++;
+  p->nStep += nStep;
+  p->nRow += nRow;
+  p->iTotal += nTick;
+  if( nTick>p->iMax ) p->iMax = nTick;
+}
+
+/*
+** Record a call of the procedure with key zKey.  Called by OP_ProcStat.
+*/
+void
+sqlite3ProcStatRecord(
+  sqlite3    *db,
+  const char *zKey,
+  u64         nTick,
+  i64         nStep,
+  i64         nRow
+){
+  SpStat *p;
+  if( db->pConnProcCtx==0 ) return;
+  p = sqlite3HashFind(&db->pConnProcCtx->procStats, zKey,
+                      sqlite3Strlen30(zKey));
+  if( p ) spStatAdd(p, nTick, nStep, nRow);
+}
+
+/*
+** Free all procedure statistics of connection db.
+*/
+static void
+spStatClear(sqlite3 *db) {
+  Hash *pStats;
+  HashElem *pElem;
+
+  if( db->pConnProcCtx==0 ) return;
+  pStats = &db->pConnProcCtx->procStats;
+  for(pElem=sqliteHashFirst(pStats); pElem; pElem=sqliteHashNext(pElem)){
+    SpStat *p = (SpStat*)sqliteHashData(pElem);
+    sqlite3DbFree(db, p->zName);
+    sqlite3DbFree(db, p->zDb);
+    sqlite3DbFree(db, p->zKey);
+    sqlite3DbFree(db, p);
+  }
+  sqlite3HashClear(pStats);
+}
+
+/*
+** Read, and optionally reset, one execution statistic of procedure
+** zProc in database zDb ("main" if NULL) on connection db.
+*/
+int
+sqlite3_proc_status(
+  sqlite3       *db,
+  const char    *zDb,
+  const char    *zProc,
+  int            op,
+  sqlite3_int64 *pValue,
+  int            resetFlg
+){
+  SpStat *p;
+  int rc = SQLITE_OK;
+
+  sqlite3_mutex_enter(db->mutex);
+  p = db->pConnProcCtx ? spStatFind(db, zDb ? zDb : "main", zProc, 0) : 0;
+  if( p==0 ){
+    rc = SQLITE_ERROR;
+  }else{
+    switch( op ){
+      case SQLITE_PROCSTATUS_CALLS: {
+        *pValue = p->nCall;
+        if( resetFlg ) p->nCall = 0;
+        break;
+      }
+      case SQLITE_PROCSTATUS_TIME: {
+        *pValue = (sqlite3_int64)p->iTotal;
+        if( resetFlg ) p->iTotal = 0;
+        break;
+      }
+      case SQLITE_PROCSTATUS_TIME_MAX: {
+        *pValue = (sqlite3_int64)p->iMax;
+        if( resetFlg ) p->iMax = 0;
+        break;
+      }
+      case SQLITE_PROCSTATUS_ROWS: {
+        *pValue = p->nRow;
+        if( resetFlg ) p->nRow = 0;
+        break;
+      }
+      case SQLITE_PROCSTATUS_VM_STEP: {
+        *pValue = p->nStep;
+        if( resetFlg ) p->nStep = 0;
+        break;
+      }
+      default: {
+        rc = SQLITE_ERROR;
+      }
+    }
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+/*
+** The sp_stats virtual table module presents the procedure statistics
+** of the connection it is created on, one row per procedure:
+**
+**     CREATE VIRTUAL TABLE temp.sp_stats USING sp_stats;
+**     SELECT * FROM sp_stats ORDER BY total_time DESC;
+**
+** The table is read-only and always does a full scan.  Statistics
+** entries are never removed before the connection closes, so a cursor
+** may safely hold on to a hash element between calls.
+*/
+typedef struct SpStatsVtab SpStatsVtab;
+typedef struct SpStatsCursor SpStatsCursor;
+struct SpStatsVtab {
+  sqlite3_vtab base;            /* Base class.  Must be first */
+  sqlite3 *db;                  /* Connection whose statistics are shown */
+};
+struct SpStatsCursor {
+  sqlite3_vtab_cursor base;     /* Base class.  Must be first */
+  HashElem *pElem;              /* Current row, or NULL at EOF */
+  sqlite3_int64 iRowid;         /* Rowid of the current row */
+};
+
+static int
+spStatsConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  SpStatsVtab *pVtab;
+  int rc;
+
+  UNUSED_PARAMETER2(pAux, argc);
+  UNUSED_PARAMETER2(argv, pzErr);
+  rc = sqlite3_declare_vtab(db, "CREATE TABLE x(db, name, calls, "
+      "total_time, max_time, rows, vm_steps)");
+  if( rc!=SQLITE_OK ) return rc;
+  pVtab = (SpStatsVtab*)sqlite3_malloc(sizeof(SpStatsVtab));
+  if( pVtab==0 ) return SQLITE_NOMEM;
+  memset(pVtab, 0, sizeof(SpStatsVtab));
+  pVtab->db = db;
+  *ppVtab = &pVtab->base;
+  return SQLITE_OK;
+}
+
+static int
+spStatsDisconnect(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+static int
+spStatsBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pInfo) {
+  UNUSED_PARAMETER(pVtab);
+  pInfo->estimatedCost = 100.0;
+  return SQLITE_OK;
+}
+
+static int
+spStatsOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+  SpStatsCursor *pCsr;
+  UNUSED_PARAMETER(pVtab);
+  pCsr = (SpStatsCursor*)sqlite3_malloc(sizeof(SpStatsCursor));
+  if( pCsr==0 ) return SQLITE_NOMEM;
+  memset(pCsr, 0, sizeof(SpStatsCursor));
+  *ppCursor = &pCsr->base;
+  return SQLITE_OK;
+}
+
+static int
+spStatsClose(sqlite3_vtab_cursor *pCursor) {
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
+
+static int
+spStatsFilter(
+  sqlite3_vtab_cursor *pCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  SpStatsCursor *pCsr = (SpStatsCursor*)pCursor;
+  sqlite3 *db = ((SpStatsVtab*)pCursor->pVtab)->db;
+  UNUSED_PARAMETER2(idxNum, idxStr);
+  UNUSED_PARAMETER2(argc, argv);
+  pCsr->pElem = sqliteHashFirst(&db->pConnProcCtx->procStats);
+  pCsr->iRowid = 1;
+  return SQLITE_OK;
+}
+
+static int
+spStatsNext(sqlite3_vtab_cursor *pCursor) {
+  SpStatsCursor *pCsr = (SpStatsCursor*)pCursor;
+  pCsr->pElem = sqliteHashNext(pCsr->pElem);
+  pCsr->iRowid++;
+  return SQLITE_OK;
+}
+
+static int
+spStatsEof(sqlite3_vtab_cursor *pCursor) {
+  return ((SpStatsCursor*)pCursor)->pElem==0;
+}
+
+static int
+spStatsColumn(sqlite3_vtab_cursor *pCursor, sqlite3_context *ctx, int i) {
+  SpStat *p = (SpStat*)sqliteHashData(((SpStatsCursor*)pCursor)->pElem);
+  switch( i ){
+    case 0:  sqlite3_result_text(ctx, p->zDb, -1, SQLITE_TRANSIENT);   break;
+    case 1:  sqlite3_result_text(ctx, p->zName, -1, SQLITE_TRANSIENT); break;
+    case 2:  sqlite3_result_int64(ctx, p->nCall);                      break;
+    case 3:  sqlite3_result_int64(ctx, (sqlite3_int64)p->iTotal);      break;
+    case 4:  sqlite3_result_int64(ctx, (sqlite3_int64)p->iMax);        break;
+    case 5:  sqlite3_result_int64(ctx, p->nRow);                       break;
+    default: sqlite3_result_int64(ctx, p->nStep);                      break;
+  }
+  return SQLITE_OK;
+}
+
+static int
+spStatsRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid) {
+  *pRowid = ((SpStatsCursor*)pCursor)->iRowid;
+  return SQLITE_OK;
+}
+
+static sqlite3_module spStatsModule = {
+  0,                            /* iVersion */
+  spStatsConnect,               /* xCreate */
+  spStatsConnect,               /* xConnect */
+  spStatsBestIndex,             /* xBestIndex */
+  spStatsDisconnect,            /* xDisconnect */
+  spStatsDisconnect,            /* xDestroy */
+  spStatsOpen,                  /* xOpen */
+  spStatsClose,                 /* xClose */
+  spStatsFilter,                /* xFilter */
+  spStatsNext,                  /* xNext */
+  spStatsEof,                   /* xEof */
+  spStatsColumn,                /* xColumn */
+  spStatsRowid,                 /* xRowid */
+  0,                            /* xUpdate */
+  0,                            /* xBegin */
+  0,                            /* xSync */
+  0,                            /* xCommit */
+  0,                            /* xRollback */
+  0,                            /* xFindFunction */
+  0,                            /* xRename */
+};
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+
+/*
+** Free a procedure cache entry and everything it owns.
+*/
+static void
+spCacheEntryFree(sqlite3 *db, SpCacheEntry *p) {
+  int i;
+  if( p->pCompiled && p->pLang->xFree ){
+    p->pLang->xFree(p->pCompiled);
+  }
+  for(i=0; i<p->nParam; i++){
+    sqlite3DbFree(db, p->aParam[i].name);
+    sqlite3DbFree(db, p->aParam[i].typeDecl);
+  }
+  sqlite3DbFree(db, p->aParam);
+  sqlite3DbFree(db, p->zBody);
+  sqlite3DbFree(db, p->zName);
+  sqlite3DbFree(db, p->zKey);
+  sqlite3DbFree(db, p);
+}
+
+/*
+** Discard every procedure held in the per-connection procedure cache.
+** Called whenever a procedure is created or dropped and when the
+** connection is closed.
+*/
+void
+sqlite3ProcCacheClear(sqlite3 *db) {
+  ConnProcCtx *pCtx = db->pConnProcCtx;
+  Hash temp;
+  HashElem *pElem;
+
+  if( pCtx==0 ) return;
+  temp = pCtx->procCache;
+  sqlite3HashInit(&pCtx->procCache);
+  for(pElem=sqliteHashFirst(&temp); pElem; pElem=sqliteHashNext(pElem)){
+    spCacheEntryFree(db, (SpCacheEntry*)sqliteHashData(pElem));
+  }
+  sqlite3HashClear(&temp);
+}
+
+/*
+** Generate code that increments the schema cookie of database iDb, so
+** that prepared statements and the procedure caches of every connection
+** that executed a procedure from that database are invalidated.
+*/
+void
+sqlite3ProcChangeCookie(Parse *pParse, int iDb) {
+  Vdbe *v = sqlite3GetVdbe(pParse);
+  if( v==0 ) return;
+  sqlite3BeginWriteOperation(pParse, 0, iDb);
+  sqlite3ChangeCookie(pParse, iDb);
+}
+
+/*
+** Map the LANGUAGE name of a procedure onto an SQLITE_SP_LANG_* value.
+** Return 0 if the language is not known.
+*/
+static int
+spLanguageCode(const char *zLang) {
+  if( zLang==0 ) return 0;
+  if( sqlite3StrICmp(zLang, "sqlite")==0 ) return SQLITE_SP_LANG_SQLITE;
+  if( sqlite3StrICmp(zLang, "python")==0 ) return SQLITE_SP_LANG_PYTHON;
+  return 0;
+}
+
+/*
+** Return the registered language extension named zLang, if it provides
+** the xCompile and xExec entry points, or NULL.
+*/
+static ProcLangImpl *
+spFindLangImpl(const char *zLang) {
+  ProcLangImpl *p;
+  for(p=pProcLangImpl; p; p=p->pNext){
+    if( p->xCompile && p->xExec && sqlite3StrICmp(p->languageName, zLang)==0 ){
+      return p;
+    }
+  }
+  return 0;
+}
+
+/*
+** Free a procedure held in a Schema procedure catalog.
+*/
+static void
+spProcFree(SpProc *p) {
+  int i;
+  for(i=0; i<p->nParam; i++){
+    sqlite3DbFree(0, p->aParam[i].name);
+    sqlite3DbFree(0, p->aParam[i].typeDecl);
+  }
+  sqlite3DbFree(0, p->aParam);
+  sqlite3DbFree(0, p->zLang);
+  sqlite3DbFree(0, p->zBody);
+  sqlite3DbFree(0, p->zName);
+  sqlite3DbFree(0, p);
+}
+
+/*
+** Allocate a new catalog entry for a procedure without parameters.
+** Return NULL if a malloc fails.
+*/
+static SpProc *
+spProcNew(
+  const char *zName,
+  const char *zBody,
+  int         returnType,
+  const char *zLang
+){
+  SpProc *p = (SpProc*)sqlite3DbMallocZero(0, sizeof(SpProc));
+  if( p==0 ) return 0;
+  p->zName = sqlite3DbStrDup(0, zName);
+  p->zBody = sqlite3DbStrDup(0, zBody ? zBody : "");
+  p->zLang = sqlite3DbStrDup(0, zLang ? zLang : "");
+  p->returnType = returnType;
+  if( p->zName==0 || p->zBody==0 || p->zLang==0 ){
+    spProcFree(p);
+    return 0;
+  }
+  return p;
+}
+
+/*
+** Append a declared parameter to catalog entry p.  Return SQLITE_NOMEM
+** if a malloc fails, or SQLITE_OK otherwise.
+*/
+static int
+spProcAddParam(SpProc *p, const char *zName, const char *zType, char aff) {
+  proc_param *aNew;
+  proc_param *pParam;
+  if( p->nParam>=MAX_SPPARAMS ) return SQLITE_OK;
+  aNew = sqlite3Realloc(p->aParam, (p->nParam+1)*sizeof(proc_param));
+  if( aNew==0 ) return SQLITE_NOMEM;
+  p->aParam = aNew;
+  pParam = &p->aParam[p->nParam++];
+  memset(pParam, 0, sizeof(*pParam));
+  pParam->name = sqlite3DbStrDup(0, zName);
+  pParam->typeDecl = sqlite3DbStrDup(0, zType ? zType : "");
+  pParam->affinity = aff;
+  if( pParam->name==0 || pParam->typeDecl==0 ) return SQLITE_NOMEM;
+  return SQLITE_OK;
+}
+
+/*
+** Add procedure p to the catalog of schema pSchema, replacing any
+** procedure of the same name.  If a malloc fails, free p, set the
+** mallocFailed flag and return SQLITE_NOMEM.
+*/
+static int
+spCatalogInsert(sqlite3 *db, Schema *pSchema, SpProc *p) {
+  SpProc *pOld;
+  pOld = sqlite3HashInsert(&pSchema->procHash, p->zName,
+                           sqlite3Strlen30(p->zName), p);
+  if( pOld==p ){
+    db->mallocFailed = 1;
+    spProcFree(p);
+    return SQLITE_NOMEM;
+  }
+  if( pOld ) spProcFree(pOld);
+  return SQLITE_OK;
+}
+
+/*
+** Return the procedure named zName in database iDb, or NULL if there
+** is no such procedure.
+*/
+static SpProc *
+spCatalogFind(sqlite3 *db, int iDb, const char *zName) {
+  Schema *pSchema = db->aDb[iDb].pSchema;
+  return (SpProc*)sqlite3HashFind(&pSchema->procHash, zName,
+                                  sqlite3Strlen30(zName));
+}
+
+/*
+** Remove the procedure named zName from the catalog of database iDb.
+*/
+static void
+spCatalogRemove(sqlite3 *db, int iDb, const char *zName) {
+  Schema *pSchema = db->aDb[iDb].pSchema;
+  SpProc *pOld;
+  pOld = sqlite3HashInsert(&pSchema->procHash, zName,
+                           sqlite3Strlen30(zName), 0);
+  if( pOld ) spProcFree(pOld);
+}
+
+/*
+** Free every procedure in the catalog of schema pSchema.  Called from
+** sqlite3SchemaFree() whenever the schema is discarded.
+*/
+void
+sqlite3ProcCatalogClear(Schema *pSchema) {
+  Hash temp;
+  HashElem *pElem;
+
+  temp = pSchema->procHash;
+  sqlite3HashInit(&pSchema->procHash);
+  for(pElem=sqliteHashFirst(&temp); pElem; pElem=sqliteHashNext(pElem)){
+    spProcFree((SpProc*)sqliteHashData(pElem));
+  }
+  sqlite3HashClear(&temp);
+}
+
+/*
+** State passed to spCatalogLoader() while the catalog of a database
+** is read.
+*/
+typedef struct SpCatalogInfo SpCatalogInfo;
+struct SpCatalogInfo {
+  sqlite3 *db;          /* Database connection loading the catalog */
+  Schema *pSchema;      /* Schema that receives the procedures */
+  i64 iId;              /* sp_schema.id of the current procedure */
+  SpProc *pCur;         /* Procedure receiving parameters, or NULL */
+};
+
+/*
+** This callback is invoked once for each parameter of each procedure,
+** and once for each procedure without parameters, in sp_schema.id and
+** then sp_params.id order.  Argument vector:
+**
+**     argv[0] = sp_schema.id         argv[4] = sp_schema.impl_lang
+**     argv[1] = sp_schema.name       argv[5] = sp_params.name
+**     argv[2] = sp_schema.body       argv[6] = sp_params.type_decl
+**     argv[3] = sp_schema.return_type argv[7] = sp_params.affinity
+**
+** The catalog is keyed by name alone.  If sp_schema holds overloads of
+** one name, the first procedure created is the one EXEC will run.
+*/
+static int
+spCatalogLoader(void *pArg, int argc, char **argv, char **NotUsed) {
+  SpCatalogInfo *pInfo = (SpCatalogInfo*)pArg;
+  i64 iId;
+
+  UNUSED_PARAMETER2(NotUsed, argc);
+  if( argv==0 || argv[0]==0 || argv[1]==0 ) return 0;
+  sqlite3Atoi64(argv[0], &iId, sqlite3Strlen30(argv[0]), SQLITE_UTF8);
+  if( pInfo->pCur==0 || iId!=pInfo->iId ){
+    int returnType = -1;
+    pInfo->iId = iId;
+    pInfo->pCur = 0;
+    if( sqlite3HashFind(&pInfo->pSchema->procHash, argv[1],
+                        sqlite3Strlen30(argv[1])) ){
+      return 0;
+    }
+    if( argv[3] ) sqlite3GetInt32(argv[3], &returnType);
+    pInfo->pCur = spProcNew(argv[1], argv[2], returnType, argv[4]);
+    if( pInfo->pCur==0
+     || spCatalogInsert(pInfo->db, pInfo->pSchema, pInfo->pCur) ){
+      pInfo->db->mallocFailed = 1;
+      return 1;
+    }
+  }
+  if( argv[5] && spProcAddParam(pInfo->pCur, argv[5], argv[6],
+                   argv[7] ? argv[7][0] : SQLITE_AFF_NONE) ){
+    pInfo->db->mallocFailed = 1;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+** Load the procedure catalog of database iDb from its sp_schema and
+** sp_params tables.  This is called from sqlite3InitOne() each time the
+** schema of the database is read.  Return SQLITE_OK on success, or an
+** error code if the tables do not exist or cannot be read.
+*/
+int
+sqlite3ProcCatalogLoad(sqlite3 *db, int iDb) {
+  SpCatalogInfo sInfo;
+  const char *zDb = db->aDb[iDb].zName;
+  char *zSql;
+  int rc;
+
+  assert( iDb>=0 && iDb<db->nDb );
+  sqlite3ProcCatalogClear(db->aDb[iDb].pSchema);
+  if( sqlite3FindTable(db, "sp_schema", zDb)==0
+   || sqlite3FindTable(db, "sp_params", zDb)==0 ){
+    return SQLITE_ERROR;
+  }
+
+  memset(&sInfo, 0, sizeof(sInfo));
+  sInfo.db = db;
+  sInfo.pSchema = db->aDb[iDb].pSchema;
+  zSql = sqlite3MPrintf(db, sel_sp_catalog, zDb, zDb);
+  if( zSql==0 ){
+    rc = SQLITE_NOMEM;
+  }else{
+    rc = sqlite3_exec(db, zSql, spCatalogLoader, &sInfo, 0);
+    sqlite3DbFree(db, zSql);
+  }
+  if( rc==SQLITE_NOMEM ) db->mallocFailed = 1;
+  return rc;
+}
+
+/*
+** Copy the catalog definition of procedure procName in database iDb
+** into a new SpCacheEntry.  Return NULL and leave an error message in
+** *pzErrMsg (to be released with sqlite3DbFree()) if the procedure does
+** not exist or cannot be run.
+*/
+static SpCacheEntry *
+spCacheLoad(sqlite3 *db, int iDb, const char *procName, char **pzErrMsg) {
+  SpCacheEntry *p;
+  SpProc *pProc;
+  int i;
+
+  *pzErrMsg = 0;
+  pProc = spCatalogFind(db, iDb, procName);
+  if( pProc==0 ){
+    *pzErrMsg = sqlite3MPrintf(db, "no such procedure \"%s\"", procName);
+    return 0;
+  }
+  if( spLanguageCode(pProc->zLang)==0 ){
+    *pzErrMsg = sqlite3MPrintf(db, "unknown language \"%s\" for procedure "
+        "\"%s\"", pProc->zLang, procName);
+    return 0;
+  }
+
+  p = (SpCacheEntry*)sqlite3DbMallocZero(db, sizeof(SpCacheEntry));
+  if( p==0 ) return 0;
+  p->zName      = sqlite3DbStrDup(db, pProc->zName);
+  p->zBody      = sqlite3DbStrDup(db, pProc->zBody);
+  p->returnType = pProc->returnType;
+  p->eLang      = spLanguageCode(pProc->zLang);
+  if( pProc->nParam>0 ){
+    p->aParam = sqlite3DbMallocZero(db, pProc->nParam*sizeof(proc_param));
+    if( p->aParam ){
+      p->nParam = pProc->nParam;
+      for(i=0; i<p->nParam; i++){
+        p->aParam[i].name     = sqlite3DbStrDup(db, pProc->aParam[i].name);
+        p->aParam[i].typeDecl = sqlite3DbStrDup(db, pProc->aParam[i].typeDecl);
+        p->aParam[i].affinity = pProc->aParam[i].affinity;
+      }
+    }
+  }
+  if( db->mallocFailed ){
+    spCacheEntryFree(db, p);
+    return 0;
+  }
+  return p;
+}
+
+/*
+** Locate the definition of procedure zName in database iDb.  The
+** definition is taken from the per-connection procedure cache if it
+** was loaded under the current schema cookie, or copied from the
+** schema's procedure catalog and cached otherwise.  If the procedure
+** cannot be found, leave an error in pParse and return NULL.
+*/
+static SpCacheEntry *
+spCacheFind(Parse *pParse, int iDb, const char *zName) {
+  sqlite3 *db = pParse->db;
+  Hash *pCache = &db->pConnProcCtx->procCache;
+  int iCookie = db->aDb[iDb].pSchema->schema_cookie;
+  SpCacheEntry *p;
+  SpCacheEntry *pOld;
+  char *zKey;
+  char *zErrMsg;
+
+  zKey = sqlite3MPrintf(db, "%s.%s", db->aDb[iDb].zName, zName);
+  if( zKey==0 ) return 0;
+  p = sqlite3HashFind(pCache, zKey, sqlite3Strlen30(zKey));
+  if( p && p->iCookie==iCookie ){
+    sqlite3DbFree(db, zKey);
+    return p;
+  }
+
+  p = spCacheLoad(db, iDb, zName, &zErrMsg);
+  if( p==0 ){
+    if( zErrMsg ){
+      sqlite3ErrorMsg(pParse, "%s", zErrMsg);
+      sqlite3DbFree(db, zErrMsg);
+    }
+    sqlite3DbFree(db, zKey);
+    return 0;
+  }
+  p->zKey = zKey;
+  p->iCookie = iCookie;
+  pOld = sqlite3HashInsert(pCache, zKey, sqlite3Strlen30(zKey), p);
+  if( pOld==p ){
+    /* Malloc failed inside the hash table.  Run uncached this time. */
+    db->mallocFailed = 1;
+    spCacheEntryFree(db, p);
+    return 0;
+  }
+  if( pOld ) spCacheEntryFree(db, pOld);
+  return p;
+}
+
+/*
+** If pExpr is a reference to a parameter of the procedure whose body
+** is currently being parsed by sqlite3ExecProc(), turn it into a
+** TK_REGISTER expression that reads the argument passed by EXEC and
+** return 1.  Otherwise leave pExpr unchanged and return 0, so that it
+** becomes an ordinary SQL variable.
+*/
+int
+sqlite3ProcArgToRegister(Parse *pParse, Expr *pExpr) {
+  ConnProcCtx *pCtx = pParse->db->pConnProcCtx;
+  SpArgFrame *pFrame;
+  int i;
+
+  if( pParse->nested==0 || pCtx==0 || (pFrame = pCtx->pArgFrame)==0 ){
+    return 0;
+  }
+  for(i=0; i<pFrame->nArg; i++){
+    if( strcmp(pFrame->azArg[i], pExpr->u.zToken)==0 ){
+      pExpr->op2 = pExpr->op;
+      pExpr->op = TK_REGISTER;
+      pExpr->iTable = pFrame->iReg + i;
+      pExpr->affinity = pFrame->zAff[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Code the EXEC arguments pArgs of procedure pProc into a block of
+** consecutive registers and fill in *pFrame so that the procedure body
+** can refer to them.  Arguments are matched to the declared parameters
+** by position, or by name when written as "@name = value".  Parameters
+** without an argument are NULL.  Each value is given the affinity of
+** its declared type.
+**
+** Return 0 on success.  On error, leave a message in pParse and return 1.
+** The caller must release pFrame->azArg with sqlite3DbFree() on success.
+*/
+static int
+spCodeArgs(
+  Parse        *pParse,
+  SpCacheEntry *pProc,
+  ExprList     *pArgs,
+  SpArgFrame   *pFrame) {
   sqlite3 *db = pParse->db;
-  Select *s = 0;
-  SelectDest dest = {SRT_Output, 0, 0, 0, 0};
+  Vdbe *v = sqlite3GetVdbe(pParse);
+  int nArg = pArgs ? pArgs->nExpr : 0;
+  int nParam = pProc->nParam;
+  NameContext sNC;
+  u8 *aSet;
+  char *zNames;
+  int nByte;
+  int i, j;
+
+  memset(pFrame, 0, sizeof(*pFrame));
+  if( v==0 ) return 1;
+  if( nArg>nParam ){
+    sqlite3ErrorMsg(pParse, "procedure \"%s\" takes %d argument%s but %d "
+        "were given", pProc->zName, nParam, nParam==1 ? "" : "s", nArg);
+    return 1;
+  }
 
-  if ((s = spresult_pop(&db->pConnProcCtx->pResultsetStack)) == (Select*)0) {
-    sqlite3ErrorMsg(pParse, "%s:%d - no resultset on stack.",
-       __FILE__, __LINE__);
-    return;
+  /* azArg[], zAff[], aSet[] and copies of the parameter names share a
+  ** single allocation.  The names are copied because the procedure
+  ** body may drop procedures, and so flush the cache, while it is
+  ** being coded. */
+  nByte = nParam*(sizeof(char*)+2) + 1;
+  for(j=0; j<nParam; j++){
+    nByte += sqlite3Strlen30(pProc->aParam[j].name) + 1;
+  }
+  pFrame->azArg = (char**)sqlite3DbMallocZero(db, nByte);
+  if( pFrame->azArg==0 ) return 1;
+  pFrame->zAff = (char*)&pFrame->azArg[nParam];
+  aSet = (u8*)&pFrame->zAff[nParam+1];
+  zNames = (char*)&aSet[nParam];
+  pFrame->nArg = nParam;
+  pFrame->iReg = pParse->nMem+1;
+  pParse->nMem += nParam;
+
+  memset(&sNC, 0, sizeof(sNC));
+  sNC.pParse = pParse;
+  for(i=0; i<nArg; i++){
+    Expr *pExpr = pArgs->a[i].pExpr;
+    j = i;
+    if( pExpr->op==TK_EQ && pExpr->pLeft->op==TK_VARIABLE ){
+      for(j=0; j<nParam; j++){
+        if( strcmp(pProc->aParam[j].name, pExpr->pLeft->u.zToken)==0 ) break;
+      }
+      if( j==nParam ){
+        sqlite3ErrorMsg(pParse, "procedure \"%s\" has no parameter named %s",
+            pProc->zName, pExpr->pLeft->u.zToken);
+        goto code_args_error;
+      }
+      pExpr = pExpr->pRight;
+    }
+    if( aSet[j] ){
+      sqlite3ErrorMsg(pParse, "parameter %s of procedure \"%s\" given "
+          "more than once", pProc->aParam[j].name, pProc->zName);
+      goto code_args_error;
+    }
+    aSet[j] = 1;
+    if( sqlite3ResolveExprNames(&sNC, pExpr) ) goto code_args_error;
+    sqlite3ExprCode(pParse, pExpr, pFrame->iReg+j);
   }
-  sqlite3Select(pParse, s, &dest);
-  sqlite3SelectDelete(pParse->db, s);
+
+  for(j=0; j<nParam; j++){
+    char aff = pProc->aParam[j].affinity;
+    int n = sqlite3Strlen30(pProc->aParam[j].name) + 1;
+    pFrame->azArg[j] = zNames;
+    memcpy(zNames, pProc->aParam[j].name, n);
+    zNames += n;
+    pFrame->zAff[j] = aff ? aff : SQLITE_AFF_NONE;
+    if( !aSet[j] ) sqlite3VdbeAddOp2(v, OP_Null, 0, pFrame->iReg+j);
+  }
+  if( nParam>0 ){
+    sqlite3VdbeAddOp4(v, OP_Affinity, pFrame->iReg, nParam, 0,
+                      pFrame->zAff, 0);
+    sqlite3ExprCacheAffinityChange(pParse, pFrame->iReg, nParam);
+  }
+  return 0;
+
+code_args_error:
+  sqlite3DbFree(db, pFrame->azArg);
+  pFrame->azArg = 0;
+  return 1;
 }
 
-int
+void
 sqlite3CreateProc(
   Parse      *pParse,
   Token      *pName1,   /* First part of the name of the proc */
@@ -241,11 +1107,14 @@ sqlite3CreateProc(
   ParseProcCtx *ctx = PARSE_PROC_CTX(pParse);
   int           iDb;         /* Database number to create the proc in */
   Token        *pName;    /* Unqualified name of the proc to create */
-  char         *zErrMsg;
-  char         *sql = sqlite3_malloc(ctx->sqlStrLen+1);
-  
-  (void)strncpy(sql, ctx->sqlStr, ctx->sqlStrLen);
-  *(sql+ctx->sqlStrLen) = '\0';  
+  const char   *zDb;      /* Name of database iDb */
+  char         *zErrMsg = 0;
+  char         *zOld = 0; /* Name of the procedure being replaced */
+  char         *sql = 0;
+  SpProc       *pProc;
+  proc_param   *pp;
+  int           rowCount;
+  int           rc;
 
   /* see sqlite3StartTable(...) for name resolution info...*/
   iDb = sqlite3TwoPartName(pParse, pName1, pName2, &pName);
@@ -257,56 +1126,152 @@ sqlite3CreateProc(
   if( SQLITE_OK!=sqlite3CheckObjectName(pParse, zName) ){
     goto create_proc_error;
   }
-#if 0 /* memory error upon closing without db file */
-  {/* use internal lookup...*/
-    Table *pTable;
-    char *zDb = db->aDb[iDb].zName;
-    if( SQLITE_OK!=sqlite3ReadSchema(pParse) ){
-      goto create_proc_error;
-    }
-    pTable = sqlite3FindTable(db, "sp_schema", zDb);
-    if( !pTable ){
-#endif
-      if(initSpSchema(pParse, &zErrMsg)!=SQLITE_OK) {
-        sqlite3ErrorMsg(pParse, "%s", zErrMsg);
-        goto create_proc_error;
+  if( SQLITE_OK!=sqlite3ReadSchema(pParse) ){
+    goto create_proc_error;
+  }
+  zDb = db->aDb[iDb].zName;
+
+  pProc = spCatalogFind(db, iDb, zName);
+  if( pProc ){
+    if( !nReplace ){
+      if( !noErr ){
+        sqlite3ErrorMsg(pParse, "procedure %s already exists", zName);
       }
-#if 0 /* memory error upon closing without db file */
-    }
-  } 
-#endif
-  
-  int rowCount=-1;
-  if(countProc(db, zName, &rowCount, &zErrMsg) != SQLITE_OK) {
-      sqlite3ErrorMsg(pParse, "%s", zErrMsg);
       goto create_proc_error;
+    }
+    zOld = sqlite3DbStrDup(db, pProc->zName);
+    if( zOld==0 ) goto create_proc_error;
   }
 
-  if (rowCount>0 && nReplace) {
-    if(deleteProcSchema(db, zName, &rowCount, 0, &zErrMsg) != SQLITE_OK) {
-      sqlite3ErrorMsg(pParse, "%s", zErrMsg);
-      goto create_proc_error;
+  /* Build the catalog entry first, so that a malloc failure cannot leave
+  ** sp_schema and the catalog out of step. */
+  pProc = spProcNew(zName, procBody, procReturnType, procLangImpl);
+  for(pp=procParams; pProc && pp && pp->name; pp=pp->pNext){
+    if( spProcAddParam(pProc, pp->name, pp->typeDecl, pp->affinity) ){
+      spProcFree(pProc);
+      pProc = 0;
     }
-    assert(rowCount == 1);
-  } else if(rowCount>0 && noErr) {
-      goto create_proc_error;
   }
-  
-  rowCount = -1;
-  if(addProcSchema(db, zName, procParams, procBody, procReturnType,
-    procLangImpl, (const char*)sql, &rowCount, &zErrMsg) != SQLITE_OK) {
-      sqlite3_free(sql);
-      sqlite3ErrorMsg(pParse, "%s", zErrMsg);
-      goto create_proc_error;
+  sql = sqlite3DbStrNDup(db, ctx->sqlStr, ctx->sqlStrLen);
+  if( pProc==0 || sql==0 ){
+    db->mallocFailed = 1;
+    if( pProc ) spProcFree(pProc);
+    goto create_proc_error;
+  }
+
+  /* The tables must be written as a unit, since a REPLACE is a delete
+  ** followed by an insert. */
+  doUpdate(db, "savepoint sp_create", 0, 0);
+  rc = initSpSchema(pParse, iDb, &zErrMsg);
+  if( rc==SQLITE_OK && zOld ){
+    rc = deleteProcSchema(db, zDb, zOld, &rowCount, &zErrMsg);
+  }
+  if( rc==SQLITE_OK ){
+    rc = addProcSchema(db, zDb, zName, procParams, procBody, procReturnType,
+                       procLangImpl, sql, &rowCount, &zErrMsg);
+  }
+  if( rc!=SQLITE_OK ){
+    doUpdate(db, "rollback to sp_create", 0, 0);
+    doUpdate(db, "release sp_create", 0, 0);
+    sqlite3ErrorMsg(pParse, "%s", zErrMsg ? zErrMsg : "out of memory");
+    sqlite3_free(zErrMsg);
+    spProcFree(pProc);
+    goto create_proc_error;
+  }
+  doUpdate(db, "release sp_create", 0, 0);
+
+  /* The schema of this connection is not reloaded when the cookie
+  ** changes, so the catalog is updated here directly. */
+  if( zOld ) spCatalogRemove(db, iDb, zOld);
+  if( spCatalogInsert(db, db->aDb[iDb].pSchema, pProc)==SQLITE_OK ){
+    sqlite3ProcCacheClear(db);
+    sqlite3ProcChangeCookie(pParse, iDb);
   }
-  sqlite3_free(sql);
-  assert(rowCount == 1);
 
 create_proc_error:
+  sqlite3DbFree(db, sql);
+  sqlite3DbFree(db, zOld);
   sqlite3DbFree(db, zName);
   return;
 }
 
+/*
+** Drop procedure zName from database iDb on behalf of DROP PROCEDURE:
+** delete it from sp_schema and sp_params, remove it from the catalog
+** and bump the schema cookie.  If the procedure does not exist, leave
+** an error in pParse unless noErr is set.
+*/
+void
+sqlite3ProcCatalogDrop(Parse *pParse, int iDb, const char *zName, int noErr) {
+  sqlite3 *db = pParse->db;
+  SpProc  *pProc;
+  char    *zProc;
+  char    *zErrMsg = 0;
+  int      rowCount;
+
+  pProc = spCatalogFind(db, iDb, zName);
+  if( pProc==0 ){
+    if( !noErr ){
+      sqlite3ErrorMsg(pParse, "no such procedure: %s", zName);
+    }
+    return;
+  }
+  zProc = sqlite3DbStrDup(db, pProc->zName);
+  if( zProc==0 ) return;
+  doUpdate(db, "savepoint sp_drop", 0, 0);
+  if( deleteProcSchema(db, db->aDb[iDb].zName, zProc, &rowCount, &zErrMsg) ){
+    doUpdate(db, "rollback to sp_drop", 0, 0);
+    doUpdate(db, "release sp_drop", 0, 0);
+    sqlite3ErrorMsg(pParse, "cannot drop procedure \"%s\": %s", zName,
+                    zErrMsg ? zErrMsg : "out of memory");
+    sqlite3_free(zErrMsg);
+  }else{
+    doUpdate(db, "release sp_drop", 0, 0);
+    spCatalogRemove(db, iDb, zProc);
+    sqlite3ProcCacheClear(db);
+    sqlite3ProcChangeCookie(pParse, iDb);
+  }
+  sqlite3DbFree(db, zProc);
+}
+
+/*
+** Code an OP_ProcStat that marks the start of the body of procedure
+** zName in database iDb, making sure the procedure has a statistics
+** entry.  Return the first of the three registers OP_ProcStat uses and
+** set *pzKey to the key for spCodeStatEnd(), or return 0 if no
+** statistics will be gathered for this call.
+*/
+static int
+spCodeStatBegin(Parse *pParse, int iDb, const char *zName, char **pzKey) {
+  sqlite3 *db = pParse->db;
+  Vdbe *v = sqlite3GetVdbe(pParse);
+  SpStat *p;
+  int iReg;
+
+  *pzKey = 0;
+  if( v==0 ) return 0;
+  p = spStatFind(db, db->aDb[iDb].zName, zName, 1);
+  if( p==0 || (*pzKey = sqlite3DbStrDup(db, p->zKey))==0 ) return 0;
+  iReg = pParse->nMem+1;
+  pParse->nMem += 3;
+  sqlite3VdbeAddOp2(v, OP_ProcStat, iReg, 0);
+  return iReg;
+}
+
+/*
+** Code the OP_ProcStat that ends a call started by the instruction
+** coded by spCodeStatBegin().  zKey is taken over by the VDBE.
+*/
+static void
+spCodeStatEnd(Parse *pParse, int iReg, char *zKey) {
+  Vdbe *v = sqlite3GetVdbe(pParse);
+  if( v ){
+    sqlite3VdbeAddOp4(v, OP_ProcStat, iReg, 1, 0, zKey, P4_DYNAMIC);
+  }else{
+    sqlite3DbFree(pParse->db, zKey);
+  }
+}
+
 void (*pf_sqlite3_execpython)(sqlite3 *, const char*);
 
 void sqlite3ExecProc(
@@ -319,87 +1284,290 @@ void sqlite3ExecProc(
   sqlite3 *db = pParse->db;
   int      iDb;         /* Database number the proc is in */
   Token   *pName;    /* Unqualified name of the proc */
-  char    *zErrMsg;
-  char    *procParams;
+  SpCacheEntry *pProc;  /* Cached definition of the proc */
   char    *procBody;
   int      procReturnType  = -1;
-  char    *procLangImpl;
   int      rowsEffected = -1;
+  SpResultset *pMark = 0; /* Result set stack top before the body ran */
+  int      iStatReg = 0;  /* First register used by OP_ProcStat, if any */
+  char    *zStatKey = 0;  /* P4 of the closing OP_ProcStat */
+  SpStat  *pStat;         /* Statistics of a Python procedure */
+  u64      iStart = 0;    /* Clock when a Python body started */
+
+  if( db->pConnProcCtx ) pMark = db->pConnProcCtx->pResultsetStack;
 
   /* see sqlite3StartTable(...) for name resolution info...*/
   iDb = sqlite3TwoPartName(pParse, pName1, pName2, &pName);
 
-  if( iDb<0 ) return;
+  if( iDb<0 ) goto exec_proc_error;
 
   pParse->sNameToken = *pName;
   zName = sqlite3NameFromToken(db, pName);
+  if( zName==0 ) goto exec_proc_error;
+  if( SQLITE_OK!=sqlite3ReadSchema(pParse) ){
+    goto exec_proc_error;
+  }
 
-  if(getProcSchema(db, zName, &procParams, &procBody, &procReturnType,
-    &procLangImpl, &zErrMsg) != SQLITE_OK) {
-      sqlite3ErrorMsg(pParse, "%s", zErrMsg);
-      return;
-  } 
+  if( (pProc = spCacheFind(pParse, iDb, zName))==0 ){
+    goto exec_proc_error;
+  }
+  procBody       = pProc->zBody;
+  procReturnType = pProc->returnType;
+
+  /* The code generated below is only valid for the current definition
+  ** of the procedure, so have the statement check the schema cookie. */
+  sqlite3CodeVerifySchema(pParse, iDb);
 
 #ifdef SQLITE_USE_TEMPTABLES_FOR_PROCS
-  if (SQLITE_SP_RESULTSET == procReturnType) {
+  /* Unless "PRAGMA stream_proc_results" is on, record the temp table
+  ** that holds the result set of this call in sp_temp. */
+  if (SQLITE_SP_RESULTSET == procReturnType
+   && (db->flags & SQLITE_StreamProcs)==0) {
+    Token tt;
+    char *zSql;
+    char *zErrMsg = 0;
+
     pParse->pExecProc->ResultTable.z = spResultTempTableName(pParse, pName);
     pParse->pExecProc->ResultTable.n = strlen(pParse->pExecProc->ResultTable.z);
-  } 
-   
-  Token tt;
-  tt.z = pParse->pExecProc->ResultTable.z;
-  tt.n = strlen(tt.z);
-
-  char *zSql = sqlite3MPrintf(db, 
-    "insert into main.sp_temp (tid,proc_name,tbl_name,last_update_time) "
-    "values(%x,%.*Q,%.*Q,%s)", 
-     (long)db, pName->n, pName->z, tt.n, tt.z,"datetime('now')");
-
-  if(doUpdate(db, zSql, &rowsEffected, &zErrMsg) != SQLITE_OK) {
-    sqlite3ErrorMsg(pParse, "Error: %s:%d %s", __FILE__,__LINE__, zErrMsg);
-    return;
+    tt.z = pParse->pExecProc->ResultTable.z;
+    tt.n = strlen(tt.z);
+
+    zSql = sqlite3MPrintf(db, 
+      "insert into main.sp_temp (tid,proc_name,tbl_name,last_update_time) "
+      "values(%x,%.*Q,%.*Q,%s)", 
+       (long)db, pName->n, pName->z, tt.n, tt.z,"datetime('now')");
+
+    if(doUpdate(db, zSql, &rowsEffected, &zErrMsg) != SQLITE_OK) {
+      sqlite3ErrorMsg(pParse, "Error: %s:%d %s", __FILE__,__LINE__, zErrMsg);
+      sqlite3DbFree(db, zSql);
+      goto exec_proc_error;
+    }
+    sqlite3DbFree(db, zSql);
   }
 #endif
 
-/*
-  sqlite3DebugPrintf("*** ExecProc: %T %s %s %d %s %T\n", 
-    pName, procParams, procBody, procReturnType, procLangImpl, 
-    pParse->pExecProc->ResultTable);
-
-  printf("*** ExecProc: %.*s %s %s %d %s %.*s\n", 
-    pName->n, pName->z,
-    procParams, procBody, procReturnType, procLangImpl, 
-    pParse->pExecProc->ResultTable.n, pParse->pExecProc->ResultTable.z);
-*/
-
-  if (strcasecmp("sqlite",procLangImpl) == 0) {
+  if (pProc->eLang == SQLITE_SP_LANG_SQLITE) {
+    ConnProcCtx *pCtx = db->pConnProcCtx;
+    SpArgFrame frame;
+    if( spCodeArgs(pParse, pProc, procArgs, &frame) ){
+      goto exec_proc_error;
+    }
+    frame.pOuter = pCtx->pArgFrame;
+    pCtx->pArgFrame = &frame;
+    iStatReg = spCodeStatBegin(pParse, iDb, pProc->zName, &zStatKey);
     sqlite3NestedParse(pParse, "%s", procBody);
-  } else if (strcasecmp("python",procLangImpl) == 0) {
-    if(!pf_sqlite3_execpython) {
+    pCtx->pArgFrame = frame.pOuter;
+    sqlite3DbFree(db, frame.azArg);
+  } else if (pProc->eLang == SQLITE_SP_LANG_PYTHON) {
+    if(!pf_sqlite3_execpython && !spFindLangImpl("python")) {
       char *zErrMsg = 0;
 #ifdef PARANOID_EXTENSION_LOADING
       sqlite3ErrorMsg(pParse, 
         "Cannot execute \"%T\" - pyproc extension not loaded.", pName);
-      return;
+      goto exec_proc_error;
 #else
       if (sqlite3_enable_load_extension(db, 1) 
         || sqlite3_load_extension(db, "libpyproc.dylib", 0, &zErrMsg)) {
         sqlite3ErrorMsg(pParse, "Cannot load pyproc extension %s",
           zErrMsg ? zErrMsg : "\"libpyproc.dylib\"");
         if (zErrMsg) sqlite3_free(zErrMsg);
-        return;
+        goto exec_proc_error;
       }
 #endif
     }
  
-    //pParse->nested++;
-    (*pf_sqlite3_execpython)(db, procBody);
-    //pParse->nested--;
+    if( pProc->pLang==0 ) pProc->pLang = spFindLangImpl("python");
+    if( pProc->pLang ){
+      /* Compile the body on first use and keep it with the cache entry */
+      char *zErr = 0;
+      if( pProc->pCompiled==0 ){
+        pProc->pCompiled = pProc->pLang->xCompile(db, procBody, &zErr);
+      }
+      iStart = sqlite3ProcClock(db);
+      if( pProc->pCompiled==0
+       || pProc->pLang->xExec(db, pProc->pCompiled, &zErr)!=SQLITE_OK ){
+        sqlite3ErrorMsg(pParse, "%s", zErr ? zErr : "python procedure failed");
+        sqlite3_free(zErr);
+        goto exec_proc_error;
+      }
+    }else{
+      iStart = sqlite3ProcClock(db);
+      (*pf_sqlite3_execpython)(db, procBody);
+    }
+    /* Python bodies run while the EXEC is prepared, so they are timed
+    ** here rather than by OP_ProcStat.  Their statements are prepared
+    ** separately and are not counted against the procedure. */
+    pStat = spStatFind(db, db->aDb[iDb].zName, pProc->zName, 1);
+    if( pStat ) spStatAdd(pStat, sqlite3ProcClock(db)-iStart, 0, 0);
   } 
 
   if(SQLITE_SP_RESULTSET == procReturnType) {
-    sqlite3OutputResultSet(pParse);
+    sqlite3OutputResultSet(pParse, zName, pMark);
+  }
+  if( iStatReg ){
+    spCodeStatEnd(pParse, iStatReg, zStatKey);
+    zStatKey = 0;
+  }
+
+exec_proc_error:
+  if( db->pConnProcCtx ) spResultsetUnwind(db, pMark);
+  sqlite3DbFree(db, zStatKey);
+  sqlite3ExprListDelete(db, procArgs);
+  sqlite3DbFree(db, zName);
+}
+
+/*
+** Run procedure zProc ("name" or "dbname.name") once for each of nCall
+** argument tuples of nArg values.  azArg holds the nCall*nArg values in
+** call order; NULL entries are passed as SQL NULL and the others as
+** text, converted by the declared parameter types.
+**
+** The EXEC statement is prepared once and rebound for each call, and
+** all calls run inside a single savepoint.  A failing call only undoes
+** its own changes, and the remaining calls still run.  The result code
+** of each call is written to aRc[] if it is not NULL.  Rows returned by
+** the procedure are discarded.
+**
+** If the closing RELEASE fails (e.g. SQLITE_BUSY), no call is committed
+** and the error is returned even though aRc[] may report success.
+** Return SQLITE_OK if every call succeeded.  Otherwise return the code
+** of the first failure and, if pzErrMsg is not NULL, set *pzErrMsg to
+** its message, to be released with sqlite3_free().
+*/
+int
+sqlite3_exec_proc_batch(
+  sqlite3     *db,
+  const char  *zProc,
+  int          nArg,
+  int          nCall,
+  const char **azArg,
+  int         *aRc,
+  char       **pzErrMsg
+){
+  sqlite3_stmt *pStmt = 0;   /* The EXEC statement */
+  const char *zName = zProc; /* Unqualified procedure name */
+  char *zDb = 0;             /* Database name, if zProc is qualified */
+  char *zSql = 0;            /* Text of the EXEC statement */
+  char *zErr = 0;            /* Message of the first failing call */
+  char *zInitErr = 0;        /* Error from loading the schema */
+  SpProc *pProc;
+  int iDb = 0;
+  int bPerCall = 0;          /* True to prepare the EXEC for each call */
+  int rc = SQLITE_OK;
+  int i, j;
+
+  if( pzErrMsg ) *pzErrMsg = 0;
+  if( zProc==0 || nArg<0 || nCall<0 || (nArg>0 && nCall>0 && azArg==0) ){
+    return SQLITE_MISUSE;
+  }
+  sqlite3_mutex_enter(db->mutex);
+  sqlite3Error(db, SQLITE_OK, 0);
+
+  if( strchr(zProc, '.') ){
+    zName = strchr(zProc, '.') + 1;
+    zDb = sqlite3DbStrNDup(db, zProc, (int)(zName - zProc - 1));
+    zSql = sqlite3_mprintf("EXEC \"%w\".\"%w\"(", zDb, zName);
+  }else{
+    zSql = sqlite3_mprintf("EXEC \"%w\"(", zName);
+  }
+  for(i=0; i<nArg; i++){
+    zSql = sqlite3_mprintf("%z%s?", zSql, i ? "," : "");
+  }
+  zSql = sqlite3_mprintf("%z)", zSql);
+  i = 0;
+  if( zSql==0 ){
+    rc = SQLITE_NOMEM;
+    goto batch_out;
+  }
+
+  /* Python bodies run while the EXEC is prepared, so a procedure in
+  ** that language needs a fresh statement for each call. */
+  rc = sqlite3Init(db, &zInitErr);
+  if( rc!=SQLITE_OK ){
+    if( zInitErr ) zErr = sqlite3_mprintf("%s", zInitErr);
+    sqlite3DbFree(db, zInitErr);
+    goto batch_out;
+  }
+  if( zDb ) iDb = sqlite3FindDbName(db, zDb);
+  if( iDb>=0 ){
+    pProc = spCatalogFind(db, iDb, zName);
+    bPerCall = pProc && spLanguageCode(pProc->zLang)==SQLITE_SP_LANG_PYTHON;
+  }
+  if( !bPerCall ){
+    rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+    if( rc!=SQLITE_OK ) goto batch_out;
+  }
+
+  rc = doUpdate(db, "savepoint sp_batch", 0, 0) ? sqlite3_errcode(db) : 0;
+  if( rc!=SQLITE_OK ) goto batch_out;
+
+  for(i=0; i<nCall; i++){
+    int rcCall = SQLITE_OK;
+    if( bPerCall ){
+      rcCall = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+    }
+    if( rcCall==SQLITE_OK ){
+      for(j=0; j<nArg; j++){
+        const char *zArg = azArg[i*nArg+j];
+        if( zArg ){
+          sqlite3_bind_text(pStmt, j+1, zArg, -1, SQLITE_STATIC);
+        }else{
+          sqlite3_bind_null(pStmt, j+1);
+        }
+      }
+      while( (rcCall = sqlite3_step(pStmt))==SQLITE_ROW ){}
+      if( rcCall==SQLITE_DONE ) rcCall = SQLITE_OK;
+      if( bPerCall ){
+        sqlite3_finalize(pStmt);
+        pStmt = 0;
+      }else{
+        sqlite3_reset(pStmt);
+      }
+    }
+    if( aRc ) aRc[i] = rcCall;
+    if( rcCall!=SQLITE_OK && rc==SQLITE_OK ){
+      rc = rcCall;
+      zErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+    }
+
+    /* Stop if the error rolled back the whole transaction, or if
+    ** carrying on is pointless. */
+    if( rcCall==SQLITE_NOMEM || rcCall==SQLITE_INTERRUPT
+     || sqlite3_get_autocommit(db) ){
+      for(i++; i<nCall; i++){
+        if( aRc ) aRc[i] = SQLITE_ABORT;
+      }
+    }
+  }
+  if( !sqlite3_get_autocommit(db) && doUpdate(db, "release sp_batch", 0, 0) ){
+    if( rc==SQLITE_OK ){
+      rc = sqlite3_errcode(db);
+      zErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+    }
+    doUpdate(db, "rollback to sp_batch", 0, 0);
+    doUpdate(db, "release sp_batch", 0, 0);
+  }
+
+batch_out:
+  /* If the batch failed before the first call, every call fails with
+  ** the same error. */
+  for(; aRc && i<nCall; i++){
+    aRc[i] = rc;
   }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  sqlite3DbFree(db, zDb);
+  if( rc!=SQLITE_OK && zErr==0 && !db->mallocFailed ){
+    zErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  }
+  if( pzErrMsg ){
+    *pzErrMsg = zErr;
+  }else{
+    sqlite3_free(zErr);
+  }
+  rc = sqlite3ApiExit(db, rc);
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
 }
 
 static char *
@@ -420,16 +1588,6 @@ sp_query_cb(void *uarg, int argc, char **argv, char **azColName){
   return 0;
 }
 
-static int 
-query_boolean_cb(void *pInt, int argc, char **argv, char **azColName){
-  if (argc>0 && argv && argv[0]) {
-    *((int *)pInt) = argv[0][0] == '0' ? 0 : 1;
-  } else {
-    *((int *)pInt) = 0;
-  }
-  return 0;
-}
-
 static int
 doUpdate(
   sqlite3     *db, 
@@ -452,6 +1610,7 @@ doUpdate(
 static int
 addProcSchema(
   sqlite3          *db, 
+  const char       *zDb,
   const char       *procName, 
   const proc_param *procParams,
   const char       *procBody,
@@ -462,77 +1621,43 @@ addProcSchema(
   char            **ppzErrMsg /* must sqlite3_free*/) {
 
   int               rc = 1;
-  int               returnCode = 1;
-  sqlite3_stmt     *pStmt;
-  sqlite3_stmt     *pStmt2;
-  const char       *pzTail = 0;
-  char             *pProcParamsKey;
-  char             *procParamsKeysMem[MAX_SPPARAMS];
+  sqlite3_stmt     *pStmt = 0;
+  sqlite3_stmt     *pStmt2 = 0;
+  char             *zSql;
+  char             *pProcParamsKey = 0;
+  const proc_param *pp;
   sqlite3_int64     sp_schema_id=0;
+  char              aff[2];
+  int               i;
 
   *rowsEffected = -1;
-  (void)memset(procParamsKeysMem, 0, MAX_SPPARAMS*sizeof(const char*));
-
-  doUpdate(db, "begin transaction", rowsEffected, ppzErrMsg);
 
-  if((rc = sqlite3_prepare_v2(db, ins_sp_schema, -1, &pStmt, &pzTail))
-    != SQLITE_OK) {
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
-  }
-
-  if((rc = sqlite3_bind_text(pStmt, 1, procName, -1, SQLITE_TRANSIENT)) 
-    != SQLITE_OK) { 
+  zSql = sqlite3MPrintf(db, ins_sp_schema, zDb);
+  rc = zSql ? sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0) : SQLITE_NOMEM;
+  sqlite3DbFree(db, zSql);
+  if( rc!=SQLITE_OK ){
     SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
   }
 
-  procParamsKeysMem[0] = pProcParamsKey = strdup("");
-
   /* 
-    concatenated param-name/param-type forms part of key 
+    concatenated param-type list forms part of key 
     to permit overloaded proc names
   */
-  proc_param *pp = (proc_param*)procParams;
-  int i;
-  for(i=1; pp && pp->name && i<=MAX_SPPARAMS*2; i+=2) {
-    procParamsKeysMem[i] = strdup(pp->typeDecl);
-    procParamsKeysMem[i+1] = strdup(",");
-    (void)strcat(strcat(pProcParamsKey,procParamsKeysMem[i]),
-          procParamsKeysMem[i+1]);
-    pp = pp->pNext;
-  }
-  pProcParamsKey[strlen(pProcParamsKey)-1] = '\0';
-
-  //printf("Paramkey: %s\n", pProcParamsKey); 
-  if((rc = sqlite3_bind_text(pStmt, 2, pProcParamsKey, -1, SQLITE_TRANSIENT)) 
-    != SQLITE_OK) { 
-    for(i=0; i<MAX_SPPARAMS*2 && procParamsKeysMem[i] != 0; i++)
-      free(procParamsKeysMem[i]);
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
-  }
-
-  for(i=0; i<MAX_SPPARAMS*2 && procParamsKeysMem[i] != 0; i++)
-    free(procParamsKeysMem[i]);
-
-  if((rc = sqlite3_bind_text(pStmt, 3, procBody, -1, SQLITE_TRANSIENT)) 
-    != SQLITE_OK) { 
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
+  pProcParamsKey = sqlite3_mprintf("");
+  for(pp=procParams, i=0; pp && pp->name && i<MAX_SPPARAMS; pp=pp->pNext, i++){
+    pProcParamsKey = sqlite3_mprintf("%z%s%s", pProcParamsKey,
+                                     i ? "," : "", pp->typeDecl);
   }
-
-  if((rc = sqlite3_bind_int(pStmt, 4, procReturnType))
-    != SQLITE_OK) { 
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
+  if( pProcParamsKey==0 ){
+    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,SQLITE_NOMEM,__FILE__, __LINE__);
   }
 
-  if((rc = sqlite3_bind_text(pStmt, 5, procLangImpl, -1, SQLITE_TRANSIENT)) 
-    != SQLITE_OK) { 
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
-  }
-  
-  if((rc = sqlite3_bind_text(pStmt, 6, sql, -1, SQLITE_TRANSIENT)) 
-    != SQLITE_OK) { 
-    SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
-  }  
-  
+  sqlite3_bind_text(pStmt, 1, procName, -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(pStmt, 2, pProcParamsKey, -1, sqlite3_free);
+  sqlite3_bind_text(pStmt, 3, procBody, -1, SQLITE_TRANSIENT);
+  sqlite3_bind_int(pStmt, 4, procReturnType);
+  sqlite3_bind_text(pStmt, 5, procLangImpl, -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(pStmt, 6, sql, -1, SQLITE_TRANSIENT);
   if((rc = sqlite3_step(pStmt)) != SQLITE_DONE) {
     SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
   }
@@ -540,97 +1665,31 @@ addProcSchema(
 
   sp_schema_id = sqlite3_last_insert_rowid(db);
 
-  if((rc = sqlite3_prepare_v2(db, ins_sp_params, -1, &pStmt2, &pzTail))
-    != SQLITE_OK) {
+  zSql = sqlite3MPrintf(db, ins_sp_params, zDb);
+  rc = zSql ? sqlite3_prepare_v2(db, zSql, -1, &pStmt2, 0) : SQLITE_NOMEM;
+  sqlite3DbFree(db, zSql);
+  if( rc!=SQLITE_OK ){
     SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);
   }
 
-  char aff[2];
-  pp = (proc_param*)procParams;
-  for(i=0; pp && pp->name && i<MAX_SPPARAMS; i++) {
-    if((rc = sqlite3_bind_int64(pStmt2, 1, sp_schema_id))
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-    if((rc = sqlite3_bind_text(pStmt2, 2, pp->name, -1, SQLITE_TRANSIENT)) 
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-    if((rc = sqlite3_bind_text(pStmt2, 3, pp->typeDecl, -1, SQLITE_TRANSIENT)) 
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-
+  for(pp=procParams, i=0; pp && pp->name && i<MAX_SPPARAMS; pp=pp->pNext, i++){
     aff[0] = pp->affinity;
     aff[1] = '\0';
-    if((rc = sqlite3_bind_text(pStmt2, 4, aff, -1, SQLITE_TRANSIENT)) 
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-
-    if((rc = sqlite3_step(pStmt2)) 
-      != SQLITE_DONE) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-
-    if((rc = sqlite3_reset(pStmt2))
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-    if((rc = sqlite3_clear_bindings(pStmt2))
-      != SQLITE_OK) {SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);}
-
-    pp = pp->pNext;
+    sqlite3_bind_int64(pStmt2, 1, sp_schema_id);
+    sqlite3_bind_text(pStmt2, 2, pp->name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pStmt2, 3, pp->typeDecl, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pStmt2, 4, aff, -1, SQLITE_TRANSIENT);
+    if((rc = sqlite3_step(pStmt2)) != SQLITE_DONE) {
+      SP_API_ERR_INTRANS(db,pStmt2,ppzErrMsg,rc,__FILE__, __LINE__);
+    }
+    sqlite3_reset(pStmt2);
   }
 
   sqlite3_finalize(pStmt2);
-
-  doUpdate(db, "commit", rowsEffected, ppzErrMsg);
- 
+  *rowsEffected = 1;
   return 0;
 }
 
-static int
-getProcSchema(
-  sqlite3          *db, 
-  const char       *procName, 
-  char            **procParams,
-  char            **procBody,
-  int              *procReturnType,
-  char            **procLangImpl,
-  char            **ppzErrMsg /* must sqlite3_free*/) {
-  
-  int               i;
-  int               rc = 1;
-  int               returnCode = 1;
-  sqlite3_stmt     *pStmt;
-  sqlite3_stmt     *pStmt2;
-  const char       *pzTail = 0;
-  char             *pProcParamsKey;
-  char             *procParamsKeysMem[MAX_SPPARAMS];
-  sqlite3_int64     sp_schema_id=0;
-  query_ctx         ctx;
-
-  ctx.data  = (char**)0;
-  ctx.nCols = 0;
-
-  char *zSql = malloc(strlen(sel_sp_schema)+strlen(procName)+2);
-  strcpy(zSql, sel_sp_schema);
-  *(zSql+strlen(zSql)-1) = '\0';
-  (void)strcat(strcat(strcat(zSql,"'"),procName),"'");
-
-  if((rc = sqlite3_exec(db, zSql, sp_query_cb, &ctx, ppzErrMsg))
-    != SQLITE_OK) {
-    free(zSql);
-    SP_API_ERR(db,ppzErrMsg,rc,__FILE__, __LINE__);
-  }
-
-  if (ctx.data == (char**)0) {
-    *ppzErrMsg = sqlite3MPrintf(db, "no such procedure \"%s\"", procName);
-    rc = SQLITE_ERROR;
-    goto exit_proc_schema;
-  }
-
-  *procParams     = ctx.data[2];
-  *procBody       = ctx.data[3];
-  *procReturnType = ctx.data[4]?(int)strtol(ctx.data[4],0,0):-1;
-  *procLangImpl   = ctx.data[5];
-
-exit_proc_schema:
-  free(zSql);
-  if (ctx.data)
-    free(ctx.data);
-  return rc;
-}
-
 static int
 getSPResultsTableName(
   sqlite3          *db, 
@@ -678,120 +1737,77 @@ exit_fetch_temptable:
   return rc;
 }
 
+/*
+** Delete procedure procName, and its parameters, from the sp_schema and
+** sp_params tables of database zDb.  The in-memory catalog is left for
+** the caller to update.
+*/
 static int
-countProc(
-  sqlite3          *db,
-  const char       *procName,
-  int              *count,
-  char            **ppzErrMsg /* must sqlite3_free*/) {
-
-  int               rc = 1;
-  query_ctx         ctx;
-
-  (void)memset(&ctx, 0, sizeof(query_ctx));
-  char *zSql = malloc(strlen(count_sp_schema)+strlen(procName)+2);
-  strcpy(zSql, count_sp_schema);
-  *(zSql+strlen(zSql)-1) = '\0';
-  (void)strcat(strcat(strcat(zSql,"'"),procName),"'");
-
-  if((rc = sqlite3_exec(db, zSql, sp_query_cb, &ctx, ppzErrMsg))
-    != SQLITE_OK) {
-    free(zSql);
-    SP_API_ERR(db,ppzErrMsg,rc,__FILE__, __LINE__);
-  }
-
-  if (ctx.nCols == 1 && ctx.data)
-    *count = ctx.data[0]?(int)strtol(ctx.data[0],0,0):-1;
-  else
-    *count = 0;
-
-  free(zSql);
-  free(ctx.data);
-  return 0;
-}
-
-
-int
 deleteProcSchema(
   sqlite3     *db, 
+  const char  *zDb,
   const char  *procName, 
   int         *rowsDeleted, 
-  int          noErr,
   char       **ppzErrMsg) {
 
-  int          bRestoreFK=0;
-  int          rc = 1;
-  int          returnCode = 1;
+  sqlite3_stmt *pStmt = 0;
+  char         *zSql;
+  int           rc;
+  int           i;
 
   *rowsDeleted = -1;
 
-  int bForeignKeys = -1;
-  if((rc = sqlite3_exec(db, "pragma foreign_keys", 
-    query_boolean_cb, &bForeignKeys, ppzErrMsg))
-    != SQLITE_OK) {
-      //fprintf(stderr, "%d: SQL error: %d - %s\n", __LINE__, rc, *ppzErrMsg);
-      if (!noErr) 
-        sqlite3Error(db, rc, "%s:%d error: %d, %s", __FILE__, __LINE__, rc, *ppzErrMsg);
-      return 1;
-  }
-
-  if(bForeignKeys == 0 && 
-    ((rc = sqlite3_exec(db, "pragma foreign_keys=on", 0, 0, ppzErrMsg))
-    != SQLITE_OK)) {
-      if (!noErr) 
-        sqlite3Error(db, rc, "%s:%d error: %d, %s", __FILE__, __LINE__, rc, *ppzErrMsg);
-      return 1;
-  } else {
-    bRestoreFK=1;
-  }
-
-  char *stmt = sqlite3_malloc(strlen(del_sp_schema)+1+strlen(procName)+2);
-  (void)strcpy(stmt,del_sp_schema);
-  *(stmt+strlen(stmt)-1) = '\0'; /* remove bind param '?' */
-  (void)strcat(strcat(strcat(stmt,"'"), procName), "'");
-
-  if((rc = sqlite3_exec(db, stmt, 0, 0, ppzErrMsg))
-    != SQLITE_OK) {
-      if (!noErr) 
-        sqlite3Error(db, rc, "%s:%d error: %d, %s", __FILE__, __LINE__, rc, *ppzErrMsg);
-      returnCode=1;
-  } else {
-      returnCode=0;
+  /* sp_params first: the cascade declared on sp_params only fires
+  ** when foreign key enforcement happens to be enabled. */
+  for(i=0; i<2; i++){
+    if( i==0 ){
+      zSql = sqlite3MPrintf(db, del_sp_params, zDb, zDb);
+    }else{
+      zSql = sqlite3MPrintf(db, del_sp_schema, zDb);
+    }
+    rc = zSql ? sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0) : SQLITE_NOMEM;
+    sqlite3DbFree(db, zSql);
+    if( rc==SQLITE_OK ){
+      sqlite3_bind_text(pStmt, 1, procName, -1, SQLITE_STATIC);
+      rc = sqlite3_step(pStmt);
+    }
+    if( rc!=SQLITE_DONE ){
+      SP_API_ERR_INTRANS(db,pStmt,ppzErrMsg,rc,__FILE__, __LINE__);
+    }
+    sqlite3_finalize(pStmt);
   }
 
-  sqlite3_free(stmt);
-
   *rowsDeleted = sqlite3_changes(db);
-
-  char *ignoredMsg;
-  if (bRestoreFK) {
-    if((rc = sqlite3_exec(db, "pragma foreign_keys=off", 0, 0, &ignoredMsg))
-      != SQLITE_OK) {
-        if (!noErr) 
-          sqlite3Error(db, rc, "%s:%d error: %d, %s", __FILE__, __LINE__, rc, *ppzErrMsg);
-    }
-  }
-  return returnCode;
+  return 0;
 }
 
-int
-initSpSchema(Parse *pParse, char **ppzErrMsg) {
+/*
+** Make sure database iDb has the sp_schema and sp_params tables.  The
+** tables are only created if they are missing from the schema.
+*/
+static int
+initSpSchema(Parse *pParse, int iDb, char **ppzErrMsg) {
   sqlite3 *db = pParse->db;
-  int rowsEffected=-1;
-
-  if(doUpdate(db, cr_sp_schema, &rowsEffected, ppzErrMsg) != SQLITE_OK 
-    || rowsEffected < 0 
-    || doUpdate(db, cr_sp_params, &rowsEffected, ppzErrMsg) != SQLITE_OK
-    || rowsEffected < 0 
+  const char *zDb = db->aDb[iDb].zName;
+  char *zSql;
+  int rc = SQLITE_OK;
+
+  if( sqlite3FindTable(db, "sp_schema", zDb)==0 
+   || sqlite3FindTable(db, "sp_params", zDb)==0 ){
+    zSql = sqlite3_mprintf("%z;%z", sqlite3_mprintf(cr_sp_schema, zDb),
+                           sqlite3_mprintf(cr_sp_params, zDb));
+    if( zSql==0 ) return SQLITE_NOMEM;
+    rc = doUpdate(db, zSql, 0, ppzErrMsg);
+    sqlite3_free(zSql);
+  }
 #ifdef SQLITE_USE_TEMPTABLES_FOR_PROCS
-    || doUpdate(db, "create table if not exists main.sp_temp "
-                    "(tid integer,proc_name text,"
-                    " tbl_name text,last_update_time datetime)",
-                    &rowsEffected, ppzErrMsg) != SQLITE_OK
-    || rowsEffected < 0) 
-#else
-    )
+  if( rc==SQLITE_OK && sqlite3FindTable(db, "sp_temp", "main")==0 ){
+    rc = doUpdate(db, "create table if not exists main.sp_temp "
+                      "(tid integer,proc_name text,"
+                      " tbl_name text,last_update_time datetime)",
+                      0, ppzErrMsg);
+  }
 #endif
-    return SQLITE_ERROR;
+  return rc ? SQLITE_ERROR : SQLITE_OK;
 }
 #endif /* SQLITE_ENABLE_STOREDPROCS */
@@ -598,6 +598,7 @@ typedef struct AggInfo AggInfo;
 typedef struct AuthContext AuthContext;
 typedef struct AutoincInfo AutoincInfo;
 typedef struct Bitvec Bitvec;
+typedef struct CkptThread CkptThread;
 typedef struct CollSeq CollSeq;
 typedef struct Column Column;
 typedef struct Db Db;
@@ -641,6 +642,10 @@ typedef struct WhereLevel WhereLevel;
   typedef struct ExecProc ExecProc;
   typedef struct SpResultset SpResultset;
   typedef struct ConnProcCtx ConnProcCtx;
+  typedef struct SpCacheEntry SpCacheEntry;
+  typedef struct SpProc SpProc;
+  typedef struct SpStat SpStat;
+  typedef struct SpArgFrame SpArgFrame;
 #endif 
 
 /*
@@ -670,6 +675,7 @@ struct Db {
   u8 inTrans;          /* 0: not writable.  1: Transaction.  2: Checkpoint */
   u8 safety_level;     /* How aggressive at syncing data to disk */
   Schema *pSchema;     /* Pointer to database schema (possibly shared) */
+  CkptThread *pCkpt;   /* Background checkpointer, or NULL */
 };
 
 /*
@@ -681,6 +687,9 @@ struct Schema {
   Hash idxHash;        /* All (named) indices indexed by name */
   Hash trigHash;       /* All triggers indexed by name */
   Hash fkeyHash;       /* All foreign keys by referenced table name */
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  Hash procHash;       /* All stored procedures indexed by name */
+#endif
   Table *pSeqTab;      /* The sqlite_sequence table used by AUTOINCREMENT */
   u8 file_format;      /* Schema format version for this file */
   u8 enc;              /* Text encoding used by this database */
@@ -796,6 +805,7 @@ struct sqlite3 {
   int errCode;                  /* Most recent error code (SQLITE_*) */
   int errMask;                  /* & result codes with this before returning */
   u8 autoCommit;                /* The auto-commit flag. */
+  u8 bConcurrent;               /* Transaction opened by BEGIN CONCURRENT */
   u8 temp_store;                /* 1: file 2: memory 0: default */
   u8 mallocFailed;              /* True if we have seen a malloc failure */
   u8 dfltLockMode;              /* Default locking-mode for attached dbs */
@@ -930,6 +940,8 @@ struct sqlite3 {
 #define SQLITE_ForeignKeys    0x04000000  /* Enforce foreign key constraints  */
 #define SQLITE_AutoIndex      0x08000000  /* Enable automatic indexes */
 #define SQLITE_PreferBuiltin  0x10000000  /* Preference to built-in funcs */
+#define SQLITE_StreamProcs    0x20000000  /* Do not record proc results in
+                                          ** sp_temp */
 
 /*
 ** Bits of the sqlite3.flags field that are used by the
@@ -2689,6 +2701,9 @@ void sqlite3CreateView(Parse*,Token*,Token*,Token*,Select*,int,int);
   struct ConnProcCtx {
     void        *procLangImpl;
     SpResultset *pResultsetStack;
+    Hash         procCache;     /* Compiled procedures, see SpCacheEntry */
+    SpArgFrame  *pArgFrame;     /* Arguments of the body being coded */
+    Hash         procStats;     /* Execution statistics, see SpStat */
   };
 
   struct proc_param {
@@ -2702,6 +2717,79 @@ void sqlite3CreateView(Parse*,Token*,Token*,Token*,Select*,int,int);
 /* other types defined in sqlite3.h */
 #define SQLITE_SP_RESULTSET 99 
 
+/* Procedure implementation languages understood by sqlite3ExecProc() */
+#define SQLITE_SP_LANG_SQLITE 1
+#define SQLITE_SP_LANG_PYTHON 2
+
+  /*
+  ** A stored procedure, as held in the Schema.procHash catalog of the
+  ** database that contains it.  The catalog is read from sp_schema and
+  ** sp_params when the schema is loaded and is changed only by CREATE
+  ** and DROP PROCEDURE.  Entries belong to the Schema, which may be
+  ** shared between connections, so they are not allocated from any
+  ** connection's lookaside.
+  */
+  struct SpProc {
+    char       *zName;       /* Procedure name.  Also the hash key */
+    char       *zBody;       /* Procedure body text */
+    int         returnType;  /* SQLITE_NULL ... SQLITE_SP_RESULTSET, or -1 */
+    char       *zLang;       /* Implementation language, e.g. "sqlite" */
+    int         nParam;      /* Number of declared parameters */
+    proc_param *aParam;      /* Declared parameters, nParam entries */
+  };
+
+  /*
+  ** A procedure definition cached in ConnProcCtx.procCache so that EXEC
+  ** does not have to query sp_schema and sp_params on every call.  The
+  ** hash key is "dbname.procname".  An entry is only used while the
+  ** schema cookie of database iDb still equals iCookie; CREATE and DROP
+  ** PROCEDURE bump that cookie and flush the cache.
+  */
+  struct SpCacheEntry {
+    char       *zKey;        /* Hash key - "dbname.procname" */
+    char       *zName;       /* Procedure name, as stored in sp_schema */
+    int         iCookie;     /* Schema cookie when the entry was loaded */
+    char       *zBody;       /* Procedure body text */
+    int         returnType;  /* SQLITE_NULL ... SQLITE_SP_RESULTSET */
+    int         eLang;       /* One of the SQLITE_SP_LANG_* values */
+    int         nParam;      /* Number of declared parameters */
+    proc_param *aParam;      /* Declared parameters, nParam entries */
+    ProcLangImpl *pLang;     /* Language extension running the body */
+    void       *pCompiled;   /* Body compiled by pLang->xCompile() */
+  };
+
+  /*
+  ** Execution statistics of one procedure on one connection, kept in
+  ** ConnProcCtx.procStats under the key "dbname.procname".  Entries are
+  ** created the first time an EXEC of the procedure is prepared and live
+  ** until the connection is closed.  Times are in sqlite3ProcClock()
+  ** ticks.  Steps and rows include those of nested EXEC statements.
+  */
+  struct SpStat {
+    char       *zKey;        /* Hash key - "dbname.procname" */
+    char       *zDb;         /* Database holding the procedure */
+    char       *zName;       /* Procedure name */
+    i64         nCall;       /* Number of completed calls */
+    i64         nRow;        /* Result rows returned by those calls */
+    i64         nStep;       /* VDBE instructions executed by those calls */
+    u64         iTotal;      /* Total time spent in the procedure */
+    u64         iMax;        /* Time taken by the slowest call */
+  };
+
+  /*
+  ** While the body of an 'sqlite' language procedure is being coded by
+  ** sqlite3ExecProc(), references to its declared parameters are bound
+  ** to the registers holding the EXEC arguments.  Frames of nested EXEC
+  ** statements are linked through pOuter.
+  */
+  struct SpArgFrame {
+    int         nArg;        /* Number of declared parameters */
+    int         iReg;        /* First of nArg registers holding the values */
+    char      **azArg;       /* Parameter names, e.g. "@x" */
+    char       *zAff;        /* Declared affinity of each parameter */
+    SpArgFrame *pOuter;      /* Frame of the enclosing EXEC, or NULL */
+  };
+
   /* per-statement stored proc parse context */
   struct ParseProcCtx {
     Token           *pName1;
@@ -2748,14 +2836,20 @@ void sqlite3EndCreateProc(
   Token *pLanguage,
   int returnTypeCode);
 
+void sqlite3CreateProc(
+  Parse      *pParse,
+  Token      *pName1,
+  Token      *pName2,
+  const char *procBody,
+  proc_param *procParams,
+  int         procReturnType,
+  const char *procLangImpl,
+  int         nReplace,
+  int         noErr);
+
 void sqlite3DropProc(Parse *pParse, SrcList *pName, int noErr);
 
-int deleteProcSchema(
-  sqlite3     *db,
-  const char  *procName,
-  int         *rowsDeleted,
-  int          noErr,
-  char       **ppzErrMsg);
+void sqlite3ProcCatalogDrop(Parse*, int iDb, const char *zName, int noErr);
 
 void sqlite3ExecProc(
   Parse *pParse,
@@ -2768,6 +2862,14 @@ void sqlite3RenderResultSet(Parse *pParse, Select *s);
 
 void sqlite3ProcDbFinalize(sqlite3 *db);
 int sqlite3ProcDbInit(sqlite3 **pDb, char **pzErrMsg);
+void sqlite3ProcCacheClear(sqlite3 *db);
+int sqlite3ProcCatalogLoad(sqlite3 *db, int iDb);
+void sqlite3ProcCatalogClear(Schema *pSchema);
+void sqlite3ProcChangeCookie(Parse *pParse, int iDb);
+int sqlite3ProcArgToRegister(Parse *pParse, Expr *pExpr);
+u64 sqlite3ProcClock(sqlite3 *db);
+void sqlite3ProcStatRecord(sqlite3*, const char *zKey, u64 nTick, i64 nStep,
+                           i64 nRow);
 #endif /* SQLITE_ENABLE_STOREDPROCS */
 
 void sqlite3DropTable(Parse*, SrcList*, int, int);
@@ -3146,6 +3248,9 @@ VTable *sqlite3GetVTable(sqlite3*, Table*);
 const char *sqlite3JournalModename(int);
 int sqlite3Checkpoint(sqlite3*, int);
 int sqlite3WalDefaultHook(void*,sqlite3*,const char*,int);
+int sqlite3CkptThreadConfig(sqlite3*, int, int);
+int sqlite3CkptThreadWake(Db*);
+void sqlite3CkptThreadStop(Db*);
 
 /* Declarations for functions in fkey.c. All of these are replaced by
 ** no-op macros if OMIT_FOREIGN_KEY is defined. In this case no foreign
@@ -206,3 +206,39 @@
 #ifndef SQLITE_MAX_TRIGGER_DEPTH
 # define SQLITE_MAX_TRIGGER_DEPTH 1000
 #endif
+
+/*
+** The default and maximum number of bytes of a database file that the
+** unix VFS will memory-map in order to read pages without copying them
+** into the page cache.  The default of zero leaves memory-mapped I/O
+** disabled until it is enabled with "PRAGMA mmap_size".  Setting
+** SQLITE_MAX_MMAP_SIZE to zero removes the capability altogether.
+*/
+#ifndef SQLITE_MAX_MMAP_SIZE
+# define SQLITE_MAX_MMAP_SIZE 0x10000000000LL  /* 1 TiB */
+#endif
+#ifndef SQLITE_DEFAULT_MMAP_SIZE
+# define SQLITE_DEFAULT_MMAP_SIZE 0
+#endif
+#if SQLITE_DEFAULT_MMAP_SIZE>SQLITE_MAX_MMAP_SIZE
+# undef SQLITE_DEFAULT_MMAP_SIZE
+# define SQLITE_DEFAULT_MMAP_SIZE SQLITE_MAX_MMAP_SIZE
+#endif
+
+/*
+** Building with SQLITE_ENABLE_DIRECT_IO adds the "unix-direct" VFS, which
+** opens database files with O_DIRECT so that the page cache is the only
+** cache.  O_DIRECT requires buffers, file offsets and transfer sizes to be
+** aligned, so the page buffers of a database file opened by this VFS are
+** aligned to SQLITE_DIRECT_IO_ALIGN bytes.  This must be a power of two no
+** smaller than the logical block size of the storage device.  In other
+** builds it is zero.
+*/
+#ifdef SQLITE_ENABLE_DIRECT_IO
+# ifndef SQLITE_DIRECT_IO_ALIGN
+#  define SQLITE_DIRECT_IO_ALIGN 4096
+# endif
+#else
+# undef SQLITE_DIRECT_IO_ALIGN
+# define SQLITE_DIRECT_IO_ALIGN 0
+#endif
@@ -3578,6 +3578,8 @@ static void init_all(Tcl_Interp *interp){
     extern int SqlitetestStat_Init(Tcl_Interp*);
     extern int Sqlitetestrtree_Init(Tcl_Interp*);
     extern int Sqlitequota_Init(Tcl_Interp*);
+    extern int Sqlitetestchecksum_Init(Tcl_Interp*);
+    extern int Sqlitetestcompress_Init(Tcl_Interp*);
 
     Sqliteconfig_Init(interp);
     Sqlitetest1_Init(interp);
@@ -3608,6 +3610,8 @@ static void init_all(Tcl_Interp *interp){
     SqlitetestStat_Init(interp);
     Sqlitetestrtree_Init(interp);
     Sqlitequota_Init(interp);
+    Sqlitetestchecksum_Init(interp);
+    Sqlitetestcompress_Init(interp);
 
     Tcl_CreateObjCommand(interp,"load_testfixture_extensions",init_all_cmd,0,0);
 
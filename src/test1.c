@@ -122,6 +122,7 @@ const char *sqlite3TestErrorName(int rc){
     case SQLITE_PERM:                zName = "SQLITE_PERM";              break;
     case SQLITE_ABORT:               zName = "SQLITE_ABORT";             break;
     case SQLITE_BUSY:                zName = "SQLITE_BUSY";              break;
+    case SQLITE_BUSY_SNAPSHOT:       zName = "SQLITE_BUSY_SNAPSHOT";     break;
     case SQLITE_LOCKED:              zName = "SQLITE_LOCKED";            break;
     case SQLITE_LOCKED_SHAREDCACHE:  zName = "SQLITE_LOCKED_SHAREDCACHE";break;
     case SQLITE_NOMEM:               zName = "SQLITE_NOMEM";             break;
@@ -2178,6 +2179,113 @@ static int test_stmt_status(
   return TCL_OK;
 }
 
+#ifdef SQLITE_ENABLE_STOREDPROCS
+/*
+** Usage:  sqlite3_proc_status  DB  DBNAME  PROC  CODE  RESETFLAG
+**
+** Return the value of a stored procedure statistic, or an empty string
+** if sqlite3_proc_status() fails.
+*/
+static int test_proc_status(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite3 *db;
+  sqlite3_int64 iValue = 0;
+  int i, op, resetFlag;
+  const char *zOpName;
+  const char *zDb;
+
+  static const struct {
+    const char *zName;
+    int op;
+  } aOp[] = {
+    { "SQLITE_PROCSTATUS_CALLS",     SQLITE_PROCSTATUS_CALLS     },
+    { "SQLITE_PROCSTATUS_TIME",      SQLITE_PROCSTATUS_TIME      },
+    { "SQLITE_PROCSTATUS_TIME_MAX",  SQLITE_PROCSTATUS_TIME_MAX  },
+    { "SQLITE_PROCSTATUS_ROWS",      SQLITE_PROCSTATUS_ROWS      },
+    { "SQLITE_PROCSTATUS_VM_STEP",   SQLITE_PROCSTATUS_VM_STEP   },
+  };
+  if( objc!=6 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB DBNAME PROC PARAMETER RESETFLAG");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  zDb = Tcl_GetString(objv[2]);
+  if( zDb[0]=='\0' ) zDb = 0;
+  zOpName = Tcl_GetString(objv[4]);
+  for(i=0; i<ArraySize(aOp); i++){
+    if( strcmp(aOp[i].zName, zOpName)==0 ){
+      op = aOp[i].op;
+      break;
+    }
+  }
+  if( i>=ArraySize(aOp) ){
+    if( Tcl_GetIntFromObj(interp, objv[4], &op) ) return TCL_ERROR;
+  }
+  if( Tcl_GetBooleanFromObj(interp, objv[5], &resetFlag) ) return TCL_ERROR;
+  if( sqlite3_proc_status(db, zDb, Tcl_GetString(objv[3]), op, &iValue,
+                          resetFlag)==SQLITE_OK ){
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(iValue));
+  }
+  return TCL_OK;
+}
+
+/*
+** Usage:  sqlite3_exec_proc_batch  DB  PROC  NARG  ARGLIST
+**
+** Run PROC once for each group of NARG values in ARGLIST.  Return a list
+** of the result code of each call, followed by the overall result code
+** and error message.  An empty list element is passed as NULL.
+*/
+static int test_exec_proc_batch(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite3 *db;
+  int nArg, nElem, nCall, i, rc;
+  Tcl_Obj **apElem;
+  const char **azArg;
+  int *aRc;
+  char *zErr = 0;
+  Tcl_Obj *pRet;
+
+  if( objc!=5 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB PROC NARG ARGLIST");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[3], &nArg) ) return TCL_ERROR;
+  if( Tcl_ListObjGetElements(interp, objv[4], &nElem, &apElem) ){
+    return TCL_ERROR;
+  }
+  nCall = nArg>0 ? nElem/nArg : nElem;
+  azArg = (const char**)ckalloc(sizeof(char*)*(nElem+1));
+  aRc = (int*)ckalloc(sizeof(int)*(nCall+1));
+  for(i=0; i<nElem; i++){
+    const char *z = Tcl_GetString(apElem[i]);
+    azArg[i] = z[0] ? z : 0;
+  }
+  rc = sqlite3_exec_proc_batch(db, Tcl_GetString(objv[2]), nArg, nCall,
+                               azArg, aRc, &zErr);
+  pRet = Tcl_NewObj();
+  for(i=0; i<nCall; i++){
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(t1ErrorName(aRc[i]),-1));
+  }
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(t1ErrorName(rc), -1));
+  Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(zErr ? zErr : "", -1));
+  sqlite3_free(zErr);
+  ckfree((char*)aRc);
+  ckfree((char*)azArg);
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
+#endif /* SQLITE_ENABLE_STOREDPROCS */
+
 /*
 ** Usage:  sqlite3_next_stmt  DB  STMT
 **
@@ -4771,6 +4879,45 @@ static int file_control_chunksize_test(
   return TCL_OK;
 }
 
+/*
+** tclcmd:   file_control_reserve_bytes DB DBNAME N
+**
+** This TCL command runs the sqlite3_file_control interface with
+** the SQLITE_FCNTL_RESERVE_BYTES opcode and returns the number of
+** reserved bytes previously requested.
+*/
+static int file_control_reserve_bytes(
+  ClientData clientData, /* Pointer to sqlite3_enable_XXX function */
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int objc,              /* Number of arguments */
+  Tcl_Obj *CONST objv[]  /* Command arguments */
+){
+  int nReserve;                   /* New reserve */
+  char *zDb;                      /* Db name ("main", "temp" etc.) */
+  sqlite3 *db;                    /* Database handle */
+  int rc;                         /* file_control() return code */
+
+  if( objc!=4 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB DBNAME N");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) 
+   || Tcl_GetIntFromObj(interp, objv[3], &nReserve)
+  ){
+   return TCL_ERROR;
+  }
+  zDb = Tcl_GetString(objv[2]);
+  if( zDb[0]=='\0' ) zDb = NULL;
+
+  rc = sqlite3_file_control(db, zDb, SQLITE_FCNTL_RESERVE_BYTES, &nReserve);
+  if( rc ){
+    Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+    return TCL_ERROR;
+  }
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(nReserve));
+  return TCL_OK;
+}
+
 /*
 ** tclcmd:   file_control_lockproxy_test DB PWD
 **
@@ -5069,6 +5216,108 @@ static int test_wal_checkpoint(
   return TCL_OK;
 }
 
+#ifndef SQLITE_OMIT_WAL
+/*
+** tclcmd:  sqlite3_wal_checkpoint_step DB NAME NPAGE NMS
+**
+** Run one step of an incremental checkpoint.  Return a list of three
+** elements: the result code name, the number of frames in the WAL and
+** the number of frames checkpointed.
+*/
+static int test_wal_checkpoint_step(
+  ClientData clientData, /* Unused */
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int objc,              /* Number of arguments */
+  Tcl_Obj *CONST objv[]  /* Command arguments */
+){
+  sqlite3 *db;
+  int nPage;
+  int nMs;
+  int nLog = -1;
+  int nCkpt = -1;
+  int rc;
+  Tcl_Obj *pRet;
+
+  if( objc!=5 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB NAME NPAGE NMS");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db)
+   || Tcl_GetIntFromObj(interp, objv[3], &nPage)
+   || Tcl_GetIntFromObj(interp, objv[4], &nMs)
+  ){
+    return TCL_ERROR;
+  }
+  rc = sqlite3_wal_checkpoint_step(db, Tcl_GetString(objv[2]), nPage, nMs,
+                                   &nLog, &nCkpt);
+  pRet = Tcl_NewObj();
+  Tcl_ListObjAppendElement(interp, pRet,
+      Tcl_NewStringObj(t1ErrorName(rc), -1));
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewIntObj(nLog));
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewIntObj(nCkpt));
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
+
+/*
+** tclcmd:  sqlite3_wal_checksum IMPL NATIVE DATA ?NREPEAT?
+**
+** Compute the WAL checksum of blob DATA, the length of which must be a
+** multiple of 8 bytes, using implementation IMPL ("auto", "scalar", "sse2"
+** or "avx2").  If NATIVE is false, the data is interpreted as words of
+** the non-native byte-order.  The checksum is computed NREPEAT times,
+** which is useful when timing the implementations.  Return the two words
+** of the checksum as a list, or an error if IMPL is not available.
+*/
+static int test_wal_checksum(
+  ClientData clientData, /* Unused */
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int objc,              /* Number of arguments */
+  Tcl_Obj *CONST objv[]  /* Command arguments */
+){
+  extern int sqlite3WalChecksumTest(const char*, int, const u8*, int, int,
+      const u32*, u32*);
+  static const u32 aIn[2] = {0, 0};
+  u32 aOut[2];
+  u8 *aData;
+  u8 *aCopy;
+  int nData;
+  int bNative;
+  int nRepeat = 1;
+  int rc;
+  Tcl_Obj *pRet;
+
+  if( objc!=4 && objc!=5 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "IMPL NATIVE DATA ?NREPEAT?");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetBooleanFromObj(interp, objv[2], &bNative) ) return TCL_ERROR;
+  if( objc==5 && Tcl_GetIntFromObj(interp, objv[4], &nRepeat) ){
+    return TCL_ERROR;
+  }
+  aData = Tcl_GetByteArrayFromObj(objv[3], &nData);
+
+  /* Copy the data to a buffer aligned as a page buffer would be. */
+  aCopy = (u8*)sqlite3_malloc(nData>0 ? nData : 1);
+  if( aCopy==0 ) return TCL_ERROR;
+  memcpy(aCopy, aData, nData);
+  rc = sqlite3WalChecksumTest(Tcl_GetString(objv[1]), bNative, aCopy, nData,
+      nRepeat, aIn, aOut);
+  sqlite3_free(aCopy);
+  if( rc!=SQLITE_OK ){
+    Tcl_AppendResult(interp, "cannot compute checksum with ",
+        Tcl_GetString(objv[1]), 0);
+    return TCL_ERROR;
+  }
+
+  pRet = Tcl_NewObj();
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewWideIntObj(aOut[0]));
+  Tcl_ListObjAppendElement(interp, pRet, Tcl_NewWideIntObj(aOut[1]));
+  Tcl_SetObjResult(interp, pRet);
+  return TCL_OK;
+}
+#endif
+
 /*
 ** tclcmd:  test_sqlite3_log ?SCRIPT?
 */
@@ -5237,6 +5486,10 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "sqlite3_prepare16_v2",          test_prepare16_v2  ,0 },
      { "sqlite3_finalize",              test_finalize      ,0 },
      { "sqlite3_stmt_status",           test_stmt_status   ,0 },
+#ifdef SQLITE_ENABLE_STOREDPROCS
+     { "sqlite3_proc_status",           test_proc_status   ,0 },
+     { "sqlite3_exec_proc_batch",       test_exec_proc_batch ,0 },
+#endif
      { "sqlite3_reset",                 test_reset         ,0 },
      { "sqlite3_expired",               test_expired       ,0 },
      { "sqlite3_transfer_bindings",     test_transfer_bind ,0 },
@@ -5306,6 +5559,7 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "file_control_lasterrno_test", file_control_lasterrno_test,  0   },
      { "file_control_lockproxy_test", file_control_lockproxy_test,  0   },
      { "file_control_chunksize_test", file_control_chunksize_test,  0   },
+     { "file_control_reserve_bytes", file_control_reserve_bytes,    0   },
      { "sqlite3_vfs_list",           vfs_list,     0   },
      { "sqlite3_create_function_v2", test_create_function_v2, 0 },
 
@@ -5334,6 +5588,10 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "sqlite3_unlock_notify", test_unlock_notify, 0  },
 #endif
      { "sqlite3_wal_checkpoint", test_wal_checkpoint, 0  },
+#ifndef SQLITE_OMIT_WAL
+     { "sqlite3_wal_checkpoint_step", test_wal_checkpoint_step, 0  },
+     { "sqlite3_wal_checksum",   test_wal_checksum, 0  },
+#endif
      { "test_sqlite3_log",     test_sqlite3_log, 0  },
   };
   static int bitmask_size = sizeof(Bitmask)*8;
@@ -5345,9 +5603,18 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
   extern int sqlite3_pager_readdb_count;
   extern int sqlite3_pager_writedb_count;
   extern int sqlite3_pager_writej_count;
+  extern int sqlite3_pager_readahead_count;
+  extern int sqlite3_pager_writev_count;
+#ifndef SQLITE_OMIT_WAL
+  extern int sqlite3_wal_search_count;
+  extern int sqlite3_wal_recover_threads;
+#endif
 #if SQLITE_OS_WIN
   extern int sqlite3_os_type;
 #endif
+#if SQLITE_OS_UNIX
+  extern int sqlite3_unix_io_engine;
+#endif
 #ifdef SQLITE_DEBUG
   extern int sqlite3WhereTrace;
   extern int sqlite3OSTrace;
@@ -5397,6 +5664,10 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
       (char*)&sqlite3_pager_writedb_count, TCL_LINK_INT);
   Tcl_LinkVar(interp, "sqlite3_pager_writej_count",
       (char*)&sqlite3_pager_writej_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_pager_readahead_count",
+      (char*)&sqlite3_pager_readahead_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_pager_writev_count",
+      (char*)&sqlite3_pager_writev_count, TCL_LINK_INT);
 #ifndef SQLITE_OMIT_UTF16
   Tcl_LinkVar(interp, "unaligned_string_counter",
       (char*)&unaligned_string_counter, TCL_LINK_INT);
@@ -5409,6 +5680,10 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
   Tcl_LinkVar(interp, "sqlite_os_type",
       (char*)&sqlite3_os_type, TCL_LINK_INT);
 #endif
+#if SQLITE_OS_UNIX
+  Tcl_LinkVar(interp, "sqlite3_unix_io_engine",
+      (char*)&sqlite3_unix_io_engine, TCL_LINK_INT);
+#endif
 #ifdef SQLITE_TEST
   Tcl_LinkVar(interp, "sqlite_query_plan",
       (char*)&query_plan, TCL_LINK_STRING|TCL_LINK_READ_ONLY);
@@ -5425,6 +5700,12 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
       (char*)&sqlite3WalTrace, TCL_LINK_INT);
 #endif
 #endif
+#ifndef SQLITE_OMIT_WAL
+  Tcl_LinkVar(interp, "sqlite3_wal_search_count",
+      (char*)&sqlite3_wal_search_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_wal_recover_threads",
+      (char*)&sqlite3_wal_recover_threads, TCL_LINK_INT);
+#endif
 #ifndef SQLITE_OMIT_DISKIO
   Tcl_LinkVar(interp, "sqlite_opentemp_count",
       (char*)&sqlite3_opentemp_count, TCL_LINK_INT);
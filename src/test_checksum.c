@@ -0,0 +1,833 @@
+/*
+** 2010 November 10
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains a VFS "shim" - a layer that sits in between the
+** pager and the real VFS.
+**
+** This particular shim stores a CRC32C checksum in the last 4 bytes of
+** every page of a database file, and verifies it each time a page is
+** read.  A page damaged on disk, or only partly written before a power
+** failure, is reported as SQLITE_CORRUPT the first time it is read rather
+** than going unnoticed until the next "PRAGMA integrity_check".
+**
+** The checksum lives in the space btree reserves at the end of each page.
+** Checksums are only stored and verified for databases that reserve
+** exactly CKSUM_NRESERVE bytes (byte 20 of the database header), so the
+** shim may be used with any database.  To create a database that carries
+** checksums, request the reserve before anything is written to it:
+**
+**     int n = CKSUM_NRESERVE;
+**     sqlite3_file_control(db, "main", SQLITE_FCNTL_RESERVE_BYTES, &n);
+**
+** An existing database gains checksums the same way, followed by VACUUM.
+**
+** Where the processor provides one, the checksum is computed with the
+** CRC32C instruction (SSE4.2 on x86-64, the CRC extension on ARMv8), which
+** costs a small fraction of the time taken to read the page.  Elsewhere
+** a table-driven implementation is used.
+**
+** Only main database files are checksummed.  Journals and WAL files are
+** passed through to the underlying VFS unchanged.  WAL frames are already
+** protected by the WAL's own checksums, and pages copied back into the
+** database by a checkpoint are checksummed as they are written.
+*/
+#include "sqlite3.h"
+#include <string.h>
+#include <assert.h>
+
+#if !defined(SQLITE_OMIT_HW_CRC32C) && defined(__GNUC__)
+# if defined(__x86_64__)
+#  define CKSUM_HW_SSE42 1
+# elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define CKSUM_HW_ARM 1
+# endif
+#endif
+
+/************************ Object Definitions ******************************/
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+
+/*
+** Number of reserved bytes that marks a database as carrying checksums.
+** The checksum is stored big-endian in the last 4 of them.
+*/
+#define CKSUM_NRESERVE 4
+
+/* Forward declaration of all object types */
+typedef struct cksumConn cksumConn;
+typedef struct cksumLanes cksumLanes;
+
+/*
+** The CRC32 instruction can start a new computation every cycle but takes
+** three cycles to finish one, so a single CRC leaves it mostly idle.  A
+** page is therefore checksummed as three lanes of nLane bytes each,
+** computed in an interleaved loop and then combined, followed by any
+** remaining bytes.  Combining needs the CRC register advanced past nLane
+** zero bytes, which is a linear function of the register, tabulated here
+** one table per register byte.
+*/
+struct cksumLanes {
+  int nLane;                      /* Bytes in each lane, a multiple of 8 */
+  u32 aShift[4][256];             /* Advance the register past nLane zeros */
+};
+
+/* Length of each lane when checksumming n bytes */
+#define CKSUM_LANE(n) (((n)/24)*8)
+
+/*
+** An instance of the following object represents each open connection
+** to a database file.  This object is a subclass of sqlite3_file.  The
+** sqlite3_file object for the underlying VFS is appended to this
+** structure.
+*/
+struct cksumConn {
+  sqlite3_file base;              /* Base class - must be first */
+  int szPage;                     /* Page size, or 0 if not known */
+  int isActive;                   /* True if pages carry checksums */
+  u8 *aPage;                      /* Buffer used to checksum written pages */
+  int nPage;                      /* Allocated size of aPage[] in bytes */
+  cksumLanes *pLanes;             /* Combining tables for szPage, or NULL */
+  /* The underlying VFS sqlite3_file is appended to this object */
+};
+
+/************************* Global Variables **********************************/
+/*
+** All global variables used by this file are containing within the following
+** gCksum structure.
+*/
+static struct {
+  /* The pOrigVfs is the real, original underlying VFS implementation.
+  ** Most operations pass-through to the real VFS.  This value is read-only
+  ** during operation.  It is only modified at start-time and thus does not
+  ** require a mutex.
+  */
+  sqlite3_vfs *pOrigVfs;
+
+  /* The sThisVfs is the VFS structure used by this shim.  It is initialized
+  ** at start-time and thus does not require a mutex
+  */
+  sqlite3_vfs sThisVfs;
+
+  /* The sIoMethods defines the methods used by sqlite3_file objects
+  ** associated with this shim.  It is initialized at start-time and does
+  ** not require a mutex.  There is one structure for each version of
+  ** sqlite3_file the underlying VFS might return.
+  */
+  sqlite3_io_methods sIoMethodsV1;
+  sqlite3_io_methods sIoMethodsV2;
+
+  /* The function used to compute checksums, whether or not pages may be
+  ** checksummed in lanes, and the lookup tables used by the portable
+  ** implementation.  Set up at start-time.
+  */
+  u32 (*xCrc32c)(u32, const u8*, int);
+  int hasLanes;
+  u32 aTable[8][256];
+
+  /* True when this shim as been initialized.
+  */
+  int isInitialized;
+} gCksum;
+
+/************************* CRC32C *******************************************/
+/*
+** Fill in the lookup tables used by cksumCrc32cSoft().  aTable[0] is the
+** usual byte-at-a-time table for the reflected Castagnoli polynomial.
+** aTable[k][i] is the CRC of byte i followed by k zero bytes, which lets
+** the loop below fold in 8 bytes per step.
+*/
+static void cksumInitTables(void){
+  u32 i;
+  int k;
+  for(i=0; i<256; i++){
+    u32 c = i;
+    for(k=0; k<8; k++){
+      c = (c>>1) ^ (0x82F63B78 & (0-(c&1)));
+    }
+    gCksum.aTable[0][i] = c;
+  }
+  for(i=0; i<256; i++){
+    u32 c = gCksum.aTable[0][i];
+    for(k=1; k<8; k++){
+      c = gCksum.aTable[0][c & 0xff] ^ (c>>8);
+      gCksum.aTable[k][i] = c;
+    }
+  }
+}
+
+/*
+** Extend CRC32C value crc with the n bytes in a[].  This implementation
+** works on any processor.
+*/
+static u32 cksumCrc32cSoft(u32 crc, const u8 *a, int n){
+  u32 (*T)[256] = gCksum.aTable;
+  crc = ~crc;
+  while( n>=8 ){
+    u32 lo = crc ^ ((u32)a[0] | ((u32)a[1]<<8)
+                    | ((u32)a[2]<<16) | ((u32)a[3]<<24));
+    u32 hi = (u32)a[4] | ((u32)a[5]<<8) | ((u32)a[6]<<16) | ((u32)a[7]<<24);
+    crc = T[7][lo & 0xff] ^ T[6][(lo>>8) & 0xff]
+        ^ T[5][(lo>>16) & 0xff] ^ T[4][lo>>24]
+        ^ T[3][hi & 0xff] ^ T[2][(hi>>8) & 0xff]
+        ^ T[1][(hi>>16) & 0xff] ^ T[0][hi>>24];
+    a += 8;
+    n -= 8;
+  }
+  while( n>0 ){
+    crc = T[0][(crc ^ *a) & 0xff] ^ (crc>>8);
+    a++;
+    n--;
+  }
+  return ~crc;
+}
+
+#ifdef CKSUM_HW_SSE42
+/*
+** Extend CRC32C value crc with the n bytes in a[] using the SSE4.2 CRC32
+** instruction.  Only called if the processor supports it.
+*/
+__attribute__((target("sse4.2")))
+static u32 cksumCrc32cHw(u32 crc, const u8 *a, int n){
+  unsigned long long c = ~crc;
+  while( n>=8 ){
+    unsigned long long x;
+    memcpy(&x, a, 8);
+    c = __builtin_ia32_crc32di(c, x);
+    a += 8;
+    n -= 8;
+  }
+  while( n>0 ){
+    c = __builtin_ia32_crc32qi((u32)c, *a);
+    a++;
+    n--;
+  }
+  return ~(u32)c;
+}
+#endif
+
+#ifdef CKSUM_HW_SSE42
+/*
+** Fill in the combining tables for lanes of nLane bytes.  Column i of the
+** linear function is the register 1<<i advanced past nLane zero bytes.
+*/
+__attribute__((target("sse4.2")))
+static void cksumLanesInit(cksumLanes *pLanes, int nLane){
+  u32 aCol[32];
+  int i, j, k;
+  for(i=0; i<32; i++){
+    unsigned long long c = (u32)1<<i;
+    for(j=0; j<nLane; j+=8){
+      c = __builtin_ia32_crc32di(c, 0);
+    }
+    aCol[i] = (u32)c;
+  }
+  for(i=0; i<4; i++){
+    for(j=0; j<256; j++){
+      u32 x = 0;
+      for(k=0; k<8; k++){
+        if( j & (1<<k) ) x ^= aCol[i*8+k];
+      }
+      pLanes->aShift[i][j] = x;
+    }
+  }
+  pLanes->nLane = nLane;
+}
+
+/*
+** Advance CRC register c past pLanes->nLane zero bytes.
+*/
+static u32 cksumShift(const cksumLanes *pLanes, u32 c){
+  return pLanes->aShift[0][c & 0xff] ^ pLanes->aShift[1][(c>>8) & 0xff]
+       ^ pLanes->aShift[2][(c>>16) & 0xff] ^ pLanes->aShift[3][c>>24];
+}
+
+/*
+** Compute the CRC32C of the n bytes in a[] as three interleaved lanes.
+** The lanes cover the first 3*pLanes->nLane bytes, which must not be
+** more than n.
+*/
+__attribute__((target("sse4.2")))
+static u32 cksumCrc32cLanes(const cksumLanes *pLanes, const u8 *a, int n){
+  int nLane = pLanes->nLane;
+  unsigned long long c0 = 0xffffffff;
+  unsigned long long c1 = 0;
+  unsigned long long c2 = 0;
+  int i;
+  assert( nLane%8==0 && 3*nLane<=n );
+  for(i=0; i<nLane; i+=8){
+    unsigned long long x0, x1, x2;
+    memcpy(&x0, &a[i], 8);
+    memcpy(&x1, &a[nLane+i], 8);
+    memcpy(&x2, &a[2*nLane+i], 8);
+    c0 = __builtin_ia32_crc32di(c0, x0);
+    c1 = __builtin_ia32_crc32di(c1, x1);
+    c2 = __builtin_ia32_crc32di(c2, x2);
+  }
+  c0 = cksumShift(pLanes, (u32)c0) ^ (u32)c1;
+  c0 = cksumShift(pLanes, (u32)c0) ^ (u32)c2;
+  return cksumCrc32cHw(~(u32)c0, &a[3*nLane], n-3*nLane);
+}
+#endif
+
+#ifdef CKSUM_HW_ARM
+/*
+** Extend CRC32C value crc with the n bytes in a[] using the ARMv8 CRC32C
+** instructions.
+*/
+static u32 cksumCrc32cHw(u32 crc, const u8 *a, int n){
+  crc = ~crc;
+  while( n>=8 ){
+    unsigned long long x;
+    memcpy(&x, a, 8);
+    crc = __crc32cd(crc, x);
+    a += 8;
+    n -= 8;
+  }
+  while( n>0 ){
+    crc = __crc32cb(crc, *a);
+    a++;
+    n--;
+  }
+  return ~crc;
+}
+#endif
+
+/*
+** Return the fastest available implementation of CRC32C.
+*/
+static u32 (*cksumCrc32cFunc(void))(u32, const u8*, int){
+#if defined(CKSUM_HW_SSE42)
+  if( __builtin_cpu_supports("sse4.2") ) return cksumCrc32cHw;
+#elif defined(CKSUM_HW_ARM)
+  return cksumCrc32cHw;
+#endif
+  return cksumCrc32cSoft;
+}
+
+/************************* Utility Routines *********************************/
+
+/* Translate an sqlite3_file* that is really a cksumConn* into
+** the sqlite3_file* for the underlying original VFS.
+*/
+static sqlite3_file *cksumSubOpen(sqlite3_file *pConn){
+  cksumConn *p = (cksumConn*)pConn;
+  return (sqlite3_file*)&p[1];
+}
+
+/*
+** Compute the checksum of page aPage[], which is p->szPage bytes in size.
+*/
+static u32 cksumCompute(cksumConn *p, const u8 *aPage){
+  int n = p->szPage - CKSUM_NRESERVE;
+#ifdef CKSUM_HW_SSE42
+  if( p->pLanes ){
+    assert( p->pLanes->nLane==CKSUM_LANE(n) );
+    return cksumCrc32cLanes(p->pLanes, aPage, n);
+  }
+#endif
+  return gCksum.xCrc32c(0, aPage, n);
+}
+
+/*
+** Return the checksum stored in the last 4 bytes of page aPage[].
+*/
+static u32 cksumStored(const u8 *aPage, int szPage){
+  const u8 *a = &aPage[szPage-4];
+  return ((u32)a[0]<<24) | ((u32)a[1]<<16) | ((u32)a[2]<<8) | (u32)a[3];
+}
+
+/*
+** Examine the first nHdr bytes of a database header, as read from or
+** written to the start of the file, and decide whether or not pages
+** carry checksums.  Nothing changes unless the header is well-formed.
+*/
+static void cksumParseHeader(cksumConn *p, const u8 *aHdr, int nHdr){
+  int szPage;
+  if( nHdr<24 || memcmp(aHdr, "SQLite format 3", 16) ) return;
+  szPage = (aHdr[16]<<8) | aHdr[17];
+  if( szPage==1 ) szPage = 65536;
+  if( szPage<512 || szPage>65536 || (szPage & (szPage-1))!=0 ) return;
+  p->szPage = szPage;
+  p->isActive = (aHdr[20]==CKSUM_NRESERVE);
+#ifdef CKSUM_HW_SSE42
+  if( gCksum.hasLanes && p->isActive ){
+    int nLane = CKSUM_LANE(szPage - CKSUM_NRESERVE);
+    if( p->pLanes==0 ){
+      p->pLanes = (cksumLanes*)sqlite3_malloc(sizeof(cksumLanes));
+      if( p->pLanes ) p->pLanes->nLane = 0;
+    }
+    if( p->pLanes && p->pLanes->nLane!=nLane ){
+      cksumLanesInit(p->pLanes, nLane);
+    }
+  }
+#endif
+}
+
+/*
+** Return true if a read or write of iAmt bytes at offset iOfst covers
+** one or more whole pages that carry checksums.  The pager reads and
+** writes single pages, but checkpoints may write a run of pages at once.
+*/
+static int cksumIsPages(cksumConn *p, int iAmt, sqlite3_int64 iOfst){
+  return p->isActive && iAmt>0
+      && (iAmt % p->szPage)==0 && (iOfst % p->szPage)==0;
+}
+
+/*
+** Reread the database header from disk.  This is done at the start of
+** each transaction, as another connection may have added checksums to
+** the database with VACUUM since this connection last looked.
+*/
+static int cksumRefresh(cksumConn *p){
+  sqlite3_file *pSubOpen = cksumSubOpen(&p->base);
+  u8 aHdr[24];
+  int rc;
+  rc = pSubOpen->pMethods->xRead(pSubOpen, aHdr, sizeof(aHdr), 0);
+  if( rc==SQLITE_IOERR_SHORT_READ ) return SQLITE_OK;
+  if( rc==SQLITE_OK ) cksumParseHeader(p, aHdr, sizeof(aHdr));
+  return rc;
+}
+
+/************************* VFS Method Wrappers *****************************/
+/*
+** This is the xOpen method used for the "checksum" VFS.
+**
+** Files other than main database files are opened directly by the
+** underlying VFS and never see this shim again.
+*/
+static int cksumOpen(
+  sqlite3_vfs *pVfs,          /* The checksum VFS */
+  const char *zName,          /* Name of file to be opened */
+  sqlite3_file *pConn,        /* Fill in this file descriptor */
+  int flags,                  /* Flags to control the opening */
+  int *pOutFlags              /* Flags showing results of opening */
+){
+  sqlite3_vfs *pOrigVfs = gCksum.pOrigVfs;
+  cksumConn *p = (cksumConn*)pConn;
+  sqlite3_file *pSubOpen;
+  int rc;
+
+  if( (flags & SQLITE_OPEN_MAIN_DB)==0 ){
+    return pOrigVfs->xOpen(pOrigVfs, zName, pConn, flags, pOutFlags);
+  }
+
+  memset(p, 0, sizeof(cksumConn));
+  pSubOpen = cksumSubOpen(pConn);
+  rc = pOrigVfs->xOpen(pOrigVfs, zName, pSubOpen, flags, pOutFlags);
+  if( rc==SQLITE_OK ){
+    if( pSubOpen->pMethods->iVersion==1 ){
+      p->base.pMethods = &gCksum.sIoMethodsV1;
+    }else{
+      p->base.pMethods = &gCksum.sIoMethodsV2;
+    }
+  }
+  return rc;
+}
+
+/************************ I/O Method Wrappers *******************************/
+
+/* Free the page buffer and pass the xClose request through.
+*/
+static int cksumClose(sqlite3_file *pConn){
+  cksumConn *p = (cksumConn*)pConn;
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  sqlite3_free(p->aPage);
+  sqlite3_free(p->pLanes);
+  p->aPage = 0;
+  p->nPage = 0;
+  p->pLanes = 0;
+  return pSubOpen->pMethods->xClose(pSubOpen);
+}
+
+/* Pass xRead requests through to the original VFS, then verify the
+** checksum of each whole page read.
+*/
+static int cksumRead(
+  sqlite3_file *pConn,
+  void *pBuf,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  cksumConn *p = (cksumConn*)pConn;
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  int rc;
+  rc = pSubOpen->pMethods->xRead(pSubOpen, pBuf, iAmt, iOfst);
+  if( rc==SQLITE_OK ){
+    if( iOfst==0 ) cksumParseHeader(p, (const u8*)pBuf, iAmt);
+    if( cksumIsPages(p, iAmt, iOfst) ){
+      const u8 *a;
+      for(a=(const u8*)pBuf; a<&((const u8*)pBuf)[iAmt]; a+=p->szPage){
+        if( cksumCompute(p, a)!=cksumStored(a, p->szPage) ){
+          return SQLITE_CORRUPT;
+        }
+      }
+    }
+  }
+  return rc;
+}
+
+/* Store the checksum in each whole page written, then pass the xWrite
+** request through.  The caller's buffer is not modified.
+*/
+static int cksumWrite(
+  sqlite3_file *pConn,
+  const void *pBuf,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  cksumConn *p = (cksumConn*)pConn;
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  if( iOfst==0 ) cksumParseHeader(p, (const u8*)pBuf, iAmt);
+  if( cksumIsPages(p, iAmt, iOfst) ){
+    u8 *a;
+    if( iAmt>p->nPage ){
+      u8 *aNew = sqlite3_realloc(p->aPage, iAmt);
+      if( aNew==0 ) return SQLITE_IOERR_NOMEM;
+      p->aPage = aNew;
+      p->nPage = iAmt;
+    }
+    memcpy(p->aPage, pBuf, iAmt);
+    for(a=p->aPage; a<&p->aPage[iAmt]; a+=p->szPage){
+      u32 cksum = cksumCompute(p, a);
+      u8 *z = &a[p->szPage-4];
+      z[0] = (u8)(cksum>>24);
+      z[1] = (u8)(cksum>>16);
+      z[2] = (u8)(cksum>>8);
+      z[3] = (u8)cksum;
+    }
+    pBuf = p->aPage;
+  }
+  return pSubOpen->pMethods->xWrite(pSubOpen, pBuf, iAmt, iOfst);
+}
+
+/* Pass xTruncate requests through to the original VFS unchanged.
+*/
+static int cksumTruncate(sqlite3_file *pConn, sqlite3_int64 size){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xTruncate(pSubOpen, size);
+}
+
+/* Pass xSync requests through to the original VFS unchanged.
+*/
+static int cksumSync(sqlite3_file *pConn, int flags){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xSync(pSubOpen, flags);
+}
+
+/* Pass xFileSize requests through to the original VFS unchanged.
+*/
+static int cksumFileSize(sqlite3_file *pConn, sqlite3_int64 *pSize){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xFileSize(pSubOpen, pSize);
+}
+
+/* Pass xLock requests through to the original VFS.  On taking a SHARED
+** lock, reread the database header.
+*/
+static int cksumLock(sqlite3_file *pConn, int lock){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  int rc;
+  rc = pSubOpen->pMethods->xLock(pSubOpen, lock);
+  if( rc==SQLITE_OK && lock==SQLITE_LOCK_SHARED ){
+    rc = cksumRefresh((cksumConn*)pConn);
+  }
+  return rc;
+}
+
+/* Pass xUnlock requests through to the original VFS unchanged.
+*/
+static int cksumUnlock(sqlite3_file *pConn, int lock){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xUnlock(pSubOpen, lock);
+}
+
+/* Pass xCheckReservedLock requests through to the original VFS unchanged.
+*/
+static int cksumCheckReservedLock(sqlite3_file *pConn, int *pResOut){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xCheckReservedLock(pSubOpen, pResOut);
+}
+
+/* Pass xFileControl requests through to the original VFS unchanged.
+*/
+static int cksumFileControl(sqlite3_file *pConn, int op, void *pArg){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xFileControl(pSubOpen, op, pArg);
+}
+
+/* Pass xSectorSize requests through to the original VFS unchanged.
+*/
+static int cksumSectorSize(sqlite3_file *pConn){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xSectorSize(pSubOpen);
+}
+
+/* Pass xDeviceCharacteristics requests through to the original VFS
+** unchanged.
+*/
+static int cksumDeviceCharacteristics(sqlite3_file *pConn){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xDeviceCharacteristics(pSubOpen);
+}
+
+/* Pass xShmMap requests through to the original VFS unchanged.
+*/
+static int cksumShmMap(
+  sqlite3_file *pConn,            /* Handle open on database file */
+  int iRegion,                    /* Region to retrieve */
+  int szRegion,                   /* Size of regions */
+  int bExtend,                    /* True to extend file if necessary */
+  void volatile **pp              /* OUT: Mapped memory */
+){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xShmMap(pSubOpen, iRegion, szRegion, bExtend, pp);
+}
+
+/* Pass xShmLock requests through to the original VFS.  In WAL mode the
+** SHARED lock on the database file is held for as long as the file is
+** open, so the header is reread here instead, when a reader or
+** checkpointer takes a shared-memory lock.
+*/
+static int cksumShmLock(
+  sqlite3_file *pConn,       /* Database file holding the shared memory */
+  int ofst,                  /* First lock to acquire or release */
+  int n,                     /* Number of locks to acquire or release */
+  int flags                  /* What to do with the lock */
+){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  int rc;
+  rc = pSubOpen->pMethods->xShmLock(pSubOpen, ofst, n, flags);
+  if( rc==SQLITE_OK && (flags & SQLITE_SHM_LOCK) ){
+    rc = cksumRefresh((cksumConn*)pConn);
+    if( rc!=SQLITE_OK ){
+      int unlock = (flags & ~SQLITE_SHM_LOCK) | SQLITE_SHM_UNLOCK;
+      pSubOpen->pMethods->xShmLock(pSubOpen, ofst, n, unlock);
+    }
+  }
+  return rc;
+}
+
+/* Pass xShmBarrier requests through to the original VFS unchanged.
+*/
+static void cksumShmBarrier(sqlite3_file *pConn){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  pSubOpen->pMethods->xShmBarrier(pSubOpen);
+}
+
+/* Pass xShmUnmap requests through to the original VFS unchanged.
+*/
+static int cksumShmUnmap(sqlite3_file *pConn, int deleteFlag){
+  sqlite3_file *pSubOpen = cksumSubOpen(pConn);
+  return pSubOpen->pMethods->xShmUnmap(pSubOpen, deleteFlag);
+}
+
+/************************** Public Interfaces *****************************/
+/*
+** Initialize the checksum VFS shim.  Use the VFS named zOrigVfsName
+** as the VFS that does the actual work.  Use the default if
+** zOrigVfsName==NULL.
+**
+** The checksum VFS shim is named "checksum".  It will become the default
+** VFS if makeDefault is non-zero.
+**
+** THIS ROUTINE IS NOT THREADSAFE.  Call this routine exactly once
+** during start-up.
+*/
+int sqlite3_checksum_initialize(const char *zOrigVfsName, int makeDefault){
+  sqlite3_vfs *pOrigVfs;
+  if( gCksum.isInitialized ) return SQLITE_MISUSE;
+  pOrigVfs = sqlite3_vfs_find(zOrigVfsName);
+  if( pOrigVfs==0 ) return SQLITE_ERROR;
+  assert( pOrigVfs!=&gCksum.sThisVfs );
+  cksumInitTables();
+  gCksum.xCrc32c = cksumCrc32cFunc();
+#ifdef CKSUM_HW_SSE42
+  gCksum.hasLanes = (gCksum.xCrc32c==cksumCrc32cHw);
+#endif
+  gCksum.isInitialized = 1;
+  gCksum.pOrigVfs = pOrigVfs;
+  gCksum.sThisVfs = *pOrigVfs;
+  gCksum.sThisVfs.xOpen = cksumOpen;
+  gCksum.sThisVfs.szOsFile += sizeof(cksumConn);
+  gCksum.sThisVfs.zName = "checksum";
+  gCksum.sIoMethodsV1.iVersion = 1;
+  gCksum.sIoMethodsV1.xClose = cksumClose;
+  gCksum.sIoMethodsV1.xRead = cksumRead;
+  gCksum.sIoMethodsV1.xWrite = cksumWrite;
+  gCksum.sIoMethodsV1.xTruncate = cksumTruncate;
+  gCksum.sIoMethodsV1.xSync = cksumSync;
+  gCksum.sIoMethodsV1.xFileSize = cksumFileSize;
+  gCksum.sIoMethodsV1.xLock = cksumLock;
+  gCksum.sIoMethodsV1.xUnlock = cksumUnlock;
+  gCksum.sIoMethodsV1.xCheckReservedLock = cksumCheckReservedLock;
+  gCksum.sIoMethodsV1.xFileControl = cksumFileControl;
+  gCksum.sIoMethodsV1.xSectorSize = cksumSectorSize;
+  gCksum.sIoMethodsV1.xDeviceCharacteristics = cksumDeviceCharacteristics;
+  gCksum.sIoMethodsV2 = gCksum.sIoMethodsV1;
+  gCksum.sIoMethodsV2.iVersion = 2;
+  gCksum.sIoMethodsV2.xShmMap = cksumShmMap;
+  gCksum.sIoMethodsV2.xShmLock = cksumShmLock;
+  gCksum.sIoMethodsV2.xShmBarrier = cksumShmBarrier;
+  gCksum.sIoMethodsV2.xShmUnmap = cksumShmUnmap;
+  sqlite3_vfs_register(&gCksum.sThisVfs, makeDefault);
+  return SQLITE_OK;
+}
+
+/*
+** Shutdown the checksum VFS shim.
+**
+** All SQLite database connections using the shim must be closed before
+** calling this routine.
+**
+** THIS ROUTINE IS NOT THREADSAFE.
+*/
+int sqlite3_checksum_shutdown(void){
+  if( gCksum.isInitialized==0 ) return SQLITE_MISUSE;
+  sqlite3_vfs_unregister(&gCksum.sThisVfs);
+  memset(&gCksum, 0, sizeof(gCksum));
+  return SQLITE_OK;
+}
+
+/***************************** Test Code ***********************************/
+#ifdef SQLITE_TEST
+#include <tcl.h>
+
+/*
+** Return a pointer to a static string containing the name of the
+** error code rc.  This is defined in test1.c.
+*/
+extern const char *sqlite3TestErrorName(int);
+
+/*
+** tclcmd: sqlite3_checksum_initialize NAME MAKEDEFAULT
+*/
+static int test_checksum_initialize(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  const char *zName;              /* Name of the underlying VFS */
+  int makeDefault;                /* True to make the new VFS the default */
+  int rc;                         /* Value returned by checksum_initialize() */
+
+  /* Process arguments */
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "NAME MAKEDEFAULT");
+    return TCL_ERROR;
+  }
+  zName = Tcl_GetString(objv[1]);
+  if( Tcl_GetBooleanFromObj(interp, objv[2], &makeDefault) ) return TCL_ERROR;
+  if( zName[0]=='\0' ) zName = 0;
+
+  /* Call sqlite3_checksum_initialize() */
+  rc = sqlite3_checksum_initialize(zName, makeDefault);
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+
+  return TCL_OK;
+}
+
+/*
+** tclcmd: sqlite3_checksum_shutdown
+*/
+static int test_checksum_shutdown(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int rc;                         /* Value returned by checksum_shutdown() */
+
+  if( objc!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "");
+    return TCL_ERROR;
+  }
+
+  /* Call sqlite3_checksum_shutdown() */
+  rc = sqlite3_checksum_shutdown();
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+
+  return TCL_OK;
+}
+
+/*
+** tclcmd: sqlite3_checksum_crc32c DATA
+**
+** Return a list of two hexadecimal CRC32C values for DATA.  The first is
+** computed by the portable implementation and the second the way the
+** shim checksums a page of the same size.  The shim must be initialized.
+*/
+static int test_checksum_crc32c(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  const u8 *a;
+  int n;
+  u32 cksum;
+  char zBuf[32];
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DATA");
+    return TCL_ERROR;
+  }
+  if( gCksum.isInitialized==0 ){
+    Tcl_SetResult(interp, "not initialized", TCL_STATIC);
+    return TCL_ERROR;
+  }
+  a = Tcl_GetByteArrayFromObj(objv[1], &n);
+  cksum = gCksum.xCrc32c(0, a, n);
+#ifdef CKSUM_HW_SSE42
+  if( gCksum.hasLanes && CKSUM_LANE(n)>0 ){
+    cksumLanes *pLanes = (cksumLanes*)sqlite3_malloc(sizeof(cksumLanes));
+    if( pLanes==0 ){
+      Tcl_SetResult(interp, "out of memory", TCL_STATIC);
+      return TCL_ERROR;
+    }
+    cksumLanesInit(pLanes, CKSUM_LANE(n));
+    cksum = cksumCrc32cLanes(pLanes, a, n);
+    sqlite3_free(pLanes);
+  }
+#endif
+  sqlite3_snprintf(sizeof(zBuf), zBuf, "%08x %08x",
+      cksumCrc32cSoft(0, a, n), cksum
+  );
+  Tcl_SetResult(interp, zBuf, TCL_VOLATILE);
+  return TCL_OK;
+}
+
+/*
+** This routine registers the custom TCL commands defined in this
+** module.  This should be the only procedure visible from outside
+** of this module.
+*/
+int Sqlitetestchecksum_Init(Tcl_Interp *interp){
+  static struct {
+     char *zName;
+     Tcl_ObjCmdProc *xProc;
+  } aCmd[] = {
+    { "sqlite3_checksum_initialize", test_checksum_initialize },
+    { "sqlite3_checksum_shutdown", test_checksum_shutdown },
+    { "sqlite3_checksum_crc32c", test_checksum_crc32c },
+  };
+  int i;
+
+  for(i=0; i<sizeof(aCmd)/sizeof(aCmd[0]); i++){
+    Tcl_CreateObjCommand(interp, aCmd[i].zName, aCmd[i].xProc, 0, 0);
+  }
+
+  return TCL_OK;
+}
+#endif
@@ -0,0 +1,1375 @@
+/*
+** 2010 November 8
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains a VFS "shim" - a layer that sits in between the
+** pager and the real VFS.
+**
+** This particular shim compresses database files.  The logical file seen
+** by the pager is divided into fixed-size blocks (normally one block per
+** database page) and each block is compressed separately and stored at
+** an arbitrary location in the real file.  A block map records where each
+** block lives, so any single page can still be read or written without
+** touching the rest of the file.  Cold reads of a database that compresses
+** well move proportionally fewer bytes from the disk.
+**
+** Only main database files are compressed.  Rollback journals, WAL files
+** and everything else are passed through to the underlying VFS unchanged,
+** so recovery and WAL-mode concurrency work exactly as they do without
+** the shim.
+**
+** The compressor is a small implementation of the LZ4 block format.  It
+** is not the fastest or the tightest, but it needs no external library
+** and decompression, which is what cold scans are waiting on, is cheap.
+**
+** FILE FORMAT
+**
+**   The real file is allocated in units of CMP_UNIT bytes.  All offsets
+**   stored in the file are unit numbers.  The first CMP_HDRSIZE bytes are
+**   a header.  All integers are big-endian:
+**
+**      0   16   Magic string "SQLite compress\0"
+**     16    4   Block size in bytes.  A power of two between 512 and 65536.
+**     20    4   Change counter.  Incremented each time the map is flushed.
+**     24    8   Size of the logical (uncompressed) file in bytes.
+**     32    4   Unit number of the first block map chunk, or zero.
+**
+**   The block map is stored in chunks of CMP_CHUNKSIZE bytes linked into a
+**   list.  Each chunk is an array of 8-byte slots.  The first slot holds
+**   the unit number of the next chunk in its first 4 bytes.  Each other
+**   slot describes one block: the unit number where the block is stored
+**   (zero if the block has never been written and so reads as zeros),
+**   then the number of bytes stored.  If the high bit of the byte count
+**   is set, the block is stored uncompressed because it did not compress.
+**
+**   The block size is taken from the first write to an empty file if that
+**   write is a suitable size (it is normally the page size).  Writes that
+**   do not cover a whole block read, modify and rewrite the block.
+**
+** CONCURRENCY
+**
+**   Each connection keeps a copy of the block map in memory.  Changes to
+**   the map are written back, and the change counter incremented, when the
+**   file is synced or when the connection releases a lock on the file or
+**   on the shared-memory region.  A connection checks the change counter
+**   and reloads the map if it has changed when it takes a SHARED lock on
+**   the file and when it takes a shared-memory lock (as WAL readers and
+**   checkpointers do at the start of each transaction).  A rewritten block
+**   that no longer fits in place is moved and its old space reused, but
+**   only pages the current transaction or checkpoint is itself replacing
+**   can ever be moved, so readers working from an older map are never
+**   looking at them.
+*/
+#include "sqlite3.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/************************ Object Definitions ******************************/
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+
+/*
+** CMP_UNIT:       Size of the allocation unit of the real file.
+** CMP_HDRSIZE:    Bytes reserved for the file header.
+** CMP_HDRUSED:    Bytes of the header actually in use.
+** CMP_CHUNKSIZE:  Size of each chunk of the block map.
+** CMP_CHUNKSLOT:  Number of 8-byte slots in a chunk.
+** CMP_CHUNKENTRY: Number of blocks described by a single chunk.
+*/
+#define CMP_UNIT          128
+#define CMP_HDRSIZE       512
+#define CMP_HDRUSED       36
+#define CMP_CHUNKSIZE     32768
+#define CMP_CHUNKSLOT     (CMP_CHUNKSIZE/8)
+#define CMP_CHUNKENTRY    (CMP_CHUNKSLOT-1)
+
+/*
+** Block size limits, and the block size used if the first write to a
+** new file is not a suitable size.
+*/
+#define CMP_MIN_BLOCK     512
+#define CMP_MAX_BLOCK     65536
+#define CMP_DEFAULT_BLOCK 4096
+
+/* Set in the byte count of a block map entry if the block is stored
+** uncompressed. */
+#define CMP_RAW           0x80000000
+
+/* The magic string at the start of every compressed file */
+static const char zCmpMagic[16] = "SQLite compress";
+
+/* Forward declaration of all object types */
+typedef struct cmpConn cmpConn;
+typedef struct cmpChunk cmpChunk;
+typedef struct cmpExtent cmpExtent;
+
+/*
+** A contiguous run of units in the real file.
+*/
+struct cmpExtent {
+  u32 iOff;                       /* First unit */
+  u32 nUnit;                      /* Number of units */
+};
+
+/*
+** In-memory description of one chunk of the block map.  Slots iMin
+** through iMax, inclusive, have been modified since the map was last
+** written to disk.  If iMin>iMax, the chunk is clean.
+*/
+struct cmpChunk {
+  u32 iOff;                       /* Unit number of this chunk */
+  int iMin;                       /* First dirty slot */
+  int iMax;                       /* Last dirty slot */
+};
+
+/*
+** An instance of the following object represents each open connection
+** to a compressed database file.  This object is a subclass of
+** sqlite3_file.  The sqlite3_file object for the underlying VFS is
+** appended to this structure.
+*/
+struct cmpConn {
+  sqlite3_file base;              /* Base class - must be first */
+  int eLock;                      /* Lock currently held on the file */
+  int isLoaded;                   /* True once the map has been read */
+  int isDirty;                    /* True if the map needs writing */
+  int needTruncate;               /* True if the real file may shrink */
+  u32 szBlock;                    /* Block size, or 0 if not yet known */
+  u32 iCounter;                   /* Change counter of the loaded map */
+  sqlite3_int64 iSize;            /* Size of the logical file */
+  int nChunk;                     /* Number of chunks in the block map */
+  cmpChunk *aChunk;               /* Array of nChunk chunks */
+  u32 *aMap;                      /* Offset and size of each block */
+  int nFree;                      /* Number of entries in aFree[] */
+  int nFreeAlloc;                 /* Allocated size of aFree[] */
+  cmpExtent *aFree;               /* Free space, sorted by offset */
+  u32 iEnd;                       /* First unit past all used space */
+  u8 *aBlock;                     /* Buffer holding one block */
+  u8 *aStore;                     /* Buffer holding one compressed block */
+  sqlite3_int64 iCache;           /* Block held in aBlock[], or -1 */
+  /* The underlying VFS sqlite3_file is appended to this object */
+};
+
+/************************* Global Variables **********************************/
+/*
+** All global variables used by this file are containing within the following
+** gCompress structure.
+*/
+static struct {
+  /* The pOrigVfs is the real, original underlying VFS implementation.
+  ** Most operations pass-through to the real VFS.  This value is read-only
+  ** during operation.  It is only modified at start-time and thus does not
+  ** require a mutex.
+  */
+  sqlite3_vfs *pOrigVfs;
+
+  /* The sThisVfs is the VFS structure used by this shim.  It is initialized
+  ** at start-time and thus does not require a mutex
+  */
+  sqlite3_vfs sThisVfs;
+
+  /* The sIoMethods defines the methods used by sqlite3_file objects
+  ** associated with this shim.  It is initialized at start-time and does
+  ** not require a mutex.
+  **
+  ** As with the quota shim, there are two I/O method structures so that
+  ** the wrapper is the same version as the underlying sqlite3_file.
+  */
+  sqlite3_io_methods sIoMethodsV1;
+  sqlite3_io_methods sIoMethodsV2;
+
+  /* True when this shim as been initialized.
+  */
+  int isInitialized;
+} gCompress;
+
+/************************* Utility Routines *********************************/
+
+/*
+** Read and write big-endian 32-bit integers.
+*/
+static u32 cmpGet32(const u8 *a){
+  return ((u32)a[0]<<24) | ((u32)a[1]<<16) | ((u32)a[2]<<8) | (u32)a[3];
+}
+static void cmpPut32(u8 *a, u32 v){
+  a[0] = (u8)(v>>24);
+  a[1] = (u8)(v>>16);
+  a[2] = (u8)(v>>8);
+  a[3] = (u8)v;
+}
+
+/* Translate an sqlite3_file* that is really a cmpConn* into
+** the sqlite3_file* for the underlying original VFS.
+*/
+static sqlite3_file *cmpSubOpen(sqlite3_file *pConn){
+  cmpConn *p = (cmpConn*)pConn;
+  return (sqlite3_file*)&p[1];
+}
+
+/************************* LZ4 Block Format *********************************/
+/*
+** A compressed block is a sequence of "sequences".  Each sequence is a
+** token byte, literal bytes, and a back-reference.  The high 4 bits of
+** the token are the literal count and the low 4 bits are the match length
+** less 4.  A nibble of 15 is followed by extra length bytes, each added to
+** the count, ending with the first byte that is not 255.  The literals
+** follow the literal count.  The back-reference is a 2-byte little-endian
+** distance followed by any extra match length bytes.  The final sequence
+** has literals only.
+*/
+#define CMP_HASHLOG 12
+
+/*
+** Append one sequence to aOut[], which holds iOut of nOut bytes.  If
+** nMatch is zero, the sequence is the last one and has no back-reference.
+** Return the new number of bytes in aOut[], or -1 if it does not fit.
+*/
+static int cmpPutSequence(
+  u8 *aOut, int nOut, int iOut,   /* Output buffer */
+  const u8 *aLit, int nLit,       /* Literal bytes */
+  int iDist, int nMatch           /* Back-reference */
+){
+  int nExtra = nMatch ? nMatch-4 : 0;
+  int iToken;
+  int n;
+
+  if( iOut + 1 + (nLit/255+1) + nLit + 2 + (nExtra/255+1) > nOut ) return -1;
+  iToken = iOut++;
+  aOut[iToken] = (u8)((nLit<15 ? nLit : 15)<<4);
+  if( nLit>=15 ){
+    for(n=nLit-15; n>=255; n-=255) aOut[iOut++] = 255;
+    aOut[iOut++] = (u8)n;
+  }
+  memcpy(&aOut[iOut], aLit, nLit);
+  iOut += nLit;
+  if( nMatch ){
+    aOut[iOut++] = (u8)(iDist & 0xff);
+    aOut[iOut++] = (u8)(iDist>>8);
+    aOut[iToken] |= (u8)(nExtra<15 ? nExtra : 15);
+    if( nExtra>=15 ){
+      for(n=nExtra-15; n>=255; n-=255) aOut[iOut++] = 255;
+      aOut[iOut++] = (u8)n;
+    }
+  }
+  return iOut;
+}
+
+/*
+** Compress the nIn bytes in aIn[] into aOut[].  Return the size of the
+** compressed data, or 0 if it would not fit in nOut bytes.
+*/
+static int cmpCompress(const u8 *aIn, int nIn, u8 *aOut, int nOut){
+  int aHash[1<<CMP_HASHLOG];      /* Most recent position of each hash + 1 */
+  int iLimit = nIn - 12;          /* No match may start at or after this */
+  int iIn = 0;                    /* Current input position */
+  int iAnchor = 0;                /* Start of pending literals */
+  int iOut = 0;                   /* Bytes written to aOut[] */
+  int nMiss = 0;                  /* Positions searched since last match */
+
+  memset(aHash, 0, sizeof(aHash));
+  while( iIn<iLimit ){
+    u32 x = (u32)aIn[iIn] | ((u32)aIn[iIn+1]<<8)
+          | ((u32)aIn[iIn+2]<<16) | ((u32)aIn[iIn+3]<<24);
+    u32 h = (x * 2654435761U) >> (32-CMP_HASHLOG);
+    int iRef = aHash[h] - 1;
+    int nMatch;
+
+    aHash[h] = iIn+1;
+    if( iRef<0 || iIn-iRef>65535 || memcmp(&aIn[iRef], &aIn[iIn], 4) ){
+      /* Step faster through data that is not compressing */
+      iIn += 1 + (nMiss++ >> 6);
+      continue;
+    }
+    nMatch = 4;
+    while( iIn+nMatch<nIn-5 && aIn[iRef+nMatch]==aIn[iIn+nMatch] ) nMatch++;
+    iOut = cmpPutSequence(aOut, nOut, iOut,
+        &aIn[iAnchor], iIn-iAnchor, iIn-iRef, nMatch
+    );
+    if( iOut<0 ) return 0;
+    iIn += nMatch;
+    iAnchor = iIn;
+    nMiss = 0;
+  }
+  iOut = cmpPutSequence(aOut, nOut, iOut, &aIn[iAnchor], nIn-iAnchor, 0, 0);
+  return iOut<0 ? 0 : iOut;
+}
+
+/*
+** Read the extra length bytes that follow a nibble of 15.  Return the
+** total, or -1 if the input ends first.
+*/
+static int cmpGetLength(const u8 *aIn, int nIn, int *piIn, int n){
+  int c;
+  do{
+    if( *piIn>=nIn ) return -1;
+    c = aIn[(*piIn)++];
+    n += c;
+  }while( c==255 );
+  return n;
+}
+
+/*
+** Decompress the nIn bytes in aIn[] into aOut[], which is nOut bytes in
+** size.  Return the number of bytes produced, or -1 if the input is not
+** well-formed or would overflow aOut[].
+*/
+static int cmpUncompress(const u8 *aIn, int nIn, u8 *aOut, int nOut){
+  int iIn = 0;
+  int iOut = 0;
+  while( iIn<nIn ){
+    int iToken = aIn[iIn++];
+    int n = iToken>>4;
+    int iDist;
+    int i;
+
+    if( n==15 && (n = cmpGetLength(aIn, nIn, &iIn, n))<0 ) return -1;
+    if( n>nIn-iIn || n>nOut-iOut ) return -1;
+    memcpy(&aOut[iOut], &aIn[iIn], n);
+    iIn += n;
+    iOut += n;
+    if( iIn==nIn ) break;
+
+    if( iIn+2>nIn ) return -1;
+    iDist = aIn[iIn] | (aIn[iIn+1]<<8);
+    iIn += 2;
+    if( iDist==0 || iDist>iOut ) return -1;
+    n = iToken & 0x0f;
+    if( n==15 && (n = cmpGetLength(aIn, nIn, &iIn, n))<0 ) return -1;
+    n += 4;
+    if( n>nOut-iOut ) return -1;
+    for(i=0; i<n; i++){
+      aOut[iOut+i] = aOut[iOut+i-iDist];
+    }
+    iOut += n;
+  }
+  return iOut;
+}
+
+/************************* Space Management *********************************/
+
+/*
+** Number of units needed to hold a block whose map entry records nByte.
+*/
+static u32 cmpUnits(u32 nByte){
+  return ((nByte & ~CMP_RAW) + CMP_UNIT - 1) / CMP_UNIT;
+}
+
+/*
+** Return nUnit units starting at iOff to the free list.  Space at the
+** end of the file is not kept in the list: iEnd is lowered instead and
+** the real file is truncated the next time the map is written.
+**
+** If the free list cannot be grown, the space is leaked until the map
+** is next loaded from disk.
+*/
+static void cmpFreeExtent(cmpConn *p, u32 iOff, u32 nUnit){
+  int iLo = 0;
+  int iHi = p->nFree;
+  cmpExtent *aFree;
+
+  /* Find the first free extent that starts after iOff */
+  while( iLo<iHi ){
+    int iMid = (iLo+iHi)/2;
+    if( p->aFree[iMid].iOff<iOff ){
+      iLo = iMid+1;
+    }else{
+      iHi = iMid;
+    }
+  }
+  aFree = p->aFree;
+  if( iLo>0 && aFree[iLo-1].iOff+aFree[iLo-1].nUnit==iOff ){
+    aFree[iLo-1].nUnit += nUnit;
+    if( iLo<p->nFree && aFree[iLo-1].iOff+aFree[iLo-1].nUnit==aFree[iLo].iOff ){
+      aFree[iLo-1].nUnit += aFree[iLo].nUnit;
+      p->nFree--;
+      memmove(&aFree[iLo], &aFree[iLo+1], (p->nFree-iLo)*sizeof(cmpExtent));
+    }
+  }else if( iLo<p->nFree && iOff+nUnit==aFree[iLo].iOff ){
+    aFree[iLo].iOff = iOff;
+    aFree[iLo].nUnit += nUnit;
+  }else{
+    if( p->nFree>=p->nFreeAlloc ){
+      int nNew = p->nFreeAlloc*2 + 16;
+      aFree = sqlite3_realloc(p->aFree, nNew*sizeof(cmpExtent));
+      if( aFree==0 ) return;
+      p->aFree = aFree;
+      p->nFreeAlloc = nNew;
+    }
+    memmove(&aFree[iLo+1], &aFree[iLo], (p->nFree-iLo)*sizeof(cmpExtent));
+    aFree[iLo].iOff = iOff;
+    aFree[iLo].nUnit = nUnit;
+    p->nFree++;
+  }
+
+  if( p->nFree>0 ){
+    cmpExtent *pLast = &p->aFree[p->nFree-1];
+    if( pLast->iOff+pLast->nUnit==p->iEnd ){
+      p->iEnd = pLast->iOff;
+      p->nFree--;
+      p->needTruncate = 1;
+    }
+  }
+}
+
+/*
+** Find space for nUnit units.  The first free extent large enough is
+** used, or else the space is taken from the end of the file.  Return
+** the unit number, or 0 if the file has grown as large as it can.
+*/
+static u32 cmpAllocExtent(cmpConn *p, u32 nUnit){
+  u32 iOff;
+  int i;
+  for(i=0; i<p->nFree; i++){
+    cmpExtent *pFree = &p->aFree[i];
+    if( pFree->nUnit>=nUnit ){
+      iOff = pFree->iOff;
+      pFree->iOff += nUnit;
+      pFree->nUnit -= nUnit;
+      if( pFree->nUnit==0 ){
+        p->nFree--;
+        memmove(pFree, &pFree[1], (p->nFree-i)*sizeof(cmpExtent));
+      }
+      return iOff;
+    }
+  }
+  if( p->iEnd > 0xffffffff - nUnit ) return 0;
+  iOff = p->iEnd;
+  p->iEnd += nUnit;
+  return iOff;
+}
+
+/************************* Block Map ****************************************/
+
+/*
+** Set the block size and allocate the block buffers.
+*/
+static int cmpSetBlockSize(cmpConn *p, u32 szBlock){
+  u8 *aBuf = sqlite3_malloc(szBlock*2);
+  if( aBuf==0 ) return SQLITE_NOMEM;
+  sqlite3_free(p->aBlock);
+  p->aBlock = aBuf;
+  p->aStore = &aBuf[szBlock];
+  p->szBlock = szBlock;
+  p->iCache = -1;
+  return SQLITE_OK;
+}
+
+/*
+** Discard the in-memory block map.
+*/
+static void cmpReset(cmpConn *p){
+  sqlite3_free(p->aChunk);
+  sqlite3_free(p->aMap);
+  sqlite3_free(p->aFree);
+  sqlite3_free(p->aBlock);
+  p->aChunk = 0;
+  p->aMap = 0;
+  p->aFree = 0;
+  p->aBlock = 0;
+  p->aStore = 0;
+  p->nChunk = 0;
+  p->nFree = 0;
+  p->nFreeAlloc = 0;
+  p->szBlock = 0;
+  p->iSize = 0;
+  p->iCounter = 0;
+  p->iEnd = CMP_HDRSIZE/CMP_UNIT;
+  p->iCache = -1;
+  p->isLoaded = 0;
+  p->isDirty = 0;
+  p->needTruncate = 0;
+}
+
+/*
+** Make room in aChunk[] and aMap[] for one more chunk.
+*/
+static int cmpGrowMap(cmpConn *p){
+  cmpChunk *aChunk;
+  u32 *aMap;
+  int nEntry = (p->nChunk+1)*CMP_CHUNKENTRY;
+
+  aChunk = sqlite3_realloc(p->aChunk, (p->nChunk+1)*sizeof(cmpChunk));
+  if( aChunk==0 ) return SQLITE_NOMEM;
+  p->aChunk = aChunk;
+  aMap = sqlite3_realloc(p->aMap, nEntry*2*sizeof(u32));
+  if( aMap==0 ) return SQLITE_NOMEM;
+  p->aMap = aMap;
+  memset(&aMap[p->nChunk*CMP_CHUNKENTRY*2], 0, CMP_CHUNKENTRY*2*sizeof(u32));
+  aChunk[p->nChunk].iMin = CMP_CHUNKSLOT;
+  aChunk[p->nChunk].iMax = -1;
+  return SQLITE_OK;
+}
+
+/*
+** Record that slot iSlot of chunk iChunk must be written to disk.
+*/
+static void cmpMarkSlot(cmpConn *p, int iChunk, int iSlot){
+  cmpChunk *pChunk = &p->aChunk[iChunk];
+  if( iSlot<pChunk->iMin ) pChunk->iMin = iSlot;
+  if( iSlot>pChunk->iMax ) pChunk->iMax = iSlot;
+  p->isDirty = 1;
+}
+
+/*
+** Add a new, empty chunk to the end of the block map.  The chunk is
+** written to disk before it is linked into the list.
+*/
+static int cmpAddChunk(cmpConn *p){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  u32 iOff;
+  u8 *aZero;
+  int rc;
+
+  rc = cmpGrowMap(p);
+  if( rc!=SQLITE_OK ) return rc;
+  iOff = cmpAllocExtent(p, CMP_CHUNKSIZE/CMP_UNIT);
+  if( iOff==0 ) return SQLITE_FULL;
+  aZero = sqlite3_malloc(CMP_CHUNKSIZE);
+  if( aZero==0 ){
+    cmpFreeExtent(p, iOff, CMP_CHUNKSIZE/CMP_UNIT);
+    return SQLITE_NOMEM;
+  }
+  memset(aZero, 0, CMP_CHUNKSIZE);
+  rc = pSub->pMethods->xWrite(pSub, aZero, CMP_CHUNKSIZE,
+                              (sqlite3_int64)iOff*CMP_UNIT);
+  sqlite3_free(aZero);
+  if( rc!=SQLITE_OK ){
+    cmpFreeExtent(p, iOff, CMP_CHUNKSIZE/CMP_UNIT);
+    return rc;
+  }
+  p->aChunk[p->nChunk].iOff = iOff;
+  if( p->nChunk>0 ) cmpMarkSlot(p, p->nChunk-1, 0);
+  p->nChunk++;
+  p->isDirty = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Write the header to disk.
+*/
+static int cmpWriteHeader(cmpConn *p){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  u8 aHdr[CMP_HDRUSED];
+  memcpy(aHdr, zCmpMagic, 16);
+  cmpPut32(&aHdr[16], p->szBlock);
+  cmpPut32(&aHdr[20], p->iCounter);
+  cmpPut32(&aHdr[24], (u32)(p->iSize>>32));
+  cmpPut32(&aHdr[28], (u32)p->iSize);
+  cmpPut32(&aHdr[32], p->nChunk ? p->aChunk[0].iOff : 0);
+  return pSub->pMethods->xWrite(pSub, aHdr, CMP_HDRUSED, 0);
+}
+
+/*
+** Write the modified parts of the block map and the header to disk,
+** incrementing the change counter.  Then, if space has been released
+** at the end of the file, truncate the real file.
+*/
+static int cmpFlush(cmpConn *p){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  int rc = SQLITE_OK;
+  int i;
+
+  if( !p->isDirty ) return SQLITE_OK;
+  for(i=0; rc==SQLITE_OK && i<p->nChunk; i++){
+    cmpChunk *pChunk = &p->aChunk[i];
+    int nSlot = pChunk->iMax - pChunk->iMin + 1;
+    u8 *aBuf;
+    int iSlot;
+    if( nSlot<=0 ) continue;
+    aBuf = sqlite3_malloc(nSlot*8);
+    if( aBuf==0 ) return SQLITE_NOMEM;
+    for(iSlot=pChunk->iMin; iSlot<=pChunk->iMax; iSlot++){
+      u8 *a = &aBuf[(iSlot-pChunk->iMin)*8];
+      if( iSlot==0 ){
+        cmpPut32(a, i+1<p->nChunk ? p->aChunk[i+1].iOff : 0);
+        cmpPut32(&a[4], 0);
+      }else{
+        u32 *aEntry = &p->aMap[(i*CMP_CHUNKENTRY + iSlot-1)*2];
+        cmpPut32(a, aEntry[0]);
+        cmpPut32(&a[4], aEntry[1]);
+      }
+    }
+    rc = pSub->pMethods->xWrite(pSub, aBuf, nSlot*8,
+        (sqlite3_int64)pChunk->iOff*CMP_UNIT + pChunk->iMin*8
+    );
+    sqlite3_free(aBuf);
+    if( rc==SQLITE_OK ){
+      pChunk->iMin = CMP_CHUNKSLOT;
+      pChunk->iMax = -1;
+    }
+  }
+  if( rc==SQLITE_OK ){
+    p->iCounter++;
+    rc = cmpWriteHeader(p);
+  }
+  if( rc==SQLITE_OK && p->needTruncate ){
+    sqlite3_int64 sz;
+    sqlite3_int64 iEnd = (sqlite3_int64)p->iEnd*CMP_UNIT;
+    rc = pSub->pMethods->xFileSize(pSub, &sz);
+    if( rc==SQLITE_OK && sz>iEnd ){
+      rc = pSub->pMethods->xTruncate(pSub, iEnd);
+    }
+    if( rc==SQLITE_OK ) p->needTruncate = 0;
+  }
+  if( rc==SQLITE_OK ) p->isDirty = 0;
+  return rc;
+}
+
+/*
+** Comparison function for sorting extents by offset.
+*/
+static int cmpExtentCompare(const void *pA, const void *pB){
+  u32 iA = ((const cmpExtent*)pA)->iOff;
+  u32 iB = ((const cmpExtent*)pB)->iOff;
+  return (iA<iB) ? -1 : (iA>iB);
+}
+
+/*
+** Work out the free space in the file from the block map.  Every extent
+** in use (the header, each chunk and each block) is collected and sorted,
+** and the gaps between them become the free list.  Return SQLITE_CORRUPT
+** if two extents overlap or an extent lies beyond the end of the file.
+*/
+static int cmpBuildFreeList(cmpConn *p, u32 nPhys){
+  int nEntry = p->nChunk*CMP_CHUNKENTRY;
+  cmpExtent *aUsed;
+  int nUsed = 0;
+  u32 iEnd;
+  int rc = SQLITE_OK;
+  int i;
+
+  aUsed = sqlite3_malloc((1 + p->nChunk + nEntry)*sizeof(cmpExtent));
+  if( aUsed==0 ) return SQLITE_NOMEM;
+  aUsed[nUsed].iOff = 0;
+  aUsed[nUsed++].nUnit = CMP_HDRSIZE/CMP_UNIT;
+  for(i=0; i<p->nChunk; i++){
+    aUsed[nUsed].iOff = p->aChunk[i].iOff;
+    aUsed[nUsed++].nUnit = CMP_CHUNKSIZE/CMP_UNIT;
+  }
+  for(i=0; i<nEntry; i++){
+    if( p->aMap[i*2] ){
+      aUsed[nUsed].iOff = p->aMap[i*2];
+      aUsed[nUsed++].nUnit = cmpUnits(p->aMap[i*2+1]);
+    }
+  }
+  qsort(aUsed, nUsed, sizeof(cmpExtent), cmpExtentCompare);
+
+  iEnd = 0;
+  for(i=0; rc==SQLITE_OK && i<nUsed; i++){
+    if( aUsed[i].iOff<iEnd || aUsed[i].nUnit>nPhys-aUsed[i].iOff ){
+      rc = SQLITE_CORRUPT;
+    }else{
+      if( aUsed[i].iOff>iEnd ) cmpFreeExtent(p, iEnd, aUsed[i].iOff-iEnd);
+      iEnd = aUsed[i].iOff + aUsed[i].nUnit;
+      p->iEnd = iEnd;
+    }
+  }
+  p->needTruncate = 0;
+  sqlite3_free(aUsed);
+  return rc;
+}
+
+/*
+** Load the header and block map from disk.
+*/
+static int cmpLoad(cmpConn *p){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  u8 aHdr[CMP_HDRUSED];
+  u8 *aBuf = 0;
+  sqlite3_int64 sz;
+  u32 nPhys;
+  u32 iNext;
+  int rc;
+
+  cmpReset(p);
+  rc = pSub->pMethods->xFileSize(pSub, &sz);
+  if( rc!=SQLITE_OK ) return rc;
+  if( sz==0 ){
+    p->isLoaded = 1;
+    return SQLITE_OK;
+  }
+  if( sz<CMP_HDRSIZE || sz>(sqlite3_int64)0xffffffff*CMP_UNIT ){
+    return SQLITE_NOTADB;
+  }
+  nPhys = (u32)((sz + CMP_UNIT - 1)/CMP_UNIT);
+
+  rc = pSub->pMethods->xRead(pSub, aHdr, CMP_HDRUSED, 0);
+  if( rc!=SQLITE_OK ) return rc;
+  if( memcmp(aHdr, zCmpMagic, 16) ) return SQLITE_NOTADB;
+  p->szBlock = cmpGet32(&aHdr[16]);
+  if( p->szBlock<CMP_MIN_BLOCK || p->szBlock>CMP_MAX_BLOCK
+   || (p->szBlock & (p->szBlock-1))!=0
+  ){
+    p->szBlock = 0;
+    return SQLITE_NOTADB;
+  }
+  rc = cmpSetBlockSize(p, p->szBlock);
+  if( rc!=SQLITE_OK ) return rc;
+  p->iCounter = cmpGet32(&aHdr[20]);
+  p->iSize = ((sqlite3_int64)cmpGet32(&aHdr[24])<<32) + cmpGet32(&aHdr[28]);
+  iNext = cmpGet32(&aHdr[32]);
+
+  if( iNext ){
+    aBuf = sqlite3_malloc(CMP_CHUNKSIZE);
+    if( aBuf==0 ) return SQLITE_NOMEM;
+  }
+  while( rc==SQLITE_OK && iNext ){
+    u32 *aEntry;
+    int i;
+    if( p->nChunk>=nPhys/(CMP_CHUNKSIZE/CMP_UNIT) ){
+      rc = SQLITE_CORRUPT;
+      break;
+    }
+    rc = cmpGrowMap(p);
+    if( rc!=SQLITE_OK ) break;
+    rc = pSub->pMethods->xRead(pSub, aBuf, CMP_CHUNKSIZE,
+                               (sqlite3_int64)iNext*CMP_UNIT);
+    if( rc==SQLITE_IOERR_SHORT_READ ) rc = SQLITE_CORRUPT;
+    if( rc!=SQLITE_OK ) break;
+    p->aChunk[p->nChunk].iOff = iNext;
+    aEntry = &p->aMap[p->nChunk*CMP_CHUNKENTRY*2];
+    for(i=0; i<CMP_CHUNKENTRY; i++){
+      aEntry[i*2] = cmpGet32(&aBuf[(i+1)*8]);
+      aEntry[i*2+1] = cmpGet32(&aBuf[(i+1)*8+4]);
+      if( aEntry[i*2] && (aEntry[i*2+1] & ~CMP_RAW)>p->szBlock ){
+        rc = SQLITE_CORRUPT;
+      }
+    }
+    p->nChunk++;
+    iNext = cmpGet32(aBuf);
+  }
+  sqlite3_free(aBuf);
+  if( rc==SQLITE_OK ) rc = cmpBuildFreeList(p, nPhys);
+  if( rc==SQLITE_OK ) p->isLoaded = 1;
+  return rc;
+}
+
+/*
+** Make sure the in-memory block map matches the file on disk.  It is
+** reloaded if it has not been loaded yet or if another connection has
+** changed the file since it was.  A connection with unwritten changes
+** is the only writer, so its map is current already.
+*/
+static int cmpRefresh(cmpConn *p){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  u8 aHdr[CMP_HDRUSED];
+  int rc;
+
+  if( p->isDirty ) return SQLITE_OK;
+  if( !p->isLoaded ) return cmpLoad(p);
+  rc = pSub->pMethods->xRead(pSub, aHdr, CMP_HDRUSED, 0);
+  if( rc==SQLITE_IOERR_SHORT_READ ){
+    if( p->szBlock==0 ) return SQLITE_OK;
+    return cmpLoad(p);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+  if( cmpGet32(&aHdr[20])!=p->iCounter || cmpGet32(&aHdr[16])!=p->szBlock ){
+    return cmpLoad(p);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Read block iBlock into aOut[], which is szBlock bytes in size.  Blocks
+** that have never been written read as zeros.
+*/
+static int cmpFetch(cmpConn *p, sqlite3_int64 iBlock, u8 *aOut){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  u32 iOff = 0;
+  u32 nByte = 0;
+  int rc;
+
+  if( iBlock<(sqlite3_int64)p->nChunk*CMP_CHUNKENTRY ){
+    iOff = p->aMap[iBlock*2];
+    nByte = p->aMap[iBlock*2+1];
+  }
+  if( iOff==0 ){
+    memset(aOut, 0, p->szBlock);
+    return SQLITE_OK;
+  }
+  if( nByte & CMP_RAW ){
+    rc = pSub->pMethods->xRead(pSub, aOut, p->szBlock,
+                               (sqlite3_int64)iOff*CMP_UNIT);
+  }else{
+    rc = pSub->pMethods->xRead(pSub, p->aStore, nByte,
+                               (sqlite3_int64)iOff*CMP_UNIT);
+    if( rc==SQLITE_OK
+     && cmpUncompress(p->aStore, nByte, aOut, p->szBlock)!=(int)p->szBlock
+    ){
+      rc = SQLITE_CORRUPT;
+    }
+  }
+  if( rc==SQLITE_IOERR_SHORT_READ ) rc = SQLITE_CORRUPT;
+  return rc;
+}
+
+/*
+** Compress block iBlock from aData[] and write it to the file.  The block
+** is rewritten in place if it still fits, or else moved.
+*/
+static int cmpStore(cmpConn *p, sqlite3_int64 iBlock, const u8 *aData){
+  sqlite3_file *pSub = cmpSubOpen(&p->base);
+  const u8 *aWrite;               /* Data to write */
+  u32 nByte;                      /* Value for the map entry */
+  u32 nUnit;                      /* Units needed */
+  u32 iOld, nOld;                 /* Existing location of the block */
+  u32 iOff;                       /* New location */
+  int n;
+  int rc;
+
+  /* Blocks that save less than one unit are stored uncompressed */
+  n = cmpCompress(aData, p->szBlock, p->aStore, p->szBlock-CMP_UNIT);
+  if( n==0 ){
+    aWrite = aData;
+    nByte = p->szBlock | CMP_RAW;
+  }else{
+    aWrite = p->aStore;
+    nByte = n;
+  }
+  nUnit = cmpUnits(nByte);
+
+  while( iBlock>=(sqlite3_int64)p->nChunk*CMP_CHUNKENTRY ){
+    rc = cmpAddChunk(p);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  iOld = p->aMap[iBlock*2];
+  nOld = iOld ? cmpUnits(p->aMap[iBlock*2+1]) : 0;
+  if( nOld>=nUnit ){
+    iOff = iOld;
+  }else{
+    iOff = cmpAllocExtent(p, nUnit);
+    if( iOff==0 ) return SQLITE_FULL;
+  }
+
+  rc = pSub->pMethods->xWrite(pSub, aWrite, nByte & ~CMP_RAW,
+                              (sqlite3_int64)iOff*CMP_UNIT);
+  if( rc!=SQLITE_OK ){
+    if( iOff!=iOld ) cmpFreeExtent(p, iOff, nUnit);
+    return rc;
+  }
+
+  if( iOff==iOld ){
+    if( nOld>nUnit ) cmpFreeExtent(p, iOld+nUnit, nOld-nUnit);
+  }else if( iOld ){
+    cmpFreeExtent(p, iOld, nOld);
+  }
+  p->aMap[iBlock*2] = iOff;
+  p->aMap[iBlock*2+1] = nByte;
+  cmpMarkSlot(p, (int)(iBlock/CMP_CHUNKENTRY), (int)(iBlock%CMP_CHUNKENTRY)+1);
+  if( aData!=p->aBlock && iBlock==p->iCache ) p->iCache = -1;
+  return SQLITE_OK;
+}
+
+/*
+** Load block iBlock into the aBlock[] buffer, if it is not there already.
+*/
+static int cmpCacheBlock(cmpConn *p, sqlite3_int64 iBlock){
+  int rc = SQLITE_OK;
+  if( p->iCache!=iBlock ){
+    p->iCache = -1;
+    rc = cmpFetch(p, iBlock, p->aBlock);
+    if( rc==SQLITE_OK ) p->iCache = iBlock;
+  }
+  return rc;
+}
+
+/************************* VFS Method Wrappers *****************************/
+/*
+** This is the xOpen method used for the "compress" VFS.
+**
+** Files other than main database files are opened directly by the
+** underlying VFS and never see this shim again.
+*/
+static int cmpOpen(
+  sqlite3_vfs *pVfs,          /* The compress VFS */
+  const char *zName,          /* Name of file to be opened */
+  sqlite3_file *pConn,        /* Fill in this file descriptor */
+  int flags,                  /* Flags to control the opening */
+  int *pOutFlags              /* Flags showing results of opening */
+){
+  sqlite3_vfs *pOrigVfs = gCompress.pOrigVfs;
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_file *pSubOpen;
+  int rc;
+
+  if( (flags & SQLITE_OPEN_MAIN_DB)==0 ){
+    return pOrigVfs->xOpen(pOrigVfs, zName, pConn, flags, pOutFlags);
+  }
+
+  memset(p, 0, sizeof(cmpConn));
+  cmpReset(p);
+  pSubOpen = cmpSubOpen(pConn);
+  rc = pOrigVfs->xOpen(pOrigVfs, zName, pSubOpen, flags, pOutFlags);
+  if( rc==SQLITE_OK ){
+    if( pSubOpen->pMethods->iVersion==1 ){
+      p->base.pMethods = &gCompress.sIoMethodsV1;
+    }else{
+      p->base.pMethods = &gCompress.sIoMethodsV2;
+    }
+  }
+  return rc;
+}
+
+/************************ I/O Method Wrappers *******************************/
+
+/* Write any changes to the block map before closing the file.
+*/
+static int cmpClose(sqlite3_file *pConn){
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  int rc;
+  int rc2;
+  rc = cmpFlush(p);
+  cmpReset(p);
+  rc2 = pSubOpen->pMethods->xClose(pSubOpen);
+  return rc==SQLITE_OK ? rc2 : rc;
+}
+
+/* Read from the logical file, decompressing each block touched.  A
+** request that covers a whole block is decompressed straight into the
+** caller's buffer.
+*/
+static int cmpRead(
+  sqlite3_file *pConn,
+  void *pBuf,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  cmpConn *p = (cmpConn*)pConn;
+  u8 *z = (u8*)pBuf;
+  int rc = SQLITE_OK;
+
+  if( !p->isLoaded ) rc = cmpLoad(p);
+  while( rc==SQLITE_OK && iAmt>0 ){
+    sqlite3_int64 iBlock;
+    int iOff;
+    int n;
+    if( iOfst>=p->iSize ){
+      memset(z, 0, iAmt);
+      return SQLITE_IOERR_SHORT_READ;
+    }
+    iBlock = iOfst/p->szBlock;
+    iOff = (int)(iOfst%p->szBlock);
+    n = p->szBlock - iOff;
+    if( n>iAmt ) n = iAmt;
+    if( n>p->iSize-iOfst ) n = (int)(p->iSize-iOfst);
+    if( n==(int)p->szBlock && iBlock!=p->iCache ){
+      rc = cmpFetch(p, iBlock, z);
+    }else{
+      rc = cmpCacheBlock(p, iBlock);
+      if( rc==SQLITE_OK ) memcpy(z, &p->aBlock[iOff], n);
+    }
+    z += n;
+    iAmt -= n;
+    iOfst += n;
+  }
+  return rc;
+}
+
+/* Compress and write each block touched.  Blocks only partly covered by
+** the request are read and merged first.
+*/
+static int cmpWrite(
+  sqlite3_file *pConn,
+  const void *pBuf,
+  int iAmt,
+  sqlite3_int64 iOfst
+){
+  cmpConn *p = (cmpConn*)pConn;
+  const u8 *z = (const u8*)pBuf;
+  sqlite3_int64 iEnd = iOfst + iAmt;
+  int rc = SQLITE_OK;
+
+  if( !p->isLoaded ) rc = cmpLoad(p);
+  if( rc==SQLITE_OK && p->szBlock==0 ){
+    u32 szBlock = CMP_DEFAULT_BLOCK;
+    if( iOfst==0 && iAmt>=CMP_MIN_BLOCK && iAmt<=CMP_MAX_BLOCK
+     && (iAmt & (iAmt-1))==0
+    ){
+      szBlock = iAmt;
+    }
+    rc = cmpSetBlockSize(p, szBlock);
+    if( rc==SQLITE_OK ){
+      p->iCounter++;
+      rc = cmpWriteHeader(p);
+    }
+  }
+  while( rc==SQLITE_OK && iAmt>0 ){
+    sqlite3_int64 iBlock = iOfst/p->szBlock;
+    int iOff = (int)(iOfst%p->szBlock);
+    int n = p->szBlock - iOff;
+    if( n>iAmt ) n = iAmt;
+    if( n==(int)p->szBlock ){
+      rc = cmpStore(p, iBlock, z);
+    }else{
+      rc = cmpCacheBlock(p, iBlock);
+      if( rc==SQLITE_OK ){
+        memcpy(&p->aBlock[iOff], z, n);
+        rc = cmpStore(p, iBlock, p->aBlock);
+        if( rc!=SQLITE_OK ) p->iCache = -1;
+      }
+    }
+    z += n;
+    iAmt -= n;
+    iOfst += n;
+  }
+  if( rc==SQLITE_OK && iEnd>p->iSize ){
+    p->iSize = iEnd;
+    p->isDirty = 1;
+  }
+  return rc;
+}
+
+/* Truncate the logical file.  Blocks past the new end are released and
+** the tail of a partial last block is zeroed, so that the file reads as
+** zeros if it is extended again.
+*/
+static int cmpTruncate(sqlite3_file *pConn, sqlite3_int64 size){
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_int64 nKeep;
+  sqlite3_int64 nEntry;
+  sqlite3_int64 i;
+  int rc = SQLITE_OK;
+
+  if( !p->isLoaded ) rc = cmpLoad(p);
+  if( rc==SQLITE_OK && p->szBlock==0 && size>0 ){
+    rc = cmpSetBlockSize(p, CMP_DEFAULT_BLOCK);
+  }
+  if( rc!=SQLITE_OK || size==p->iSize ) return rc;
+  if( size>p->iSize || p->szBlock==0 ){
+    p->iSize = size;
+    p->isDirty = 1;
+    return SQLITE_OK;
+  }
+
+  nKeep = (size + p->szBlock - 1)/p->szBlock;
+  if( size%p->szBlock ){
+    int iOff = (int)(size%p->szBlock);
+    rc = cmpCacheBlock(p, nKeep-1);
+    if( rc==SQLITE_OK ){
+      memset(&p->aBlock[iOff], 0, p->szBlock-iOff);
+      rc = cmpStore(p, nKeep-1, p->aBlock);
+      if( rc!=SQLITE_OK ) p->iCache = -1;
+    }
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  nEntry = (sqlite3_int64)p->nChunk*CMP_CHUNKENTRY;
+  for(i=nKeep; i<nEntry; i++){
+    if( p->aMap[i*2] ){
+      cmpFreeExtent(p, p->aMap[i*2], cmpUnits(p->aMap[i*2+1]));
+      p->aMap[i*2] = 0;
+      p->aMap[i*2+1] = 0;
+      cmpMarkSlot(p, (int)(i/CMP_CHUNKENTRY), (int)(i%CMP_CHUNKENTRY)+1);
+    }
+  }
+  if( p->iCache>=nKeep ) p->iCache = -1;
+  p->iSize = size;
+  p->isDirty = 1;
+  return SQLITE_OK;
+}
+
+/* Write the block map, then pass the xSync request through.
+*/
+static int cmpSync(sqlite3_file *pConn, int flags){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  int rc = cmpFlush((cmpConn*)pConn);
+  if( rc==SQLITE_OK ){
+    rc = pSubOpen->pMethods->xSync(pSubOpen, flags);
+  }
+  return rc;
+}
+
+/* Return the size of the logical file.
+*/
+static int cmpFileSize(sqlite3_file *pConn, sqlite3_int64 *pSize){
+  cmpConn *p = (cmpConn*)pConn;
+  int rc = SQLITE_OK;
+  if( !p->isLoaded ) rc = cmpLoad(p);
+  *pSize = p->iSize;
+  return rc;
+}
+
+/* Pass xLock requests through to the original VFS.  On taking the first
+** lock, reload the block map if another connection has changed it.
+*/
+static int cmpLock(sqlite3_file *pConn, int lock){
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  int rc;
+  rc = pSubOpen->pMethods->xLock(pSubOpen, lock);
+  if( rc==SQLITE_OK && p->eLock==SQLITE_LOCK_NONE ){
+    rc = cmpRefresh(p);
+    if( rc!=SQLITE_OK ){
+      pSubOpen->pMethods->xUnlock(pSubOpen, SQLITE_LOCK_NONE);
+      return rc;
+    }
+  }
+  if( rc==SQLITE_OK ) p->eLock = lock;
+  return rc;
+}
+
+/* Write the block map before other connections can see the file, then
+** pass the xUnlock request through.
+*/
+static int cmpUnlock(sqlite3_file *pConn, int lock){
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  int rc;
+  int rc2;
+  rc = cmpFlush(p);
+  rc2 = pSubOpen->pMethods->xUnlock(pSubOpen, lock);
+  if( rc2==SQLITE_OK ) p->eLock = lock;
+  return rc==SQLITE_OK ? rc2 : rc;
+}
+
+/* Pass xCheckReservedLock requests through to the original VFS unchanged.
+*/
+static int cmpCheckReservedLock(sqlite3_file *pConn, int *pResOut){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  return pSubOpen->pMethods->xCheckReservedLock(pSubOpen, pResOut);
+}
+
+/* Size hints and memory-mapping refer to the logical file, which does
+** not exist on disk, so they are not passed through.  Other xFileControl
+** requests are.
+*/
+static int cmpFileControl(sqlite3_file *pConn, int op, void *pArg){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  switch( op ){
+    case SQLITE_FCNTL_SIZE_HINT:
+    case SQLITE_FCNTL_CHUNK_SIZE:
+    case SQLITE_FCNTL_MMAP_SIZE:
+    case SQLITE_FCNTL_READAHEAD:
+      return SQLITE_NOTFOUND;
+  }
+  return pSubOpen->pMethods->xFileControl(pSubOpen, op, pArg);
+}
+
+/* Pass xSectorSize requests through to the original VFS unchanged.
+*/
+static int cmpSectorSize(sqlite3_file *pConn){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  return pSubOpen->pMethods->xSectorSize(pSubOpen);
+}
+
+/* Writes to the logical file are not atomic at any size, and do not
+** append safely, whatever the underlying file system offers.
+*/
+static int cmpDeviceCharacteristics(sqlite3_file *pConn){
+  return 0;
+}
+
+/* Pass xShmMap requests through to the original VFS unchanged.
+*/
+static int cmpShmMap(
+  sqlite3_file *pConn,            /* Handle open on database file */
+  int iRegion,                    /* Region to retrieve */
+  int szRegion,                   /* Size of regions */
+  int bExtend,                    /* True to extend file if necessary */
+  void volatile **pp              /* OUT: Mapped memory */
+){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  return pSubOpen->pMethods->xShmMap(pSubOpen, iRegion, szRegion, bExtend, pp);
+}
+
+/* Pass xShmLock requests through to the original VFS.  WAL readers and
+** checkpointers take a shared-memory lock at the start of each
+** transaction and release one at the end, so this is where the block
+** map is reloaded and written back in WAL mode.
+*/
+static int cmpShmLock(
+  sqlite3_file *pConn,       /* Database file holding the shared memory */
+  int ofst,                  /* First lock to acquire or release */
+  int n,                     /* Number of locks to acquire or release */
+  int flags                  /* What to do with the lock */
+){
+  cmpConn *p = (cmpConn*)pConn;
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  int rc;
+  if( flags & SQLITE_SHM_UNLOCK ){
+    rc = cmpFlush(p);
+    pSubOpen->pMethods->xShmLock(pSubOpen, ofst, n, flags);
+    return rc;
+  }
+  rc = pSubOpen->pMethods->xShmLock(pSubOpen, ofst, n, flags);
+  if( rc==SQLITE_OK ){
+    rc = cmpRefresh(p);
+    if( rc!=SQLITE_OK ){
+      int unlock = (flags & ~SQLITE_SHM_LOCK) | SQLITE_SHM_UNLOCK;
+      pSubOpen->pMethods->xShmLock(pSubOpen, ofst, n, unlock);
+    }
+  }
+  return rc;
+}
+
+/* Pass xShmBarrier requests through to the original VFS unchanged.
+*/
+static void cmpShmBarrier(sqlite3_file *pConn){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  pSubOpen->pMethods->xShmBarrier(pSubOpen);
+}
+
+/* Pass xShmUnmap requests through to the original VFS unchanged.
+*/
+static int cmpShmUnmap(sqlite3_file *pConn, int deleteFlag){
+  sqlite3_file *pSubOpen = cmpSubOpen(pConn);
+  return pSubOpen->pMethods->xShmUnmap(pSubOpen, deleteFlag);
+}
+
+/************************** Public Interfaces *****************************/
+/*
+** Initialize the compress VFS shim.  Use the VFS named zOrigVfsName
+** as the VFS that does the actual work.  Use the default if
+** zOrigVfsName==NULL.
+**
+** The compress VFS shim is named "compress".  It will become the default
+** VFS if makeDefault is non-zero.  Database files created through the
+** shim can only be opened through the shim.
+**
+** THIS ROUTINE IS NOT THREADSAFE.  Call this routine exactly once
+** during start-up.
+*/
+int sqlite3_compress_initialize(const char *zOrigVfsName, int makeDefault){
+  sqlite3_vfs *pOrigVfs;
+  if( gCompress.isInitialized ) return SQLITE_MISUSE;
+  pOrigVfs = sqlite3_vfs_find(zOrigVfsName);
+  if( pOrigVfs==0 ) return SQLITE_ERROR;
+  assert( pOrigVfs!=&gCompress.sThisVfs );
+  gCompress.isInitialized = 1;
+  gCompress.pOrigVfs = pOrigVfs;
+  gCompress.sThisVfs = *pOrigVfs;
+  gCompress.sThisVfs.xOpen = cmpOpen;
+  gCompress.sThisVfs.szOsFile += sizeof(cmpConn);
+  gCompress.sThisVfs.zName = "compress";
+  gCompress.sIoMethodsV1.iVersion = 1;
+  gCompress.sIoMethodsV1.xClose = cmpClose;
+  gCompress.sIoMethodsV1.xRead = cmpRead;
+  gCompress.sIoMethodsV1.xWrite = cmpWrite;
+  gCompress.sIoMethodsV1.xTruncate = cmpTruncate;
+  gCompress.sIoMethodsV1.xSync = cmpSync;
+  gCompress.sIoMethodsV1.xFileSize = cmpFileSize;
+  gCompress.sIoMethodsV1.xLock = cmpLock;
+  gCompress.sIoMethodsV1.xUnlock = cmpUnlock;
+  gCompress.sIoMethodsV1.xCheckReservedLock = cmpCheckReservedLock;
+  gCompress.sIoMethodsV1.xFileControl = cmpFileControl;
+  gCompress.sIoMethodsV1.xSectorSize = cmpSectorSize;
+  gCompress.sIoMethodsV1.xDeviceCharacteristics = cmpDeviceCharacteristics;
+  gCompress.sIoMethodsV2 = gCompress.sIoMethodsV1;
+  gCompress.sIoMethodsV2.iVersion = 2;
+  gCompress.sIoMethodsV2.xShmMap = cmpShmMap;
+  gCompress.sIoMethodsV2.xShmLock = cmpShmLock;
+  gCompress.sIoMethodsV2.xShmBarrier = cmpShmBarrier;
+  gCompress.sIoMethodsV2.xShmUnmap = cmpShmUnmap;
+  sqlite3_vfs_register(&gCompress.sThisVfs, makeDefault);
+  return SQLITE_OK;
+}
+
+/*
+** Shutdown the compress VFS shim.
+**
+** All SQLite database connections using the shim must be closed before
+** calling this routine.
+**
+** THIS ROUTINE IS NOT THREADSAFE.
+*/
+int sqlite3_compress_shutdown(void){
+  if( gCompress.isInitialized==0 ) return SQLITE_MISUSE;
+  sqlite3_vfs_unregister(&gCompress.sThisVfs);
+  memset(&gCompress, 0, sizeof(gCompress));
+  return SQLITE_OK;
+}
+
+/***************************** Test Code ***********************************/
+#ifdef SQLITE_TEST
+#include <tcl.h>
+
+/*
+** Return a pointer to a static string containing the name of the
+** error code rc.  This is defined in test1.c.
+*/
+extern const char *sqlite3TestErrorName(int);
+
+/*
+** tclcmd: sqlite3_compress_initialize NAME MAKEDEFAULT
+*/
+static int test_compress_initialize(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  const char *zName;              /* Name of the underlying VFS */
+  int makeDefault;                /* True to make the new VFS the default */
+  int rc;                         /* Value returned by compress_initialize() */
+
+  /* Process arguments */
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "NAME MAKEDEFAULT");
+    return TCL_ERROR;
+  }
+  zName = Tcl_GetString(objv[1]);
+  if( Tcl_GetBooleanFromObj(interp, objv[2], &makeDefault) ) return TCL_ERROR;
+  if( zName[0]=='\0' ) zName = 0;
+
+  /* Call sqlite3_compress_initialize() */
+  rc = sqlite3_compress_initialize(zName, makeDefault);
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+
+  return TCL_OK;
+}
+
+/*
+** tclcmd: sqlite3_compress_shutdown
+*/
+static int test_compress_shutdown(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int rc;                         /* Value returned by compress_shutdown() */
+
+  if( objc!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "");
+    return TCL_ERROR;
+  }
+
+  /* Call sqlite3_compress_shutdown() */
+  rc = sqlite3_compress_shutdown();
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+
+  return TCL_OK;
+}
+
+/*
+** This routine registers the custom TCL commands defined in this
+** module.  This should be the only procedure visible from outside
+** of this module.
+*/
+int Sqlitetestcompress_Init(Tcl_Interp *interp){
+  static struct {
+     char *zName;
+     Tcl_ObjCmdProc *xProc;
+  } aCmd[] = {
+    { "sqlite3_compress_initialize", test_compress_initialize },
+    { "sqlite3_compress_shutdown", test_compress_shutdown },
+  };
+  int i;
+
+  for(i=0; i<sizeof(aCmd)/sizeof(aCmd[0]); i++){
+    Tcl_CreateObjCommand(interp, aCmd[i].zName, aCmd[i].xProc, 0, 0);
+  }
+
+  return TCL_OK;
+}
+#endif
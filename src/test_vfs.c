@@ -26,6 +26,7 @@
 **   -default    BOOLEAN        (True to make the vfs default. Default false)
 **   -szosfile   INTEGER        (Value for sqlite3_vfs.szOsFile)
 **   -mxpathname INTEGER        (Value for sqlite3_vfs.mxPathname)
+**   -shmnlock   INTEGER        (Locks reported for SQLITE_FCNTL_SHM_NLOCK)
 */
 
 #include "sqlite3.h"
@@ -85,6 +86,7 @@ struct Testvfs {
   Tcl_Obj **apScript;             /* Array version of pScript */
   TestvfsBuffer *pBuffer;         /* List of shared buffers */
   int isNoshm;
+  int nShmLock;                   /* Value for SQLITE_FCNTL_SHM_NLOCK, or 0 */
 
   int mask;                       /* Mask controlling [script] and [ioerr] */
 
@@ -489,6 +491,14 @@ static int tvfsCheckReservedLock(sqlite3_file *pFile, int *pResOut){
 */
 static int tvfsFileControl(sqlite3_file *pFile, int op, void *pArg){
   TestvfsFd *p = tvfsGetFd(pFile);
+  if( op==SQLITE_FCNTL_SHM_NLOCK ){
+    /* The locks are implemented by tvfsShmLock(), not the real VFS. By
+    ** default only the first SQLITE_SHM_NLOCK are supported. */
+    Testvfs *pVfs = (Testvfs *)p->pVfs->pAppData;
+    if( pVfs->nShmLock==0 ) return SQLITE_NOTFOUND;
+    *(int*)pArg = pVfs->nShmLock;
+    return SQLITE_OK;
+  }
   return sqlite3OsFileControl(p->pReal, op, pArg);
 }
 
@@ -831,6 +841,7 @@ static int tvfsShmLock(
   int nLock;
   char zLock[80];
 
+  assert( ofst>=0 && ofst+n<=(p->nShmLock ? p->nShmLock : SQLITE_SHM_NLOCK) );
   if( p->pScript && p->mask&TESTVFS_SHMLOCK_MASK ){
     sqlite3_snprintf(sizeof(zLock), zLock, "%d %d", ofst, n);
     nLock = strlen(zLock);
@@ -1316,6 +1327,7 @@ static int testvfs_cmd(
   int szOsFile = 0;               /* Value passed to -szosfile */
   int mxPathname = -1;            /* Value passed to -mxpathname */
   int iVersion = 2;               /* Value passed to -iversion */
+  int nShmLock = 0;               /* Value passed to -shmnlock */
 
   if( objc<2 || 0!=(objc%2) ) goto bad_args;
   for(i=2; i<objc; i += 2){
@@ -1348,6 +1360,15 @@ static int testvfs_cmd(
         return TCL_ERROR;
       }
     }
+    else if( nSwitch>2 && 0==strncmp("-shmnlock", zSwitch, nSwitch) ){
+      if( Tcl_GetIntFromObj(interp, objv[i+1], &nShmLock) ){
+        return TCL_ERROR;
+      }
+      if( nShmLock<0 || nShmLock>31 ){
+        Tcl_AppendResult(interp, "-shmnlock must be between 0 and 31", 0);
+        return TCL_ERROR;
+      }
+    }
     else{
       goto bad_args;
     }
@@ -1389,6 +1410,7 @@ static int testvfs_cmd(
   pVfs->szOsFile = szOsFile;
   p->pVfs = pVfs;
   p->isNoshm = isNoshm;
+  p->nShmLock = nShmLock;
   p->mask = TESTVFS_ALL_MASK;
 
   sqlite3_vfs_register(pVfs, isDefault);
@@ -1396,7 +1418,7 @@ static int testvfs_cmd(
   return TCL_OK;
 
  bad_args:
-  Tcl_WrongNumArgs(interp, 1, objv, "VFSNAME ?-noshm BOOL? ?-default BOOL? ?-mxpathname INT? ?-szosfile INT? ?-iversion INT?");
+  Tcl_WrongNumArgs(interp, 1, objv, "VFSNAME ?-noshm BOOL? ?-default BOOL? ?-mxpathname INT? ?-szosfile INT? ?-iversion INT? ?-shmnlock INT?");
   return TCL_ERROR;
 }
 
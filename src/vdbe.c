@@ -564,6 +564,9 @@ int sqlite3VdbeExec(
   Mem *pOut = 0;             /* Output operand */
   int iCompare = 0;          /* Result of last OP_Compare operation */
   int *aPermute = 0;         /* Permutation of columns for OP_Compare */
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  u8 doProcStat = p->doProcStat;   /* True to count steps for OP_ProcStat */
+#endif
 #ifdef VDBE_PROFILE
   u64 start;                 /* CPU clock count at start of opcode */
   int origPc;                /* Program counter at start of opcode */
@@ -607,6 +610,9 @@ int sqlite3VdbeExec(
     start = sqlite3Hwtime();
 #endif
     pOp = &aOp[pc];
+#ifdef SQLITE_ENABLE_STOREDPROCS
+    if( doProcStat ) p->nVmStep++;
+#endif
 
     /* Only allow tracing if SQLITE_DEBUG is defined.
     */
@@ -1137,6 +1143,10 @@ case OP_ResultRow: {
   }
   if( db->mallocFailed ) goto no_mem;
 
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  if( p->doProcStat ) p->nResultRow++;
+#endif
+
   /* Return SQLITE_ROW
   */
   p->pc = pc + 1;
@@ -2566,6 +2576,7 @@ case OP_Savepoint: {
         if( db->autoCommit ){
           db->autoCommit = 0;
           db->isTransactionSavepoint = 1;
+          db->bConcurrent = 0;
         }else{
           db->nSavepoint++;
         }
@@ -2667,13 +2678,16 @@ case OP_Savepoint: {
   break;
 }
 
-/* Opcode: AutoCommit P1 P2 * * *
+/* Opcode: AutoCommit P1 P2 P3 * *
 **
 ** Set the database auto-commit flag to P1 (1 or 0). If P2 is true, roll
 ** back any currently active btree transactions. If there are any active
 ** VMs (apart from this one), then a ROLLBACK fails.  A COMMIT fails if
 ** there are active writing VMs or active VMs that use shared cache.
 **
+** When a transaction is started (P1 is 0), P3 is true for BEGIN CONCURRENT
+** and false otherwise.
+**
 ** This instruction causes the VM to halt.
 */
 case OP_AutoCommit: {
@@ -2712,6 +2726,7 @@ case OP_AutoCommit: {
       goto vdbe_return;
     }else{
       db->autoCommit = (u8)desiredAutoCommit;
+      if( desiredAutoCommit==0 ) db->bConcurrent = (u8)pOp->p3;
       if( sqlite3VdbeHalt(p)==SQLITE_BUSY ){
         p->pc = pc;
         db->autoCommit = (u8)(1-desiredAutoCommit);
@@ -5253,6 +5268,7 @@ case OP_JournalMode: {    /* out2-prerelease */
        || eNew==PAGER_JOURNALMODE_OFF
        || eNew==PAGER_JOURNALMODE_MEMORY
        || eNew==PAGER_JOURNALMODE_WAL
+       || eNew==PAGER_JOURNALMODE_WAL2
        || eNew==PAGER_JOURNALMODE_QUERY
   );
   assert( pOp->p1>=0 && pOp->p1<db->nDb );
@@ -5285,10 +5301,10 @@ case OP_JournalMode: {    /* out2-prerelease */
 #ifndef SQLITE_OMIT_WAL
   zFilename = sqlite3PagerFilename(pPager);
 
-  /* Do not allow a transition to journal_mode=WAL for a database
+  /* Do not allow a transition to journal_mode=WAL or WAL2 for a database
   ** in temporary storage or if the VFS does not support shared memory 
   */
-  if( eNew==PAGER_JOURNALMODE_WAL
+  if( (eNew==PAGER_JOURNALMODE_WAL || eNew==PAGER_JOURNALMODE_WAL2)
    && (zFilename[0]==0                         /* Temp file */
        || !sqlite3PagerWalSupported(pPager))   /* No shared-memory support */
   ){
@@ -5296,26 +5312,31 @@ case OP_JournalMode: {    /* out2-prerelease */
   }
 
   if( (eNew!=eOld)
-   && (eOld==PAGER_JOURNALMODE_WAL || eNew==PAGER_JOURNALMODE_WAL)
+   && (eOld==PAGER_JOURNALMODE_WAL || eNew==PAGER_JOURNALMODE_WAL
+    || eOld==PAGER_JOURNALMODE_WAL2 || eNew==PAGER_JOURNALMODE_WAL2)
   ){
+    int bNewWal = (eNew==PAGER_JOURNALMODE_WAL||eNew==PAGER_JOURNALMODE_WAL2);
     if( !db->autoCommit || db->activeVdbeCnt>1 ){
       rc = SQLITE_ERROR;
       sqlite3SetString(&p->zErrMsg, db, 
           "cannot change %s wal mode from within a transaction",
-          (eNew==PAGER_JOURNALMODE_WAL ? "into" : "out of")
+          (bNewWal ? "into" : "out of")
       );
       break;
     }else{
  
-      if( eOld==PAGER_JOURNALMODE_WAL ){
+      if( eOld==PAGER_JOURNALMODE_WAL || eOld==PAGER_JOURNALMODE_WAL2 ){
         /* If leaving WAL mode, close the log file. If successful, the call
         ** to PagerCloseWal() checkpoints and deletes the write-ahead-log 
         ** file. An EXCLUSIVE lock may still be held on the database file 
-        ** after a successful return. 
+        ** after a successful return.  When changing between WAL and WAL2
+        ** modes, the database passes through rollback mode.
         */
         rc = sqlite3PagerCloseWal(pPager);
         if( rc==SQLITE_OK ){
-          sqlite3PagerSetJournalMode(pPager, eNew);
+          sqlite3PagerSetJournalMode(pPager,
+              bNewWal ? PAGER_JOURNALMODE_DELETE : eNew
+          );
         }
       }else if( eOld==PAGER_JOURNALMODE_MEMORY ){
         /* Cannot transition directly from MEMORY to WAL.  Use mode OFF
@@ -5328,7 +5349,10 @@ case OP_JournalMode: {    /* out2-prerelease */
       */
       assert( sqlite3BtreeIsInTrans(pBt)==0 );
       if( rc==SQLITE_OK ){
-        rc = sqlite3BtreeSetVersion(pBt, (eNew==PAGER_JOURNALMODE_WAL ? 2 : 1));
+        int iVersion = 1;
+        if( eNew==PAGER_JOURNALMODE_WAL ) iVersion = 2;
+        if( eNew==PAGER_JOURNALMODE_WAL2 ) iVersion = 3;
+        rc = sqlite3BtreeSetVersion(pBt, iVersion);
       }
     }
   }
@@ -5402,6 +5426,34 @@ case OP_Expire: {
   break;
 }
 
+#ifdef SQLITE_ENABLE_STOREDPROCS
+/* Opcode: ProcStat P1 P2 * P4 *
+**
+** Gather execution statistics for the stored procedure whose key
+** ("dbname.procname") is P4.  If P2 is zero, the procedure body is about
+** to run: save the clock and the instruction and result row counts of
+** this VM in registers P1, P1+1 and P1+2.  Otherwise the body has just
+** finished: add one call, and the differences since the values were
+** saved, to the statistics of the procedure.
+*/
+case OP_ProcStat: {
+  Mem *pMem;
+  assert( pOp->p1>0 && pOp->p1+2<=p->nMem );
+  pMem = &aMem[pOp->p1];
+  if( pOp->p2==0 ){
+    sqlite3VdbeMemSetInt64(&pMem[0], (i64)sqlite3ProcClock(db));
+    sqlite3VdbeMemSetInt64(&pMem[1], (i64)p->nVmStep);
+    sqlite3VdbeMemSetInt64(&pMem[2], (i64)p->nResultRow);
+  }else{
+    sqlite3ProcStatRecord(db, pOp->p4.z,
+        sqlite3ProcClock(db) - (u64)pMem[0].u.i,
+        (u32)(p->nVmStep - (u32)pMem[1].u.i),
+        (u32)(p->nResultRow - (u32)pMem[2].u.i));
+  }
+  break;
+}
+#endif /* SQLITE_ENABLE_STOREDPROCS */
+
 #ifndef SQLITE_OMIT_SHARED_CACHE
 /* Opcode: TableLock P1 P2 P3 P4 *
 **
@@ -324,6 +324,11 @@ struct Vdbe {
   i64 startTime;          /* Time when query started - used for profiling */
   BtreeMutexArray aMutex; /* An array of Btree used here and needing locks */
   int aCounter[3];        /* Counters used by sqlite3_stmt_status() */
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  u8 doProcStat;          /* True if the program contains OP_ProcStat */
+  u32 nVmStep;            /* Instructions executed, for procedure stats */
+  u32 nResultRow;         /* OP_ResultRow executions, for procedure stats */
+#endif
   char *zSql;             /* Text of the SQL statement that generated this */
   void *pFree;            /* Free this when deleting the vdbe */
   i64 nFkConstraint;      /* Number of imm. FK constraints this VM */
@@ -402,6 +402,9 @@ static void resolveP2Values(Vdbe *p, int *pMaxFuncArgs){
   Op *pOp;
   int *aLabel = p->aLabel;
   p->readOnly = 1;
+#ifdef SQLITE_ENABLE_STOREDPROCS
+  p->doProcStat = 0;
+#endif
   for(pOp=p->aOp, i=p->nOp-1; i>=0; i--, pOp++){
     u8 opcode = pOp->opcode;
 
@@ -410,6 +413,10 @@ static void resolveP2Values(Vdbe *p, int *pMaxFuncArgs){
       if( pOp->p5>nMaxArgs ) nMaxArgs = pOp->p5;
     }else if( opcode==OP_Transaction && pOp->p2!=0 ){
       p->readOnly = 0;
+#ifdef SQLITE_ENABLE_STOREDPROCS
+    }else if( opcode==OP_ProcStat ){
+      p->doProcStat = 1;
+#endif
 #ifndef SQLITE_OMIT_VIRTUALTABLE
     }else if( opcode==OP_VUpdate ){
       if( pOp->p2>nMaxArgs ) nMaxArgs = pOp->p2;
@@ -2128,6 +2135,7 @@ int sqlite3VdbeHalt(Vdbe *p){
         sqlite3RollbackAll(db);
       }
       db->nStatement = 0;
+      db->bConcurrent = 0;
     }else if( eStatementOp==0 ){
       if( p->rc==SQLITE_OK || p->errorAction==OE_Fail ){
         eStatementOp = SAVEPOINT_RELEASE;
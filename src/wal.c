@@ -238,6 +238,65 @@
 ** When a rollback occurs, the value of K is decreased. Hash table entries
 ** that correspond to frames greater than the new K value are removed
 ** from the hash table at this point.
+**
+** Searching a hash table that does not contain page P still costs a few
+** probes of a table that is unlikely to be in cache, and a search for a
+** page that is not in the WAL probes every index block.  So each index 
+** block also has a Bloom filter of WALINDEX_BLOOM_NBIT bits.  When page
+** P is added to the mapping section, WALINDEX_BLOOM_NHASH bits of the
+** filter, each chosen by a different multiplicative hash of P, are set.  
+** A reader skips any index block in which one of those bits is clear.
+** With a full index block, about 3% of the index blocks that do not
+** contain P are searched anyway.  Like the hash table, a filter is
+** cleared when the first entry is added to its index block.  Bits are
+** not cleared when a rollback removes entries from the index block.  This
+** only makes the filter less selective until the block is reused.
+**
+** The filters for WALINDEX_BLOOM_NBLOCK consecutive index blocks share a
+** single wal-index page, which follows the first of those index blocks.
+** So the wal-index holds index block 0, the filters for blocks 0 to 7,
+** then index blocks 1 to 8, the filters for blocks 8 to 15, and so on 
+** (see walBlockPage()).
+**
+** WAL2 MODE
+**
+** In "journal_mode=WAL2" mode there are two WAL files, "<db>-wal" and 
+** "<db>-wal2", which are used alternately.  Each has the format described
+** above, with its own header, salt values and checksums.  Transactions are
+** appended to the "current" file only.  Once the current file contains at
+** least as many frames as the limit set by sqlite3WalLimit(), and the other
+** file has been completely checkpointed and is not in use by any reader,
+** the next writer switches files: it starts writing at the beginning of
+** the other file, and the file that was current is left to be checkpointed.
+** Of the two files, the current one is the one with the larger checkpoint
+** sequence number in its header.
+**
+** A checkpoint only ever copies frames from the file that is not current.
+** Only readers that began while that file was current prevent it from
+** doing so, and no new readers of that kind can start.  So under a steady
+** load of overlapping readers, each file is eventually checkpointed and
+** reused, and the combined size of the two files stays bounded.  In the
+** default mode, the WAL can only be reset at an instant when no reader at
+** all is using it.
+**
+** The wal-index holds separate hash tables for the two files.  In wal2
+** mode, index block 2*N+I holds the N'th hash table of WAL file I.  The
+** first hash table of file 1 indexes the same number of frames as that of
+** file 0 (the first HASHTABLE_NPAGE_ONE), so that the same frames map to
+** the N'th table of each file.  The wal-index header describes the current
+** file, except that its mxFrame2 field holds the number of the current
+** file in the most significant bit and the number of valid frames in the
+** other file in the remaining 31 bits.  WalCkptInfo.nBackfill is the
+** number of frames of the other file that have been checkpointed.
+**
+** The read locks are also used differently.  A reader whose snapshot
+** uses frames from the current file I only holds WAL2_LOCK_PART(I).  A
+** reader that also uses the frames in the other file, because they had not
+** all been checkpointed when it began, holds WAL2_LOCK_FULL(I).  There are
+** no read marks.  A checkpointer holds an exclusive lock on
+** WAL2_LOCK_PART(J) while it copies frames from file J, and a writer holds
+** an exclusive lock on WAL2_LOCK_FULL(I) while it switches from file I to
+** file J.
 */
 #ifndef SQLITE_OMIT_WAL
 
@@ -253,6 +312,18 @@ int sqlite3WalTrace = 0;
 # define WALTRACE(X)
 #endif
 
+/*
+** The following global variable is incremented each time a reader
+** searches the hash table of an index block.  It is used for testing
+** only, and does not exist in a non-testing build.
+*/
+#ifdef SQLITE_TEST
+int sqlite3_wal_search_count = 0;
+# define WAL_INCR(v)  v++
+#else
+# define WAL_INCR(v)
+#endif
+
 /*
 ** The maximum (and only) versions of the wal and wal-index formats
 ** that may be interpreted by this version of SQLite.
@@ -265,26 +336,57 @@ int sqlite3WalTrace = 0;
 ** checksum test is successful) and finds that the version field is not
 ** WALINDEX_MAX_VERSION, then no read-transaction is opened and SQLite
 ** returns SQLITE_CANTOPEN.
+**
+** Wal-index version 3007001 added the pages of Bloom filters, which move
+** all index blocks other than the first.  Version 3007002 added the
+** WalReaderInfo object to the wal-index header, and version 3007003 moved
+** the nSynced field from WalCkptInfo to WalReaderInfo.
+**
+** Connections using different wal-index versions cannot share a database
+** while the wal-index is in use.  Whichever one did not build the
+** wal-index fails with SQLITE_CANTOPEN instead of misreading it.  Once
+** all connections have closed the database, the next one to open it
+** rebuilds the wal-index in its own format.
 */
 #define WAL_MAX_VERSION      3007000
-#define WALINDEX_MAX_VERSION 3007000
+#define WALINDEX_MAX_VERSION 3007003
 
 /*
 ** Indices of various locking bytes.   WAL_NREADER is the number
 ** of available reader locks and should be at least 3.
+**
+** Only the first WAL_NREADER_MIN reader locks are below SQLITE_SHM_NLOCK.
+** The locks at or above SQLITE_SHM_NLOCK, up to a total of WAL_NLOCK, are
+** only used if the VFS reports that it supports that many locks in
+** response to the SQLITE_FCNTL_SHM_NLOCK file-control (see WalReaderInfo).
+** The first of them, WAL_SYNC_LOCK, is held by a connection that is
+** syncing the WAL on behalf of a group of committers (see
+** sqlite3WalSyncCommit()).  The others are the remaining reader locks.
 */
 #define WAL_WRITE_LOCK         0
 #define WAL_ALL_BUT_WRITE      1
 #define WAL_CKPT_LOCK          1
 #define WAL_RECOVER_LOCK       2
-#define WAL_READ_LOCK(I)       (3+(I))
-#define WAL_NREADER            (SQLITE_SHM_NLOCK-3)
+#define WAL_READ_LOCK(I)       ((I)<WAL_NREADER_MIN ? 3+(I) : 4+(I))
+#define WAL_NREADER_MIN        (SQLITE_SHM_NLOCK-3)
+#define WAL_NREADER            20
+#define WAL_SYNC_LOCK          SQLITE_SHM_NLOCK
+#define WAL_NLOCK              (WAL_READ_LOCK(WAL_NREADER))
+
+/*
+** In wal2 mode, the read lock held by a reader of a snapshot for which
+** WAL file I is current.  See "WAL2 MODE" above.
+*/
+#define WAL2_LOCK_PART(I)      ((I)*2)
+#define WAL2_LOCK_FULL(I)      ((I)*2+1)
 
 
 /* Object declarations */
 typedef struct WalIndexHdr WalIndexHdr;
 typedef struct WalIterator WalIterator;
 typedef struct WalCkptInfo WalCkptInfo;
+typedef struct WalReaderInfo WalReaderInfo;
+typedef struct WalCkpt WalCkpt;
 
 
 /*
@@ -296,10 +398,15 @@ typedef struct WalCkptInfo WalCkptInfo;
 ** The szPage value can be any power of 2 between 512 and 32768, inclusive.
 ** Or it can be 1 to represent a 65536-byte page.  The latter case was
 ** added in 3.7.1 when support for 64K pages was added.  
+**
+** The mxFrame2 field is always zero, except in wal2 mode.  In that mode
+** the other fields describe the current WAL file, and mxFrame2 holds the
+** number of the current file and the size of the other one.  It should
+** only be accessed using the walidxXXX() routines below.
 */
 struct WalIndexHdr {
   u32 iVersion;                   /* Wal-index version */
-  u32 unused;                     /* Unused (padding) field */
+  u32 mxFrame2;                   /* Current file and other file's mxFrame */
   u32 iChange;                    /* Counter incremented each transaction */
   u8 isInit;                      /* 1 when initialized */
   u8 bigEndCksum;                 /* True if checksums in WAL are big-endian */
@@ -324,7 +431,9 @@ struct WalIndexHdr {
 ** However, a WAL_WRITE_LOCK thread can move the value of nBackfill from
 ** mxFrame back to zero when the WAL is reset.
 **
-** There is one entry in aReadMark[] for each reader lock.  If a reader
+** There is one entry in aReadMark[] for each of the first WAL_NREADER_MIN
+** reader locks.  The entries for the others are in WalReaderInfo, and
+** both are accessed using walReadMark().  If a reader
 ** holds read-lock K, then the value in aReadMark[K] is no greater than
 ** the mxFrame for that reader.  The value READMARK_NOT_USED (0xffffffff)
 ** for any aReadMark[] means that entry is unused.  aReadMark[0] is 
@@ -359,22 +468,55 @@ struct WalIndexHdr {
 **
 ** We assume that 32-bit loads are atomic and so no locks are needed in
 ** order to read from any aReadMark[] entries.
+**
+** In wal2 mode nBackfill is the number of frames of the WAL file that is
+** not current that have been backfilled, and aReadMark[] is not used.
 */
 struct WalCkptInfo {
   u32 nBackfill;                  /* Number of WAL frames backfilled into DB */
-  u32 aReadMark[WAL_NREADER];     /* Reader marks */
+  u32 aReadMark[WAL_NREADER_MIN]; /* Reader marks */
 };
 #define READMARK_NOT_USED  0xffffffff
 
+/*
+** A copy of the following object follows the block of bytes reserved for
+** locks in the wal-index.
+**
+** The read marks for reader locks WAL_NREADER_MIN and greater are stored
+** in aReadMark[].  They are only used if eLock is WAL_LOCK_EXTENDED.
+** Recovery sets eLock, if it is still zero, according to whether or not
+** the VFS of the recovering connection supports WAL_NLOCK locks.  Until
+** the shared-memory is next created, connections that use a VFS without
+** that support fail with SQLITE_CANTOPEN if eLock is WAL_LOCK_EXTENDED,
+** and all connections use only the first WAL_NREADER_MIN read marks if
+** it is WAL_LOCK_LEGACY.
+**
+** nSynced is used by group commit, which is only enabled if eLock is
+** WAL_LOCK_EXTENDED.  All frames up to and including frame nSynced are
+** known to have been synced to disk.  It may only be read or written by a
+** thread holding WAL_SYNC_LOCK.  A writer that resets the WAL also sets
+** nSynced back to zero, and must hold WAL_SYNC_LOCK to do so.
+*/
+struct WalReaderInfo {
+  u32 eLock;                      /* WAL_LOCK_LEGACY or WAL_LOCK_EXTENDED */
+  u32 nSynced;                    /* Last WAL frame known to be synced */
+  u32 aReadMark[WAL_NREADER-WAL_NREADER_MIN];  /* More reader marks */
+};
+#define WAL_LOCK_LEGACY    1
+#define WAL_LOCK_EXTENDED  2
+
 
 /* A block of WALINDEX_LOCK_RESERVED bytes beginning at
 ** WALINDEX_LOCK_OFFSET is reserved for locks. Since some systems
 ** only support mandatory file-locks, we do not read or write data
-** from the region of the file on which locks are applied.
+** from the region of the file on which locks are applied.  The block
+** covers the SQLITE_SHM_NLOCK lock bytes, the dead-man switch byte
+** and the bytes used by a VFS for locks beyond SQLITE_SHM_NLOCK.
 */
 #define WALINDEX_LOCK_OFFSET   (sizeof(WalIndexHdr)*2 + sizeof(WalCkptInfo))
-#define WALINDEX_LOCK_RESERVED 16
-#define WALINDEX_HDR_SIZE      (WALINDEX_LOCK_OFFSET+WALINDEX_LOCK_RESERVED)
+#define WALINDEX_LOCK_RESERVED 32
+#define WALINDEX_READER_OFFSET (WALINDEX_LOCK_OFFSET+WALINDEX_LOCK_RESERVED)
+#define WALINDEX_HDR_SIZE      (WALINDEX_READER_OFFSET+sizeof(WalReaderInfo))
 
 /* Size of header before each frame in wal */
 #define WAL_FRAME_HDRSIZE 24
@@ -411,6 +553,7 @@ struct Wal {
   sqlite3_vfs *pVfs;         /* The VFS used to create pDbFd */
   sqlite3_file *pDbFd;       /* File handle for the database file */
   sqlite3_file *pWalFd;      /* File handle for WAL file */
+  sqlite3_file *pWalFd2;     /* File handle for second WAL file (wal2 mode) */
   u32 iCallback;             /* Value to pass to log callback (or 0) */
   int nWiData;               /* Size of array apWiData */
   volatile u32 **apWiData;   /* Pointer to wal-index content in memory */
@@ -418,11 +561,22 @@ struct Wal {
   i16 readLock;              /* Which read lock is being held.  -1 for none */
   u8 exclusiveMode;          /* Non-zero if connection is in exclusive mode */
   u8 writeLock;              /* True if in a write transaction */
+  u8 concurrent;             /* True if in a BEGIN CONCURRENT transaction */
   u8 ckptLock;               /* True if holding a checkpoint lock */
   u8 readOnly;               /* True if the WAL file is open read-only */
+  u8 syncFlags;              /* Flags for the deferred sync of iSyncFrame */
+  u8 bWal2;                  /* True in wal2 mode */
+  u8 bExtLock;               /* True if the VFS supports WAL_NLOCK locks */
+  u8 nReader;                /* Number of read marks in use */
+  int nGroupCommit;          /* Group commit window in us. -1 to disable */
+  u32 iSyncFrame;            /* Last committed frame awaiting a sync, or 0 */
+  u32 iSyncSalt;             /* aSalt[0] of the WAL iSyncFrame belongs to */
   WalIndexHdr hdr;           /* Wal-index header for current transaction */
   const char *zWalName;      /* Name of WAL file */
+  const char *zWal2Name;     /* Name of second WAL file (wal2 mode) */
   u32 nCkpt;                 /* Checkpoint sequence counter in the wal-header */
+  i64 mxWalSize;             /* Size at which to switch files (wal2 mode) */
+  WalCkpt *pCkpt;            /* State of an incremental checkpoint, or NULL */
 #ifdef SQLITE_DEBUG
   u8 lockError;              /* True if a locking error has occurred */
 #endif
@@ -461,6 +615,30 @@ struct WalIterator {
   } aSegment[1];                  /* One for every 32KB page in the WAL */
 };
 
+/*
+** A connection that runs checkpoints with a page or time budget (see
+** walCheckpoint()) keeps one of these between calls, so that it does not
+** have to sort the contents of the WAL again for each call.
+**
+** aFrame[] holds, in ascending order, each frame after the first nBackfill
+** frames of WAL file iWal that is the last one before frame iLast to hold
+** its database page.  aPgno[] holds the page number for each.  Entries
+** before iNext have already been copied into the database.
+**
+** The object is only valid while the salt values of the wal-index header
+** are the same as aSalt[].  They change each time the WAL is reset and,
+** in wal2 mode, each time the writer switches WAL files.
+*/
+struct WalCkpt {
+  int iWal;                       /* WAL file the frames are read from */
+  u32 aSalt[2];                   /* Wal-index header salt when created */
+  u32 iLast;                      /* Last frame considered */
+  int nFrame;                     /* Number of entries in aFrame[] */
+  int iNext;                      /* Next entry in aFrame[] to copy */
+  u32 *aFrame;                    /* Frames to copy, in ascending order */
+  u32 *aPgno;                     /* Database page held by each frame */
+};
+
 /*
 ** Define the parameters of the hash tables in the wal-index file. There
 ** is a hash-table following every HASHTABLE_NPAGE page numbers in the
@@ -485,6 +663,34 @@ struct WalIterator {
     sizeof(ht_slot)*HASHTABLE_NSLOT + HASHTABLE_NPAGE*sizeof(u32) \
 )
 
+/*
+** Parameters of the Bloom filters in the wal-index.  The filters for 
+** WALINDEX_BLOOM_NBLOCK index blocks are stored on each wal-index page
+** reserved for filters.  Each bit number in a filter is given by the most
+** significant WALINDEX_BLOOM_LOG2 bits of the product of the page number
+** and one of the WALINDEX_BLOOM_NHASH values in aBloomMul[].
+**
+** Changing any of these constants will alter the wal-index format and
+** create incompatibilities.
+*/
+#define WALINDEX_BLOOM_NBLOCK  8
+#define WALINDEX_BLOOM_NBYTE   (WALINDEX_PGSZ/WALINDEX_BLOOM_NBLOCK)
+#define WALINDEX_BLOOM_NBIT    (WALINDEX_BLOOM_NBYTE*8)
+#define WALINDEX_BLOOM_LOG2    15
+#define WALINDEX_BLOOM_NHASH   3
+
+/*
+** Return the wal-index page that holds index block iHash, or the Bloom
+** filter for index block iHash.  Index block 0 is always on page 0, 
+** along with the wal-index header.
+*/
+#define walBlockPage(iHash) (                                    \
+    ((iHash)/WALINDEX_BLOOM_NBLOCK)*(WALINDEX_BLOOM_NBLOCK+1)      \
+  + ((iHash)%WALINDEX_BLOOM_NBLOCK ? (iHash)%WALINDEX_BLOOM_NBLOCK+1 : 0) \
+)
+#define walBloomPage(iHash) \
+    (((iHash)/WALINDEX_BLOOM_NBLOCK)*(WALINDEX_BLOOM_NBLOCK+1) + 1)
+
 /*
 ** Obtain a pointer to the iPage'th page of the wal-index. The wal-index
 ** is broken into pages of WALINDEX_PGSZ bytes. Wal-index pages are
@@ -532,6 +738,26 @@ static volatile WalCkptInfo *walCkptInfo(Wal *pWal){
   return (volatile WalCkptInfo*)&(pWal->apWiData[0][sizeof(WalIndexHdr)/2]);
 }
 
+/*
+** Return a pointer to the WalReaderInfo structure in the wal-index.
+*/
+static volatile WalReaderInfo *walReaderInfo(Wal *pWal){
+  assert( pWal->nWiData>0 && pWal->apWiData[0] );
+  return (volatile WalReaderInfo*)
+      &(pWal->apWiData[0][WALINDEX_READER_OFFSET/sizeof(u32)]);
+}
+
+/*
+** Return a pointer to the read mark for reader lock i in the wal-index.
+*/
+static volatile u32 *walReadMark(Wal *pWal, int i){
+  assert( i>=0 && i<WAL_NREADER );
+  if( i<WAL_NREADER_MIN ){
+    return &walCkptInfo(pWal)->aReadMark[i];
+  }
+  return &walReaderInfo(pWal)->aReadMark[i-WAL_NREADER_MIN];
+}
+
 /*
 ** Return a pointer to the WalIndexHdr structure in the wal-index.
 */
@@ -540,6 +766,41 @@ static volatile WalIndexHdr *walIndexHdr(Wal *pWal){
   return (volatile WalIndexHdr*)pWal->apWiData[0];
 }
 
+/*
+** Routines to access the mxFrame2 field of a wal-index header.  In wal2
+** mode, walidxGetFile() returns the number of the current WAL file (0 for
+** "-wal", 1 for "-wal2") and walidxGetMxFrame() the number of valid frames
+** in WAL file iWal.  Outside of wal2 mode, the current file is always 0
+** and file 1 contains no frames.
+*/
+static int walidxGetFile(WalIndexHdr *pHdr){
+  return (int)(pHdr->mxFrame2 >> 31);
+}
+static void walidxSetFile(WalIndexHdr *pHdr, int iWal){
+  pHdr->mxFrame2 = (pHdr->mxFrame2 & 0x7FFFFFFF) | (((u32)iWal)<<31);
+}
+static u32 walidxGetMxFrame(WalIndexHdr *pHdr, int iWal){
+  if( iWal==walidxGetFile(pHdr) ) return pHdr->mxFrame;
+  return pHdr->mxFrame2 & 0x7FFFFFFF;
+}
+static void walidxSetMxFrame(WalIndexHdr *pHdr, int iWal, u32 mxFrame){
+  if( iWal==walidxGetFile(pHdr) ){
+    pHdr->mxFrame = mxFrame;
+  }else{
+    assert( mxFrame<=0x7FFFFFFF );
+    pHdr->mxFrame2 = (pHdr->mxFrame2 & 0x80000000) | mxFrame;
+  }
+}
+
+/*
+** Return the file handle for WAL file iWal (0 or 1).  Only wal2 mode has
+** a file 1.
+*/
+static sqlite3_file *walFd(Wal *pWal, int iWal){
+  assert( iWal==0 || (iWal==1 && pWal->bWal2) );
+  return iWal ? pWal->pWalFd2 : pWal->pWalFd;
+}
+
 /*
 ** The argument to this macro must be of type u32. On a little-endian
 ** architecture, it returns the u32 value that results from interpreting
@@ -552,6 +813,339 @@ static volatile WalIndexHdr *walIndexHdr(Wal *pWal){
   + (((x)&0x00FF0000)>>8)  + (((x)&0xFF000000)>>24) \
 )
 
+/*
+** The checksum computed by walChecksumBytes() below is defined by the
+** loop in walChecksumScalar():  for each pair of 32-bit words (a,b),
+**
+**     s1 += a + s2;
+**     s2 += b + s1;
+**
+** Each step depends on the one before, so the loop cannot go faster than
+** one pair every few cycles however wide the processor.  But the step is
+** linear.  Written as a 2x2 matrix acting on (s1,s2), it is
+**
+**     s' = M*s + N*(a,b)      where M = {{1,1},{1,2}} and N = {{1,0},{1,1}}
+**
+** so the checksum of n pairs is the sum of M^(n-1-i)*N*(a[i],b[i]) plus
+** M^n times the initial value, with all arithmetic modulo 2^32.  The SIMD
+** versions split the pairs into L interleaved lanes, such that lane l
+** sees pairs l, l+L, l+2L and so on.  Each lane runs the same recurrence
+** with M^L in place of M, and since the lanes are independent they can
+** be computed in parallel, one lane per 64-bit element of a vector.  Only
+** the low 32 bits of each element are significant, and those are the
+** bits read by the 32x32->64 bit multiply instructions of SSE2 and AVX2.
+** The final value is M^(L-1)*lane[0] + M^(L-2)*lane[1] + ... + lane[L-1],
+** again evaluated by Horner's rule.  The result is identical to that of the
+** scalar loop for all inputs.
+**
+** The SIMD versions are only built for x86_64 using GCC or clang, and are
+** only used if the processor supports them.  Define SQLITE_OMIT_WAL_SIMD
+** to omit them.
+*/
+#if !defined(SQLITE_OMIT_WAL_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+# include <immintrin.h>
+# define WAL_CKSUM_SIMD 1
+#endif
+
+/*
+** Values that may be passed as the first argument to walChecksumImpl().
+*/
+#define WAL_CKSUM_AUTO    0    /* Fastest available implementation */
+#define WAL_CKSUM_SCALAR  1    /* Plain C */
+#define WAL_CKSUM_SSE2    2    /* SSE2, 2 lanes per vector */
+#define WAL_CKSUM_AVX2    3    /* AVX2, 4 lanes per vector */
+
+/*
+** Advance checksum s[] by one step of the recurrence with a zero input.
+** That is, set s to M*s.
+*/
+#define WAL_CKSUM_STEP(s) { (s)[0] += (s)[1]; (s)[1] += (s)[0]; }
+
+/*
+** Extend checksum s[] with the nPair pairs of 32-bit words in aData[].
+*/
+static void walChecksumScalar(
+  int nativeCksum,                /* True for native byte-order */
+  const u32 *aData,               /* Content to be checksummed */
+  int nPair,                      /* Number of pairs of words in aData[] */
+  u32 *s                          /* IN/OUT: Checksum value */
+){
+  u32 s1 = s[0];
+  u32 s2 = s[1];
+  const u32 *aEnd = &aData[nPair*2];
+
+  if( nativeCksum ){
+    while( aData<aEnd ){
+      s1 += *aData++ + s2;
+      s2 += *aData++ + s1;
+    }
+  }else{
+    while( aData<aEnd ){
+      s1 += BYTESWAP32(aData[0]) + s2;
+      s2 += BYTESWAP32(aData[1]) + s1;
+      aData += 2;
+    }
+  }
+
+  s[0] = s1;
+  s[1] = s2;
+}
+
+/*
+** Set aM[] to the matrix M^n, stored in row-major order.  Each pass of
+** the loop multiplies both rows by M on the right.
+*/
+static void walChecksumMatrix(int n, u32 *aM){
+  int i;
+  aM[0] = aM[3] = 1;
+  aM[1] = aM[2] = 0;
+  for(i=0; i<n; i++){
+    WAL_CKSUM_STEP(&aM[0]);
+    WAL_CKSUM_STEP(&aM[2]);
+  }
+}
+
+#ifdef WAL_CKSUM_SIMD
+
+/*
+** Combine the nLane lanes stored in aLane[] into checksum s[].  On input,
+** the low 32 bits of aLane[l*2] and aLane[l*2+1] are the two halves of
+** the value of lane l.  s[] is overwritten.
+*/
+static void walChecksumCombine(int nLane, const u64 *aLane, u32 *s){
+  int l;
+  s[0] = s[1] = 0;
+  for(l=0; l<nLane; l++){
+    WAL_CKSUM_STEP(s);
+    s[0] += (u32)aLane[l*2];
+    s[1] += (u32)aLane[l*2+1];
+  }
+}
+
+/*
+** Byte-swap each 32-bit word of SSE2 vector x.
+*/
+__attribute__((target("sse2")))
+static __m128i walBswapSse2(__m128i x){
+  x = _mm_or_si128(
+      _mm_and_si128(_mm_slli_epi32(x, 8), _mm_set1_epi32((int)0xFF00FF00)),
+      _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0x00FF00FF))
+  );
+  return _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+}
+
+/*
+** Advance the two lanes held in SSE2 vectors A (first halves) and B
+** (second halves) past the two pairs of words at aData[iOff].
+*/
+#define WAL_SSE2_STEP(A, B, iOff, bSwap) {                                \
+  __m128i x = _mm_loadu_si128((const __m128i*)&aData[iOff]);              \
+  __m128i a, b;                                                           \
+  if( bSwap ) x = walBswapSse2(x);                                        \
+  a = _mm_and_si128(x, lo);                                               \
+  b = _mm_add_epi64(a, _mm_srli_epi64(x, 32));                            \
+  x = A;                                                                  \
+  A = _mm_add_epi64(a,                                                    \
+      _mm_add_epi64(_mm_mul_epu32(m00, x), _mm_mul_epu32(m01, B)));       \
+  B = _mm_add_epi64(b,                                                    \
+      _mm_add_epi64(_mm_mul_epu32(m10, x), _mm_mul_epu32(m11, B)));       \
+}
+
+/*
+** Extend checksum s[] with the nPair pairs of words in aData[] using
+** SSE2.  nPair must be a multiple of WAL_SSE2_NLANE.
+**
+** There are 8 lanes in four pairs of vectors, so that the multiplies
+** for one pair are not waiting on the results of the previous iteration
+** for another.  Vector A0 holds the first half (s1) of lanes 0 and 1, B0
+** the second half of the same lanes, A1 and B1 lanes 2 and 3, and so on.
+** The value passed in through s[] is added to the last lane, so that it
+** is multiplied by M^nPair by the time the lanes are combined.
+*/
+#define WAL_SSE2_NLANE 8
+__attribute__((target("sse2")))
+static void walChecksumSse2(
+  int nativeCksum,
+  const u32 *aData,
+  int nPair,
+  u32 *s
+){
+  __m128i a0, a1, a2, a3;
+  __m128i b0, b1, b2, b3;
+  __m128i m00, m01, m10, m11;
+  __m128i lo = _mm_set_epi32(0, -1, 0, -1);
+  const u32 *aEnd = &aData[nPair*2];
+  u64 aLane[WAL_SSE2_NLANE*2];
+  u32 aM[4];
+
+  assert( nPair%WAL_SSE2_NLANE==0 );
+  walChecksumMatrix(WAL_SSE2_NLANE, aM);
+  m00 = _mm_set1_epi32((int)aM[0]);
+  m01 = _mm_set1_epi32((int)aM[1]);
+  m10 = _mm_set1_epi32((int)aM[2]);
+  m11 = _mm_set1_epi32((int)aM[3]);
+  a0 = a1 = a2 = b0 = b1 = b2 = _mm_setzero_si128();
+  a3 = _mm_set_epi32(0, (int)s[0], 0, 0);
+  b3 = _mm_set_epi32(0, (int)s[1], 0, 0);
+
+  if( nativeCksum ){
+    for(; aData<aEnd; aData+=WAL_SSE2_NLANE*2){
+      WAL_SSE2_STEP(a0, b0, 0, 0);
+      WAL_SSE2_STEP(a1, b1, 4, 0);
+      WAL_SSE2_STEP(a2, b2, 8, 0);
+      WAL_SSE2_STEP(a3, b3, 12, 0);
+    }
+  }else{
+    for(; aData<aEnd; aData+=WAL_SSE2_NLANE*2){
+      WAL_SSE2_STEP(a0, b0, 0, 1);
+      WAL_SSE2_STEP(a1, b1, 4, 1);
+      WAL_SSE2_STEP(a2, b2, 8, 1);
+      WAL_SSE2_STEP(a3, b3, 12, 1);
+    }
+  }
+
+  _mm_storeu_si128((__m128i*)&aLane[0], _mm_unpacklo_epi64(a0, b0));
+  _mm_storeu_si128((__m128i*)&aLane[2], _mm_unpackhi_epi64(a0, b0));
+  _mm_storeu_si128((__m128i*)&aLane[4], _mm_unpacklo_epi64(a1, b1));
+  _mm_storeu_si128((__m128i*)&aLane[6], _mm_unpackhi_epi64(a1, b1));
+  _mm_storeu_si128((__m128i*)&aLane[8], _mm_unpacklo_epi64(a2, b2));
+  _mm_storeu_si128((__m128i*)&aLane[10], _mm_unpackhi_epi64(a2, b2));
+  _mm_storeu_si128((__m128i*)&aLane[12], _mm_unpacklo_epi64(a3, b3));
+  _mm_storeu_si128((__m128i*)&aLane[14], _mm_unpackhi_epi64(a3, b3));
+  walChecksumCombine(WAL_SSE2_NLANE, aLane, s);
+}
+
+/*
+** Advance the four lanes held in AVX2 vectors A and B past the four pairs
+** of words at aData[iOff].
+*/
+#define WAL_AVX2_STEP(A, B, iOff, bSwap) {                                \
+  __m256i x = _mm256_loadu_si256((const __m256i*)&aData[iOff]);           \
+  __m256i a, b;                                                           \
+  if( bSwap ) x = _mm256_shuffle_epi8(x, bswap);                          \
+  a = _mm256_and_si256(x, lo);                                            \
+  b = _mm256_add_epi64(a, _mm256_srli_epi64(x, 32));                      \
+  x = A;                                                                  \
+  A = _mm256_add_epi64(a,                                                 \
+      _mm256_add_epi64(_mm256_mul_epu32(m00, x), _mm256_mul_epu32(m01, B)));\
+  B = _mm256_add_epi64(b,                                                 \
+      _mm256_add_epi64(_mm256_mul_epu32(m10, x), _mm256_mul_epu32(m11, B)));\
+}
+
+/*
+** Store the four lanes held in AVX2 vectors A and B in aLane[0..7].
+*/
+__attribute__((target("avx2")))
+static void walStoreAvx2(__m256i A, __m256i B, u64 *aLane){
+  __m256i lo = _mm256_unpacklo_epi64(A, B);    /* Lanes 0 and 2 */
+  __m256i hi = _mm256_unpackhi_epi64(A, B);    /* Lanes 1 and 3 */
+  _mm256_storeu_si256((__m256i*)&aLane[0],
+      _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i*)&aLane[4],
+      _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+/*
+** Extend checksum s[] with the nPair pairs of words in aData[] using
+** AVX2.  nPair must be a multiple of WAL_AVX2_NLANE.  This is the same as
+** walChecksumSse2() except that each vector holds 4 lanes.
+*/
+#define WAL_AVX2_NLANE 16
+__attribute__((target("avx2")))
+static void walChecksumAvx2(
+  int nativeCksum,
+  const u32 *aData,
+  int nPair,
+  u32 *s
+){
+  __m256i a0, a1, a2, a3;
+  __m256i b0, b1, b2, b3;
+  __m256i m00, m01, m10, m11;
+  __m256i lo = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+  __m256i bswap = _mm256_set_epi8(
+      12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+      12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3
+  );
+  const u32 *aEnd = &aData[nPair*2];
+  u64 aLane[WAL_AVX2_NLANE*2];
+  u32 aM[4];
+
+  assert( nPair%WAL_AVX2_NLANE==0 );
+  walChecksumMatrix(WAL_AVX2_NLANE, aM);
+  m00 = _mm256_set1_epi32((int)aM[0]);
+  m01 = _mm256_set1_epi32((int)aM[1]);
+  m10 = _mm256_set1_epi32((int)aM[2]);
+  m11 = _mm256_set1_epi32((int)aM[3]);
+  a0 = a1 = a2 = b0 = b1 = b2 = _mm256_setzero_si256();
+  a3 = _mm256_set_epi32(0, (int)s[0], 0, 0, 0, 0, 0, 0);
+  b3 = _mm256_set_epi32(0, (int)s[1], 0, 0, 0, 0, 0, 0);
+
+  if( nativeCksum ){
+    for(; aData<aEnd; aData+=WAL_AVX2_NLANE*2){
+      WAL_AVX2_STEP(a0, b0, 0, 0);
+      WAL_AVX2_STEP(a1, b1, 8, 0);
+      WAL_AVX2_STEP(a2, b2, 16, 0);
+      WAL_AVX2_STEP(a3, b3, 24, 0);
+    }
+  }else{
+    for(; aData<aEnd; aData+=WAL_AVX2_NLANE*2){
+      WAL_AVX2_STEP(a0, b0, 0, 1);
+      WAL_AVX2_STEP(a1, b1, 8, 1);
+      WAL_AVX2_STEP(a2, b2, 16, 1);
+      WAL_AVX2_STEP(a3, b3, 24, 1);
+    }
+  }
+
+  walStoreAvx2(a0, b0, &aLane[0]);
+  walStoreAvx2(a1, b1, &aLane[8]);
+  walStoreAvx2(a2, b2, &aLane[16]);
+  walStoreAvx2(a3, b3, &aLane[24]);
+  walChecksumCombine(WAL_AVX2_NLANE, aLane, s);
+}
+#endif /* WAL_CKSUM_SIMD */
+
+/*
+** Extend checksum s[] with the nByte bytes of content in a[] using the
+** implementation identified by eImpl, one of the WAL_CKSUM_* values.
+** Return SQLITE_OK, or SQLITE_ERROR if that implementation is not
+** available on this processor.  The result is the same whichever
+** implementation is used.
+*/
+static int walChecksumImpl(
+  int eImpl,                      /* WAL_CKSUM_* value */
+  int nativeCksum,                /* True for native byte-order */
+  const u8 *a,                    /* Content to be checksummed */
+  int nByte,                      /* Bytes of content.  A multiple of 8 */
+  u32 *s                          /* IN/OUT: Checksum value */
+){
+  const u32 *aData = (const u32*)a;
+  int nPair = nByte/8;
+  int nDone = 0;                  /* Pairs checksummed by SIMD code */
+
+#ifdef WAL_CKSUM_SIMD
+  if( eImpl==WAL_CKSUM_AUTO ){
+    if( __builtin_cpu_supports("avx2") ){
+      eImpl = WAL_CKSUM_AVX2;
+    }else{
+      eImpl = WAL_CKSUM_SSE2;
+    }
+  }
+  if( eImpl==WAL_CKSUM_AVX2 ){
+    if( !__builtin_cpu_supports("avx2") ) return SQLITE_ERROR;
+    nDone = nPair - nPair%WAL_AVX2_NLANE;
+    if( nDone ) walChecksumAvx2(nativeCksum, aData, nDone, s);
+  }else if( eImpl==WAL_CKSUM_SSE2 ){
+    nDone = nPair - nPair%WAL_SSE2_NLANE;
+    if( nDone ) walChecksumSse2(nativeCksum, aData, nDone, s);
+  }
+#else
+  if( eImpl!=WAL_CKSUM_AUTO && eImpl!=WAL_CKSUM_SCALAR ) return SQLITE_ERROR;
+#endif
+
+  walChecksumScalar(nativeCksum, &aData[nDone*2], nPair-nDone, s);
+  return SQLITE_OK;
+}
+
 /*
 ** Generate or extend an 8 byte checksum based on the data in 
 ** array aByte[] and the initial values of aIn[0] and aIn[1] (or
@@ -568,37 +1162,62 @@ static void walChecksumBytes(
   const u32 *aIn,  /* Initial checksum value input */
   u32 *aOut        /* OUT: Final checksum value output */
 ){
-  u32 s1, s2;
-  u32 *aData = (u32 *)a;
-  u32 *aEnd = (u32 *)&a[nByte];
+  u32 s[2];
 
   if( aIn ){
-    s1 = aIn[0];
-    s2 = aIn[1];
+    s[0] = aIn[0];
+    s[1] = aIn[1];
   }else{
-    s1 = s2 = 0;
+    s[0] = s[1] = 0;
   }
 
   assert( nByte>=8 );
   assert( (nByte&0x00000007)==0 );
 
-  if( nativeCksum ){
-    do {
-      s1 += *aData++ + s2;
-      s2 += *aData++ + s1;
-    }while( aData<aEnd );
-  }else{
-    do {
-      s1 += BYTESWAP32(aData[0]) + s2;
-      s2 += BYTESWAP32(aData[1]) + s1;
-      aData += 2;
-    }while( aData<aEnd );
-  }
+  walChecksumImpl(WAL_CKSUM_AUTO, nativeCksum, a, nByte, s);
 
-  aOut[0] = s1;
-  aOut[1] = s2;
+  aOut[0] = s[0];
+  aOut[1] = s[1];
 }
 
+#ifdef SQLITE_TEST
+/*
+** Compute the checksum of the nByte bytes in a[] using implementation
+** zImpl - "auto", "scalar", "sse2" or "avx2" - nRepeat times over.  The
+** checksum of the last repetition, which starts from aIn[] like all the
+** others, is written to aOut[].  Return SQLITE_ERROR if the named
+** implementation is not available, or SQLITE_OK otherwise.
+**
+** This is used by the test code to compare the implementations with each
+** other and to time them.
+*/
+int sqlite3WalChecksumTest(
+  const char *zImpl,
+  int nativeCksum,
+  const u8 *a,
+  int nByte,
+  int nRepeat,
+  const u32 *aIn,
+  u32 *aOut
+){
+  static const char *azImpl[] = { "auto", "scalar", "sse2", "avx2" };
+  int eImpl;
+  int rc = SQLITE_OK;
+  int i;
+
+  for(eImpl=0; eImpl<ArraySize(azImpl); eImpl++){
+    if( sqlite3StrICmp(zImpl, azImpl[eImpl])==0 ) break;
+  }
+  if( eImpl>=ArraySize(azImpl) || nByte%8 ) return SQLITE_ERROR;
+  for(i=0; rc==SQLITE_OK && i<nRepeat; i++){
+    aOut[0] = aIn[0];
+    aOut[1] = aIn[1];
+    rc = walChecksumImpl(eImpl, nativeCksum, a, nByte, aOut);
+  }
+  return rc;
+}
+#endif
+
 /*
 ** Write the header information in pWal->hdr into the wal-index.
 **
@@ -653,20 +1272,29 @@ static void walEncodeFrame(
 }
 
 /*
-** Check to see if the frame with header in aFrame[] and content
-** in aData[] is valid.  If it is a valid frame, fill *piPage and
-** *pnTruncate and return true.  Return if the frame is not valid.
+** Check to see if the frame with header in aFrame[] is valid.  If it is
+** a valid frame, fill *piPage and *pnTruncate and return true.  Return
+** false if the frame is not valid.
+**
+** Rather than the content of the frame, this function is passed aPart[],
+** the checksum of the frame computed from an initial value of zero, and
+** aM[], the matrix that advances a checksum past a frame's worth of zero
+** words (see walChecksumMatrix()).  Since the checksum is linear, the
+** checksum of the frame extending pWal->hdr.aFrameCksum[] is aM times
+** that value plus aPart[].  This allows recovery to checksum frames in
+** parallel and check the chain afterwards.
 */
 static int walDecodeFrame(
   Wal *pWal,                      /* The write-ahead log */
   u32 *piPage,                    /* OUT: Database page number for frame */
   u32 *pnTruncate,                /* OUT: New db size (or 0 if not commit) */
-  u8 *aData,                      /* Pointer to page data (for checksum) */
-  u8 *aFrame                      /* Frame data */
+  const u32 *aM,                  /* Matrix M^n for a frame of n pairs */
+  const u32 *aPart,               /* Checksum of frame from zero */
+  u8 *aFrame                      /* Frame header */
 ){
-  int nativeCksum;                /* True for native byte-order checksums */
   u32 *aCksum = pWal->hdr.aFrameCksum;
   u32 pgno;                       /* Page number of the frame */
+  u32 c0, c1;                     /* Checksum of this frame */
   assert( WAL_FRAME_HDRSIZE==24 );
 
   /* A frame is only valid if the salt values in the frame-header
@@ -688,15 +1316,14 @@ static int walDecodeFrame(
   ** and the frame-data matches the checksum in the last 8 
   ** bytes of this frame-header.
   */
-  nativeCksum = (pWal->hdr.bigEndCksum==SQLITE_BIGENDIAN);
-  walChecksumBytes(nativeCksum, aFrame, 8, aCksum, aCksum);
-  walChecksumBytes(nativeCksum, aData, pWal->szPage, aCksum, aCksum);
-  if( aCksum[0]!=sqlite3Get4byte(&aFrame[16]) 
-   || aCksum[1]!=sqlite3Get4byte(&aFrame[20]) 
-  ){
+  c0 = aM[0]*aCksum[0] + aM[1]*aCksum[1] + aPart[0];
+  c1 = aM[2]*aCksum[0] + aM[3]*aCksum[1] + aPart[1];
+  if( c0!=sqlite3Get4byte(&aFrame[16]) || c1!=sqlite3Get4byte(&aFrame[20]) ){
     /* Checksum failed. */
     return 0;
   }
+  aCksum[0] = c0;
+  aCksum[1] = c1;
 
   /* If we reach this point, the frame is valid.  Return the page number
   ** and the new database size.
@@ -719,10 +1346,13 @@ static const char *walLockName(int lockIdx){
     return "CKPT-LOCK";
   }else if( lockIdx==WAL_RECOVER_LOCK ){
     return "RECOVER-LOCK";
+  }else if( lockIdx==WAL_SYNC_LOCK ){
+    return "SYNC-LOCK";
   }else{
     static char zName[15];
-    sqlite3_snprintf(sizeof(zName), zName, "READ-LOCK[%d]",
-                     lockIdx-WAL_READ_LOCK(0));
+    int iReader = lockIdx - WAL_READ_LOCK(0);
+    if( lockIdx>WAL_SYNC_LOCK ) iReader--;
+    sqlite3_snprintf(sizeof(zName), zName, "READ-LOCK[%d]", iReader);
     return zName;
   }
 }
@@ -770,6 +1400,31 @@ static void walUnlockExclusive(Wal *pWal, int lockIdx, int n){
              walLockName(lockIdx), n));
 }
 
+/*
+** Obtain or release exclusive locks on the reader locks of all readers
+** that may use the WAL, that is those of readers 1 to pWal->nReader-1.
+** The locks beyond WAL_NREADER_MIN do not follow on from the others, so
+** this takes two calls to xShmLock if they are in use.
+*/
+static int walLockReaders(Wal *pWal){
+  int rc = walLockExclusive(pWal, WAL_READ_LOCK(1), WAL_NREADER_MIN-1);
+  if( rc==SQLITE_OK && pWal->nReader>WAL_NREADER_MIN ){
+    rc = walLockExclusive(pWal, WAL_READ_LOCK(WAL_NREADER_MIN),
+                          pWal->nReader-WAL_NREADER_MIN);
+    if( rc!=SQLITE_OK ){
+      walUnlockExclusive(pWal, WAL_READ_LOCK(1), WAL_NREADER_MIN-1);
+    }
+  }
+  return rc;
+}
+static void walUnlockReaders(Wal *pWal){
+  if( pWal->nReader>WAL_NREADER_MIN ){
+    walUnlockExclusive(pWal, WAL_READ_LOCK(WAL_NREADER_MIN),
+                       pWal->nReader-WAL_NREADER_MIN);
+  }
+  walUnlockExclusive(pWal, WAL_READ_LOCK(1), WAL_NREADER_MIN-1);
+}
+
 /*
 ** Compute a hash on a page number.  The resulting hash value must land
 ** between 0 and (HASHTABLE_NSLOT-1).  The walHashNext() function advances
@@ -784,10 +1439,64 @@ static int walNextHash(int iPriorHash){
   return (iPriorHash+1)&(HASHTABLE_NSLOT-1);
 }
 
+/*
+** Multipliers used to compute the bits of a Bloom filter that are set
+** for a page number.  These are odd, and have no simple relationship
+** with each other or with HASHTABLE_HASH_1.
+*/
+static const u32 aBloomMul[WALINDEX_BLOOM_NHASH] = {
+  0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D
+};
+
+/*
+** Return the number of the iHash'th bit of the Bloom filter for page iPage.
+*/
+static u32 walBloomBit(u32 iPage, int iHash){
+  assert( (1<<WALINDEX_BLOOM_LOG2)==WALINDEX_BLOOM_NBIT );
+  return (iPage*aBloomMul[iHash]) >> (32-WALINDEX_BLOOM_LOG2);
+}
+
+/*
+** Add page iPage to Bloom filter aBloom.
+*/
+static void walBloomAdd(volatile u32 *aBloom, u32 iPage){
+  int i;
+  for(i=0; i<WALINDEX_BLOOM_NHASH; i++){
+    u32 iBit = walBloomBit(iPage, i);
+    aBloom[iBit/32] |= ((u32)1 << (iBit%32));
+  }
+}
+
+/*
+** Return false if page iPage has definitely not been added to Bloom 
+** filter aBloom, or true if it may have been.
+*/
+static int walBloomTest(volatile u32 *aBloom, u32 iPage){
+  int i;
+  for(i=0; i<WALINDEX_BLOOM_NHASH; i++){
+    u32 iBit = walBloomBit(iPage, i);
+    if( (aBloom[iBit/32] & ((u32)1 << (iBit%32)))==0 ) return 0;
+  }
+  return 1;
+}
+
+/*
+** Set *paBloom to point to the Bloom filter for index block iHash.
+*/
+static int walBloomGet(Wal *pWal, int iHash, volatile u32 **paBloom){
+  volatile u32 *aPage;
+  int rc = walIndexPage(pWal, walBloomPage(iHash), &aPage);
+  if( rc==SQLITE_OK ){
+    int iFilter = iHash % WALINDEX_BLOOM_NBLOCK;
+    *paBloom = &aPage[iFilter * (WALINDEX_BLOOM_NBYTE/sizeof(u32))];
+  }
+  return rc;
+}
+
 /* 
-** Return pointers to the hash table and page number array stored on
-** page iHash of the wal-index. The wal-index is broken into 32KB pages
-** numbered starting from 0.
+** Return pointers to the hash table and page number array of index block
+** iHash of the wal-index.  Index blocks are numbered starting from 0.  They
+** are stored on the wal-index pages given by walBlockPage().
 **
 ** Set output variable *paHash to point to the start of the hash table
 ** in the wal-index file. Set *piZero to one less than the frame 
@@ -797,6 +1506,9 @@ static int walNextHash(int iPriorHash){
 **
 ** Finally, set *paPgno so that *paPgno[1] is the page number of the
 ** first frame indexed by the hash table, frame (*piZero+1).
+**
+** In wal2 mode index blocks 2*N and 2*N+1 both hold the N'th hash
+** table of a WAL file (see walIndexPageOf()).
 */
 static int walHashGet(
   Wal *pWal,                      /* WAL handle */
@@ -806,9 +1518,10 @@ static int walHashGet(
   u32 *piZero                     /* OUT: Frame associated with *paPgno[0] */
 ){
   int rc;                         /* Return code */
+  int iBlock = pWal->bWal2 ? iHash>>1 : iHash;
   volatile u32 *aPgno;
 
-  rc = walIndexPage(pWal, iHash, &aPgno);
+  rc = walIndexPage(pWal, walBlockPage(iHash), &aPgno);
   assert( rc==SQLITE_OK || iHash>0 );
 
   if( rc==SQLITE_OK ){
@@ -816,11 +1529,11 @@ static int walHashGet(
     volatile ht_slot *aHash;
 
     aHash = (volatile ht_slot *)&aPgno[HASHTABLE_NPAGE];
-    if( iHash==0 ){
+    if( iBlock==0 ){
       aPgno = &aPgno[WALINDEX_HDR_SIZE/sizeof(u32)];
       iZero = 0;
     }else{
-      iZero = HASHTABLE_NPAGE_ONE + (iHash-1)*HASHTABLE_NPAGE;
+      iZero = HASHTABLE_NPAGE_ONE + (iBlock-1)*HASHTABLE_NPAGE;
     }
   
     *paPgno = &aPgno[-1];
@@ -848,19 +1561,29 @@ static int walFramePage(u32 iFrame){
 }
 
 /*
-** Return the page number associated with frame iFrame in this WAL.
+** Return the number of the index block that holds the iBlock'th hash
+** table of WAL file iWal.  Outside of wal2 mode, iWal is always 0 and
+** this is just iBlock.
 */
-static u32 walFramePgno(Wal *pWal, u32 iFrame){
-  int iHash = walFramePage(iFrame);
-  if( iHash==0 ){
-    return pWal->apWiData[0][WALINDEX_HDR_SIZE/sizeof(u32) + iFrame - 1];
+#define walIndexPageOf(pWal, iWal, iBlock) \
+  ((pWal)->bWal2 ? (iBlock)*2+(iWal) : (iBlock))
+
+/*
+** Return the page number associated with frame iFrame of WAL file iWal.
+*/
+static u32 walFramePgno(Wal *pWal, int iWal, u32 iFrame){
+  int iBlock = walFramePage(iFrame);
+  int iPage = walBlockPage(walIndexPageOf(pWal, iWal, iBlock));
+  if( iBlock==0 ){
+    return pWal->apWiData[iPage][WALINDEX_HDR_SIZE/sizeof(u32) + iFrame - 1];
   }
-  return pWal->apWiData[iHash][(iFrame-1-HASHTABLE_NPAGE_ONE)%HASHTABLE_NPAGE];
+  return pWal->apWiData[iPage][(iFrame-1-HASHTABLE_NPAGE_ONE)%HASHTABLE_NPAGE];
 }
 
 /*
 ** Remove entries from the hash table that point to WAL slots greater
-** than pWal->hdr.mxFrame.
+** than pWal->hdr.mxFrame.  In wal2 mode, this applies to the hash tables
+** of the current WAL file.
 **
 ** This function is called whenever pWal->hdr.mxFrame is decreased due
 ** to a rollback or savepoint.
@@ -877,6 +1600,7 @@ static void walCleanupHash(Wal *pWal){
   int iLimit = 0;                 /* Zero values greater than this */
   int nByte;                      /* Number of bytes to zero in aPgno[] */
   int i;                          /* Used to iterate through aHash[] */
+  int iHash;                      /* Index block holding mxFrame */
 
   assert( pWal->writeLock );
   testcase( pWal->hdr.mxFrame==HASHTABLE_NPAGE_ONE-1 );
@@ -889,9 +1613,11 @@ static void walCleanupHash(Wal *pWal){
   ** the entry that corresponds to frame pWal->hdr.mxFrame. It is guaranteed
   ** that the page said hash-table and array reside on is already mapped.
   */
-  assert( pWal->nWiData>walFramePage(pWal->hdr.mxFrame) );
-  assert( pWal->apWiData[walFramePage(pWal->hdr.mxFrame)] );
-  walHashGet(pWal, walFramePage(pWal->hdr.mxFrame), &aHash, &aPgno, &iZero);
+  iHash = walIndexPageOf(pWal, walidxGetFile(&pWal->hdr),
+                         walFramePage(pWal->hdr.mxFrame));
+  assert( pWal->nWiData>walBlockPage(iHash) );
+  assert( pWal->apWiData[walBlockPage(iHash)] );
+  walHashGet(pWal, iHash, &aHash, &aPgno, &iZero);
 
   /* Zero all hash-table entries that correspond to frame numbers greater
   ** than pWal->hdr.mxFrame.
@@ -930,15 +1656,21 @@ static void walCleanupHash(Wal *pWal){
 
 /*
 ** Set an entry in the wal-index that will map database page number
-** pPage into WAL frame iFrame.
+** pPage into frame iFrame of WAL file iWal.
 */
-static int walIndexAppend(Wal *pWal, u32 iFrame, u32 iPage){
+static int walIndexAppend(Wal *pWal, int iWal, u32 iFrame, u32 iPage){
   int rc;                         /* Return code */
   u32 iZero = 0;                  /* One less than frame number of aPgno[1] */
   volatile u32 *aPgno = 0;        /* Page number array */
   volatile ht_slot *aHash = 0;    /* Hash table */
+  volatile u32 *aBloom = 0;       /* Bloom filter */
+  int iHash;                      /* Index block for frame iFrame */
 
-  rc = walHashGet(pWal, walFramePage(iFrame), &aHash, &aPgno, &iZero);
+  iHash = walIndexPageOf(pWal, iWal, walFramePage(iFrame));
+  rc = walHashGet(pWal, iHash, &aHash, &aPgno, &iZero);
+  if( rc==SQLITE_OK ){
+    rc = walBloomGet(pWal, iHash, &aBloom);
+  }
 
   /* Assuming the wal-index file was successfully mapped, populate the
   ** page number array and hash table entry.
@@ -952,11 +1684,12 @@ static int walIndexAppend(Wal *pWal, u32 iFrame, u32 iPage){
     assert( idx <= HASHTABLE_NSLOT/2 + 1 );
     
     /* If this is the first entry to be added to this hash-table, zero the
-    ** entire hash table and aPgno[] array before proceding. 
+    ** entire hash table, aPgno[] array and Bloom filter before proceding. 
     */
     if( idx==1 ){
       int nByte = (int)((u8 *)&aHash[HASHTABLE_NSLOT] - (u8 *)&aPgno[1]);
       memset((void*)&aPgno[1], 0, nByte);
+      memset((void*)aBloom, 0, WALINDEX_BLOOM_NBYTE);
     }
 
     /* If the entry in aPgno[] is already set, then the previous writer
@@ -977,6 +1710,7 @@ static int walIndexAppend(Wal *pWal, u32 iFrame, u32 iPage){
     }
     aPgno[idx] = iPage;
     aHash[iKey] = (ht_slot)idx;
+    walBloomAdd(aBloom, iPage);
 
 #ifdef SQLITE_ENABLE_EXPENSIVE_ASSERT
     /* Verify that the number of entries in the hash table exactly equals
@@ -1011,6 +1745,315 @@ static int walIndexAppend(Wal *pWal, u32 iFrame, u32 iPage){
 }
 
 
+/*
+** Read the header of WAL file iWal into aBuf[].  Set *pbValid to true if
+** the file is large enough to contain a header and the magic number, page
+** size and checksum of the header are valid, or to false otherwise.  If
+** pnSize is not NULL, also set *pnSize to the size of the file in bytes.
+**
+** Return SQLITE_OK if successful, or an SQLite error code if an I/O error
+** occurs.  An invalid header is not an error.
+*/
+static int walReadFileHdr(
+  Wal *pWal,                      /* WAL handle */
+  int iWal,                       /* Read the header of this file */
+  u8 *aBuf,                       /* OUT: Buffer of WAL_HDRSIZE bytes */
+  i64 *pnSize,                    /* OUT: Size of file (or NULL) */
+  int *pbValid                    /* OUT: True if header is valid */
+){
+  int rc;
+  i64 nSize;
+  u32 magic;
+  int szPage;
+  u32 aCksum[2];
+
+  *pbValid = 0;
+  rc = sqlite3OsFileSize(walFd(pWal, iWal), &nSize);
+  if( pnSize ) *pnSize = nSize;
+  if( rc!=SQLITE_OK || nSize<WAL_HDRSIZE ) return rc;
+  rc = sqlite3OsRead(walFd(pWal, iWal), aBuf, WAL_HDRSIZE, 0);
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* If the database page size is not a power of two, or is greater than
+  ** SQLITE_MAX_PAGE_SIZE, conclude that the WAL file contains no valid 
+  ** data. Similarly, if the 'magic' value is invalid, ignore the whole
+  ** WAL file.
+  */
+  magic = sqlite3Get4byte(&aBuf[0]);
+  szPage = sqlite3Get4byte(&aBuf[8]);
+  if( (magic&0xFFFFFFFE)!=WAL_MAGIC 
+   || szPage&(szPage-1) 
+   || szPage>SQLITE_MAX_PAGE_SIZE 
+   || szPage<512 
+  ){
+    return SQLITE_OK;
+  }
+
+  /* Verify that the WAL header checksum is correct */
+  walChecksumBytes((magic&0x00000001)==SQLITE_BIGENDIAN, 
+      aBuf, WAL_HDRSIZE-2*4, 0, aCksum
+  );
+  if( aCksum[0]==sqlite3Get4byte(&aBuf[24])
+   && aCksum[1]==sqlite3Get4byte(&aBuf[28])
+  ){
+    *pbValid = 1;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Recovery reads the WAL file in chunks of up to WAL_RECOVER_CHUNK bytes,
+** each as a single sequential read, or in smaller chunks if memory is
+** short.  The frames of a chunk are then checksummed, each independently
+** from a zero initial value, divided between up to WAL_RECOVER_THREADS
+** threads.  Finally the frames are checked in order by walDecodeFrame(),
+** which links the checksums into the chain (see the comments above
+** walChecksumScalar()), and added to the wal-index.  Each thread is given
+** at least WAL_RECOVER_MINFRAME frames, so that small WAL files are
+** recovered by the calling thread alone.
+**
+** The number of threads, including the calling thread, may be set at
+** compile time with SQLITE_WAL_RECOVER_THREADS (at most 16).  Threads are
+** only used in threadsafe builds on unix.  Elsewhere, or if the number is
+** 1, the calling thread does all the work.  In test builds the number of
+** threads may be changed by setting the sqlite3_wal_recover_threads
+** variable.
+*/
+#ifndef SQLITE_WAL_RECOVER_THREADS
+# define SQLITE_WAL_RECOVER_THREADS 4
+#endif
+#define WAL_RECOVER_CHUNK    (4*1024*1024)
+#define WAL_RECOVER_MINFRAME 64
+
+#ifdef SQLITE_TEST
+int sqlite3_wal_recover_threads = SQLITE_WAL_RECOVER_THREADS;
+# define WAL_RECOVER_THREADS sqlite3_wal_recover_threads
+#else
+# define WAL_RECOVER_THREADS SQLITE_WAL_RECOVER_THREADS
+#endif
+#define WAL_RECOVER_MAXTHREAD 16
+
+#if SQLITE_THREADSAFE>0 && SQLITE_OS_UNIX
+# include <pthread.h>
+# define WAL_RECOVER_PTHREADS 1
+#endif
+
+/*
+** A set of frames to be checksummed by one thread during recovery.
+*/
+typedef struct WalRecoverJob WalRecoverJob;
+struct WalRecoverJob {
+  int nativeCksum;                /* True for native byte-order checksums */
+  int szPage;                     /* Database page size */
+  u8 *aBuf;                       /* First frame (header and content) */
+  int nFrame;                     /* Number of frames */
+  u32 *aPart;                     /* OUT: Checksums, 2 words per frame */
+};
+
+/*
+** Compute the checksum of each frame of job p, from an initial value of
+** zero.  The argument is really a WalRecoverJob*.  This is the main
+** routine of the threads used by walRecoverChecksums().
+*/
+static void *walRecoverJobMain(void *pArg){
+  WalRecoverJob *p = (WalRecoverJob*)pArg;
+  int szFrame = p->szPage + WAL_FRAME_HDRSIZE;
+  int i;
+  for(i=0; i<p->nFrame; i++){
+    u8 *aFrame = &p->aBuf[i*szFrame];
+    u32 *s = &p->aPart[i*2];
+    s[0] = s[1] = 0;
+    walChecksumImpl(WAL_CKSUM_AUTO, p->nativeCksum, aFrame, 8, s);
+    walChecksumImpl(WAL_CKSUM_AUTO, p->nativeCksum,
+        &aFrame[WAL_FRAME_HDRSIZE], p->szPage, s
+    );
+  }
+  return 0;
+}
+
+/*
+** Set aPart[i*2] and aPart[i*2+1] to the checksum of the i'th of the
+** nFrame frames in aBuf[], computed from an initial value of zero.  The
+** frames are divided between as many threads as is useful, one of which
+** is the calling thread.
+*/
+static void walRecoverChecksums(
+  int nativeCksum,                /* True for native byte-order checksums */
+  int szPage,                     /* Database page size */
+  u8 *aBuf,                       /* Frames to checksum */
+  int nFrame,                     /* Number of frames in aBuf[] */
+  u32 *aPart                      /* OUT: Checksums */
+){
+  WalRecoverJob aJob[WAL_RECOVER_MAXTHREAD];
+  int nThread = WAL_RECOVER_THREADS;
+  int iFrame = 0;
+  int i;
+
+  if( nThread>WAL_RECOVER_MAXTHREAD ) nThread = WAL_RECOVER_MAXTHREAD;
+  if( nThread>nFrame/WAL_RECOVER_MINFRAME ){
+    nThread = nFrame/WAL_RECOVER_MINFRAME;
+  }
+  if( nThread<1 ) nThread = 1;
+  for(i=0; i<nThread; i++){
+    WalRecoverJob *p = &aJob[i];
+    int nJob = (nFrame - iFrame) / (nThread - i);
+    p->nativeCksum = nativeCksum;
+    p->szPage = szPage;
+    p->aBuf = &aBuf[iFrame*(szPage+WAL_FRAME_HDRSIZE)];
+    p->nFrame = nJob;
+    p->aPart = &aPart[iFrame*2];
+    iFrame += nJob;
+  }
+  assert( iFrame==nFrame );
+
+#ifdef WAL_RECOVER_PTHREADS
+  /* Start a thread for each job but the first, and do that one here.  If
+  ** a thread cannot be started, its job is done here too. */
+  {
+    pthread_t aThread[WAL_RECOVER_MAXTHREAD];
+    int abRun[WAL_RECOVER_MAXTHREAD];
+    for(i=1; i<nThread; i++){
+      abRun[i] = !pthread_create(&aThread[i], 0, walRecoverJobMain, &aJob[i]);
+    }
+    walRecoverJobMain(&aJob[0]);
+    for(i=1; i<nThread; i++){
+      if( abRun[i] ){
+        pthread_join(aThread[i], 0);
+      }else{
+        walRecoverJobMain(&aJob[i]);
+      }
+    }
+  }
+#else
+  for(i=0; i<nThread; i++){
+    walRecoverJobMain(&aJob[i]);
+  }
+#endif
+}
+
+/*
+** Add the frames of WAL file iWal to the wal-index.  This is called by
+** walIndexRecover() with the file number in pWal->hdr set to iWal.  On
+** return, pWal->hdr describes the file, except that its aFrameCksum[]
+** holds the checksum of the last valid frame, not of the last commit
+** frame.  The checksum of the last commit frame is written to
+** aFrameCksum[].
+*/
+static int walRecoverFile(Wal *pWal, int iWal, u32 *aFrameCksum){
+  int rc;                         /* Return Code */
+  i64 nSize;                      /* Size of log file */
+  u8 aHdr[WAL_HDRSIZE];           /* Buffer to load WAL header into */
+  int bValid;                     /* True if the WAL header is valid */
+  u8 *aBuf = 0;                   /* Malloc'd buffer to load frames into */
+  u32 *aPart;                     /* Checksum of each frame in aBuf[] */
+  u32 aM[4];                      /* Used to link checksums into the chain */
+  int szFrame;                    /* Size of each frame in bytes */
+  int nChunk;                     /* Max frames that fit in aBuf[] */
+  int iFrame;                     /* Index of last frame read */
+  i64 iOffset;                    /* Next offset to read from log file */
+  int szPage;                     /* Page size according to the log */
+  u32 version;                    /* Magic value read from WAL header */
+
+  assert( walidxGetFile(&pWal->hdr)==iWal );
+
+  /* Read in the WAL header. */
+  rc = walReadFileHdr(pWal, iWal, aHdr, &nSize, &bValid);
+  if( rc!=SQLITE_OK || !bValid || nSize==WAL_HDRSIZE ){
+    return rc;
+  }
+  szPage = sqlite3Get4byte(&aHdr[8]);
+  pWal->hdr.bigEndCksum = (u8)(sqlite3Get4byte(&aHdr[0])&0x00000001);
+  pWal->szPage = szPage;
+  pWal->nCkpt = sqlite3Get4byte(&aHdr[12]);
+  memcpy(&pWal->hdr.aSalt, &aHdr[16], 8);
+  pWal->hdr.aFrameCksum[0] = sqlite3Get4byte(&aHdr[24]);
+  pWal->hdr.aFrameCksum[1] = sqlite3Get4byte(&aHdr[28]);
+
+  /* Verify that the version number on the WAL format is one that
+  ** are able to understand */
+  version = sqlite3Get4byte(&aHdr[4]);
+  if( version!=WAL_MAX_VERSION ){
+    return SQLITE_CANTOPEN_BKPT;
+  }
+
+  /* Malloc a buffer to read chunks of frames into, and space for the
+  ** checksum of each frame of a chunk.  If a buffer that large cannot be
+  ** allocated, try successively smaller ones, down to a single frame.
+  ** Only a failure to allocate the last is reported.  */
+  szFrame = szPage + WAL_FRAME_HDRSIZE;
+  nChunk = WAL_RECOVER_CHUNK / szFrame;
+  if( nChunk<1 ) nChunk = 1;
+  if( nChunk>(nSize-WAL_HDRSIZE)/szFrame ){
+    nChunk = (int)((nSize-WAL_HDRSIZE)/szFrame);
+  }
+  if( nChunk<1 ){
+    return SQLITE_OK;
+  }
+  while( 1 ){
+    int nByte = nChunk*szFrame + nChunk*2*sizeof(u32);
+    if( nChunk==1 ){
+      aBuf = (u8 *)sqlite3_malloc(nByte);
+      break;
+    }
+    sqlite3BeginBenignMalloc();
+    aBuf = (u8 *)sqlite3_malloc(nByte);
+    sqlite3EndBenignMalloc();
+    if( aBuf ) break;
+    nChunk = nChunk/2;
+  }
+  if( !aBuf ){
+    return SQLITE_NOMEM;
+  }
+  aPart = (u32 *)&aBuf[nChunk*szFrame];
+  walChecksumMatrix((szPage+8)/8, aM);
+
+  /* Read all frames from the log file. */
+  iFrame = 0;
+  iOffset = WAL_HDRSIZE;
+  while( (iOffset+szFrame)<=nSize ){
+    int nRead;                    /* Frames in this chunk */
+    int i;
+
+    nRead = (int)((nSize - iOffset) / szFrame);
+    if( nRead>nChunk ) nRead = nChunk;
+    rc = sqlite3OsRead(walFd(pWal, iWal), aBuf, nRead*szFrame, iOffset);
+    if( rc!=SQLITE_OK ) break;
+    iOffset += nRead*szFrame;
+    walRecoverChecksums(pWal->hdr.bigEndCksum==SQLITE_BIGENDIAN, szPage,
+        aBuf, nRead, aPart
+    );
+
+    for(i=0; i<nRead; i++){
+      u32 pgno;                   /* Database page number for frame */
+      u32 nTruncate;              /* dbsize field from frame header */
+      int isValid;                /* True if this frame is valid */
+
+      /* Decode the next log frame. */
+      isValid = walDecodeFrame(pWal, &pgno, &nTruncate, aM, &aPart[i*2],
+          &aBuf[i*szFrame]
+      );
+      if( !isValid ) break;
+      rc = walIndexAppend(pWal, iWal, ++iFrame, pgno);
+      if( rc!=SQLITE_OK ) break;
+
+      /* If nTruncate is non-zero, this is a commit record. */
+      if( nTruncate ){
+        pWal->hdr.mxFrame = iFrame;
+        pWal->hdr.nPage = nTruncate;
+        pWal->hdr.szPage = (u16)((szPage&0xff00) | (szPage>>16));
+        testcase( szPage<=32768 );
+        testcase( szPage>=65536 );
+        aFrameCksum[0] = pWal->hdr.aFrameCksum[0];
+        aFrameCksum[1] = pWal->hdr.aFrameCksum[1];
+      }
+    }
+    if( i<nRead || rc!=SQLITE_OK ) break;
+  }
+
+  sqlite3_free(aBuf);
+  return rc;
+}
+
 /*
 ** Recover the wal-index by reading the write-ahead log file. 
 **
@@ -1020,138 +2063,93 @@ static int walIndexAppend(Wal *pWal, u32 iFrame, u32 iPage){
 ** WAL_RECOVER_LOCK is also held so that other threads will know
 ** that this thread is running recovery.  If unable to establish
 ** the necessary locks, this routine returns SQLITE_BUSY.
+**
+** In wal2 mode, the current file is the one with the larger checkpoint
+** sequence number in its header.  The other file is recovered first.
 */
 static int walIndexRecover(Wal *pWal){
   int rc;                         /* Return Code */
-  i64 nSize;                      /* Size of log file */
   u32 aFrameCksum[2] = {0, 0};
   int iLock;                      /* Lock offset to lock for checkpoint */
   int nLock;                      /* Number of locks to hold */
+  volatile WalReaderInfo *pReader;  /* Reader info in wal-index */
+
+  /* A connection that cannot take the locks of all WAL_NREADER readers
+  ** may not recover a wal-index that other connections use them with.
+  */
+  pReader = walReaderInfo(pWal);
+  if( pReader->eLock==WAL_LOCK_EXTENDED && !pWal->bExtLock ){
+    return SQLITE_CANTOPEN_BKPT;
+  }
 
   /* Obtain an exclusive lock on all byte in the locking range not already
   ** locked by the caller. The caller is guaranteed to have locked the
   ** WAL_WRITE_LOCK byte, and may have also locked the WAL_CKPT_LOCK byte.
   ** If successful, the same bytes that are locked here are unlocked before
-  ** this function returns.
+  ** this function returns. WAL_SYNC_LOCK is not taken, as recovery does
+  ** not modify the WAL file.  Nor are the locks of the readers beyond
+  ** WAL_NREADER_MIN, unless the VFS supports them.
   */
   assert( pWal->ckptLock==1 || pWal->ckptLock==0 );
   assert( WAL_ALL_BUT_WRITE==WAL_WRITE_LOCK+1 );
   assert( WAL_CKPT_LOCK==WAL_ALL_BUT_WRITE );
   assert( pWal->writeLock );
   iLock = WAL_ALL_BUT_WRITE + pWal->ckptLock;
-  nLock = SQLITE_SHM_NLOCK - iLock;
+  nLock = WAL_READ_LOCK(WAL_NREADER_MIN-1) + 1 - iLock;
   rc = walLockExclusive(pWal, iLock, nLock);
   if( rc ){
     return rc;
   }
+  if( pWal->bExtLock ){
+    rc = walLockExclusive(pWal, WAL_READ_LOCK(WAL_NREADER_MIN),
+                          WAL_NREADER-WAL_NREADER_MIN);
+    if( rc ){
+      walUnlockExclusive(pWal, iLock, nLock);
+      return rc;
+    }
+  }
   WALTRACE(("WAL%p: recovery begin...\n", pWal));
 
   memset(&pWal->hdr, 0, sizeof(WalIndexHdr));
 
-  rc = sqlite3OsFileSize(pWal->pWalFd, &nSize);
-  if( rc!=SQLITE_OK ){
-    goto recovery_error;
-  }
-
-  if( nSize>WAL_HDRSIZE ){
-    u8 aBuf[WAL_HDRSIZE];         /* Buffer to load WAL header into */
-    u8 *aFrame = 0;               /* Malloc'd buffer to load entire frame */
-    int szFrame;                  /* Number of bytes in buffer aFrame[] */
-    u8 *aData;                    /* Pointer to data part of aFrame buffer */
-    int iFrame;                   /* Index of last frame read */
-    i64 iOffset;                  /* Next offset to read from log file */
-    int szPage;                   /* Page size according to the log */
-    u32 magic;                    /* Magic value read from WAL header */
-    u32 version;                  /* Magic value read from WAL header */
-
-    /* Read in the WAL header. */
-    rc = sqlite3OsRead(pWal->pWalFd, aBuf, WAL_HDRSIZE, 0);
-    if( rc!=SQLITE_OK ){
-      goto recovery_error;
-    }
-
-    /* If the database page size is not a power of two, or is greater than
-    ** SQLITE_MAX_PAGE_SIZE, conclude that the WAL file contains no valid 
-    ** data. Similarly, if the 'magic' value is invalid, ignore the whole
-    ** WAL file.
-    */
-    magic = sqlite3Get4byte(&aBuf[0]);
-    szPage = sqlite3Get4byte(&aBuf[8]);
-    if( (magic&0xFFFFFFFE)!=WAL_MAGIC 
-     || szPage&(szPage-1) 
-     || szPage>SQLITE_MAX_PAGE_SIZE 
-     || szPage<512 
-    ){
-      goto finished;
-    }
-    pWal->hdr.bigEndCksum = (u8)(magic&0x00000001);
-    pWal->szPage = szPage;
-    pWal->nCkpt = sqlite3Get4byte(&aBuf[12]);
-    memcpy(&pWal->hdr.aSalt, &aBuf[16], 8);
-
-    /* Verify that the WAL header checksum is correct */
-    walChecksumBytes(pWal->hdr.bigEndCksum==SQLITE_BIGENDIAN, 
-        aBuf, WAL_HDRSIZE-2*4, 0, pWal->hdr.aFrameCksum
-    );
-    if( pWal->hdr.aFrameCksum[0]!=sqlite3Get4byte(&aBuf[24])
-     || pWal->hdr.aFrameCksum[1]!=sqlite3Get4byte(&aBuf[28])
-    ){
-      goto finished;
-    }
-
-    /* Verify that the version number on the WAL format is one that
-    ** are able to understand */
-    version = sqlite3Get4byte(&aBuf[4]);
-    if( version!=WAL_MAX_VERSION ){
-      rc = SQLITE_CANTOPEN_BKPT;
-      goto finished;
-    }
-
-    /* Malloc a buffer to read frames into. */
-    szFrame = szPage + WAL_FRAME_HDRSIZE;
-    aFrame = (u8 *)sqlite3_malloc(szFrame);
-    if( !aFrame ){
-      rc = SQLITE_NOMEM;
-      goto recovery_error;
+  if( pWal->bWal2 ){
+    u8 aBuf[WAL_HDRSIZE];         /* Buffer to load WAL headers into */
+    int abValid[2];               /* True for each file with a valid header */
+    u32 aCkpt[2];                 /* Checkpoint sequence numbers */
+    int iCur;                     /* The current WAL file */
+    int i;
+    for(i=0; rc==SQLITE_OK && i<2; i++){
+      rc = walReadFileHdr(pWal, i, aBuf, 0, &abValid[i]);
+      aCkpt[i] = abValid[i] ? sqlite3Get4byte(&aBuf[12]) : 0;
     }
-    aData = &aFrame[WAL_FRAME_HDRSIZE];
-
-    /* Read all frames from the log file. */
-    iFrame = 0;
-    for(iOffset=WAL_HDRSIZE; (iOffset+szFrame)<=nSize; iOffset+=szFrame){
-      u32 pgno;                   /* Database page number for frame */
-      u32 nTruncate;              /* dbsize field from frame header */
-      int isValid;                /* True if this frame is valid */
+    if( rc!=SQLITE_OK ) goto recovery_error;
+    iCur = (abValid[1] && (!abValid[0] || aCkpt[1]>aCkpt[0]));
 
-      /* Read and decode the next log frame. */
-      rc = sqlite3OsRead(pWal->pWalFd, aFrame, szFrame, iOffset);
-      if( rc!=SQLITE_OK ) break;
-      isValid = walDecodeFrame(pWal, &pgno, &nTruncate, aData, aFrame);
-      if( !isValid ) break;
-      rc = walIndexAppend(pWal, ++iFrame, pgno);
-      if( rc!=SQLITE_OK ) break;
-
-      /* If nTruncate is non-zero, this is a commit record. */
-      if( nTruncate ){
-        pWal->hdr.mxFrame = iFrame;
-        pWal->hdr.nPage = nTruncate;
-        pWal->hdr.szPage = (u16)((szPage&0xff00) | (szPage>>16));
-        testcase( szPage<=32768 );
-        testcase( szPage>=65536 );
-        aFrameCksum[0] = pWal->hdr.aFrameCksum[0];
-        aFrameCksum[1] = pWal->hdr.aFrameCksum[1];
-      }
+    walidxSetFile(&pWal->hdr, !iCur);
+    rc = walRecoverFile(pWal, !iCur, aFrameCksum);
+    if( rc==SQLITE_OK ){
+      WalIndexHdr hdr;
+      memcpy(&hdr, &pWal->hdr, sizeof(WalIndexHdr));
+      memset(&pWal->hdr, 0, sizeof(WalIndexHdr));
+      pWal->hdr.nPage = hdr.nPage;
+      pWal->hdr.szPage = hdr.szPage;
+      walidxSetFile(&pWal->hdr, iCur);
+      walidxSetMxFrame(&pWal->hdr, !iCur, hdr.mxFrame);
+      aFrameCksum[0] = aFrameCksum[1] = 0;
+      rc = walRecoverFile(pWal, iCur, aFrameCksum);
     }
-
-    sqlite3_free(aFrame);
+  }else{
+    rc = walRecoverFile(pWal, 0, aFrameCksum);
   }
 
-finished:
   if( rc==SQLITE_OK ){
     volatile WalCkptInfo *pInfo;
     int i;
     pWal->hdr.aFrameCksum[0] = aFrameCksum[0];
     pWal->hdr.aFrameCksum[1] = aFrameCksum[1];
+    if( pReader->eLock==0 ){
+      pReader->eLock = pWal->bExtLock ? WAL_LOCK_EXTENDED : WAL_LOCK_LEGACY;
+    }
     walIndexWriteHdr(pWal);
 
     /* Reset the checkpoint-header. This is safe because this thread is 
@@ -1161,7 +2159,8 @@ finished:
     pInfo = walCkptInfo(pWal);
     pInfo->nBackfill = 0;
     pInfo->aReadMark[0] = 0;
-    for(i=1; i<WAL_NREADER; i++) pInfo->aReadMark[i] = READMARK_NOT_USED;
+    pReader->nSynced = 0;
+    for(i=1; i<WAL_NREADER; i++) *walReadMark(pWal, i) = READMARK_NOT_USED;
 
     /* If more than one frame was recovered from the log file, report an
     ** event via sqlite3_log(). This is to help with identifying performance
@@ -1177,6 +2176,10 @@ finished:
 
 recovery_error:
   WALTRACE(("WAL%p: recovery %s\n", pWal, rc ? "failed" : "ok"));
+  if( pWal->bExtLock ){
+    walUnlockExclusive(pWal, WAL_READ_LOCK(WAL_NREADER_MIN),
+                       WAL_NREADER-WAL_NREADER_MIN);
+  }
   walUnlockExclusive(pWal, iLock, nLock);
   return rc;
 }
@@ -1193,6 +2196,9 @@ static void walIndexClose(Wal *pWal, int isDelete){
 ** already be opened on connection pDbFd. The buffer that zWalName points
 ** to must remain valid for the lifetime of the returned Wal* handle.
 **
+** If zWal2Name is not NULL, the WAL is opened in wal2 mode and zWal2Name
+** is the name of the second WAL file.  The same requirements apply to it.
+**
 ** A SHARED lock should be held on the database file when this function
 ** is called. The purpose of this SHARED lock is to prevent any other
 ** client from unlinking the WAL or wal-index file. If another process
@@ -1207,14 +2213,17 @@ int sqlite3WalOpen(
   sqlite3_vfs *pVfs,              /* vfs module to open wal and wal-index */
   sqlite3_file *pDbFd,            /* The open database file */
   const char *zWalName,           /* Name of the WAL file */
+  const char *zWal2Name,          /* Name of second WAL file, or NULL */
   Wal **ppWal                     /* OUT: Allocated Wal handle */
 ){
   int rc;                         /* Return Code */
   Wal *pRet;                      /* Object to allocate and return */
   int flags;                      /* Flags passed to OsOpen() */
+  int nLock = 0;                  /* Number of shm locks the VFS supports */
 
   assert( zWalName && zWalName[0] );
   assert( pDbFd );
+  assert( WAL_NLOCK<WALINDEX_LOCK_RESERVED );
 
   /* In the amalgamation, the os_unix.c and os_win.c source files come before
   ** this source file.  Verify that the #defines of the locking byte offsets
@@ -1230,27 +2239,49 @@ int sqlite3WalOpen(
 
   /* Allocate an instance of struct Wal to return. */
   *ppWal = 0;
-  pRet = (Wal*)sqlite3MallocZero(sizeof(Wal) + pVfs->szOsFile);
+  pRet = (Wal*)sqlite3MallocZero(sizeof(Wal) + 2*pVfs->szOsFile);
   if( !pRet ){
     return SQLITE_NOMEM;
   }
 
   pRet->pVfs = pVfs;
   pRet->pWalFd = (sqlite3_file *)&pRet[1];
+  pRet->pWalFd2 = (sqlite3_file *)&((u8*)pRet->pWalFd)[pVfs->szOsFile];
   pRet->pDbFd = pDbFd;
   pRet->readLock = -1;
+  pRet->nGroupCommit = -1;
   pRet->zWalName = zWalName;
+  pRet->zWal2Name = zWal2Name;
+  pRet->bWal2 = (zWal2Name!=0);
+  pRet->mxWalSize = -1;
+  pRet->nReader = WAL_NREADER_MIN;
+  if( sqlite3OsFileControl(pDbFd, SQLITE_FCNTL_SHM_NLOCK, &nLock)==SQLITE_OK
+   && nLock>=WAL_NLOCK
+  ){
+    pRet->bExtLock = 1;
+  }
 
-  /* Open file handle on the write-ahead log file. */
-  flags = (SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_WAL);
-  rc = sqlite3OsOpen(pVfs, zWalName, pRet->pWalFd, flags, &flags);
-  if( rc==SQLITE_OK && flags&SQLITE_OPEN_READONLY ){
-    pRet->readOnly = 1;
+  /* Open file handles on the write-ahead log files. */
+  rc = SQLITE_OK;
+  if( zWal2Name ){
+    flags = (SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_WAL);
+    rc = sqlite3OsOpen(pVfs, zWal2Name, pRet->pWalFd2, flags, &flags);
+    if( rc==SQLITE_OK && flags&SQLITE_OPEN_READONLY ){
+      pRet->readOnly = 1;
+    }
+  }
+  if( rc==SQLITE_OK ){
+    flags = (SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_WAL);
+    rc = sqlite3OsOpen(pVfs, zWalName, pRet->pWalFd, flags, &flags);
+    if( rc==SQLITE_OK && flags&SQLITE_OPEN_READONLY ){
+      pRet->readOnly = 1;
+    }
   }
 
   if( rc!=SQLITE_OK ){
     walIndexClose(pRet, 0);
     sqlite3OsClose(pRet->pWalFd);
+    sqlite3OsClose(pRet->pWalFd2);
     sqlite3_free(pRet);
   }else{
     *ppWal = pRet;
@@ -1412,6 +2443,11 @@ static void walIteratorFree(WalIterator *p){
 ** Construct a WalInterator object that can be used to loop over all 
 ** pages in the WAL in ascending order. The caller must hold the checkpoint
 **
+** Only the hash-table segments that hold frames iFirst to iLast are
+** merged.  So the iterator may also visit some frames earlier than
+** iFirst, but it does not visit pages that only appear in segments
+** before the one holding frame iFirst.
+**
 ** On success, make *pp point to the newly allocated WalInterator object
 ** return SQLITE_OK. Otherwise, return an error code. If this routine
 ** returns an error, the value of *pp is undefined.
@@ -1419,10 +2455,17 @@ static void walIteratorFree(WalIterator *p){
 ** The calling routine should invoke walIteratorFree() to destroy the
 ** WalIterator object when it has finished with it.
 */
-static int walIteratorInit(Wal *pWal, WalIterator **pp){
+static int walIteratorInit(
+  Wal *pWal,                      /* WAL connection */
+  int iWal,                       /* Iterate through frames of this file */
+  u32 iFirst,                     /* First frame to iterate through */
+  u32 iLast,                      /* Last frame to iterate through */
+  WalIterator **pp                /* OUT: New iterator */
+){
   WalIterator *p;                 /* Return value */
+  int iSegment0;                  /* Index of first segment to merge */
   int nSegment;                   /* Number of segments to merge */
-  u32 iLast;                      /* Last frame in log */
+  u32 iBase;                      /* Frames before first merged segment */
   int nByte;                      /* Number of bytes to allocate */
   int i;                          /* Iterator variable */
   ht_slot *aTmp;                  /* Temp space used by merge-sort */
@@ -1431,14 +2474,16 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
   /* This routine only runs while holding the checkpoint lock. And
   ** it only runs if there is actually content in the log (mxFrame>0).
   */
-  assert( pWal->ckptLock && pWal->hdr.mxFrame>0 );
-  iLast = pWal->hdr.mxFrame;
+  assert( pWal->ckptLock && iLast>0 );
+  assert( iFirst>0 && iFirst<=iLast );
 
   /* Allocate space for the WalIterator object. */
-  nSegment = walFramePage(iLast) + 1;
+  iSegment0 = walFramePage(iFirst);
+  nSegment = walFramePage(iLast) + 1 - iSegment0;
+  iBase = iSegment0 ? HASHTABLE_NPAGE_ONE+(iSegment0-1)*HASHTABLE_NPAGE : 0;
   nByte = sizeof(WalIterator) 
         + (nSegment-1)*sizeof(struct WalSegment)
-        + iLast*sizeof(ht_slot);
+        + (iLast-iBase)*sizeof(ht_slot);
   p = (WalIterator *)sqlite3ScratchMalloc(nByte);
   if( !p ){
     return SQLITE_NOMEM;
@@ -1449,8 +2494,8 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
   /* Allocate temporary space used by the merge-sort routine. This block
   ** of memory will be freed before this function returns.
   */
-  aTmp = (ht_slot *)sqlite3ScratchMalloc(
-      sizeof(ht_slot) * (iLast>HASHTABLE_NPAGE?HASHTABLE_NPAGE:iLast)
+  aTmp = (ht_slot *)sqlite3ScratchMalloc(sizeof(ht_slot) *
+      (iLast-iBase>HASHTABLE_NPAGE ? HASHTABLE_NPAGE : iLast-iBase)
   );
   if( !aTmp ){
     rc = SQLITE_NOMEM;
@@ -1461,7 +2506,8 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
     u32 iZero;
     volatile u32 *aPgno;
 
-    rc = walHashGet(pWal, i, &aHash, &aPgno, &iZero);
+    rc = walHashGet(pWal, walIndexPageOf(pWal, iWal, iSegment0+i),
+                    &aHash, &aPgno, &iZero);
     if( rc==SQLITE_OK ){
       int j;                      /* Counter variable */
       int nEntry;                 /* Number of entries in this segment */
@@ -1473,7 +2519,8 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
       }else{
         nEntry = (int)((u32*)aHash - (u32*)aPgno);
       }
-      aIndex = &((ht_slot *)&p->aSegment[p->nSegment])[iZero];
+      assert( iZero>=iBase );
+      aIndex = &((ht_slot *)&p->aSegment[p->nSegment])[iZero-iBase];
       iZero++;
   
       for(j=0; j<nEntry; j++){
@@ -1486,13 +2533,173 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
       p->aSegment[i].aPgno = (u32 *)aPgno;
     }
   }
-  sqlite3ScratchFree(aTmp);
+  sqlite3ScratchFree(aTmp);
+
+  if( rc!=SQLITE_OK ){
+    walIteratorFree(p);
+  }
+  *pp = p;
+  return rc;
+}
+
+/*
+** Free the incremental checkpoint state of connection pWal, if any.
+*/
+static void walCkptFree(Wal *pWal){
+  sqlite3_free(pWal->pCkpt);
+  pWal->pCkpt = 0;
+}
+
+/*
+** Make sure pWal->pCkpt holds incremental checkpoint state for the frames
+** of WAL file iWal after the first nBackfill, which are already in the
+** database file.  iLast is the last frame of the file.
+**
+** State left by the previous call is used if it was created for the same
+** WAL content and some frames it lists remain to be copied.  Otherwise
+** new state is created for frames nBackfill+1 to iLast.  Only the hash
+** tables holding those frames need to be merged to find the last frame
+** for each page, and the results are then put into frame order.
+**
+** Return SQLITE_OK if successful, or an error code otherwise.
+*/
+static int walCkptInit(Wal *pWal, int iWal, u32 nBackfill, u32 iLast){
+  WalCkpt *p = pWal->pCkpt;       /* Incremental checkpoint state */
+  WalIterator *pIter = 0;         /* Iterator used to find frames */
+  u32 *aPgno;                     /* Page for each frame, or zero */
+  u32 iFrame;                     /* Frame number */
+  u32 iPg;                        /* Database page number */
+  int nFrame = 0;                 /* Number of frames to copy */
+  int i;                          /* Loop counter */
+  int rc;                         /* Return code */
+
+  assert( nBackfill<iLast );
+  if( p && (p->iWal!=iWal || p->iLast>iLast
+         || memcmp(p->aSalt, pWal->hdr.aSalt, sizeof(p->aSalt)))
+  ){
+    walCkptFree(pWal);
+    p = 0;
+  }
+  if( p ){
+    /* Skip any frames backfilled by other connections. */
+    while( p->iNext<p->nFrame && p->aFrame[p->iNext]<=nBackfill ) p->iNext++;
+    if( p->iNext<p->nFrame || p->iLast==iLast ) return SQLITE_OK;
+    walCkptFree(pWal);
+  }
+
+  rc = walIteratorInit(pWal, iWal, nBackfill+1, iLast, &pIter);
+  if( rc!=SQLITE_OK ) return rc;
+  aPgno = (u32 *)sqlite3MallocZero((iLast-nBackfill)*sizeof(u32));
+  if( !aPgno ){
+    walIteratorFree(pIter);
+    return SQLITE_NOMEM;
+  }
+  while( 0==walIteratorNext(pIter, &iPg, &iFrame) ){
+    if( iFrame>nBackfill ){
+      aPgno[iFrame-nBackfill-1] = iPg;
+      nFrame++;
+    }
+  }
+  walIteratorFree(pIter);
+
+  p = (WalCkpt *)sqlite3Malloc(sizeof(WalCkpt) + 2*nFrame*sizeof(u32));
+  if( p ){
+    p->iWal = iWal;
+    memcpy(p->aSalt, pWal->hdr.aSalt, sizeof(p->aSalt));
+    p->iLast = iLast;
+    p->nFrame = nFrame;
+    p->iNext = 0;
+    p->aFrame = (u32 *)&p[1];
+    p->aPgno = &p->aFrame[nFrame];
+    for(i=0, iFrame=nBackfill+1; iFrame<=iLast; iFrame++){
+      if( aPgno[iFrame-nBackfill-1] ){
+        p->aFrame[i] = iFrame;
+        p->aPgno[i] = aPgno[iFrame-nBackfill-1];
+        i++;
+      }
+    }
+    assert( i==nFrame );
+    pWal->pCkpt = p;
+  }else{
+    rc = SQLITE_NOMEM;
+  }
+  sqlite3_free(aPgno);
+  return rc;
+}
+
+/*
+** The maximum number of frames copied by a checkpoint in one batch.
+*/
+#define WAL_CKPT_BATCH 32
+
+/*
+** Sort the nFrame entries of aPgno[] into ascending order, moving the
+** corresponding entries of aFrame[] with them.  nFrame is small.
+*/
+static void walSortBatch(u32 *aFrame, u32 *aPgno, int nFrame){
+  int i, j;
+  for(i=1; i<nFrame; i++){
+    u32 iPg = aPgno[i];
+    u32 iFrame = aFrame[i];
+    for(j=i; j>0 && aPgno[j-1]>iPg; j--){
+      aPgno[j] = aPgno[j-1];
+      aFrame[j] = aFrame[j-1];
+    }
+    aPgno[j] = iPg;
+    aFrame[j] = iFrame;
+  }
+}
 
-  if( rc!=SQLITE_OK ){
-    walIteratorFree(p);
+/*
+** Copy the nFrame frames listed in aFrame[] from WAL file iWal into the
+** database file.  Frame aFrame[i] holds the content of database page
+** aPgno[i].  The
+** page numbers are in increasing order.  aBuf[] has room for nFrame pages
+** of szPage bytes each.
+**
+** All the frames are read with a single call to sqlite3OsSubmit(), so that
+** the VFS may read them concurrently.  The pages are then written by a
+** second batch.  Each run of consecutive page numbers lies contiguously in
+** aBuf[], so it is written by a single request.
+*/
+static int walCopyBatch(
+  Wal *pWal,                      /* WAL connection */
+  int iWal,                       /* WAL file to copy frames from */
+  u8 *aBuf,                       /* Buffer for nFrame pages */
+  u32 *aFrame,                    /* Frames to copy */
+  u32 *aPgno,                     /* Database page held by each frame */
+  int nFrame,                     /* Number of frames to copy */
+  int szPage                      /* Database page size */
+){
+  sqlite3_io_request aReq[WAL_CKPT_BATCH];
+  int nReq = 0;                   /* Number of write requests */
+  int rc;
+  int i;
+
+  assert( nFrame>0 && nFrame<=WAL_CKPT_BATCH );
+  for(i=0; i<nFrame; i++){
+    aReq[i].op = SQLITE_IOREQ_READ;
+    aReq[i].iAmt = szPage;
+    aReq[i].iOfst = walFrameOffset(aFrame[i], szPage) + WAL_FRAME_HDRSIZE;
+    /* testcase( IS_BIG_INT(aReq[i].iOfst) ); // requires a 4GiB WAL file */
+    aReq[i].pBuf = &aBuf[i*szPage];
   }
-  *pp = p;
-  return rc;
+  rc = sqlite3OsSubmit(walFd(pWal, iWal), aReq, nFrame);
+  if( rc!=SQLITE_OK ) return rc;
+
+  for(i=0; i<nFrame; i++){
+    if( i>0 && aPgno[i]==aPgno[i-1]+1 ){
+      aReq[nReq-1].iAmt += szPage;
+    }else{
+      aReq[nReq].op = SQLITE_IOREQ_WRITE;
+      aReq[nReq].iAmt = szPage;
+      aReq[nReq].iOfst = (aPgno[i]-1)*(i64)szPage;
+      testcase( IS_BIG_INT(aReq[nReq].iOfst) );
+      aReq[nReq].pBuf = &aBuf[i*szPage];
+      nReq++;
+    }
+  }
+  return sqlite3OsSubmit(pWal->pDbFd, aReq, nReq);
 }
 
 /*
@@ -1522,37 +2729,90 @@ static int walIteratorInit(Wal *pWal, WalIterator **pp){
 ** (A WAL reset or recovery will revert nBackfill to zero, but not increase
 ** its value.)
 **
+** If nPage or nMs is greater than zero, the checkpoint is incremental.
+** It copies at most nPage pages, and stops after the first batch that
+** ends more than nMs milliseconds after it started.  Instead of visiting
+** pages in page order, it copies the last frame for each page in the
+** order the frames were written, using and updating the state saved in
+** pWal->pCkpt by the previous call, and advances nBackfill after each
+** batch.  Frames not reached are left for a later checkpoint, exactly as
+** if an active reader were preventing them from being backfilled.  So a
+** checkpoint can be run in short slices with the WAL locks released in
+** between.
+**
+** In wal2 mode, iWal is normally the WAL file that is not current, and
+** nBackfill refers to that file.  The WAL_READ_LOCK(WAL2_LOCK_PART(iWal))
+** lock is held while frames are copied, and once all frames of the file
+** have been copied the database is synced but not truncated, as readers
+** of older snapshots may still need pages beyond the end of the current
+** database image.  The current file is only checkpointed by
+** sqlite3WalClose(), when there are no other connections.  That starts
+** from the first frame and does not update nBackfill.
+**
 ** The caller must be holding sufficient locks to ensure that no other
 ** checkpoint is running (in any other thread or process) at the same
 ** time.
 */
 static int walCheckpoint(
   Wal *pWal,                      /* Wal connection */
+  int iWal,                       /* WAL file to checkpoint */
   int sync_flags,                 /* Flags for OsSync() (or 0) */
   int nBuf,                       /* Size of zBuf in bytes */
-  u8 *zBuf                        /* Temporary buffer to use */
+  u8 *zBuf,                       /* Temporary buffer to use */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs                         /* Max time to spend in ms, or 0 */
 ){
   int rc;                         /* Return code */
   int szPage;                     /* Database page-size */
   WalIterator *pIter = 0;         /* Wal iterator context */
+  WalCkpt *pCkpt = 0;             /* Incremental checkpoint state */
   u32 iDbpage = 0;                /* Next database page to write */
   u32 iFrame = 0;                 /* Wal frame containing data for iDbpage */
   u32 mxSafeFrame;                /* Max frame that can be backfilled */
   u32 mxPage;                     /* Max database page to write */
   int i;                          /* Loop counter */
   volatile WalCkptInfo *pInfo;    /* The checkpoint status information */
+  u8 *aBatch = 0;                 /* Buffer for a batch of pages to copy */
+  int nBatch = 0;                 /* Number of frames in the batch */
+  int nBatchMax = 1;              /* Capacity of batch buffer in pages */
+  u32 aFrame[WAL_CKPT_BATCH];     /* Frames in the batch */
+  u32 aPgno[WAL_CKPT_BATCH];      /* Database page of each frame in batch */
+  u32 iLast;                      /* Last frame of WAL file iWal */
+  int bCur;                       /* True if iWal is the current file */
+  int iLock;                      /* Lock held while backfilling */
+  u32 nBackfill;                  /* Frames of iWal already backfilled */
+  u32 iBackfill;                  /* Frames of iWal backfilled when done */
 
   szPage = (pWal->hdr.szPage&0xfe00) + ((pWal->hdr.szPage&0x0001)<<16);
   testcase( szPage<=32768 );
   testcase( szPage>=65536 );
-  if( pWal->hdr.mxFrame==0 ) return SQLITE_OK;
-
-  /* Allocate the iterator */
-  rc = walIteratorInit(pWal, &pIter);
-  if( rc!=SQLITE_OK ){
-    return rc;
+  iLast = walidxGetMxFrame(&pWal->hdr, iWal);
+  if( iLast==0 ) return SQLITE_OK;
+  bCur = (iWal==walidxGetFile(&pWal->hdr));
+  assert( bCur || pWal->bWal2 );
+  assert( !bCur || !pWal->bWal2 || pWal->exclusiveMode );
+  pInfo = walCkptInfo(pWal);
+  nBackfill = (pWal->bWal2 && bCur) ? 0 : pInfo->nBackfill;
+
+  /* Allocate the iterator, or find the incremental checkpoint state. An
+  ** incremental checkpoint does not go past the last frame the state
+  ** was created for. */
+  if( nPage>0 || nMs>0 ){
+    assert( !pWal->bWal2 || !bCur );
+    if( nBackfill>=iLast ) return SQLITE_OK;
+    rc = walCkptInit(pWal, iWal, nBackfill, iLast);
+    if( rc!=SQLITE_OK ){
+      return rc;
+    }
+    pCkpt = pWal->pCkpt;
+    iLast = pCkpt->iLast;
+  }else{
+    rc = walIteratorInit(pWal, iWal, 1, iLast, &pIter);
+    if( rc!=SQLITE_OK ){
+      return rc;
+    }
+    assert( pIter );
   }
-  assert( pIter );
 
   /*** TODO:  Move this test out to the caller.  Make it an assert() here ***/
   if( szPage!=nBuf ){
@@ -1565,16 +2825,15 @@ static int walCheckpoint(
   ** overwrite database pages that are in use by active readers and thus
   ** cannot be backfilled from the WAL.
   */
-  mxSafeFrame = pWal->hdr.mxFrame;
+  mxSafeFrame = iLast;
   mxPage = pWal->hdr.nPage;
-  pInfo = walCkptInfo(pWal);
-  for(i=1; i<WAL_NREADER; i++){
-    u32 y = pInfo->aReadMark[i];
+  for(i=1; i<pWal->nReader && !pWal->bWal2; i++){
+    u32 y = *walReadMark(pWal, i);
     if( mxSafeFrame>=y ){
       assert( y<=pWal->hdr.mxFrame );
       rc = walLockExclusive(pWal, WAL_READ_LOCK(i), 1);
       if( rc==SQLITE_OK ){
-        pInfo->aReadMark[i] = READMARK_NOT_USED;
+        *walReadMark(pWal, i) = READMARK_NOT_USED;
         walUnlockExclusive(pWal, WAL_READ_LOCK(i), 1);
       }else if( rc==SQLITE_BUSY ){
         mxSafeFrame = y;
@@ -1584,15 +2843,15 @@ static int walCheckpoint(
     }
   }
 
-  if( pInfo->nBackfill<mxSafeFrame
-   && (rc = walLockExclusive(pWal, WAL_READ_LOCK(0), 1))==SQLITE_OK
+  iLock = WAL_READ_LOCK(pWal->bWal2 ? WAL2_LOCK_PART(iWal) : 0);
+  if( nBackfill<mxSafeFrame
+   && (rc = walLockExclusive(pWal, iLock, 1))==SQLITE_OK
   ){
     i64 nSize;                    /* Current size of database file */
-    u32 nBackfill = pInfo->nBackfill;
 
     /* Sync the WAL to disk */
     if( sync_flags ){
-      rc = sqlite3OsSync(pWal->pWalFd, sync_flags);
+      rc = sqlite3OsSync(walFd(pWal, iWal), sync_flags);
     }
 
     /* If the database file may grow as a result of this checkpoint, hint
@@ -1606,24 +2865,99 @@ static int walCheckpoint(
       }
     }
 
-    /* Iterate through the contents of the WAL, copying data to the db file. */
-    while( rc==SQLITE_OK && 0==walIteratorNext(pIter, &iDbpage, &iFrame) ){
-      i64 iOffset;
-      assert( walFramePgno(pWal, iFrame)==iDbpage );
+    /* Try to allocate a buffer large enough for WAL_CKPT_BATCH pages. If
+    ** this fails, use zBuf and write one page at a time. */
+    if( rc==SQLITE_OK ){
+      sqlite3BeginBenignMalloc();
+      aBatch = (u8 *)sqlite3Malloc(WAL_CKPT_BATCH*szPage);
+      sqlite3EndBenignMalloc();
+      nBatchMax = aBatch ? WAL_CKPT_BATCH : 1;
+    }
+
+    /* Iterate through the contents of the WAL, copying data to the db file.
+    ** Frames are copied in batches of up to nBatchMax by walCopyBatch(). */
+    iBackfill = mxSafeFrame;
+    while( pIter && rc==SQLITE_OK
+        && 0==walIteratorNext(pIter, &iDbpage, &iFrame)
+    ){
+      assert( walFramePgno(pWal, iWal, iFrame)==iDbpage );
       if( iFrame<=nBackfill || iFrame>mxSafeFrame || iDbpage>mxPage ) continue;
-      iOffset = walFrameOffset(iFrame, szPage) + WAL_FRAME_HDRSIZE;
-      /* testcase( IS_BIG_INT(iOffset) ); // requires a 4GiB WAL file */
-      rc = sqlite3OsRead(pWal->pWalFd, zBuf, szPage, iOffset);
-      if( rc!=SQLITE_OK ) break;
-      iOffset = (iDbpage-1)*(i64)szPage;
-      testcase( IS_BIG_INT(iOffset) );
-      rc = sqlite3OsWrite(pWal->pDbFd, zBuf, szPage, iOffset);
-      if( rc!=SQLITE_OK ) break;
+      aFrame[nBatch] = iFrame;
+      aPgno[nBatch] = iDbpage;
+      if( ++nBatch==nBatchMax ){
+        rc = walCopyBatch(pWal, iWal, aBatch ? aBatch : zBuf, aFrame, aPgno,
+                          nBatch, szPage);
+        nBatch = 0;
+      }
+    }
+    if( rc==SQLITE_OK && nBatch>0 ){
+      rc = walCopyBatch(pWal, iWal, aBatch ? aBatch : zBuf, aFrame, aPgno,
+                        nBatch, szPage);
+    }
+
+    /* For an incremental checkpoint, copy the frames listed in pCkpt
+    ** instead, in frame order, until the budget is used up.  Once a batch
+    ** has been copied, every frame before the next one listed has been
+    ** backfilled, and nBackfill is advanced to match. */
+    if( pCkpt && rc==SQLITE_OK ){
+      int nCopy = 0;              /* Pages copied so far */
+      sqlite3_int64 iEnd = 0;     /* Time to stop, if nMs>0 */
+      sqlite3_int64 iNow = 0;     /* Current time */
+      if( nMs>0 ){
+        rc = sqlite3OsCurrentTimeInt64(pWal->pVfs, &iEnd);
+        iEnd += nMs;
+      }
+      iBackfill = nBackfill;
+      while( rc==SQLITE_OK && iBackfill<mxSafeFrame ){
+        nBatch = 0;
+        while( nBatch<nBatchMax && pCkpt->iNext<pCkpt->nFrame
+            && (nPage<=0 || nCopy+nBatch<nPage)
+            && pCkpt->aFrame[pCkpt->iNext]<=mxSafeFrame
+        ){
+          iFrame = pCkpt->aFrame[pCkpt->iNext];
+          iDbpage = pCkpt->aPgno[pCkpt->iNext];
+          pCkpt->iNext++;
+          assert( walFramePgno(pWal, iWal, iFrame)==iDbpage );
+          if( iDbpage>mxPage ) continue;
+          aFrame[nBatch] = iFrame;
+          aPgno[nBatch] = iDbpage;
+          nBatch++;
+        }
+        if( nBatch>0 ){
+          walSortBatch(aFrame, aPgno, nBatch);
+          rc = walCopyBatch(pWal, iWal, aBatch ? aBatch : zBuf, aFrame, aPgno,
+                            nBatch, szPage);
+          nCopy += nBatch;
+        }
+        if( rc==SQLITE_OK ){
+          if( pCkpt->iNext<pCkpt->nFrame ){
+            iBackfill = pCkpt->aFrame[pCkpt->iNext] - 1;
+          }else{
+            iBackfill = iLast;
+          }
+          if( iBackfill>mxSafeFrame ) iBackfill = mxSafeFrame;
+          if( iBackfill<mxSafeFrame ){
+            assert( iBackfill>=pInfo->nBackfill );
+            pInfo->nBackfill = iBackfill;
+            if( (nPage>0 && nCopy>=nPage)
+             || (nMs>0 && sqlite3OsCurrentTimeInt64(pWal->pVfs, &iNow)==SQLITE_OK
+                       && iNow>=iEnd)
+            ){
+              break;
+            }
+          }
+        }
+      }
     }
+    sqlite3_free(aBatch);
 
     /* If work was actually accomplished... */
     if( rc==SQLITE_OK ){
-      if( mxSafeFrame==walIndexHdr(pWal)->mxFrame ){
+      if( !bCur ){
+        if( iBackfill==iLast && sync_flags ){
+          rc = sqlite3OsSync(pWal->pDbFd, sync_flags);
+        }
+      }else if( iBackfill==walIndexHdr(pWal)->mxFrame ){
         i64 szDb = pWal->hdr.nPage*(i64)szPage;
         testcase( IS_BIG_INT(szDb) );
         rc = sqlite3OsTruncate(pWal->pDbFd, szDb);
@@ -1631,13 +2965,13 @@ static int walCheckpoint(
           rc = sqlite3OsSync(pWal->pDbFd, sync_flags);
         }
       }
-      if( rc==SQLITE_OK ){
-        pInfo->nBackfill = mxSafeFrame;
+      if( rc==SQLITE_OK && !(pWal->bWal2 && bCur) ){
+        pInfo->nBackfill = iBackfill;
       }
     }
 
     /* Release the reader lock held while backfilling */
-    walUnlockExclusive(pWal, WAL_READ_LOCK(0), 1);
+    walUnlockExclusive(pWal, iLock, 1);
   }else if( rc==SQLITE_BUSY ){
     /* Reset the return code so as not to report a checkpoint failure
     ** just because active readers prevent any backfill.
@@ -1647,9 +2981,14 @@ static int walCheckpoint(
 
  walcheckpoint_out:
   walIteratorFree(pIter);
+  if( pCkpt && (rc!=SQLITE_OK || pCkpt->iNext>=pCkpt->nFrame) ){
+    walCkptFree(pWal);
+  }
   return rc;
 }
 
+static int walIndexReadHdr(Wal *pWal, int *pChanged);
+
 /*
 ** Close a connection to a log file.
 */
@@ -1674,7 +3013,21 @@ int sqlite3WalClose(
     rc = sqlite3OsLock(pWal->pDbFd, SQLITE_LOCK_EXCLUSIVE);
     if( rc==SQLITE_OK ){
       pWal->exclusiveMode = 1;
-      rc = sqlite3WalCheckpoint(pWal, sync_flags, nBuf, zBuf);
+      rc = sqlite3WalCheckpoint(pWal, sync_flags, nBuf, zBuf, 0, 0, 0, 0);
+
+      /* In wal2 mode, sqlite3WalCheckpoint() only copies the frames of
+      ** the file that is not current.  Copy those of the current file
+      ** too, now that there is no other connection to read them.  */
+      if( rc==SQLITE_OK && pWal->bWal2 ){
+        int isChanged = 0;
+        pWal->ckptLock = 1;
+        rc = walIndexReadHdr(pWal, &isChanged);
+        if( rc==SQLITE_OK ){
+          rc = walCheckpoint(pWal, walidxGetFile(&pWal->hdr), sync_flags,
+                             nBuf, zBuf, 0, 0);
+        }
+        pWal->ckptLock = 0;
+      }
       if( rc==SQLITE_OK ){
         isDelete = 1;
       }
@@ -1682,10 +3035,15 @@ int sqlite3WalClose(
 
     walIndexClose(pWal, isDelete);
     sqlite3OsClose(pWal->pWalFd);
+    sqlite3OsClose(pWal->pWalFd2);
     if( isDelete ){
       sqlite3OsDelete(pWal->pVfs, pWal->zWalName, 0);
+      if( pWal->bWal2 ){
+        sqlite3OsDelete(pWal->pVfs, pWal->zWal2Name, 0);
+      }
     }
     WALTRACE(("WAL%p: closed\n", pWal));
+    walCkptFree(pWal);
     sqlite3_free((void *)pWal->apWiData);
     sqlite3_free(pWal);
   }
@@ -1818,6 +3176,19 @@ static int walIndexReadHdr(Wal *pWal, int *pChanged){
     rc = SQLITE_CANTOPEN_BKPT;
   }
 
+  /* Use the read marks beyond WAL_NREADER_MIN only if the connection
+  ** that built the wal-index did.  If it did, this connection must be
+  ** able to take the corresponding locks.
+  */
+  if( rc==SQLITE_OK ){
+    if( walReaderInfo(pWal)->eLock==WAL_LOCK_EXTENDED ){
+      if( !pWal->bExtLock ) rc = SQLITE_CANTOPEN_BKPT;
+      pWal->nReader = WAL_NREADER;
+    }else{
+      pWal->nReader = WAL_NREADER_MIN;
+    }
+  }
+
   return rc;
 }
 
@@ -1858,7 +3229,7 @@ static int walIndexReadHdr(Wal *pWal, int *pChanged){
 **
 ** On success, this routine obtains a read lock on 
 ** WAL_READ_LOCK(pWal->readLock).  The pWal->readLock integer is
-** in the range 0 <= pWal->readLock < WAL_NREADER.  If pWal->readLock==(-1)
+** in the range 0 <= pWal->readLock < pWal->nReader.  If pWal->readLock==(-1)
 ** that means the Wal does not hold any read lock.  The reader must not
 ** access any database page that is modified by a WAL frame up to and
 ** including frame number aReadMark[pWal->readLock].  The reader will
@@ -1925,6 +3296,32 @@ static int walTryBeginRead(Wal *pWal, int *pChanged, int useWal, int cnt){
   }
 
   pInfo = walCkptInfo(pWal);
+  if( pWal->bWal2 ){
+    /* In wal2 mode, take WAL2_LOCK_PART() on the current file if all
+    ** frames of the other file have been checkpointed, or WAL2_LOCK_FULL()
+    ** otherwise.  Then check that the header has not changed, as for
+    ** aReadMark[] below.  A writer switching files, or a checkpointer
+    ** backfilling frames this reader needs, holds an exclusive lock on
+    ** the slot.  */
+    int iWal = walidxGetFile(&pWal->hdr);
+    int iSlot;
+    if( pInfo->nBackfill==walidxGetMxFrame(&pWal->hdr, !iWal) ){
+      iSlot = WAL2_LOCK_PART(iWal);
+    }else{
+      iSlot = WAL2_LOCK_FULL(iWal);
+    }
+    rc = walLockShared(pWal, WAL_READ_LOCK(iSlot));
+    if( rc ){
+      return rc==SQLITE_BUSY ? WAL_RETRY : rc;
+    }
+    sqlite3OsShmBarrier(pWal->pDbFd);
+    if( memcmp((void *)walIndexHdr(pWal), &pWal->hdr, sizeof(WalIndexHdr)) ){
+      walUnlockShared(pWal, WAL_READ_LOCK(iSlot));
+      return WAL_RETRY;
+    }
+    pWal->readLock = (i16)iSlot;
+    return SQLITE_OK;
+  }
   if( !useWal && pInfo->nBackfill==pWal->hdr.mxFrame ){
     /* The WAL has been completely backfilled (or it is empty).
     ** and can be safely ignored.
@@ -1963,8 +3360,8 @@ static int walTryBeginRead(Wal *pWal, int *pChanged, int useWal, int cnt){
   */
   mxReadMark = 0;
   mxI = 0;
-  for(i=1; i<WAL_NREADER; i++){
-    u32 thisMark = pInfo->aReadMark[i];
+  for(i=1; i<pWal->nReader; i++){
+    u32 thisMark = *walReadMark(pWal, i);
     if( mxReadMark<=thisMark && thisMark<=pWal->hdr.mxFrame ){
       assert( thisMark!=READMARK_NOT_USED );
       mxReadMark = thisMark;
@@ -1973,7 +3370,7 @@ static int walTryBeginRead(Wal *pWal, int *pChanged, int useWal, int cnt){
   }
   if( mxI==0 ){
     /* If we get here, it means that all of the aReadMark[] entries between
-    ** 1 and WAL_NREADER-1 are zero.  Try to initialize aReadMark[1] to
+    ** 1 and pWal->nReader-1 are zero.  Try to initialize aReadMark[1] to
     ** be mxFrame, then retry.
     */
     rc = walLockExclusive(pWal, WAL_READ_LOCK(1), 1);
@@ -1987,10 +3384,10 @@ static int walTryBeginRead(Wal *pWal, int *pChanged, int useWal, int cnt){
     return rc;
   }else{
     if( mxReadMark < pWal->hdr.mxFrame ){
-      for(i=1; i<WAL_NREADER; i++){
+      for(i=1; i<pWal->nReader; i++){
         rc = walLockExclusive(pWal, WAL_READ_LOCK(i), 1);
         if( rc==SQLITE_OK ){
-          mxReadMark = pInfo->aReadMark[i] = pWal->hdr.mxFrame;
+          mxReadMark = *walReadMark(pWal, i) = pWal->hdr.mxFrame;
           mxI = i;
           walUnlockExclusive(pWal, WAL_READ_LOCK(i), 1);
           break;
@@ -2025,7 +3422,7 @@ static int walTryBeginRead(Wal *pWal, int *pChanged, int useWal, int cnt){
     ** WAL_READ_LOCK(mxI)) has not occurred since the snapshot was valid.
     */
     sqlite3OsShmBarrier(pWal->pDbFd);
-    if( pInfo->aReadMark[mxI]!=mxReadMark
+    if( *walReadMark(pWal, mxI)!=mxReadMark
      || memcmp((void *)walIndexHdr(pWal), &pWal->hdr, sizeof(WalIndexHdr))
     ){
       walUnlockShared(pWal, WAL_READ_LOCK(mxI));
@@ -2075,41 +3472,38 @@ void sqlite3WalEndReadTransaction(Wal *pWal){
 }
 
 /*
-** Read a page from the WAL, if it is present in the WAL and if the 
-** current read transaction is configured to use the WAL.  
+** Search frames 1 to iLast of WAL file iWal for page pgno.  If found, set
+** *piRead to the last frame that contains the page.  Otherwise, set
+** *piRead to zero.
 **
-** The *pInWal is set to 1 if the requested page is in the WAL and
-** has been loaded.  Or *pInWal is set to 0 if the page was not in 
-** the WAL and needs to be read out of the database.
+** Return SQLITE_OK if successful, or an error code if an error occurs. If an
+** error does occur, the final value of *piRead is undefined.
 */
-int sqlite3WalRead(
+static int walSearchFile(
   Wal *pWal,                      /* WAL handle */
+  int iWal,                       /* WAL file to search */
+  u32 iLast,                      /* Last frame of iWal used by this reader */
   Pgno pgno,                      /* Database page number to read data for */
-  int *pInWal,                    /* OUT: True if data is read from WAL */
-  int nOut,                       /* Size of buffer pOut in bytes */
-  u8 *pOut                        /* Buffer to write page data to */
+  u32 *piRead                     /* OUT: Frame number (or zero) */
 ){
   u32 iRead = 0;                  /* If !=0, WAL frame to return data from */
-  u32 iLast = pWal->hdr.mxFrame;  /* Last page in WAL for this reader */
   int iHash;                      /* Used to loop through N hash tables */
 
-  /* This routine is only be called from within a read transaction. */
-  assert( pWal->readLock>=0 || pWal->lockError );
-
   /* If the "last page" field of the wal-index header snapshot is 0, then
   ** no data will be read from the wal under any circumstances. Return early
-  ** in this case as an optimization.  Likewise, if pWal->readLock==0, 
-  ** then the WAL is ignored by the reader so return early, as if the 
-  ** WAL were empty.
+  ** in this case as an optimization.
   */
-  if( iLast==0 || pWal->readLock==0 ){
-    *pInWal = 0;
+  if( iLast==0 ){
+    *piRead = 0;
     return SQLITE_OK;
   }
 
   /* Search the hash table or tables for an entry matching page number
   ** pgno. Each iteration of the following for() loop searches one
-  ** hash table (each hash table indexes up to HASHTABLE_NPAGE frames).
+  ** hash table (each hash table indexes up to HASHTABLE_NPAGE frames),
+  ** unless the Bloom filter of its index block shows that pgno is not
+  ** there.  As with the hash table, bits of the filter set after the
+  ** read transaction was opened can only cause an unnecessary search.
   **
   ** This code might run concurrently to the code in walIndexAppend()
   ** that adds entries to the wal-index (and possibly to this hash 
@@ -2136,11 +3530,20 @@ int sqlite3WalRead(
     volatile ht_slot *aHash;      /* Pointer to hash table */
     volatile u32 *aPgno;          /* Pointer to array of page numbers */
     u32 iZero;                    /* Frame number corresponding to aPgno[0] */
+    volatile u32 *aBloom;         /* Bloom filter for this index block */
     int iKey;                     /* Hash slot index */
     int nCollide;                 /* Number of hash collisions remaining */
     int rc;                       /* Error code */
 
-    rc = walHashGet(pWal, iHash, &aHash, &aPgno, &iZero);
+    rc = walBloomGet(pWal, walIndexPageOf(pWal, iWal, iHash), &aBloom);
+    if( rc!=SQLITE_OK ){
+      return rc;
+    }
+    if( !walBloomTest(aBloom, pgno) ) continue;
+    WAL_INCR(sqlite3_wal_search_count);
+
+    rc = walHashGet(pWal, walIndexPageOf(pWal, iWal, iHash),
+                    &aHash, &aPgno, &iZero);
     if( rc!=SQLITE_OK ){
       return rc;
     }
@@ -2165,7 +3568,7 @@ int sqlite3WalRead(
     u32 iRead2 = 0;
     u32 iTest;
     for(iTest=iLast; iTest>0; iTest--){
-      if( walFramePgno(pWal, iTest)==pgno ){
+      if( walFramePgno(pWal, iWal, iTest)==pgno ){
         iRead2 = iTest;
         break;
       }
@@ -2174,24 +3577,78 @@ int sqlite3WalRead(
   }
 #endif
 
-  /* If iRead is non-zero, then it is the log frame number that contains the
-  ** required page. Read and return data from the log file.
-  */
-  if( iRead ){
-    int sz;
-    i64 iOffset;
-    sz = pWal->hdr.szPage;
-    sz = (pWal->hdr.szPage&0xfe00) + ((pWal->hdr.szPage&0x0001)<<16);
-    testcase( sz<=32768 );
-    testcase( sz>=65536 );
-    iOffset = walFrameOffset(iRead, sz) + WAL_FRAME_HDRSIZE;
-    *pInWal = 1;
-    /* testcase( IS_BIG_INT(iOffset) ); // requires a 4GiB WAL */
-    return sqlite3OsRead(pWal->pWalFd, pOut, nOut, iOffset);
+  *piRead = iRead;
+  return SQLITE_OK;
+}
+
+/*
+** Search the wal file for page pgno. If found, set *piRead to the frame that
+** contains the page. Otherwise, if pgno is not in the wal file, set *piRead
+** to zero.
+**
+** In wal2 mode, the current WAL file is searched first.  If the page is
+** not found there and the reader holds WAL2_LOCK_FULL(), the other WAL
+** file is searched too.  The value written to *piRead then has the number
+** of the WAL file the frame belongs to in its most significant bit.  It
+** should only be passed to sqlite3WalReadFrame().
+**
+** Return SQLITE_OK if successful, or an error code if an error occurs. If an
+** error does occur, the final value of *piRead is undefined.
+*/
+int sqlite3WalFindFrame(
+  Wal *pWal,                      /* WAL handle */
+  Pgno pgno,                      /* Database page number to read data for */
+  u32 *piRead                     /* OUT: Frame number (or zero) */
+){
+  int rc;                         /* Return code */
+  int iWal;                       /* Current WAL file */
+
+  /* This routine is only be called from within a read transaction. */
+  assert( pWal->readLock>=0 || pWal->lockError );
+
+  if( !pWal->bWal2 ){
+    /* If pWal->readLock==0, then the WAL is ignored by the reader so
+    ** return early, as if the WAL were empty.  */
+    if( pWal->readLock==0 ){
+      *piRead = 0;
+      return SQLITE_OK;
+    }
+    return walSearchFile(pWal, 0, pWal->hdr.mxFrame, pgno, piRead);
   }
 
-  *pInWal = 0;
-  return SQLITE_OK;
+  iWal = walidxGetFile(&pWal->hdr);
+  rc = walSearchFile(pWal, iWal, pWal->hdr.mxFrame, pgno, piRead);
+  if( rc==SQLITE_OK && *piRead==0 && pWal->readLock==WAL2_LOCK_FULL(iWal) ){
+    iWal = !iWal;
+    rc = walSearchFile(pWal, iWal, walidxGetMxFrame(&pWal->hdr, iWal),
+                       pgno, piRead);
+  }
+  if( rc==SQLITE_OK && *piRead ){
+    *piRead |= ((u32)iWal)<<31;
+  }
+  return rc;
+}
+
+/*
+** Read the contents of frame iRead from the wal file into buffer pOut
+** (which is nOut bytes in size). Return SQLITE_OK if successful, or an
+** error code otherwise.  iRead is a value returned by sqlite3WalFindFrame().
+*/
+int sqlite3WalReadFrame(
+  Wal *pWal,                      /* WAL handle */
+  u32 iRead,                      /* Frame to read */
+  int nOut,                       /* Size of buffer pOut in bytes */
+  u8 *pOut                        /* Buffer to write page data to */
+){
+  int sz;
+  i64 iOffset;
+  sz = pWal->hdr.szPage;
+  sz = (pWal->hdr.szPage&0xfe00) + ((pWal->hdr.szPage&0x0001)<<16);
+  testcase( sz<=32768 );
+  testcase( sz>=65536 );
+  iOffset = walFrameOffset(iRead & 0x7FFFFFFF, sz) + WAL_FRAME_HDRSIZE;
+  /* testcase( IS_BIG_INT(iOffset) ); // requires a 4GiB WAL */
+  return sqlite3OsRead(walFd(pWal, iRead>>31), pOut, nOut, iOffset);
 }
 
 
@@ -2261,9 +3718,133 @@ int sqlite3WalEndWriteTransaction(Wal *pWal){
     walUnlockExclusive(pWal, WAL_WRITE_LOCK, 1);
     pWal->writeLock = 0;
   }
+  pWal->concurrent = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Start a write transaction opened by BEGIN CONCURRENT.  The WRITER lock
+** is not taken here.  The transaction is built in the page cache on top
+** of the snapshot held by the read transaction, without writing anything
+** to the log, and sqlite3WalLockForCommit() is called when it is time to
+** commit.
+*/
+int sqlite3WalBeginConcurrent(Wal *pWal){
+  assert( pWal->readLock>=0 && pWal->writeLock==0 );
+  if( pWal->readOnly ){
+    return SQLITE_READONLY;
+  }
+  pWal->concurrent = 1;
   return SQLITE_OK;
 }
 
+/*
+** Obtain the WRITER lock for a transaction started by 
+** sqlite3WalBeginConcurrent(), so that it can be committed.
+**
+** If other connections have committed transactions since the snapshot
+** of this connection was taken, the callback is invoked once for each
+** frame they appended to the log, with the page number the frame holds.
+** The callback returns SQLITE_OK if the page was not read by this
+** transaction, or an error code (normally SQLITE_BUSY_SNAPSHOT) if it
+** was.  In the latter case, or if the size of the database has changed,
+** the WRITER lock is released and the error code returned.  The
+** transaction cannot commit and must be rolled back.
+**
+** Otherwise, the read transaction is moved to the current snapshot, so
+** that the new frames are appended after those written by the other
+** connections, and SQLITE_OK is returned with the WRITER lock held.  
+** SQLITE_BUSY is returned if the WRITER lock cannot be obtained.
+*/
+int sqlite3WalLockForCommit(Wal *pWal, int (*xPage)(void*,Pgno), void *pCtx){
+  int rc;
+  WalIndexHdr head;               /* Current wal-index header */
+
+  assert( pWal->concurrent && pWal->readLock>=0 );
+  if( pWal->writeLock ){
+    return SQLITE_OK;
+  }
+
+  rc = walLockExclusive(pWal, WAL_WRITE_LOCK, 1);
+  if( rc ){
+    return rc;
+  }
+  pWal->writeLock = 1;
+
+  /* The wal-index header cannot change while the WRITER lock is held. */
+  memcpy(&head, (void *)walIndexHdr(pWal), sizeof(WalIndexHdr));
+  if( memcmp(&pWal->hdr, &head, sizeof(WalIndexHdr))!=0 ){
+    int iWal = walidxGetFile(&pWal->hdr);   /* WAL file of the snapshot */
+    u32 iFrame;                   /* First frame appended since snapshot */
+    u32 iLast;                    /* Last frame appended to file iWal */
+
+    /* If the log has been restarted since the snapshot was taken (which
+    ** is only possible if this connection is reading the database file
+    ** directly, with read-lock 0), every frame in it is new. Otherwise
+    ** the new frames are those that follow hdr.mxFrame.
+    **
+    ** In wal2 mode, the log cannot be restarted, but a writer may have
+    ** switched to the other file.  In that case the new frames are those
+    ** that follow hdr.mxFrame in the file of the snapshot, and all frames
+    ** of the other file.  There cannot have been a second switch, as
+    ** the file of the snapshot cannot be checkpointed while this
+    ** connection is reading it.  */
+    if( pWal->bWal2 || memcmp(pWal->hdr.aSalt, head.aSalt, 8)==0 ){
+      iFrame = pWal->hdr.mxFrame+1;
+    }else{
+      assert( pWal->readLock==0 );
+      iFrame = 1;
+    }
+    /* A snapshot taken while the log was empty has nPage and szPage set
+    ** to zero.  A change in the database size also modifies page 1, so
+    ** it is still detected below in that case.  */
+    iLast = walidxGetMxFrame(&head, iWal);
+    if( pWal->hdr.szPage!=0
+     && (head.nPage!=pWal->hdr.nPage || head.szPage!=pWal->hdr.szPage)
+    ){
+      rc = SQLITE_BUSY_SNAPSHOT;
+    }
+    while( rc==SQLITE_OK ){
+      volatile ht_slot *aHash;    /* Unused */
+      volatile u32 *aPgno;        /* Page number array for iFrame */
+      u32 iZero;                  /* Frame number of aPgno[0] */
+      if( iFrame>iLast ){
+        if( iWal==walidxGetFile(&head) ) break;
+        iWal = walidxGetFile(&head);
+        iLast = head.mxFrame;
+        iFrame = 1;
+        continue;
+      }
+      rc = walHashGet(pWal, walIndexPageOf(pWal, iWal, walFramePage(iFrame)),
+                      &aHash, &aPgno, &iZero);
+      if( rc==SQLITE_OK ){
+        rc = xPage(pCtx, aPgno[iFrame-iZero]);
+      }
+      iFrame++;
+    }
+
+    /* Move to the current snapshot.  */
+    if( rc==SQLITE_OK ){
+      int cnt = 0;
+      int notUsed;
+      walUnlockShared(pWal, WAL_READ_LOCK(pWal->readLock));
+      pWal->readLock = -1;
+      do{
+        rc = walTryBeginRead(pWal, &notUsed, 0, ++cnt);
+      }while( rc==WAL_RETRY );
+      assert( rc!=SQLITE_OK 
+           || memcmp(&pWal->hdr, &head, sizeof(WalIndexHdr))==0 );
+    }
+
+    if( rc!=SQLITE_OK ){
+      walUnlockExclusive(pWal, WAL_WRITE_LOCK, 1);
+      pWal->writeLock = 0;
+    }
+  }
+
+  return rc;
+}
+
 /*
 ** If any data has been written (but not committed) to the log file, this
 ** function moves the write-pointer back to the start of the transaction.
@@ -2278,7 +3859,7 @@ int sqlite3WalEndWriteTransaction(Wal *pWal){
 */
 int sqlite3WalUndo(Wal *pWal, int (*xUndo)(void *, Pgno), void *pUndoCtx){
   int rc = SQLITE_OK;
-  if( ALWAYS(pWal->writeLock) ){
+  if( pWal->writeLock ){
     Pgno iMax = pWal->hdr.mxFrame;
     Pgno iFrame;
   
@@ -2302,8 +3883,9 @@ int sqlite3WalUndo(Wal *pWal, int (*xUndo)(void *, Pgno), void *pUndoCtx){
       ** page 1 is never written to the log until the transaction is
       ** committed. As a result, the call to xUndo may not fail.
       */
-      assert( walFramePgno(pWal, iFrame)!=1 );
-      rc = xUndo(pUndoCtx, walFramePgno(pWal, iFrame));
+      int iWal = walidxGetFile(&pWal->hdr);
+      assert( walFramePgno(pWal, iWal, iFrame)!=1 );
+      rc = xUndo(pUndoCtx, walFramePgno(pWal, iWal, iFrame));
     }
     walCleanupHash(pWal);
   }
@@ -2318,7 +3900,7 @@ int sqlite3WalUndo(Wal *pWal, int (*xUndo)(void *, Pgno), void *pUndoCtx){
 ** point in the event of a savepoint rollback (via WalSavepointUndo()).
 */
 void sqlite3WalSavepoint(Wal *pWal, u32 *aWalData){
-  assert( pWal->writeLock );
+  assert( pWal->writeLock || pWal->concurrent );
   aWalData[0] = pWal->hdr.mxFrame;
   aWalData[1] = pWal->hdr.aFrameCksum[0];
   aWalData[2] = pWal->hdr.aFrameCksum[1];
@@ -2334,7 +3916,7 @@ void sqlite3WalSavepoint(Wal *pWal, u32 *aWalData){
 int sqlite3WalSavepointUndo(Wal *pWal, u32 *aWalData){
   int rc = SQLITE_OK;
 
-  assert( pWal->writeLock );
+  assert( pWal->writeLock || pWal->concurrent );
   assert( aWalData[3]!=pWal->nCkpt || aWalData[0]<=pWal->hdr.mxFrame );
 
   if( aWalData[3]!=pWal->nCkpt ){
@@ -2376,30 +3958,48 @@ static int walRestartLog(Wal *pWal){
     volatile WalCkptInfo *pInfo = walCkptInfo(pWal);
     assert( pInfo->nBackfill==pWal->hdr.mxFrame );
     if( pInfo->nBackfill>0 ){
-      rc = walLockExclusive(pWal, WAL_READ_LOCK(1), WAL_NREADER-1);
+      rc = walLockReaders(pWal);
       if( rc==SQLITE_OK ){
-        /* If all readers are using WAL_READ_LOCK(0) (in other words if no
-        ** readers are currently using the WAL), then the transactions
-        ** frames will overwrite the start of the existing log. Update the
-        ** wal-index header to reflect this.
-        **
-        ** In theory it would be Ok to update the cache of the header only
-        ** at this point. But updating the actual wal-index header is also
-        ** safe and means there is no special case for sqlite3WalUndo()
-        ** to handle if this transaction is rolled back.
+        /* The log is not reset while another connection is syncing it
+        ** for a group commit, as that connection is about to record the
+        ** frames of the current log as synced in WalReaderInfo.nSynced.
+        ** There is no group commit unless the extended locks are in use.
         */
-        int i;                    /* Loop counter */
-        u32 *aSalt = pWal->hdr.aSalt;       /* Big-endian salt values */
-        pWal->nCkpt++;
-        pWal->hdr.mxFrame = 0;
-        sqlite3Put4byte((u8*)&aSalt[0], 1 + sqlite3Get4byte((u8*)&aSalt[0]));
-        sqlite3_randomness(4, &aSalt[1]);
-        walIndexWriteHdr(pWal);
-        pInfo->nBackfill = 0;
-        for(i=1; i<WAL_NREADER; i++) pInfo->aReadMark[i] = READMARK_NOT_USED;
-        assert( pInfo->aReadMark[0]==0 );
-        walUnlockExclusive(pWal, WAL_READ_LOCK(1), WAL_NREADER-1);
-      }else if( rc!=SQLITE_BUSY ){
+        int bSyncLock = pWal->nReader>WAL_NREADER_MIN;
+        if( bSyncLock ){
+          rc = walLockExclusive(pWal, WAL_SYNC_LOCK, 1);
+        }
+        if( rc==SQLITE_OK ){
+          /* If all readers are using WAL_READ_LOCK(0) (in other words if no
+          ** readers are currently using the WAL), then the transactions
+          ** frames will overwrite the start of the existing log. Update the
+          ** wal-index header to reflect this.
+          **
+          ** In theory it would be Ok to update the cache of the header only
+          ** at this point. But updating the actual wal-index header is also
+          ** safe and means there is no special case for sqlite3WalUndo()
+          ** to handle if this transaction is rolled back.
+          */
+          int i;                    /* Loop counter */
+          u32 *aSalt = pWal->hdr.aSalt;       /* Big-endian salt values */
+          pWal->nCkpt++;
+          pWal->hdr.mxFrame = 0;
+          sqlite3Put4byte((u8*)&aSalt[0], 1 + sqlite3Get4byte((u8*)&aSalt[0]));
+          sqlite3_randomness(4, &aSalt[1]);
+          walIndexWriteHdr(pWal);
+          pInfo->nBackfill = 0;
+          for(i=1; i<pWal->nReader; i++){
+            *walReadMark(pWal, i) = READMARK_NOT_USED;
+          }
+          assert( pInfo->aReadMark[0]==0 );
+          if( bSyncLock ){
+            walReaderInfo(pWal)->nSynced = 0;
+            walUnlockExclusive(pWal, WAL_SYNC_LOCK, 1);
+          }
+        }
+        walUnlockReaders(pWal);
+      }
+      if( rc!=SQLITE_OK && rc!=SQLITE_BUSY ){
         return rc;
       }
     }
@@ -2414,6 +4014,99 @@ static int walRestartLog(Wal *pWal){
   return rc;
 }
 
+/*
+** This function is called instead of walRestartLog() in wal2 mode, just
+** before writing a set of frames to the log.  If the current WAL file has
+** reached the limit set by sqlite3WalLimit(), this transaction has not yet
+** written any frames, and it is possible to do so, it switches to the other
+** WAL file.  The new frames are then written to the start of that file.
+**
+** Switching is possible if the frames in the other file have all been
+** checkpointed and no reader is still using them.  This connection must
+** not be one of those readers.  The file that was current is synced before
+** the switch, so that frames written to the new file cannot survive a
+** crash if those in the old file do not.
+**
+** SQLITE_OK is returned if no error is encountered (regardless of whether
+** or not there is a switch). An SQLite error code is returned if an error
+** occurs.
+*/
+static int walSwitchLog(Wal *pWal){
+  int rc = SQLITE_OK;
+  int iWal = walidxGetFile(&pWal->hdr);   /* The current WAL file */
+  i64 nLimit;                             /* Switch at this many frames */
+
+  if( pWal->hdr.mxFrame==0 ) return SQLITE_OK;
+  if( pWal->mxWalSize<0 ){
+    nLimit = SQLITE_DEFAULT_WAL_AUTOCHECKPOINT;
+  }else{
+    nLimit = (pWal->mxWalSize - WAL_HDRSIZE)/(pWal->szPage + WAL_FRAME_HDRSIZE);
+  }
+
+  if( pWal->hdr.mxFrame>=nLimit
+   && pWal->readLock==WAL2_LOCK_PART(iWal)
+   && pWal->hdr.mxFrame==walIndexHdr(pWal)->mxFrame
+  ){
+    volatile WalCkptInfo *pInfo = walCkptInfo(pWal);
+    int iNew = !iWal;
+    assert( pInfo->nBackfill==walidxGetMxFrame(&pWal->hdr, iNew) );
+
+    /* Take a shared lock on WAL2_LOCK_FULL(iNew), which this connection
+    ** will hold once it is reading the new snapshot.  Then take the
+    ** checkpointer lock, so that no checkpoint of file iNew is running,
+    ** and an exclusive lock on WAL2_LOCK_FULL(iWal), which readers of
+    ** file iNew hold.  */
+    rc = walLockShared(pWal, WAL_READ_LOCK(WAL2_LOCK_FULL(iNew)));
+    if( rc==SQLITE_OK ){
+      rc = walLockExclusive(pWal, WAL_CKPT_LOCK, 1);
+      if( rc==SQLITE_OK ){
+        rc = walLockExclusive(pWal, WAL_READ_LOCK(WAL2_LOCK_FULL(iWal)), 1);
+        if( rc==SQLITE_OK ){
+          rc = sqlite3OsSync(walFd(pWal, iWal), SQLITE_SYNC_NORMAL);
+          if( rc==SQLITE_OK ){
+            u32 mxFrame = pWal->hdr.mxFrame;
+
+            /* nBackfill is cleared before the new header is written.  A
+            ** reader that sees the old header and the new nBackfill uses 
+            ** a snapshot that is still valid, or tries to take the
+            ** WAL2_LOCK_FULL(iWal) lock held by this connection.  */
+            pInfo->nBackfill = 0;
+            sqlite3OsShmBarrier(pWal->pDbFd);
+            walidxSetFile(&pWal->hdr, iNew);
+            walidxSetMxFrame(&pWal->hdr, iWal, mxFrame);
+            pWal->hdr.mxFrame = 0;
+            pWal->nCkpt++;
+            walIndexWriteHdr(pWal);
+
+            /* No reader is using the frames in file iNew, so it may now
+            ** be truncated to the journal_size_limit.  Otherwise it would
+            ** stay as large as it once grew while a reader held an old
+            ** snapshot.  Failing to truncate it is not an error. */
+            if( pWal->mxWalSize>=0 ){
+              i64 sz;
+              if( sqlite3OsFileSize(walFd(pWal, iNew), &sz)==SQLITE_OK
+               && sz>pWal->mxWalSize
+              ){
+                sqlite3OsTruncate(walFd(pWal, iNew), pWal->mxWalSize);
+              }
+            }
+          }
+          walUnlockExclusive(pWal, WAL_READ_LOCK(WAL2_LOCK_FULL(iWal)), 1);
+        }
+        walUnlockExclusive(pWal, WAL_CKPT_LOCK, 1);
+      }
+      if( walidxGetFile(&pWal->hdr)==iNew ){
+        walUnlockShared(pWal, WAL_READ_LOCK(pWal->readLock));
+        pWal->readLock = WAL2_LOCK_FULL(iNew);
+      }else{
+        walUnlockShared(pWal, WAL_READ_LOCK(WAL2_LOCK_FULL(iNew)));
+      }
+    }
+    if( rc==SQLITE_BUSY ) rc = SQLITE_OK;
+  }
+  return rc;
+}
+
 /* 
 ** Write a set of frames to the log. The caller must hold the write-lock
 ** on the log file (obtained using sqlite3WalBeginWriteTransaction()).
@@ -2432,6 +4125,8 @@ int sqlite3WalFrames(
   PgHdr *p;                       /* Iterator to run through pList with. */
   PgHdr *pLast = 0;               /* Last frame in list */
   int nLast = 0;                  /* Number of extra copies of last page */
+  int iWal;                       /* WAL file to write to */
+  sqlite3_file *pWalFd;           /* File handle for WAL file iWal */
 
   assert( pList );
   assert( pWal->writeLock );
@@ -2444,25 +4139,48 @@ int sqlite3WalFrames(
 #endif
 
   /* See if it is possible to write these frames into the start of the
-  ** log file, instead of appending to it at pWal->hdr.mxFrame.
+  ** log file, instead of appending to it at pWal->hdr.mxFrame.  Or, in
+  ** wal2 mode, to switch to the other log file.
   */
-  if( SQLITE_OK!=(rc = walRestartLog(pWal)) ){
+  if( pWal->bWal2 ){
+    rc = walSwitchLog(pWal);
+  }else{
+    rc = walRestartLog(pWal);
+  }
+  if( rc!=SQLITE_OK ){
     return rc;
   }
+  iWal = walidxGetFile(&pWal->hdr);
+  pWalFd = walFd(pWal, iWal);
 
   /* If this is the first frame written into the log, write the WAL
   ** header to the start of the WAL file. See comments at the top of
   ** this source file for a description of the WAL header format.
+  **
+  ** In wal2 mode, the checkpoint sequence number written to the header is
+  ** one greater than that of the other file, so that recovery can tell
+  ** which file is current.  pWal->nCkpt is not set to this value, as the
+  ** savepoint code relies on it changing only when the log is switched.
   */
   iFrame = pWal->hdr.mxFrame;
   if( iFrame==0 ){
     u8 aWalHdr[WAL_HDRSIZE];      /* Buffer to assemble wal-header in */
     u32 aCksum[2];                /* Checksum for wal-header */
+    u32 nCkpt = pWal->nCkpt;      /* Checkpoint sequence number */
+
+    if( pWal->bWal2 ){
+      int bValid;
+      rc = walReadFileHdr(pWal, !iWal, aWalHdr, 0, &bValid);
+      if( rc!=SQLITE_OK ){
+        return rc;
+      }
+      nCkpt = bValid ? sqlite3Get4byte(&aWalHdr[12])+1 : 0;
+    }
 
     sqlite3Put4byte(&aWalHdr[0], (WAL_MAGIC | SQLITE_BIGENDIAN));
     sqlite3Put4byte(&aWalHdr[4], WAL_MAX_VERSION);
     sqlite3Put4byte(&aWalHdr[8], szPage);
-    sqlite3Put4byte(&aWalHdr[12], pWal->nCkpt);
+    sqlite3Put4byte(&aWalHdr[12], nCkpt);
     sqlite3_randomness(8, pWal->hdr.aSalt);
     memcpy(&aWalHdr[16], pWal->hdr.aSalt, 8);
     walChecksumBytes(1, aWalHdr, WAL_HDRSIZE-2*4, 0, aCksum);
@@ -2474,7 +4192,7 @@ int sqlite3WalFrames(
     pWal->hdr.aFrameCksum[0] = aCksum[0];
     pWal->hdr.aFrameCksum[1] = aCksum[1];
 
-    rc = sqlite3OsWrite(pWal->pWalFd, aWalHdr, sizeof(aWalHdr), 0);
+    rc = sqlite3OsWrite(pWalFd, aWalHdr, sizeof(aWalHdr), 0);
     WALTRACE(("WAL%p: wal-header write %s\n", pWal, rc ? "failed" : "ok"));
     if( rc!=SQLITE_OK ){
       return rc;
@@ -2499,13 +4217,13 @@ int sqlite3WalFrames(
     pData = p->pData;
 #endif
     walEncodeFrame(pWal, p->pgno, nDbsize, pData, aFrame);
-    rc = sqlite3OsWrite(pWal->pWalFd, aFrame, sizeof(aFrame), iOffset);
+    rc = sqlite3OsWrite(pWalFd, aFrame, sizeof(aFrame), iOffset);
     if( rc!=SQLITE_OK ){
       return rc;
     }
 
     /* Write the page data */
-    rc = sqlite3OsWrite(pWal->pWalFd, pData, szPage, iOffset+sizeof(aFrame));
+    rc = sqlite3OsWrite(pWalFd, pData, szPage, iOffset+sizeof(aFrame));
     if( rc!=SQLITE_OK ){
       return rc;
     }
@@ -2514,7 +4232,7 @@ int sqlite3WalFrames(
 
   /* Sync the log file if the 'isSync' flag was specified. */
   if( sync_flags ){
-    i64 iSegment = sqlite3OsSectorSize(pWal->pWalFd);
+    i64 iSegment = sqlite3OsSectorSize(pWalFd);
     i64 iOffset = walFrameOffset(iFrame+1, szPage);
 
     assert( isCommit );
@@ -2530,12 +4248,12 @@ int sqlite3WalFrames(
 #endif
       walEncodeFrame(pWal, pLast->pgno, nTruncate, pData, aFrame);
       /* testcase( IS_BIG_INT(iOffset) ); // requires a 4GiB WAL */
-      rc = sqlite3OsWrite(pWal->pWalFd, aFrame, sizeof(aFrame), iOffset);
+      rc = sqlite3OsWrite(pWalFd, aFrame, sizeof(aFrame), iOffset);
       if( rc!=SQLITE_OK ){
         return rc;
       }
       iOffset += WAL_FRAME_HDRSIZE;
-      rc = sqlite3OsWrite(pWal->pWalFd, pData, szPage, iOffset); 
+      rc = sqlite3OsWrite(pWalFd, pData, szPage, iOffset); 
       if( rc!=SQLITE_OK ){
         return rc;
       }
@@ -2543,7 +4261,19 @@ int sqlite3WalFrames(
       iOffset += szPage;
     }
 
-    rc = sqlite3OsSync(pWal->pWalFd, sync_flags);
+    if( pWal->nGroupCommit>=0 && !pWal->exclusiveMode && !pWal->bWal2
+     && pWal->nReader>WAL_NREADER_MIN
+    ){
+      /* Group commit is enabled. The sync is done by sqlite3WalSyncCommit()
+      ** once the write lock has been released.  Group commit is not
+      ** supported in wal2 mode, nor unless the wal-index uses the extended
+      ** locks, as WAL_SYNC_LOCK is one of them.  */
+      pWal->iSyncFrame = iFrame + nLast;
+      pWal->iSyncSalt = pWal->hdr.aSalt[0];
+      pWal->syncFlags = (u8)sync_flags;
+    }else{
+      rc = sqlite3OsSync(pWalFd, sync_flags);
+    }
   }
 
   /* Append data to the wal-index. It is not necessary to lock the 
@@ -2554,12 +4284,12 @@ int sqlite3WalFrames(
   iFrame = pWal->hdr.mxFrame;
   for(p=pList; p && rc==SQLITE_OK; p=p->pDirty){
     iFrame++;
-    rc = walIndexAppend(pWal, iFrame, p->pgno);
+    rc = walIndexAppend(pWal, iWal, iFrame, p->pgno);
   }
   while( nLast>0 && rc==SQLITE_OK ){
     iFrame++;
     nLast--;
-    rc = walIndexAppend(pWal, iFrame, pLast->pgno);
+    rc = walIndexAppend(pWal, iWal, iFrame, pLast->pgno);
   }
 
   if( rc==SQLITE_OK ){
@@ -2576,6 +4306,17 @@ int sqlite3WalFrames(
     if( isCommit ){
       walIndexWriteHdr(pWal);
       pWal->iCallback = iFrame;
+      if( pWal->bWal2 ){
+        /* In wal2 mode, report the number of frames that a checkpoint
+        ** would copy - all frames in both files if the other file has
+        ** not been completely checkpointed, otherwise none.  */
+        u32 nOther = walidxGetMxFrame(&pWal->hdr, !iWal);
+        if( walCkptInfo(pWal)->nBackfill<nOther ){
+          pWal->iCallback = nOther + iFrame;
+        }else{
+          pWal->iCallback = 0;
+        }
+      }
     }
   }
 
@@ -2583,23 +4324,157 @@ int sqlite3WalFrames(
   return rc;
 }
 
+/*
+** Configure group commit for WAL connection pWal.  If nWindow is negative,
+** group commit is disabled and each commit syncs the WAL before the
+** new transaction becomes visible to other connections.  Otherwise,
+** the sync is deferred until sqlite3WalSyncCommit() is called, and the
+** connection that performs the sync first waits nWindow microseconds
+** for other committers to join it.
+*/
+void sqlite3WalGroupCommit(Wal *pWal, int nWindow){
+  pWal->nGroupCommit = nWindow;
+}
+
+/*
+** Set the size limit of the WAL file for connection pWal, in bytes.  In
+** wal2 mode, writers switch to the other WAL file once the current one 
+** holds as many frames as fit in this size.  A negative value selects the
+** default, SQLITE_DEFAULT_WAL_AUTOCHECKPOINT frames.  Outside of wal2 mode
+** this has no effect, as the pager truncates the WAL file itself.
+*/
+void sqlite3WalLimit(Wal *pWal, i64 iLimit){
+  pWal->mxWalSize = iLimit;
+}
+
+/*
+** Make a copy of the wal-index header as it currently stands in shared
+** memory into *pHdr.  Return non-zero if successful, or zero if a
+** consistent copy could not be obtained because a writer was updating
+** the header at the same time.
+*/
+static int walSharedHdr(Wal *pWal, WalIndexHdr *pHdr){
+  volatile WalIndexHdr *aHdr = walIndexHdr(pWal);
+  WalIndexHdr h1;
+  int cnt;
+
+  for(cnt=0; cnt<100; cnt++){
+    memcpy(pHdr, (void *)&aHdr[0], sizeof(WalIndexHdr));
+    sqlite3OsShmBarrier(pWal->pDbFd);
+    memcpy(&h1, (void *)&aHdr[1], sizeof(WalIndexHdr));
+    if( pHdr->isInit && memcmp(pHdr, &h1, sizeof(WalIndexHdr))==0 ){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** If group commit is enabled and the most recent commit made by this
+** connection deferred its WAL sync, make sure the frames it wrote are
+** durable before returning.  This is called after the WAL write lock
+** has been released, so that other connections may append transactions
+** while the sync is in progress.
+**
+** Only one connection at a time syncs the WAL, while holding
+** WAL_SYNC_LOCK.  Before the sync it reads the current mxFrame from the
+** wal-index, so that the sync also covers any transactions committed by
+** other connections since, and afterwards records that frame as synced in
+** WalReaderInfo.nSynced.  A connection that obtains WAL_SYNC_LOCK and
+** finds its own frames already covered returns without syncing.  So do
+** connections whose frames have been checkpointed and the WAL reset.
+**
+** A connection that is unable to obtain WAL_SYNC_LOCK after a reasonable
+** amount of time syncs the WAL itself without it.
+**
+** If this function returns an error, the transaction has been committed
+** but may not be durable.
+*/
+int sqlite3WalSyncCommit(Wal *pWal){
+  volatile WalReaderInfo *pInfo;  /* Reader info holding nSynced */
+  WalIndexHdr hdr;                /* Copy of shared wal-index header */
+  int bHdr;                       /* True if hdr is a consistent copy */
+  u32 iFrame = pWal->iSyncFrame;  /* Frame that must be synced */
+  int cnt = 0;                    /* Number of attempts to get WAL_SYNC_LOCK */
+  int rc;                         /* Return code */
+
+  if( iFrame==0 ) return SQLITE_OK;
+  pWal->iSyncFrame = 0;
+  assert( pWal->writeLock==0 );
+
+  while( (rc = walLockExclusive(pWal, WAL_SYNC_LOCK, 1))==SQLITE_BUSY ){
+    /* Some other connection is syncing the WAL. Wait for it to finish. */
+    if( ++cnt>1000 ){
+      WALTRACE(("WAL%p: group sync lock timeout\n", pWal));
+      return sqlite3OsSync(pWal->pWalFd, pWal->syncFlags);
+    }
+    sqlite3OsSleep(pWal->pVfs, 20);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+
+  pInfo = walReaderInfo(pWal);
+  bHdr = walSharedHdr(pWal, &hdr);
+  if( bHdr && hdr.aSalt[0]!=pWal->iSyncSalt ){
+    /* The WAL has been reset since this connection wrote to it. That
+    ** only happens after all frames have been checkpointed. */
+    WALTRACE(("WAL%p: group sync skipped (wal reset)\n", pWal));
+  }else if( bHdr && pInfo->nSynced>=iFrame ){
+    WALTRACE(("WAL%p: group sync skipped (%d<=%d)\n",
+              pWal, iFrame, pInfo->nSynced));
+  }else{
+    if( pWal->nGroupCommit>0 ){
+      sqlite3OsSleep(pWal->pVfs, pWal->nGroupCommit);
+      bHdr = walSharedHdr(pWal, &hdr);
+    }
+    if( !bHdr || hdr.aSalt[0]!=pWal->iSyncSalt || hdr.mxFrame<iFrame ){
+      /* Cannot tell which frames the sync covers. Sync, but do not
+      ** update nSynced. */
+      hdr.mxFrame = 0;
+    }
+    rc = sqlite3OsSync(pWal->pWalFd, pWal->syncFlags);
+    if( rc==SQLITE_OK && hdr.mxFrame ){
+      pInfo->nSynced = hdr.mxFrame;
+    }
+    WALTRACE(("WAL%p: group sync of frames up to %d %s\n",
+              pWal, hdr.mxFrame, rc ? "failed" : "ok"));
+  }
+
+  walUnlockExclusive(pWal, WAL_SYNC_LOCK, 1);
+  return rc;
+}
+
 /* 
 ** This routine is called to implement sqlite3_wal_checkpoint() and
 ** related interfaces.
 **
 ** Obtain a CHECKPOINT lock and then backfill as much information as
-** we can from WAL into the database.
+** we can from WAL into the database.  If nPage or nMs is greater than
+** zero, the checkpoint is incremental and copies no more than nPage pages
+** or for no longer than about nMs milliseconds, continuing from where the
+** previous incremental checkpoint on this connection stopped.  See
+** walCheckpoint() for details.
+**
+** If they are not NULL, *pnLog is set to the number of frames in the WAL
+** and *pnCkpt to the number of those that have been backfilled when
+** this function returns.  Both are set to zero if an error occurs.
 */
 int sqlite3WalCheckpoint(
   Wal *pWal,                      /* Wal connection */
   int sync_flags,                 /* Flags to sync db file with (or 0) */
   int nBuf,                       /* Size of temporary buffer */
-  u8 *zBuf                        /* Temporary buffer to use */
+  u8 *zBuf,                       /* Temporary buffer to use */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs,                        /* Max time to spend in ms, or 0 */
+  int *pnLog,                     /* OUT: Frames in WAL */
+  int *pnCkpt                     /* OUT: Frames backfilled */
 ){
   int rc;                         /* Return code */
   int isChanged = 0;              /* True if a new wal-index header is loaded */
+  int iWal = 0;                   /* WAL file to checkpoint */
 
   assert( pWal->ckptLock==0 );
+  if( pnLog ) *pnLog = 0;
+  if( pnCkpt ) *pnCkpt = 0;
 
   WALTRACE(("WAL%p: checkpoint begins\n", pWal));
   rc = walLockExclusive(pWal, WAL_CKPT_LOCK, 1);
@@ -2614,7 +4489,12 @@ int sqlite3WalCheckpoint(
   /* Copy data from the log to the database file. */
   rc = walIndexReadHdr(pWal, &isChanged);
   if( rc==SQLITE_OK ){
-    rc = walCheckpoint(pWal, sync_flags, nBuf, zBuf);
+    if( pWal->bWal2 ) iWal = !walidxGetFile(&pWal->hdr);
+    rc = walCheckpoint(pWal, iWal, sync_flags, nBuf, zBuf, nPage, nMs);
+  }
+  if( rc==SQLITE_OK ){
+    if( pnLog ) *pnLog = (int)walidxGetMxFrame(&pWal->hdr, iWal);
+    if( pnCkpt ) *pnCkpt = (int)walCkptInfo(pWal)->nBackfill;
   }
   if( isChanged ){
     /* If a new wal-index header was loaded before the checkpoint was 
@@ -2707,4 +4587,11 @@ int sqlite3WalExclusiveMode(Wal *pWal, int op){
   return rc;
 }
 
+/*
+** Return the sqlite3_file object for the WAL file.
+*/
+sqlite3_file *sqlite3WalFile(Wal *pWal){
+  return pWal->pWalFd;
+}
+
 #endif /* #ifndef SQLITE_OMIT_WAL */
@@ -20,21 +20,28 @@
 #include "sqliteInt.h"
 
 #ifdef SQLITE_OMIT_WAL
-# define sqlite3WalOpen(x,y,z)                 0
+# define sqlite3WalOpen(v,w,x,y,z)             0
 # define sqlite3WalClose(w,x,y,z)              0
 # define sqlite3WalBeginReadTransaction(y,z)   0
 # define sqlite3WalEndReadTransaction(z)
-# define sqlite3WalRead(v,w,x,y,z)             0
+# define sqlite3WalFindFrame(x,y,z)            0
+# define sqlite3WalReadFrame(w,x,y,z)          0
 # define sqlite3WalDbsize(y)                   0
 # define sqlite3WalBeginWriteTransaction(y)    0
 # define sqlite3WalEndWriteTransaction(x)      0
+# define sqlite3WalBeginConcurrent(x)          0
+# define sqlite3WalLockForCommit(x,y,z)        0
 # define sqlite3WalUndo(x,y,z)                 0
 # define sqlite3WalSavepoint(y,z)
 # define sqlite3WalSavepointUndo(y,z)          0
 # define sqlite3WalFrames(u,v,w,x,y,z)         0
-# define sqlite3WalCheckpoint(u,v,w,x)         0
+# define sqlite3WalGroupCommit(y,z)
+# define sqlite3WalLimit(y,z)
+# define sqlite3WalSyncCommit(z)               0
+# define sqlite3WalCheckpoint(q,r,s,t,u,v,w,x) 0
 # define sqlite3WalCallback(z)                 0
 # define sqlite3WalExclusiveMode(y,z)          0
+# define sqlite3WalFile(z)                     0
 #else
 
 #define WAL_SAVEPOINT_NDATA 4
@@ -44,8 +51,11 @@
 */
 typedef struct Wal Wal;
 
-/* Open and close a connection to a write-ahead log. */
-int sqlite3WalOpen(sqlite3_vfs*, sqlite3_file*, const char *zName, Wal**);
+/* Open and close a connection to a write-ahead log. zName2 is the name of
+** the second WAL file in wal2 mode, or NULL. */
+int sqlite3WalOpen(
+  sqlite3_vfs*, sqlite3_file*, const char *zName, const char *zName2, Wal**
+);
 int sqlite3WalClose(Wal *pWal, int sync_flags, int, u8 *);
 
 /* Used by readers to open (lock) and close (unlock) a snapshot.  A 
@@ -58,8 +68,9 @@ int sqlite3WalClose(Wal *pWal, int sync_flags, int, u8 *);
 int sqlite3WalBeginReadTransaction(Wal *pWal, int *);
 void sqlite3WalEndReadTransaction(Wal *pWal);
 
-/* Read a page from the write-ahead log, if it is present. */
-int sqlite3WalRead(Wal *pWal, Pgno pgno, int *pInWal, int nOut, u8 *pOut);
+/* Search for a page in the write-ahead log, and read a frame from it. */
+int sqlite3WalFindFrame(Wal *, Pgno, u32 *);
+int sqlite3WalReadFrame(Wal *, u32, int, u8 *);
 
 /* If the WAL is not empty, return the size of the database. */
 Pgno sqlite3WalDbsize(Wal *pWal);
@@ -68,6 +79,11 @@ Pgno sqlite3WalDbsize(Wal *pWal);
 int sqlite3WalBeginWriteTransaction(Wal *pWal);
 int sqlite3WalEndWriteTransaction(Wal *pWal);
 
+/* Start a BEGIN CONCURRENT write transaction, which does not take the
+** WRITER lock until it is ready to commit. */
+int sqlite3WalBeginConcurrent(Wal *pWal);
+int sqlite3WalLockForCommit(Wal *pWal, int (*xPage)(void*,Pgno), void *pCtx);
+
 /* Undo any frames written (but not committed) to the log */
 int sqlite3WalUndo(Wal *pWal, int (*xUndo)(void *, Pgno), void *pUndoCtx);
 
@@ -82,12 +98,24 @@ int sqlite3WalSavepointUndo(Wal *pWal, u32 *aWalData);
 /* Write a frame or frames to the log. */
 int sqlite3WalFrames(Wal *pWal, int, PgHdr *, Pgno, int, int);
 
+/* Configure group commit, and complete the WAL sync deferred by the
+** most recent commit if it is enabled. */
+void sqlite3WalGroupCommit(Wal *pWal, int nWindow);
+int sqlite3WalSyncCommit(Wal *pWal);
+
+/* Set the size at which wal2 mode switches WAL files. */
+void sqlite3WalLimit(Wal *pWal, i64 iLimit);
+
 /* Copy pages from the log to the database file */ 
 int sqlite3WalCheckpoint(
   Wal *pWal,                      /* Write-ahead log connection */
   int sync_flags,                 /* Flags to sync db file with (or 0) */
   int nBuf,                       /* Size of buffer nBuf */
-  u8 *zBuf                        /* Temporary buffer to use */
+  u8 *zBuf,                       /* Temporary buffer to use */
+  int nPage,                      /* Max pages to copy, or 0 for no limit */
+  int nMs,                        /* Max time to spend in ms, or 0 */
+  int *pnLog,                     /* OUT: Frames in WAL */
+  int *pnCkpt                     /* OUT: Frames backfilled */
 );
 
 /* Return the value to pass to a sqlite3_wal_hook callback, the
@@ -102,5 +130,14 @@ int sqlite3WalCallback(Wal *pWal);
 */
 int sqlite3WalExclusiveMode(Wal *pWal, int op);
 
+/* Return the sqlite3_file object for the WAL file. */
+sqlite3_file *sqlite3WalFile(Wal *pWal);
+
+#ifdef SQLITE_TEST
+/* Compute a WAL checksum using a named implementation.  For testing. */
+int sqlite3WalChecksumTest(const char*, int, const u8*, int, int,
+                           const u32*, u32*);
+#endif
+
 #endif /* ifndef SQLITE_OMIT_WAL */
 #endif /* _WAL_H_ */
@@ -299,6 +299,7 @@ foreach file {
 
    main.c
    notify.c
+   bgckpt.c
 
    fts3.c
    fts3_expr.c